@@ -8,17 +8,34 @@ out      vec3 normal;
 out      vec2 uv;
 out flat vec3 stitched_shading_position;
 out flat vec3 shading_position;
+out flat uint instance_sector_id;
+out flat uint instance_visible_id;
+
+// Keep in sync with "BillboardInstanceGPU"
+struct BillboardInstance
+{
+  mat4 transform;
+  vec2 texture_pos;
+  vec2 texture_size;
+  uint sector_id;
+  uint visible_id;
+};
+
+layout(std430, binding = 8) readonly buffer billboard_instance_buffer { BillboardInstance instances[]; };
 
-layout(location = 0)  uniform mat4 transform;
 layout(location = 1)  uniform mat4 view;
 layout(location = 2)  uniform mat4 projection;
 layout(location = 3)  uniform vec2 atlas_size;
-layout(location = 4)  uniform vec2 texture_pos;
-layout(location = 5)  uniform vec2 texture_size;
 layout(location = 7)  uniform mat4 portal_dest_to_src;
+layout(location = 10) uniform uint first_instance;
 
 void main()
 {
+  BillboardInstance instance = instances[first_instance + gl_InstanceID];
+  mat4 transform    = instance.transform;
+  vec2 texture_pos  = instance.texture_pos;
+  vec2 texture_size = instance.texture_size;
+
   gl_Position = projection * view * transform * vec4(a_position, 1.0f);
   stitched_position = (portal_dest_to_src * transform * vec4(a_position, 1.0f)).xyz;
   position = (transform * vec4(a_position, 1.0f)).xyz;
@@ -32,4 +49,7 @@ void main()
 
   stitched_shading_position = (portal_dest_to_src * transform * vec4(offset, 1.0f)).xyz;
   shading_position          = (transform * vec4(offset, 1.0f)).xyz;
+
+  instance_sector_id = instance.sector_id;
+  instance_visible_id = instance.visible_id;
 }
@@ -9,6 +9,8 @@ out      vec3 normal;
 out      vec2 uv;
 out flat vec3 stitched_shading_position;
 out flat vec3 shading_position;
+out flat uint instance_sector_id;
+out flat uint instance_visible_id;
 
 layout(location = 0) uniform mat4 transform;
 layout(location = 1) uniform mat4 view;
@@ -16,6 +18,8 @@ layout(location = 2) uniform mat4 projection;
 layout(location = 3) uniform vec2 atlas_size;
 layout(location = 4) uniform vec2 texture_pos;
 layout(location = 5) uniform vec2 texture_size;
+layout(location = 6) uniform uint sector_id;
+layout(location = 8) uniform uint visible_id;
 
 void main()
 {
@@ -27,4 +31,7 @@ void main()
 
   stitched_shading_position = (transform * vec4(vec3(0.0f), 1.0f)).xyz;
   shading_position          = (transform * vec4(vec3(0.0f), 1.0f)).xyz;
+
+  instance_sector_id = sector_id;
+  instance_visible_id = visible_id;
 }
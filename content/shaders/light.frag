@@ -1,9 +1,6 @@
 
 #version 430 core
 
-#define TILE_SIZE_X 16
-#define TILE_SIZE_Y 16
-
 #define LIGHT_BANDS 48
 // #define DO_SHADOWS
 // #define PIXEL_DEBUG
@@ -24,12 +21,16 @@ struct PointLight
     vec3  color;
     float falloff;
     uint  sector_id;
+    uint  bake_offset;
+    uint  bake_count;
 };
 
-struct TileData
+// Keep in sync with "VisibleSectorGPU"
+struct VisibleSector
 {
-  uint count;
-  uint offset;
+  uint matrix_id;
+  uint lights_offset;
+  uint lights_count;
 };
 
 struct SectorData
@@ -62,7 +63,7 @@ layout(binding = 5) uniform usampler2D g_sector;
 
 layout(location = 0) uniform vec3  view_position;
 //layout(location = 1) uniform uint  num_dir_lights; // Not using this anymore
-layout(location = 2) uniform uint  num_tiles_x;
+layout(location = 2) uniform uint  num_visible_sectors;
 layout(location = 3) uniform float ambient_strength;
 layout(location = 4) uniform uint  num_sectors;
 layout(location = 5) uniform uint  num_walls;
@@ -70,12 +71,13 @@ layout(location = 6) uniform bool  do_shadows = true;
 
 layout(std430, binding = 0) readonly buffer dir_lights_buffer      { DirLight   dir_lights[];       };
 layout(std430, binding = 1) readonly buffer point_light_buffer     { PointLight point_lights[];     };
-layout(std430, binding = 2) readonly buffer light_index_buffer     { uint       light_indices[];    };
-layout(std430, binding = 3) readonly buffer tile_data_buffer       { TileData   tile_data[];        };
+layout(std430, binding = 2) readonly buffer light_index_buffer     { uint          light_indices[];   };
+layout(std430, binding = 3) readonly buffer visible_sector_buffer  { VisibleSector visible_sectors[]; };
 layout(std430, binding = 4) readonly buffer sector_data_buffer     { SectorData sectors[];          };
 layout(std430, binding = 5) readonly buffer wall_data_buffer       { WallData   walls[];            };
 layout(std430, binding = 6) readonly buffer portal_matrices_buffer { mat4       portal_matrices[]; };
 layout(std430, binding = 7) readonly buffer sector_matrices_buffer { mat4       sector_matrices[]; };
+layout(std430, binding = 8) readonly buffer light_bake_buffer      { uint       light_bake[];      };
 
 bool out_of_range_sectors = false;
 bool out_of_range_walls = false;
@@ -116,7 +118,23 @@ float get_intersection_t(vec2 ray_origin, vec2 ray_direction, vec2 wall_p0, vec2
   return ray_t;
 }
 
-bool is_in_shadow(vec3 position, vec3 stitched_position, uint start_sector_id, uint start_matrix_id, PointLight light)
+// True if the bake of the light says nothing can stand between the light and
+// the sector. Only valid for lights not seen through a nuclidean portal.
+bool is_baked_unoccluded(uint sector_id, PointLight light)
+{
+  const uint UNOCCLUDED_BIT = 1;
+
+  for (uint i = 0; i < light.bake_count; ++i)
+  {
+    uint entry = light_bake[light.bake_offset + i];
+    if ((entry >> 1) == sector_id)
+      return (entry & UNOCCLUDED_BIT) != 0;
+  }
+
+  return false;
+}
+
+bool is_in_shadow(vec3 position, vec3 stitched_position, uint start_sector_id, mat4 stitched_to_local, PointLight light)
 {
   const uint INVALID_WALL_ID = 65535;
   const uint MAX_LIGHT_TRAVERSE_SECTORS = 32;
@@ -124,7 +142,6 @@ bool is_in_shadow(vec3 position, vec3 stitched_position, uint start_sector_id, u
   vec3 ray_stitched_origin = stitched_position;
   vec3 ray_origin = position;
   vec3 ray_stitched_direction = normalize(light.stitched_position - stitched_position);
-  mat4 stitched_to_local = inverse(sector_matrices[start_matrix_id]);
   vec3 ray_direction = mat3(stitched_to_local) * ray_stitched_direction;
   
   uint current_sector_id = start_sector_id;
@@ -221,7 +238,8 @@ void main()
 
   vec4 g_stitched_position_sample = texture(g_stitched_position, uv);
   vec3 stitched_position = g_stitched_position_sample.xyz;
-  uint matrix_id = floatBitsToUint(g_stitched_position_sample.w);
+  // Sector seen in the given pass, has its list of lights
+  uint visible_id = min(floatBitsToUint(g_stitched_position_sample.w), max(num_visible_sectors, 1) - 1);
 
   vec4 g_normal_sample = texture(g_normal, uv);
   vec3 normal = g_normal_sample.xyz;
@@ -260,18 +278,18 @@ void main()
   */
 
   // point lights
-  uvec2 tile_coords = uvec2(gl_FragCoord.xy) / uvec2(TILE_SIZE_X, TILE_SIZE_Y);
-  uint tile_index = tile_coords.y * num_tiles_x + tile_coords.x;
-
-  TileData data = tile_data[tile_index];
+  VisibleSector visible = visible_sectors[visible_id];
+  uint matrix_id = visible.matrix_id;
+  uint lights_count = num_visible_sectors > 0 ? visible.lights_count : 0;
+  mat4 stitched_to_local = inverse(sector_matrices[matrix_id]);
 
   // For billboards we store shading position in "normal" and shading stitched position in "stitched normal"
   vec3 shading_position          = mix(position,          normal,          billboard_f); // Storing shading position here for billboards
   vec3 shading_stitched_position = mix(stitched_position, stitched_normal, billboard_f); // Storing stitched shading position here for billboards
 
-  for (int i = 0; i < data.count; i++)
+  for (uint i = 0; i < lights_count; i++)
   {
-    uint light_index = light_indices[data.offset + i];
+    uint light_index = light_indices[visible.lights_offset + i];
 
     PointLight light = point_lights[light_index];
 
@@ -287,8 +305,18 @@ void main()
     if (angle <= 0.0f)
       continue;
 
-    if (do_shadows && is_in_shadow(shading_position, shading_stitched_position, sector_id, matrix_id, light)) 
-    continue;
+    if (do_shadows)
+    {
+      // The bake is done in the world space, so it holds only if the light is
+      // not seen through a nuclidean portal
+      vec3 light_local = (stitched_to_local * vec4(light.stitched_position, 1.0)).xyz;
+      vec3 light_diff  = light_local - light.position;
+      bool direct      = dot(light_diff, light_diff) <= 0.01;
+
+      bool unoccluded = direct && is_baked_unoccluded(sector_id, light);
+      if (!unoccluded && is_in_shadow(shading_position, shading_stitched_position, sector_id, stitched_to_local, light))
+        continue;
+    }
 
     vec3 diffuse = max(angle, 0.0f) * albedo;
 
@@ -19,6 +19,8 @@ flat in float texture_rotation;
 flat in float tile_rotations_count;
 flat in float tile_rotation_increment;
 flat in vec2 texture_offset;
+flat in uint draw_sector_id;
+flat in uint draw_visible_id;
 
 layout(location = 0) out vec4 g_position;
 layout(location = 1) out vec4 g_stitched_position;
@@ -36,8 +38,6 @@ layout(binding = 5) uniform sampler2D level_specular_sampler;
 
 layout(location = 2) uniform vec2 game_atlas_size;
 layout(location = 3) uniform vec2 level_atlas_size;
-layout(location = 5) uniform uint sector_id;
-layout(location = 6) uniform uint matrix_id;
 
 #define PIXELS_PER_M 48
 
@@ -106,7 +106,7 @@ void main()
   g_position.xyz = position;
   // 4-th component of position is used for specular strength
   g_position.w = specular_strength;
-  g_stitched_position = vec4(stitched_position, uintBitsToFloat(matrix_id));
+  g_stitched_position = vec4(stitched_position, uintBitsToFloat(draw_visible_id));
   g_normal.xyz = world_normal;
   // 4-th component of normal is used to determine if pixel should be lit
   g_normal.w = 1.0f;
@@ -114,5 +114,5 @@ void main()
   // 4-th component of stitched_normal is used to determine if shadows are enabled
   g_stitched_normal.w = 1.0f;
   g_albedo = color;
-  g_sector = sector_id;
+  g_sector = draw_sector_id;
 }
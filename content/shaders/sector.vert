@@ -8,6 +8,7 @@ layout (location = 5) in float  a_texture_rotation;
 layout (location = 6) in float  a_tile_rotations_count;
 layout (location = 7) in float  a_tile_rotation_increment;
 layout (location = 8) in vec2   a_texture_offset;
+layout (location = 9) in uint   a_draw_id; // "base_instance" of the indirect draw command
 
 out vec3  position;
 out vec3  stitched_position;
@@ -21,6 +22,17 @@ flat out float  texture_rotation;
 flat out float  tile_rotations_count;
 flat out float  tile_rotation_increment;
 flat out vec2   texture_offset;
+flat out uint   draw_sector_id;
+flat out uint   draw_visible_id;
+
+// Keep in sync with "Renderer::SectorDrawGPU"
+struct SectorDraw
+{
+  uint sector_id;
+  uint visible_id;
+};
+
+layout(std430, binding = 9) readonly buffer sector_draw_buffer { SectorDraw sector_draws[]; };
 
 layout(location = 0) uniform mat4 view;
 layout(location = 1) uniform mat4 projection;
@@ -44,4 +56,7 @@ void main()
   tile_rotations_count = a_tile_rotations_count;
   tile_rotation_increment = a_tile_rotation_increment;
   texture_offset = a_texture_offset;
+
+  draw_sector_id = sector_draws[a_draw_id].sector_id;
+  draw_visible_id = sector_draws[a_draw_id].visible_id;
 }
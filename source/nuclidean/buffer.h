@@ -1,6 +1,8 @@
 // Project Nuclidean Source File
 #pragma once
 
+#include <vector> // std::vector
+
 namespace nc
 {
 
@@ -9,6 +11,7 @@ enum class SerializationType : u8
   serialize,
   deserialize,
   counting_bytes,
+  hashing,        // only hashes the bytes, see "Buffer::get_hash"
 };
 
 class Buffer
@@ -17,6 +20,14 @@ public:
   // Only for counting
   Buffer();
 
+  // For counting or hashing, these do not need any memory
+  explicit Buffer(SerializationType type);
+
+  // For serialization into the vector, which grows if it is too small. Its
+  // size stays the same otherwise, so it can be reused without reallocating.
+  // The number of bytes written is "get_written_size".
+  explicit Buffer(std::vector<byte>& growable);
+
   // For serialization and deserialization
   Buffer(void* data, u64 bytes_cnt, SerializationType type);
 
@@ -28,10 +39,16 @@ public:
 
   u64  get_remaining_buffer_size() const { return size; }
   u64  get_counted_size()          const { return size; }
+  u64  get_written_size()          const;
+
+  // FNV-1a of everything serialized so far. Hashes whole 8 byte words where
+  // possible, so the hash is only comparable between buffers of the same type.
+  u64  get_hash()                  const { return hash; }
 
   bool is_deserializing() const { return type == SerializationType::deserialize;    }
   bool is_serializing()   const { return type == SerializationType::serialize;      }
   bool is_counting()      const { return type == SerializationType::counting_bytes; }
+  bool is_hashing()       const { return type == SerializationType::hashing;        }
 
 private:
   template<typename T>
@@ -46,10 +63,17 @@ private:
   template<typename T>
   void load_array(T* first, u64 cnt);
 
+  void hash_bytes(const void* data, u64 bytes_cnt);
+
+  // Grows the vector if the next write does not fit
+  void reserve_for_write(u64 bytes_cnt);
+
 private:
   void*             head = nullptr;
   u64               size = 0;
+  u64               hash = 0xcbf29ce484222325; // FNV offset basis
   SerializationType type = SerializationType::serialize;
+  std::vector<byte>* growable = nullptr;          // only if it can grow
 };
 
 }
@@ -4,6 +4,8 @@
 #include <buffer.h>
 #include <common.h>
 
+#include <algorithm> // std::max
+
 namespace nc
 {
 
@@ -24,10 +26,76 @@ inline Buffer::Buffer()
   
 }
 
+//==============================================================================
+inline Buffer::Buffer(SerializationType type)
+: head(nullptr)
+, size(0)
+, type(type)
+{
+  nc_assert(type == SerializationType::counting_bytes || type == SerializationType::hashing);
+}
+
+//==============================================================================
+inline Buffer::Buffer(std::vector<byte>& growable)
+: head(growable.data())
+, size(growable.size())
+, type(SerializationType::serialize)
+, growable(&growable)
+{
+}
+
+//==============================================================================
+inline u64 Buffer::get_written_size() const
+{
+  nc_assert(growable);
+  return growable->size() - size;
+}
+
+//==============================================================================
+inline void Buffer::reserve_for_write(u64 bytes_cnt)
+{
+  if (!growable || size >= bytes_cnt)
+  {
+    return;
+  }
+
+  // Doubles, so a state that grows by a few bytes at a time does not
+  // reallocate on every write
+  const u64 written = growable->size() - size;
+  growable->resize(std::max<u64>(growable->size() * 2, written + bytes_cnt));
+
+  head = growable->data() + written;
+  size = growable->size() - written;
+}
+
+//==============================================================================
+inline void Buffer::hash_bytes(const void* data, u64 bytes_cnt)
+{
+  constexpr u64 FNV_PRIME = 0x100000001b3;
+
+  const byte* bytes = recast<const byte*>(data);
+
+  // Word by word, the state of a game is hundreds of kilobytes
+  u64 i = 0;
+  for (; i + sizeof(u64) <= bytes_cnt; i += sizeof(u64))
+  {
+    u64 word;
+    std::memcpy(&word, bytes + i, sizeof(u64));
+    hash = (hash ^ word) * FNV_PRIME;
+  }
+
+  for (; i < bytes_cnt; ++i)
+  {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
 //==============================================================================
 template<typename T>
 void Buffer::store(const T& value)
 {
+  reserve_for_write(sizeof(T));
+
   T* ptr = recast<T*>(head);
   *ptr = value;
   head = recast<void*>(ptr + 1);
@@ -51,6 +119,7 @@ T Buffer::load()
 template<typename T>
 void Buffer::store_array(const T* first, u64 cnt)
 {
+  reserve_for_write(sizeof(T) * cnt);
   std::memcpy(head, first, sizeof(T) * cnt);
   size -= sizeof(T) * cnt;
   head = recast<T*>(head) + cnt;
@@ -83,6 +152,10 @@ void Buffer::serialize(T& inout)
   {
     size += sizeof(T);
   }
+  else if (is_hashing())
+  {
+    hash_bytes(&inout, sizeof(T));
+  }
 }
 
 //==============================================================================
@@ -101,6 +174,10 @@ void Buffer::serialize_array(T* array, u64 cnt)
   {
     size += sizeof(T) * cnt;
   }
+  else if (is_hashing())
+  {
+    hash_bytes(array, sizeof(T) * cnt);
+  }
 }
 
 }
@@ -23,12 +23,14 @@
 #endif
 
 #if defined(NC_Profiling)
-#define NC_BENCHMARK NC_CONFIG_ON // benchmarks should be compiled
+#define NC_BENCHMARK      NC_CONFIG_ON // benchmarks should be compiled
+#define NC_ALLOC_TRACKING NC_CONFIG_ON // global new/delete count allocations per profiled scope
 // Google benchmark library requires this in order to link.
 #pragma comment (lib, "Shlwapi.lib")
 #define BENCHMARK_STATIC_DEFINE
 #else
-#define NC_BENCHMARK NC_CONFIG_OFF
+#define NC_BENCHMARK      NC_CONFIG_OFF
+#define NC_ALLOC_TRACKING NC_CONFIG_OFF
 #endif
 
 #if defined(NC_Deploy)
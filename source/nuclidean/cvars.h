@@ -144,6 +144,7 @@ struct CVars
   NC_REGISTER_CVAR(bool, billboard_cam_rot,     true,  "True = rotate billboards with camera, False = rotate to the camera");
 
   NC_REGISTER_CVAR(bool, character_physics_stabilize, true, "Extra stabilization iterations for character physics.");
+  NC_REGISTER_CVAR(bool, frame_arena,                 true, "Per-frame scratch memory comes from the frame arena, otherwise from the heap.");
 
   NC_REGISTER_CVAR_RANGED(f32, fps_limit, 120.0f, 1.0f, 512.0f,
     "FPS limit if the \"has_fps_limit\" is turned on");
@@ -152,6 +153,10 @@ struct CVars
   NC_REGISTER_CVAR_RANGED(s32, opengl_debug_severity, 1, 0, 3,
     "0 = everything, 1 = low and higher, 2 = medium and higher, 3 = critical only");
   NC_REGISTER_CVAR_RANGED(f32, time_speed, 1.0f, 0.0f, 10.0f, "Changes the update speed.");
+  // Off by default, rewinding captures the whole game state every simulated
+  // frame and that cost was not measured under real play yet.
+  NC_REGISTER_CVAR_RANGED(s32, rewind_frames, 0, 0, 7200,
+    "How many frames are kept in memory for rewinding, 0 turns it off. Applied on the next level load.");
 
   NC_REGISTER_CVAR_RANGED(f32, gun_sway_amount,           0.05f, 0.0f, 1.0f, "");
   NC_REGISTER_CVAR_RANGED(f32, gun_sway_speed,            4.5f,  0.0f, 8.0f, "");
@@ -3,12 +3,14 @@
 #include <config.h>
 
 #include <cvars.h>
+#include <frame_arena.h>
 
 #include <engine/core/engine.h>
 #include <engine/core/engine_module.h>
 #include <engine/core/module_event.h>
 #include <engine/core/is_engine_module.h>
 #include <engine/core/engine_module_types.h>
+#include <engine/core/job_system.h>
 
 #include <engine/map/map_system.h>
 #include <engine/entity/entity_system.h>
@@ -50,6 +52,13 @@
 #include <utility>     // std::move
 #include <map>         // std::map
 #include <vector>      // std::vector
+#include <numeric>     // std::accumulate
+#include <cmath>       // std::ceil
+#include <fstream>     // std::ofstream
+#include <charconv>    // std::from_chars
+#include <thread>      // std::thread::hardware_concurrency
+
+#include <json/json.hpp>
 
 namespace nc
 {
@@ -69,6 +78,13 @@ namespace engine_utils
 [[maybe_unused]] constexpr cstr EDITOR_MODE_ARG    = "-editor_mode"; // sets up bunch of minor stuff to make it more pleasant to use the game for preview when editing a level
 [[maybe_unused]] constexpr cstr PRESENTATION_ARG   = "-presentation"; // shows prepared slides while demos play in the background; followed by slide texture names
 [[maybe_unused]] constexpr cstr PRINT_COUNTERS_ARG = "-print_counters"; // prints the performance counters [into a file] 
+[[maybe_unused]] constexpr cstr BENCH_DEMO_ARG     = "-bench_demo";   // simulates a demo headless as fast as possible and exits
+[[maybe_unused]] constexpr cstr BENCH_OUTPUT_ARG   = "-bench_output"; // output JSON file of the demo benchmark
+[[maybe_unused]] constexpr cstr BENCH_OUTPUT_DEFAULT = "demo_benchmark.json";
+[[maybe_unused]] constexpr cstr TEST_DETERMINISM_ARG = "-test_determinism"; // simulates a demo on one and on all threads and compares the results
+[[maybe_unused]] constexpr cstr TEST_DETERMINISM_DEMO_DEFAULT = "presentation_demo.ncd"; // unless "-bench_demo" says otherwise
+[[maybe_unused]] constexpr cstr JOBS_ARG           = "-jobs";         // number of worker threads of the job system
+[[maybe_unused]] constexpr cstr COOK_LEVELS_ARG    = "-cook_levels";  // writes the cooked ".ncl" file of every level and exits
 
 //==============================================================================
 static f32 duration_to_seconds(auto t1, auto t2)
@@ -153,6 +169,27 @@ static std::vector<std::string> collect_values_after_arg
   return out;
 }
 
+//==============================================================================
+// Number of the job system workers from "-jobs", otherwise one less than the
+// number of hardware threads as the main thread works as well.
+static u32 get_job_worker_cnt(const CmdArgs& cmd_args)
+{
+  std::string value;
+  if (contains_pair_of_args(cmd_args, JOBS_ARG, value))
+  {
+    u32 cnt = 0;
+    auto[ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), cnt);
+    if (ec == std::errc{} && ptr == value.data() + value.size())
+    {
+      return cnt;
+    }
+
+    nc_warn("Invalid number of jobs \"{}\", using the default.", value);
+  }
+
+  return std::max(std::thread::hardware_concurrency(), 1u) - 1;
+}
+
 //==============================================================================
 static bool should_play_demo(const CmdArgs& cmd_args, std::string& out_demo)
 {
@@ -265,6 +302,29 @@ static bool execute_benchmarks_if_required(const std::vector<std::string>& args)
 }
 #endif
 
+//==============================================================================
+static bool cook_levels_if_required(const CmdArgs& args, bool& success_out)
+{
+  if (!contains_arg(args, COOK_LEVELS_ARG))
+  {
+    return false;
+  }
+
+  success_out = true;
+  for (const LevelName& level : LevelsDB)
+  {
+    const bool ok = GameSystem::cook_level(level);
+    success_out &= ok;
+
+    std::cout << std::format
+    (
+      "[Cook Levels] [{}] {}\n", ok ? "SUCCESS" : " FAIL  ", level.to_string()
+    );
+  }
+
+  return true;
+}
+
 //==============================================================================
 #if NC_TESTS
 //==============================================================================
@@ -390,6 +450,12 @@ int init_engine_and_run_game(const CmdArgs& args)
     return 0;
   }
 
+  if (bool cook_ok; engine_utils::cook_levels_if_required(args, cook_ok))
+  {
+    // only cooking the levels, exit
+    return cook_ok ? 0 : 1;
+  }
+
   // create instance of the engine
   g_engine = new Engine();
 
@@ -400,13 +466,22 @@ int init_engine_and_run_game(const CmdArgs& args)
     return 1;
   }
 
-  g_engine->run();
+  int exit_code = 0;
+  if (g_engine->is_headless())
+  {
+    // Only simulate the demo, nothing gets presented
+    exit_code = g_engine->run_demo_benchmark() ? 0 : 1;
+  }
+  else
+  {
+    g_engine->run();
+  }
 
   // graceful exit
   g_engine->terminate();
 
   delete g_engine;
-  return 0;
+  return exit_code;
 }
 
 //==============================================================================
@@ -492,6 +567,39 @@ bool Engine::init(const CmdArgs& cmd_args)
   }
 #endif
 
+  // Headless demo benchmark
+  this->m_headless = engine_utils::contains_pair_of_args
+  (
+    cmd_args, engine_utils::BENCH_DEMO_ARG, m_bench_demo_file
+  );
+
+  if (!engine_utils::contains_pair_of_args(cmd_args, engine_utils::BENCH_OUTPUT_ARG, m_bench_output_path))
+  {
+    m_bench_output_path = engine_utils::BENCH_OUTPUT_DEFAULT;
+  }
+
+  // The determinism check is headless as well and uses the shipped demo if no
+  // other one was given
+  this->m_test_determinism = engine_utils::contains_arg
+  (
+    cmd_args, engine_utils::TEST_DETERMINISM_ARG
+  );
+
+  if (m_test_determinism && !m_headless)
+  {
+    m_headless        = true;
+    m_bench_demo_file = engine_utils::TEST_DETERMINISM_DEMO_DEFAULT;
+  }
+
+#if NC_PROFILING
+  // Before the workers exist, so none of them can get profiled by accident
+  set_profiled_thread();
+#endif
+
+  // Worker threads for the game code
+  m_job_worker_cnt = engine_utils::get_job_worker_cnt(cmd_args);
+  JobSystem::get().init(m_job_worker_cnt);
+
   // init the modules here..
   #define INIT_MODULE(_module_class, ...)                     \
   {                                                           \
@@ -504,11 +612,21 @@ bool Engine::init(const CmdArgs& cmd_args)
     m_modules[_module_class::get_module_id()] = std::move(m); \
   }
 
-  INIT_MODULE(GraphicsSystem);
-  INIT_MODULE(InputSystem);
-  INIT_MODULE(GameSystem);
-  INIT_MODULE(SoundSystem);
-  INIT_MODULE(UserInterfaceSystem);
+  if (m_headless)
+  {
+    // No window, input or UI. The sound system stays so the game code can
+    // call it, but it does not open an audio device.
+    INIT_MODULE(GameSystem);
+    INIT_MODULE(SoundSystem);
+  }
+  else
+  {
+    INIT_MODULE(GraphicsSystem);
+    INIT_MODULE(InputSystem);
+    INIT_MODULE(GameSystem);
+    INIT_MODULE(SoundSystem);
+    INIT_MODULE(UserInterfaceSystem);
+  }
 
   #undef INIT_MODULE
 
@@ -518,6 +636,12 @@ bool Engine::init(const CmdArgs& cmd_args)
     .type = ModuleEventType::post_init,
   });
 
+  if (m_headless)
+  {
+    // The demo benchmark starts the level by itself
+    return true;
+  }
+
   // Boot into the menu or start a demo
   return this->handle_post_init_game_startup(cmd_args);
 }
@@ -543,9 +667,10 @@ void Engine::play_random_demo()
   // Play one demo and then exit
   LevelName           lvl_name;
   DemoDataFrames      frames;
+  DemoCheckpoints     checkpoints;
   LevelTransitionData transition;
 
-  if (!load_demo_from_file(demo, lvl_name, transition, frames))
+  if (!load_demo_from_file(demo, lvl_name, transition, frames, &checkpoints))
   {
     // Empty level = black screen in the menu
     nc_warn(
@@ -556,7 +681,10 @@ void Engine::play_random_demo()
   }
 
   // Demo loaded, play it
-  game_system.request_level_change(lvl_name, std::move(frames), transition);
+  game_system.request_level_change
+  (
+    lvl_name, std::move(frames), transition, std::move(checkpoints)
+  );
 }
 
 //==============================================================================
@@ -565,11 +693,12 @@ void Engine::loop_current_demo()
   // Play demo and go to the level transition state
   GameSystem& game_system = GameSystem::get();
 
-  LevelName      lvl  = game_system.get_level_name();
-  DemoDataFrames demo = game_system.get_demo_frames(); // Intentional copy
+  LevelName       lvl         = game_system.get_level_name();
+  DemoDataFrames  demo        = game_system.get_demo_frames();      // Intentional copy
+  DemoCheckpoints checkpoints = game_system.get_demo_checkpoints(); // Intentional copy
   LevelTransitionData transition = game_system.get_transition_data();
 
-  game_system.request_level_change(lvl, std::move(demo), transition);
+  game_system.request_level_change(lvl, std::move(demo), transition, std::move(checkpoints));
 }
 
 //==============================================================================
@@ -627,9 +756,10 @@ bool Engine::handle_post_init_game_startup(const CmdArgs& cmd_args)
     // Play one demo and then exit
     LevelName           lvl_name;
     DemoDataFrames      frames;
+    DemoCheckpoints     checkpoints;
     LevelTransitionData transition;
 
-    if (!load_demo_from_file(demo, lvl_name, transition, frames))
+    if (!load_demo_from_file(demo, lvl_name, transition, frames, &checkpoints))
     {
       nc_crit("Could not start demo \"{}\", quitting game.", demo);
       return false;
@@ -637,7 +767,10 @@ bool Engine::handle_post_init_game_startup(const CmdArgs& cmd_args)
 
     set_game_state(GameState::debug_demo);
 
-    game_system.request_level_change(lvl_name, std::move(frames), transition);
+    game_system.request_level_change
+    (
+      lvl_name, std::move(frames), transition, std::move(checkpoints)
+    );
   }
 #if !NC_IS_DEPLOY
   else if (std::string lvl; engine_utils::should_play_level(cmd_args, lvl))
@@ -770,6 +903,9 @@ void Engine::run()
         .type = ModuleEventType::cleanup,
       });
 
+      // The modules are done with the frame, throw away its scratch memory
+      FrameArena::get().reset();
+
       m_frame_idx += 1;
     }
   }
@@ -801,6 +937,8 @@ void Engine::terminate()
     nc_assert(module);
     module->on_event(terminate_event);
   }
+
+  JobSystem::get().terminate();
 }
 
 //==============================================================================
@@ -1070,4 +1208,206 @@ bool Engine::is_editor_mode() const
   return m_editor_mode; 
 }
 
+//==============================================================================
+bool Engine::is_headless() const
+{
+  return m_headless;
+}
+
+//==============================================================================
+bool Engine::load_bench_demo
+(
+  LevelName&           lvl_name_out,
+  LevelTransitionData& transition_out,
+  DemoDataFrames&      frames_out,
+  DemoCheckpoints&     checkpoints_out
+)
+{
+  if
+  (
+    !load_demo_from_file(m_bench_demo_file, lvl_name_out, transition_out, frames_out, &checkpoints_out)
+    || frames_out.empty()
+  )
+  {
+    nc_crit("Could not load demo \"{}\" for the benchmark.", m_bench_demo_file);
+    return false;
+  }
+
+  set_game_state(GameState::debug_demo);
+  return true;
+}
+
+//==============================================================================
+bool Engine::run_determinism_test()
+{
+  nc_assert(this->is_headless());
+
+  LevelName           lvl_name;
+  DemoDataFrames      frames;
+  DemoCheckpoints     checkpoints;
+  LevelTransitionData transition;
+
+  // A manual check, not a unit test. The tests run before the engine and its
+  // modules exist, but the demo needs the whole game. The exit code and the
+  // last line of the output tell the result.
+  auto report = [&](bool ok, std::string_view reason)
+  {
+    std::cout << std::format
+    (
+      "[Determinism] {} \"{}\": {}\n", ok ? "SUCCESS" : "FAIL", m_bench_demo_file, reason
+    );
+
+    return ok;
+  };
+
+  if (!this->load_bench_demo(lvl_name, transition, frames, checkpoints))
+  {
+    return report(false, "the demo could not be loaded, is it missing or of an unsupported version?");
+  }
+
+  // First everything on this thread, then with the workers. Parallel parts of
+  // the game must not change the result.
+  const u32 worker_cnts[] = {0, std::max(m_job_worker_cnt, 1u)};
+  u64       state_hashes[ARRAY_LENGTH(worker_cnts)]{};
+  u64       frame_cnts[ARRAY_LENGTH(worker_cnts)]{};
+
+  std::vector<f64> frame_times;
+  for (u64 i = 0; i < ARRAY_LENGTH(worker_cnts); ++i)
+  {
+    JobSystem::get().init(worker_cnts[i]);
+    GameSystem::get().simulate_demo_headless(lvl_name, transition, frames, checkpoints, frame_times);
+    state_hashes[i] = GameSystem::get().calc_game_state_hash();
+    frame_cnts[i]   = frame_times.size();
+
+    nc_log
+    (
+      "Demo \"{}\" simulated on {} thread(s): {} frames, state hash {:016x}",
+      m_bench_demo_file, JobSystem::get().get_thread_cnt(), frame_cnts[i], state_hashes[i]
+    );
+  }
+
+  if (frame_cnts[0] == 0)
+  {
+    return report(false, "no frame was simulated");
+  }
+
+  if (frame_cnts[0] != frame_cnts[1] || state_hashes[0] != state_hashes[1])
+  {
+    nc_crit("Demo \"{}\" diverges when simulated on multiple threads.", m_bench_demo_file);
+    return report(false, "diverges when simulated on multiple threads");
+  }
+
+  return report(true, "deterministic across thread counts");
+}
+
+//==============================================================================
+bool Engine::run_demo_benchmark()
+{
+  nc_assert(this->is_headless());
+
+  if (m_test_determinism)
+  {
+    return this->run_determinism_test();
+  }
+
+  LevelName           lvl_name;
+  DemoDataFrames      frames;
+  DemoCheckpoints     checkpoints;
+  LevelTransitionData transition;
+
+  if (!this->load_bench_demo(lvl_name, transition, frames, checkpoints))
+  {
+    return false;
+  }
+
+  std::vector<f64> frame_times; // in seconds
+  GameSystem::get().simulate_demo_headless(lvl_name, transition, frames, checkpoints, frame_times);
+
+  if (frame_times.empty())
+  {
+    nc_crit("Demo \"{}\" did not simulate any frame.", m_bench_demo_file);
+    return false;
+  }
+
+  const f64 total_time = std::accumulate(frame_times.begin(), frame_times.end(), 0.0);
+
+  std::vector<f64> sorted_times = frame_times;
+  std::sort(sorted_times.begin(), sorted_times.end());
+
+  // Nearest-rank percentile, in milliseconds
+  auto percentile = [&](f64 p) -> f64
+  {
+    const u64 rank = cast<u64>(std::ceil(p * sorted_times.size()));
+    return sorted_times[std::clamp<u64>(rank, 1, sorted_times.size()) - 1] * 1000.0;
+  };
+
+  nlohmann::json output;
+  output["demo"]             = m_bench_demo_file;
+  output["level"]            = lvl_name.to_string();
+  output["demo_frames"]      = frames.size();
+  output["simulated_frames"] = frame_times.size();
+  output["total_time_s"]     = total_time;
+  output["frame_time_ms"]    =
+  {
+    {"mean", total_time * 1000.0 / frame_times.size()},
+    {"p50",  percentile(0.50)},
+    {"p95",  percentile(0.95)},
+    {"p99",  percentile(0.99)},
+    {"max",  sorted_times.back() * 1000.0},
+  };
+
+  // The first checkpoint that did not match the recording, null if all did
+  if (std::optional<u64> divergent = GameSystem::get().get_demo_divergent_frame())
+  {
+    output["divergent_frame"] = *divergent;
+  }
+  else
+  {
+    output["divergent_frame"] = nullptr;
+  }
+
+#if NC_PROFILING
+  auto counter_to_json = [](auto&& self, const RuntimeCounterNode& node) -> nlohmann::json
+  {
+    nlohmann::json js =
+    {
+      {"name",       node.name},
+      {"time_s",     node.time},
+      {"percentage", node.percentage},
+    };
+
+    nlohmann::json& children = js["children"] = nlohmann::json::array();
+    for (const RuntimeCounterNode& child : node.children)
+    {
+      children.push_back(self(self, child));
+    }
+
+    return js;
+  };
+
+  nlohmann::json& counters = output["counters"] = nlohmann::json::array();
+  for (const RuntimeCounterNode& root : collect_runtime_counters())
+  {
+    counters.push_back(counter_to_json(counter_to_json, root));
+  }
+#endif
+
+  std::ofstream file(m_bench_output_path, std::ios_base::out);
+  if (!file.is_open())
+  {
+    nc_crit("Could not write the demo benchmark into \"{}\".", m_bench_output_path);
+    return false;
+  }
+
+  file << output.dump(2) << std::endl;
+
+  nc_log
+  (
+    "Demo benchmark of \"{}\" written into \"{}\": {} frames, p50 {:.3f}ms, p99 {:.3f}ms",
+    m_bench_demo_file, m_bench_output_path, frame_times.size(), percentile(0.50), percentile(0.99)
+  );
+
+  return true;
+}
+
 }
@@ -75,6 +75,17 @@ public:
 
   bool is_editor_mode() const;
 
+  // True if the engine runs without a window, GL context and audio device.
+  // Only the game simulation is available in such case (see "-bench_demo").
+  bool is_headless() const;
+
+  // Simulates the demo given by "-bench_demo" as fast as possible and writes
+  // the frame time statistics and runtime counters into a JSON file.
+  // With "-test_determinism" checks that the demo ends up in the same state
+  // regardless of the number of threads instead. That one is a manual check,
+  // it is not part of the unit tests.
+  bool run_demo_benchmark();
+
 private:
   // Called first before level end if a demo was playing
   // menu:     schedule next demo
@@ -112,6 +123,17 @@ private:
   enum class GameState : u8;
   void set_game_state(GameState new_state);
 
+  // Loads the demo given by "-bench_demo"
+  bool load_bench_demo
+  (
+    LevelName&           lvl_name_out,
+    LevelTransitionData& transition_out,
+    DemoDataFrames&      frames_out,
+    DemoCheckpoints&     checkpoints_out
+  );
+
+  bool run_determinism_test();
+
 private:
   using ModuleArray  = std::array<std::unique_ptr<IEngineModule>, 8>;
   using ModuleVector = std::vector<IEngineModule*>;
@@ -147,7 +169,12 @@ private:
   bool          m_paused            : 1 = false;
   bool          m_editor_mode       : 1 = false;
   bool          m_print_counters    : 1 = false;
+  bool          m_headless          : 1 = false;
+  bool          m_test_determinism  : 1 = false;
+  u32           m_job_worker_cnt        = 0;
   std::string   m_counters_output_path;
+  std::string   m_bench_demo_file;
+  std::string   m_bench_output_path;
 };
 
 Engine& get_engine();
@@ -0,0 +1,248 @@
+// Project Nuclidean Source File
+#include <common.h>
+
+#include <engine/core/job_system.h>
+
+#include <algorithm> // std::max, std::min
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+/*static*/ JobSystem& JobSystem::get()
+{
+  static JobSystem job_system;
+  return job_system;
+}
+
+//==============================================================================
+JobSystem::~JobSystem()
+{
+  this->terminate();
+}
+
+//==============================================================================
+void JobSystem::init(u32 worker_cnt)
+{
+  this->terminate();
+
+  m_queue_cnt = worker_cnt + 1;
+  m_queues    = std::make_unique<JobQueue[]>(m_queue_cnt);
+  m_quit      = false;
+
+  m_workers.reserve(worker_cnt);
+  for (u32 i = 0; i < worker_cnt; ++i)
+  {
+    m_workers.emplace_back([this, i]()
+    {
+      this->worker_main(i + 1);
+    });
+  }
+}
+
+//==============================================================================
+void JobSystem::terminate()
+{
+  if (m_workers.empty())
+  {
+    return;
+  }
+
+  {
+    std::lock_guard lock(m_wake_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+
+  for (std::thread& worker : m_workers)
+  {
+    worker.join();
+  }
+
+  m_workers.clear();
+  m_queues.reset();
+  m_queue_cnt = 1;
+}
+
+//==============================================================================
+u32 JobSystem::get_thread_cnt() const
+{
+  return m_queue_cnt;
+}
+
+//==============================================================================
+void JobSystem::run_batches(JobFunc func, void* ctx, u64 cnt, u64 batch_size)
+{
+  batch_size = std::max<u64>(batch_size, 1);
+
+  if (m_workers.empty())
+  {
+    // No workers, do it inline in order
+    func(ctx, 0, cnt);
+    return;
+  }
+
+  const u64 batch_cnt = (cnt + batch_size - 1) / batch_size;
+  std::atomic<u64> pending = batch_cnt;
+
+  // Counted in advance so the counter does not underflow if a worker takes a
+  // job before we finish pushing
+  m_queued_cnt += batch_cnt;
+
+  // Spread the batches over all queues so the workers do not have to steal
+  // everything from us
+  for (u64 batch = 0; batch < batch_cnt; ++batch)
+  {
+    Job job
+    {
+      .func    = func,
+      .ctx     = ctx,
+      .begin   = batch * batch_size,
+      .end     = std::min(cnt, (batch + 1) * batch_size),
+      .pending = &pending,
+    };
+
+    JobQueue& queue = m_queues[batch % m_queue_cnt];
+    std::lock_guard lock(queue.mutex);
+    queue.jobs.push_back(job);
+  }
+
+  {
+    // Nobody can miss the wake up between checking the counter and waiting
+    std::lock_guard lock(m_wake_mutex);
+  }
+  m_wake.notify_all();
+
+  // Help until everything is done. The last jobs might still be running on
+  // the workers even if there is nothing left to take.
+  while (pending.load(std::memory_order_acquire))
+  {
+    Job job;
+    if (this->try_get_job(0, job))
+    {
+      this->execute(job);
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+}
+
+//==============================================================================
+bool JobSystem::try_get_job(u32 queue_idx, Job& job_out)
+{
+  // Our own queue first, newest jobs first as they are still warm in the cache
+  {
+    JobQueue& own = m_queues[queue_idx];
+    std::lock_guard lock(own.mutex);
+    if (!own.jobs.empty())
+    {
+      job_out = own.jobs.back();
+      own.jobs.pop_back();
+      m_queued_cnt -= 1;
+      return true;
+    }
+  }
+
+  // Steal the oldest job from someone else
+  for (u32 i = 1; i < m_queue_cnt; ++i)
+  {
+    JobQueue& victim = m_queues[(queue_idx + i) % m_queue_cnt];
+    std::lock_guard lock(victim.mutex);
+    if (!victim.jobs.empty())
+    {
+      job_out = victim.jobs.front();
+      victim.jobs.pop_front();
+      m_queued_cnt -= 1;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//==============================================================================
+void JobSystem::execute(Job& job)
+{
+  nc_assert(job.func && job.pending);
+
+  job.func(job.ctx, job.begin, job.end);
+  job.pending->fetch_sub(1, std::memory_order_release);
+}
+
+//==============================================================================
+void JobSystem::worker_main(u32 queue_idx)
+{
+  while (true)
+  {
+    {
+      std::unique_lock lock(m_wake_mutex);
+      m_wake.wait(lock, [this]()
+      {
+        return m_quit || m_queued_cnt > 0;
+      });
+
+      if (m_quit)
+      {
+        return;
+      }
+    }
+
+    Job job;
+    while (this->try_get_job(queue_idx, job))
+    {
+      this->execute(job);
+    }
+  }
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool job_system_test_parallel_for(unit_test::TestCtx& /*ctx*/)
+{
+  constexpr u64 CNT = 10'000;
+
+  // Test also the inline path without any workers
+  for (u32 worker_cnt : {0, 1, 3})
+  {
+    JobSystem jobs;
+    jobs.init(worker_cnt);
+
+    for (u64 batch_size : {1_u64, 7_u64, 64_u64, CNT * 2})
+    {
+      // Every index has to be visited exactly once
+      std::vector<u32> visits(CNT, 0);
+      jobs.parallel_for(CNT, batch_size, [&](u64 idx)
+      {
+        visits[idx] += 1;
+      });
+
+      for (u64 i = 0; i < CNT; ++i)
+      {
+        if (visits[i] != 1)
+        {
+          nc_warn
+          (
+            "Job system test failed. Index {} visited {} times with {} workers and batch of {}.",
+            i, visits[i], worker_cnt, batch_size
+          );
+          NC_TEST_FAIL;
+        }
+      }
+    }
+
+    jobs.terminate();
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(job_system_test_parallel_for)->name("Job System Parallel For");
+#endif
+
+}
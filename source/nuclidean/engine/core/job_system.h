@@ -0,0 +1,97 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <atomic>             // std::atomic
+#include <condition_variable> // std::condition_variable
+#include <deque>              // std::deque
+#include <memory>             // std::unique_ptr
+#include <mutex>              // std::mutex
+#include <thread>             // std::thread
+#include <vector>             // std::vector
+
+namespace nc
+{
+
+// A small work-stealing job system for data parallel loops in the game code.
+// Each thread (the workers and the thread that submits the work) has its own
+// queue of jobs. A thread takes the jobs from the back of its own queue and
+// when it runs out of them, it steals from the front of the queues of the
+// others.
+// The order in which the jobs run is not specified, so the jobs must not
+// depend on each other and must not write into any shared state. Anything that
+// has to be deterministic must be merged serially after "parallel_for" returns.
+class JobSystem
+{
+public:
+  // Returns the singleton instance.
+  static JobSystem& get();
+
+  JobSystem() = default;
+  ~JobSystem();
+
+  JobSystem(const JobSystem&)            = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  // Starts the worker threads. With zero workers all the jobs run on the
+  // calling thread. Can be called again to change the number of workers.
+  void init(u32 worker_cnt);
+
+  // Waits for the workers to finish and joins them.
+  void terminate();
+
+  // Number of threads that execute the jobs, including the one calling
+  // "parallel_for".
+  u32 get_thread_cnt() const;
+
+  // Calls "func(idx)" for every idx in [0, cnt) and returns after all of the
+  // calls finished. The range is split into batches of "batch_size" indices
+  // which are spread over all threads, the calling thread helps as well.
+  // Has to be called from the thread that called "init".
+  template<typename F>
+  void parallel_for(u64 cnt, u64 batch_size, F&& func);
+
+private:
+  using JobFunc = void(*)(void* ctx, u64 begin, u64 end);
+
+  struct Job
+  {
+    JobFunc           func    = nullptr;
+    void*             ctx     = nullptr;
+    u64               begin   = 0;
+    u64               end     = 0;
+    std::atomic<u64>* pending = nullptr; // decremented after the job is done
+  };
+
+  struct JobQueue
+  {
+    std::mutex      mutex;
+    std::deque<Job> jobs;
+  };
+
+  // Splits [0, cnt) into jobs, spreads them over the queues and helps with
+  // executing them until all are done.
+  void run_batches(JobFunc func, void* ctx, u64 cnt, u64 batch_size);
+
+  // Pops a job from the back of our own queue or steals one from the front of
+  // any other queue.
+  bool try_get_job(u32 queue_idx, Job& job_out);
+
+  void execute(Job& job);
+
+  void worker_main(u32 queue_idx);
+
+private:
+  std::vector<std::thread>    m_workers;
+  std::unique_ptr<JobQueue[]> m_queues;         // [0] is the submitting thread, then the workers
+  u32                         m_queue_cnt = 1;
+  std::mutex                  m_wake_mutex;
+  std::condition_variable     m_wake;
+  std::atomic<u64>            m_queued_cnt = 0; // jobs waiting in all queues
+  std::atomic<bool>           m_quit       = false;
+};
+
+}
+
+#include <engine/core/job_system.inl>
@@ -0,0 +1,34 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <type_traits> // std::remove_reference_t
+
+namespace nc
+{
+
+//==============================================================================
+template<typename F>
+void JobSystem::parallel_for(u64 cnt, u64 batch_size, F&& func)
+{
+  using FuncType = std::remove_reference_t<F>;
+
+  if (cnt == 0)
+  {
+    return;
+  }
+
+  auto run_batch = [](void* ctx, u64 begin, u64 end)
+  {
+    FuncType& fn = *static_cast<FuncType*>(ctx);
+    for (u64 idx = begin; idx < end; ++idx)
+    {
+      fn(idx);
+    }
+  };
+
+  // The lambda outlives all of the jobs as we wait for them to finish
+  void* ctx = const_cast<void*>(static_cast<const void*>(&func));
+  this->run_batches(run_batch, ctx, cnt, batch_size);
+}
+
+}
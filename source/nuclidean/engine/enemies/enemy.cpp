@@ -174,13 +174,14 @@ static Appearance::SpriteMode choose_sprite_mode(const ActorFSM& fsm)
 template<typename F>
 bool scan_sector_tree_recursively
 (
-  const MapSectors&     map,
-  const VisibilityTree& tree,
-  mat4                  transform,
-  F                     callback
+  const MapSectors&      map,
+  const VisibilityTree&  tree,
+  VisibilityTree::NodeID node,
+  mat4                   transform,
+  F                      callback
 )
 {
-  for (const VisibilityTree::SectorFrustum& sfs : tree.sectors)
+  for (const VisibilityTree::SectorFrustum& sfs : tree.get_sectors(node))
   {
     if (!callback(sfs.sector, sfs.frustum, transform))
     {
@@ -188,8 +189,10 @@ bool scan_sector_tree_recursively
     }
   }
 
-  for (const VisibilityTree& subtree : tree.children)
+  const VisibilityTree::Node& current = tree.nodes[node];
+  for (auto child = current.children_begin; child < current.children_end; ++child)
   {
+    const VisibilityTree::Node& subtree = tree.nodes[child];
     nc_assert(map.is_valid_sector_id(subtree.portal_sector));
     nc_assert(map.is_valid_wall_id(subtree.portal_wall));
 
@@ -198,7 +201,7 @@ bool scan_sector_tree_recursively
       subtree.portal_sector, subtree.portal_wall
     );
     
-    if (!scan_sector_tree_recursively(map, subtree, sub_transform * transform, callback))
+    if (!scan_sector_tree_recursively(map, tree, child, sub_transform * transform, callback))
     {
       return false;
     }
@@ -270,7 +273,75 @@ void Enemy::post_init()
 }
 
 //==============================================================================
-void Enemy::update(f32 delta)
+void Enemy::think(Thoughts& out) const
+{
+  out = Thoughts{};
+
+  auto game = GameHelpers::get();
+  bool my_turn = this->is_my_turn_for_visibility_query();
+
+  switch (this->state)
+  {
+    case EnemyAiState::idle:
+    {
+      // Same as in "handle_ai_idle", we do not have to look if the player is
+      // close enough
+      Player* player = game.get_player();
+      if (my_turn && player && distance(player->get_position(), this->get_position()) > SPOT_DISTANCE)
+      {
+        out.looked_at   = player->get_id();
+        out.sees_target = this->can_see_point(player->get_position() + vec3{0, 0.5f, 0}, this->facing);
+      }
+    }
+    break;
+
+    case EnemyAiState::alert:
+    {
+      const Entity* target = GameSystem::get().get_entities().get_entity(this->target_id);
+      if (!target)
+      {
+        break;
+      }
+
+      bool sees_target = this->can_see_target;
+      if (my_turn)
+      {
+        vec3 pt = target->get_position() + vec3{0, 0.5f, 0};
+        vec3 direction = normalize_or_zero(pt - target->get_position());
+
+        out.looked_at   = target->get_id();
+        out.sees_target = this->can_see_point(pt, direction);
+        sees_target     = out.sees_target && !(CVars::invisibility && target->get_type() == EntityTypes::player);
+      }
+
+      // Plan the path only if we are going to walk, the position to follow is
+      // predicted the same way as "handle_ai_alert" is going to update it.
+      // The search itself waits for "think_search" if we get a path slot.
+      ActorAnimState anim_state = this->anim_fsm.get_state();
+      if (anim_state == ActorAnimStates::idle || anim_state == ActorAnimStates::walk)
+      {
+        vec3 follow_pos = sees_target ? target->get_position() : this->follow_target_pos;
+        if (this->wants_new_path(follow_pos) && !this->plan_flow_field_path(follow_pos, out.plan))
+        {
+          out.needs_search = true;
+        }
+      }
+    }
+    break;
+
+    default: break;
+  }
+}
+
+//==============================================================================
+void Enemy::think_search(Thoughts& thoughts) const
+{
+  nc_assert(thoughts.needs_search && thoughts.has_path_slot);
+  this->plan_search_path(thoughts.plan.follow_pos, thoughts.plan);
+}
+
+//==============================================================================
+void Enemy::update(f32 delta, const Thoughts& thoughts)
 {
   NC_SCOPE_PROFILER(EnemyUpdate)
 
@@ -280,7 +351,7 @@ void Enemy::update(f32 delta)
   }
   else
   {
-    this->handle_ai(delta);
+    this->handle_ai(delta, thoughts);
   }
 
   this->handle_movement(delta);
@@ -288,19 +359,19 @@ void Enemy::update(f32 delta)
 }
 
 //==============================================================================
-void Enemy::handle_ai(f32 delta_seconds)
+void Enemy::handle_ai(f32 delta_seconds, const Thoughts& thoughts)
 {
   switch (this->state)
   {
     case EnemyAiState::idle:
     {
-      this->handle_ai_idle(delta_seconds);
+      this->handle_ai_idle(delta_seconds, thoughts);
     }
     break;
 
     case EnemyAiState::alert:
     {
-      this->handle_ai_alert(delta_seconds);
+      this->handle_ai_alert(delta_seconds, thoughts);
     }
     break;
 
@@ -497,7 +568,7 @@ bool Enemy::is_my_turn_for_visibility_query() const
 }
 
 //==============================================================================
-void Enemy::handle_ai_idle(f32 /*delta*/)
+void Enemy::handle_ai_idle(f32 /*delta*/, const Thoughts& thoughts)
 {
   auto game = GameHelpers::get();
 
@@ -524,9 +595,12 @@ void Enemy::handle_ai_idle(f32 /*delta*/)
   {
     transition_to_alert = true;
   }
-  else if (my_turn && this->can_see_point(look_at_pos, this->facing))
+  else if (my_turn)
   {
-    transition_to_alert = true;
+    // Looked ahead in "think" unless the player has changed since
+    transition_to_alert = thoughts.looked_at == player->get_id()
+      ? thoughts.sees_target
+      : this->can_see_point(look_at_pos, this->facing);
   }
 
   // For debugging reasons want to do the query even if the player is invisible
@@ -546,11 +620,10 @@ void Enemy::handle_ai_idle(f32 /*delta*/)
 }
 
 //==============================================================================
-void Enemy::handle_ai_alert(f32 delta)
+void Enemy::handle_ai_alert(f32 delta, const Thoughts& thoughts)
 {
   auto& game   = GameSystem::get();
   auto& ecs    = game.get_entities();
-  auto  lvl    = game.get_level();
   auto& stats  = this->get_stats();
 
   Entity* target = ecs.get_entity(this->target_id);
@@ -570,9 +643,16 @@ void Enemy::handle_ai_alert(f32 delta)
   // Update only once in a while
   if (this->is_my_turn_for_visibility_query())
   {
-    vec3 pt = target->get_position() + vec3{0, 0.5f, 0};
-    vec3 direction = normalize_or_zero(pt - target->get_position());
-    this->can_see_target = this->can_see_point(pt, direction);
+    if (thoughts.looked_at == this->target_id)
+    {
+      this->can_see_target = thoughts.sees_target;
+    }
+    else
+    {
+      vec3 pt = target->get_position() + vec3{0, 0.5f, 0};
+      vec3 direction = normalize_or_zero(pt - target->get_position());
+      this->can_see_target = this->can_see_point(pt, direction);
+    }
 
     if (CVars::invisibility && target->get_type() == EntityTypes::player)
     {
@@ -599,118 +679,44 @@ void Enemy::handle_ai_alert(f32 delta)
     case ActorAnimStates::walk:
     {
       // Recompute the path if needed
-      bool no_path  = current_path.empty();
-      vec2 last_pt2 = current_path.target_pt_world_space.xz();
-
-      vec3 rel_target_pos_ =
-      (
-        current_path.target_transform_inv * vec4{ this->follow_target_pos, 1.0f }
-        ).xyz();
-
-      // We calculate continuation of current path to see how far the player actually is
-      // if they move through a portal, the transform will be modified
-      f32 dist = distance(last_pt2, rel_target_pos_.xz());
-      if (!no_path && dist > 5.0f)
+      if (this->wants_new_path(this->follow_target_pos))
       {
-        mat4 ext_transform = identity<mat4>();
-        bool found_ext;
-        std::vector<vec3> path_extension_points = lvl.calc_path_relative(
-        current_path.target_pt_world_space,
-        this->follow_target_pos,
-        this->get_radius(),
-        this->get_height(),
-        get_stats().step_height,
-        ENEMY_DROP_HEIGHT,
-        true,
-        &ext_transform,
-        &found_ext);
-      
-        rel_target_pos_ =
-        (
-          inverse(ext_transform) * vec4 { rel_target_pos_, 1.0f }
-          ).xyz();
-      }
-      
+        // Usually planned ahead in "think", unless something changed since
+        const bool planned_ahead  = this->is_path_plan_valid(thoughts.plan);
+        const bool searched_ahead = planned_ahead && thoughts.has_path_slot;
 
-      if (no_path || distance(last_pt2, rel_target_pos_.xz()) > 5.0f)
-      //if (no_path || distance(last_pt2, this->follow_target_pos.xz()) > 5.0f)
-      {
-        // Portal transform of the path
-        mat4 nc_transform = identity<mat4>();
-
-        // Points relative to our portal transform
-        std::vector<vec3> path_points;
-
-        bool found_one         = false;
-        bool only_for_shooting = false;
-
-          path_points = lvl.calc_path_relative
-          (
-            this->get_position(),
-            this->follow_target_pos,
-            this->get_radius(),
-            this->get_height(),
-            get_stats().step_height,
-            ENEMY_DROP_HEIGHT,
-            true,
-            &nc_transform,
-            &found_one
-          );
-
-        if (!found_one && !get_stats().is_melee)
+        PathPlan        new_plan;
+        const PathPlan* plan = &thoughts.plan;
+
+        if (!planned_ahead)
         {
-          // We calculate this path only for shooting, because we need to know
-          // where the player is relative to us when we account for portals.
-          // We do this only for ranged enemies, because they can just stand on
-          // a spot and shoot.
-          only_for_shooting = true;
-
-          f32 r = 0.25f; // So we can shoot through spaces we can't squeeze
-          f32 h = 0.25f; // through
-          f32 up_down = 300.0f; // Arbitrary large number so we can shoot from up or below
-
-          path_points = lvl.calc_path_relative
-          (
-            this->get_position(),
-            this->follow_target_pos,
-            r, h, up_down, up_down,
-            false, // No need to smooth
-            &nc_transform,
-            &found_one
-          );
+          this->plan_flow_field_path(this->follow_target_pos, new_plan);
+          plan = &new_plan;
         }
-        else if (!found_one && get_stats().is_melee)
+
+        // Following the shared flow field is cheap. Searching for a path is
+        // expensive and only a few enemies can do it each frame, the path
+        // slots were handed out before thinking. The rest keeps following the
+        // old path for now.
+        if (plan->from_flow_field)
         {
-          // Calculate random shit path for melee dudes that are out of reach
-          // of the target.
-          // This will make them harder to hit.
-          path_points = lvl.calc_random_path_nearby
-          (
-            this->get_position(),
-            15.0f,
-            this->get_radius(),
-            this->get_height(),
-            get_stats().step_height,
-            ENEMY_DROP_HEIGHT,
-            this->rng,
-            true,
-            &nc_transform
-          );
-
-          found_one = !path_points.empty();
+          this->apply_path_plan(*plan);
         }
-
-        if (found_one)
+        else if (thoughts.has_path_slot || GameHelpers::get().try_consume_path_query())
         {
-          // We found a path, let's set it
-          this->current_path.target_pt_world_space = this->follow_target_pos;
-          this->current_path.target_transform_inv  = inverse(nc_transform);
-
-          if (!only_for_shooting)
+          if (!searched_ahead)
           {
-            // It might be only a visibility path for shooting
-            this->current_path.assign(path_points.data(), path_points.size());
+            if (planned_ahead)
+            {
+              // The flow field did not lead there in "think" either
+              new_plan = thoughts.plan;
+            }
+
+            this->plan_search_path(this->follow_target_pos, new_plan);
+            plan = &new_plan;
           }
+
+          this->apply_path_plan(*plan);
         }
       }
 
@@ -818,6 +824,7 @@ void Enemy::handle_ai_alert(f32 delta)
 
   // Debug draw path points
 #if NC_DEBUG_DRAW
+  if (!get_engine().is_headless())
   {
     for (u64 i = 0; i < current_path.size(); ++i)
     {
@@ -875,13 +882,20 @@ bool Enemy::can_see_point(vec3 point, vec3 look_direction) const
   // TODO: This is not an ideal algorithm and therefore not very efficient.
   // Do a visibility query, store the visible sectors and iterate them.
   // Search for the point inside these sectors.
-  VisibilityTree tree;
+  // The tree is reused between the calls so we do not allocate every time.
+  static thread_local VisibilityTree tree;
   level.map.query_visible(from, look_dir_2d, FOV_RAD, PI * 0.25f, tree, 3);
 
   bool sees_the_point        = false;
   u8   raycast_attempts_left = 3; // number of recursive raycasts is limited to this
 
-  scan_sector_tree_recursively(level.map, tree, identity<mat4>(),
+  if (tree.is_empty())
+  {
+    // We are out of the map
+    return false;
+  }
+
+  scan_sector_tree_recursively(level.map, tree, VisibilityTree::ROOT, identity<mat4>(),
   [&](SectorID sector_id, const FrustumBuffer& frustums, mat4 portal_transforms)
   {
     if (!level.map.is_point_in_sector(to_2d, sector_id))
@@ -1091,6 +1105,251 @@ vec2 Enemy::get_facing_2d() const
   return vec2{hor.x, hor.y};
 }
 
+//==============================================================================
+/*static*/ FlowField::Agent Enemy::get_flow_field_agent()
+{
+  FlowField::Agent agent
+  {
+    .radius    = 0.0f,
+    .height    = 0.0f,
+    .step_up   = FLT_MAX,
+    .step_down = ENEMY_DROP_HEIGHT,
+  };
+
+  for (EnemyType type = 0; type < EnemyTypes::count; ++type)
+  {
+    const EnemyStats& stats = ENEMY_STATS[type];
+    agent.radius  = max(agent.radius,  stats.radius);
+    agent.height  = max(agent.height,  stats.height);
+    agent.step_up = min(agent.step_up, stats.step_height);
+  }
+
+  return agent;
+}
+
+//==============================================================================
+bool Enemy::wants_new_path(vec3 follow_pos) const
+{
+  if (current_path.empty())
+  {
+    return true;
+  }
+
+  vec3 rel_target_pos =
+  (
+    current_path.target_transform_inv * vec4{follow_pos, 1.0f}
+  ).xyz();
+
+  return distance(current_path.target_pt_world_space.xz(), rel_target_pos.xz()) > 5.0f;
+}
+
+//==============================================================================
+bool Enemy::plan_flow_field_path(vec3 follow_pos, PathPlan& out) const
+{
+  out            = PathPlan{};
+  out.from       = this->get_position();
+  out.follow_pos = follow_pos;
+  out.target     = this->target_id;
+  out.valid      = true;
+
+  GameHelpers game = GameHelpers::get();
+
+  Player* player = game.get_player();
+  if (!player || player->get_id() != this->target_id)
+  {
+    return false;
+  }
+
+  // The field leads to the player, but we follow the position we saw them at
+  // the last time
+  const FlowField&  field = game.get_flow_field();
+  const MapSectors& map   = GameSystem::get().get_map();
+  if (map.get_sector_from_point(follow_pos.xz()) != field.get_target_sector())
+  {
+    return false;
+  }
+
+  vec3 points[PathInline::NUM_PTS_INLINE];
+  mat4 nc_transform = identity<mat4>();
+
+  u64 cnt = field.calc_path_relative
+  (
+    map, this->get_position(), follow_pos, this->get_radius(),
+    points, PathInline::NUM_PTS_INLINE, nc_transform
+  );
+
+  if (!cnt)
+  {
+    return false;
+  }
+
+  out.path.target_pt_world_space = follow_pos;
+  out.path.target_transform_inv  = inverse(nc_transform);
+  out.path.assign(points, cnt);
+
+  out.from_flow_field = true;
+  out.repath          = true;
+  out.found           = true;
+  return true;
+}
+
+//==============================================================================
+void Enemy::plan_search_path(vec3 follow_pos, PathPlan& out) const
+{
+  nc_assert(out.valid && !out.from_flow_field);
+
+  PhysLevel lvl = GameSystem::get().get_level();
+
+  vec3 rel_target_pos =
+  (
+    current_path.target_transform_inv * vec4{follow_pos, 1.0f}
+  ).xyz();
+
+  // We calculate continuation of current path to see how far the player actually is
+  // if they move through a portal, the transform will be modified
+  if (!current_path.empty())
+  {
+    mat4 ext_transform = identity<mat4>();
+    bool found_ext;
+    lvl.calc_path_relative
+    (
+      current_path.target_pt_world_space,
+      follow_pos,
+      this->get_radius(),
+      this->get_height(),
+      get_stats().step_height,
+      ENEMY_DROP_HEIGHT,
+      true,
+      &ext_transform,
+      &found_ext
+    );
+
+    rel_target_pos =
+    (
+      inverse(ext_transform) * vec4{rel_target_pos, 1.0f}
+    ).xyz();
+  }
+
+  out.repath = current_path.empty()
+    || distance(current_path.target_pt_world_space.xz(), rel_target_pos.xz()) > 5.0f;
+
+  if (!out.repath)
+  {
+    return;
+  }
+
+  // Portal transform of the path
+  mat4 nc_transform = identity<mat4>();
+
+  // Points relative to our portal transform
+  std::vector<vec3> path_points = lvl.calc_path_relative
+  (
+    this->get_position(),
+    follow_pos,
+    this->get_radius(),
+    this->get_height(),
+    get_stats().step_height,
+    ENEMY_DROP_HEIGHT,
+    true,
+    &nc_transform,
+    &out.found
+  );
+
+  if (!out.found && !get_stats().is_melee)
+  {
+    // We calculate this path only for shooting, because we need to know
+    // where the player is relative to us when we account for portals.
+    // We do this only for ranged enemies, because they can just stand on
+    // a spot and shoot.
+    out.only_for_shooting = true;
+
+    f32 r = 0.25f; // So we can shoot through spaces we can't squeeze
+    f32 h = 0.25f; // through
+    f32 up_down = 300.0f; // Arbitrary large number so we can shoot from up or below
+
+    path_points = lvl.calc_path_relative
+    (
+      this->get_position(),
+      follow_pos,
+      r, h, up_down, up_down,
+      false, // No need to smooth
+      &nc_transform,
+      &out.found
+    );
+  }
+
+  if (out.found)
+  {
+    out.path.target_pt_world_space = follow_pos;
+    out.path.target_transform_inv  = inverse(nc_transform);
+
+    if (!out.only_for_shooting)
+    {
+      // It might be only a visibility path for shooting
+      out.path.assign(path_points.data(), path_points.size());
+    }
+  }
+}
+
+//==============================================================================
+bool Enemy::is_path_plan_valid(const PathPlan& plan) const
+{
+  return plan.valid
+      && plan.target     == this->target_id
+      && plan.from       == this->get_position()
+      && plan.follow_pos == this->follow_target_pos;
+}
+
+//==============================================================================
+void Enemy::apply_path_plan(const PathPlan& plan)
+{
+  if (!plan.repath)
+  {
+    // The old path still leads close enough to the target
+    return;
+  }
+
+  if (plan.found)
+  {
+    // We found a path, let's set it
+    this->current_path.target_pt_world_space = plan.path.target_pt_world_space;
+    this->current_path.target_transform_inv  = plan.path.target_transform_inv;
+
+    if (!plan.only_for_shooting)
+    {
+      this->current_path = plan.path;
+    }
+  }
+  else if (get_stats().is_melee)
+  {
+    // Calculate random shit path for melee dudes that are out of reach
+    // of the target.
+    // This will make them harder to hit.
+    // Done here and not in "think" because it depends on our rng.
+    mat4 nc_transform = identity<mat4>();
+
+    std::vector<vec3> path_points = GameSystem::get().get_level().calc_random_path_nearby
+    (
+      this->get_position(),
+      15.0f,
+      this->get_radius(),
+      this->get_height(),
+      get_stats().step_height,
+      ENEMY_DROP_HEIGHT,
+      this->rng,
+      true,
+      &nc_transform
+    );
+
+    if (!path_points.empty())
+    {
+      this->current_path.target_pt_world_space = plan.follow_pos;
+      this->current_path.target_transform_inv  = inverse(nc_transform);
+      this->current_path.assign(path_points.data(), path_points.size());
+    }
+  }
+}
+
 //==============================================================================
 void Enemy::on_self_or_target_traversed_nc_portal()
 {
@@ -5,6 +5,7 @@
 #include <engine/entity/entity_types.h>
 
 #include <engine/map/map_types.h>
+#include <engine/map/flow_field.h>
 #include <engine/appearance.h>
 #include <anim_state_machine.h>
 
@@ -27,7 +28,20 @@ public:
   void init(vec3 position, vec3 facing, EnemyType type);
   void post_init();
 
-  void update(f32 delta);
+  // Results of the read-only part of the AI update.
+  struct Thoughts;
+
+  // The update is split into two phases so the expensive queries of the AI
+  // (visibility and path search) can run on multiple threads. All enemies
+  // "think" in parallel on the state from the start of the enemy update and
+  // only read the game. Then they "update" one after another and apply their
+  // thoughts if they are still valid.
+  // Searching for a path is expensive, so "think" only marks that it needs
+  // one. The game hands out the path slots serially and "think_search" runs
+  // (again in parallel) only for the enemies that got one.
+  void think(Thoughts& out) const;
+  void think_search(Thoughts& thoughts) const;
+  void update(f32 delta, const Thoughts& thoughts);
 
   // Take damage, save inflictor
   void damage(int damage, EntityID from_who);
@@ -46,10 +60,32 @@ public:
 
   bool is_physics_enabled() const;
 
+  // The shared flow field towards the player has to be walkable by all enemy
+  // types
+  static FlowField::Agent get_flow_field_agent();
+
 private:
   void on_self_or_target_traversed_nc_portal();
 
-  void handle_ai(f32 delta);
+  struct PathPlan;
+
+  // True if we do not have any path or the target moved too far from it
+  bool wants_new_path(vec3 follow_pos) const;
+
+  // Starts a new plan towards "follow_pos" and takes the path from the shared
+  // flow field if it leads to our target. Returns false if it does not and the
+  // path has to be searched for separately.
+  bool plan_flow_field_path(vec3 follow_pos, PathPlan& out) const;
+
+  // Searches for a path towards "follow_pos", expensive.
+  void plan_search_path(vec3 follow_pos, PathPlan& out) const;
+
+  // True if the plan was made for our current position and target.
+  bool is_path_plan_valid(const PathPlan& plan) const;
+
+  void apply_path_plan(const PathPlan& plan);
+
+  void handle_ai(f32 delta, const Thoughts& thoughts);
   void handle_movement(f32 delta);
   void handle_appearance(f32 delta);
   void die();
@@ -58,8 +94,8 @@ private:
   // Returns true if this enemy can perform a visibility query this frame.
   bool is_my_turn_for_visibility_query() const;
 
-  void handle_ai_idle(f32 delta);
-  void handle_ai_alert(f32 delta);
+  void handle_ai_idle(f32 delta, const Thoughts& thoughts);
+  void handle_ai_alert(f32 delta, const Thoughts& thoughts);
 
   bool can_see_point(vec3 pt, vec3 look_dir) const;
   bool can_attack(const Entity& target)      const;
@@ -115,6 +151,20 @@ private:
     mat4 target_transform_inv  = mat4{1.0f};
   };
 
+  // A new path for us, either planned ahead in "think" or on the spot.
+  struct PathPlan
+  {
+    PathInline path;                             // the new path and its target transform
+    vec3       from              = VEC3_ZERO;    // our position at the time of planning
+    vec3       follow_pos        = VEC3_ZERO;    // the position we planned to get to
+    EntityID   target            = INVALID_ENTITY_ID;
+    bool       valid             = false;
+    bool       from_flow_field   = false;        // does not consume a path query
+    bool       repath            = false;        // false if the current path is still good
+    bool       found             = false;
+    bool       only_for_shooting = false;        // only the transform is usable, not the points
+  };
+
   static constexpr u8 Y_SMOOTHING_FRAMES = 12;
   std::array<f32, Y_SMOOTHING_FRAMES> smooth_ys{};
   u8 smooth_y_idx = 0;
@@ -138,4 +188,20 @@ private:
   ActionTimestamp move_sound_timestamp;
 };
 
+struct Enemy::Thoughts
+{
+  // Result of the visibility query if it was our turn to do it
+  EntityID  looked_at   = INVALID_ENTITY_ID;
+  bool      sees_target = false;
+
+  // The path we would take if we get to repath this frame
+  PathPlan  plan;
+
+  // The flow field does not lead to the target, so the plan needs a search
+  bool      needs_search  = false;
+
+  // Got one of the path queries of this frame, the plan was searched for
+  bool      has_path_slot = false;
+};
+
 }
@@ -0,0 +1,62 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+#include <engine/entity/entity_types.h>
+
+#include <limits> // std::numeric_limits
+#include <vector>
+
+namespace nc
+{
+
+class Buffer;
+
+// Storage of all entities of a single type.
+// The entities are kept densely packed so iterating them is fast. The index
+// of an ID points into a table of slots which knows where the entity lives
+// right now. Slots of destroyed entities are reused, but each reuse bumps the
+// generation of the slot so the old IDs no longer resolve. A slot whose
+// generation would wrap around is retired instead, an old ID must never
+// resolve to a new entity.
+// There are no virtuals, the registry always knows the concrete type of the
+// pool it works with.
+template<typename T>
+struct EntityPool
+{
+  using Type = T;
+
+  static constexpr u32 FREE_SLOT      = std::numeric_limits<u32>::max();
+  static constexpr u16 MAX_GENERATION = std::numeric_limits<u16>::max();
+
+  struct Slot
+  {
+    u32 dense_idx  = FREE_SLOT; // index into "entities"
+    u16 generation = 0;
+    u8  moved      = 0;         // waits for the registry to flush the moves
+    u8  _padding   = 0;
+  };
+
+  std::vector<T>    entities;
+  std::vector<Slot> slots;
+  std::vector<u32>  free_slots;
+
+  // Returns nullptr if the entity does not exist or is already destroyed
+  T*   get(EntityID id);
+  void destroy(EntityID id);
+
+  // Fills in the index and generation of the ID
+  T*   create(EntityID& id_out);
+
+  // Returns true if the entity exists and was not marked already
+  bool mark_moved(EntityID id);
+
+  // Clears the mark and returns the entity, nullptr if it does not exist
+  T*   take_moved(EntityID id);
+
+  void serialize(Buffer& buffer);
+};
+
+}
+
+#include <engine/entity/entity_pool.inl>
@@ -0,0 +1,155 @@
+// Project Nuclidean Source File
+
+#include <common.h>
+#include <buffer.h>
+
+#include <engine/entity/entity_type_definitions.h>
+
+#include <algorithm> // std::swap
+
+namespace nc
+{
+
+//==============================================================================
+template<typename T>
+T* EntityPool<T>::get(EntityID id)
+{
+  if (id.idx < this->slots.size())
+  {
+    const Slot& slot = this->slots[id.idx];
+    if (slot.generation == id.generation && slot.dense_idx != FREE_SLOT)
+    {
+      return &this->entities[slot.dense_idx];
+    }
+  }
+
+  return nullptr; // Does not exist or is already destroyed
+}
+
+//==============================================================================
+template<typename T>
+void EntityPool<T>::destroy(EntityID id)
+{
+  if (!this->get(id))
+  {
+    return;
+  }
+
+  Slot& slot   = this->slots[id.idx];
+  u32   my_idx = slot.dense_idx;
+
+  // Swap with the last one if we are not the last one
+  if (my_idx + 1 != this->entities.size())
+  {
+    u32 last_slot = this->entities.back().get_id().idx;
+    nc_assert(this->slots[last_slot].dense_idx + 1 == this->entities.size());
+    this->slots[last_slot].dense_idx = my_idx;
+    std::swap(this->entities[my_idx], this->entities.back());
+  }
+
+  // Pop the last one
+  this->entities.pop_back();
+
+  // And free the slot, the old IDs are not valid anymore
+  slot.dense_idx = FREE_SLOT;
+  slot.moved     = 0;
+
+  // Never reuse the slot again if the generation would wrap around, it costs
+  // only the few bytes of the slot
+  if (slot.generation == MAX_GENERATION)
+  {
+    return;
+  }
+
+  slot.generation += 1;
+  this->free_slots.push_back(id.idx);
+}
+
+//==============================================================================
+template<typename T>
+T* EntityPool<T>::create(EntityID& id_out)
+{
+  u32 slot_idx;
+  if (!this->free_slots.empty())
+  {
+    slot_idx = this->free_slots.back();
+    this->free_slots.pop_back();
+  }
+  else
+  {
+    slot_idx = cast<u32>(this->slots.size());
+    this->slots.emplace_back();
+  }
+
+  Slot& slot = this->slots[slot_idx];
+  slot.dense_idx = cast<u32>(this->entities.size());
+
+  id_out.idx        = slot_idx;
+  id_out.generation = slot.generation;
+  return &this->entities.emplace_back();
+}
+
+//==============================================================================
+template<typename T>
+bool EntityPool<T>::mark_moved(EntityID id)
+{
+  if (!this->get(id))
+  {
+    return false;
+  }
+
+  u8& moved = this->slots[id.idx].moved;
+  if (moved)
+  {
+    return false;
+  }
+
+  moved = 1;
+  return true;
+}
+
+//==============================================================================
+template<typename T>
+T* EntityPool<T>::take_moved(EntityID id)
+{
+  T* entity = this->get(id);
+  if (entity)
+  {
+    this->slots[id.idx].moved = 0;
+  }
+
+  return entity;
+}
+
+//==============================================================================
+template<typename T>
+void EntityPool<T>::serialize(Buffer& buffer)
+{
+  if (!(T::get_static_flags() & EntityStaticFlags::save_load))
+  {
+    // No serialization for this type
+    return;
+  }
+
+  // The slots have to be stored as well, otherwise the generations (and
+  // the IDs stored in the entities) would not match after loading
+  u32 slot_cnt = cast<u32>(this->slots.size());
+  u32 free_cnt = cast<u32>(this->free_slots.size());
+  u32 cnt      = cast<u32>(this->entities.size());
+  buffer.serialize<u32>(slot_cnt);
+  buffer.serialize<u32>(free_cnt);
+  buffer.serialize<u32>(cnt);
+
+  if (buffer.is_deserializing())
+  {
+    this->slots.resize(slot_cnt);
+    this->free_slots.resize(free_cnt);
+    this->entities.resize(cnt);
+  }
+
+  buffer.serialize_array<Slot>(this->slots.data(), slot_cnt);
+  buffer.serialize_array<u32>(this->free_slots.data(), free_cnt);
+  buffer.serialize_array<T>(this->entities.data(), cnt);
+}
+
+}
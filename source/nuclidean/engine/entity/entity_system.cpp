@@ -8,314 +8,537 @@
 #include <engine/entity/entity.h>
 #include <engine/entity/entity_system_listener.h>
 
-#include <engine/graphics/entities/sky_box.h>
-#include <engine/graphics/entities/lights.h>
-#include <engine/graphics/entities/prop.h>
-#include <engine/enemies/enemy.h>
-#include <engine/player/player.h>
-#include <engine/sound/sound_emitter.h>
-#include <game/item.h>
-#include <game/particle.h>
-#include <game/projectile.h>
-#include <game/teleport.h>
-
 #include <buffer.h>
 
+#include <algorithm>     // std::find
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+#if NC_BENCHMARK
+#include <benchmark/benchmark.h>
 #include <unordered_map>
-#include <algorithm>     // std::swap
+#endif
 
 namespace nc
 {
 
 //==============================================================================
-template<typename EntityType>
-struct EntityPool : IEntityPool
+EntityRegistry::EntityRegistry()
+  : m_pools(std::make_unique<EntityPools>())
 {
-  std::unordered_map<u32, u32> id_to_idx;
-  std::vector<EntityType>      entities;
-  u32                          next_id = 0; // have to serialize this as well
-
-  virtual Entity* get(EntityID id)     override;
-  virtual Entity* get_first()          override;
-  virtual void    destroy(EntityID id) override;
-  virtual Entity* create(u32& idx_out) override;
-  virtual u64     get_cnt()      const override;
-  virtual u64     get_stride()   const override;
+}
 
-  virtual void serialize(Buffer& buffer) override;
-};
+//==============================================================================
+EntityRegistry::~EntityRegistry() = default;
 
 //==============================================================================
-template<typename EntityType>
-Entity* EntityPool<EntityType>::get(EntityID id)
+void EntityRegistry::destroy_entity(EntityID id)
 {
-  if (auto it = this->id_to_idx.find(id.idx); it != this->id_to_idx.end())
+  nc_assert(id.type < EntityTypes::count);
+
+  auto beg = m_pending_for_destruction.begin();
+  auto end = m_pending_for_destruction.end();
+
+  if (std::find(beg, end, id) == end)
   {
-    return &this->entities[it->second];
-  }
+    m_pending_for_destruction.push_back(id);
 
-  return nullptr; // Does not exist
+    for (IEntityListener* listener : m_listeners)
+    {
+      listener->on_entity_garbaged(id);
+    }
+  }
 }
 
 //==============================================================================
-template<typename EntityType>
-Entity* EntityPool<EntityType>::get_first()
+void EntityRegistry::cleanup()
 {
-  if (entities.size())
+  // The listeners have to know where the entities ended up before they die
+  this->flush_moves();
+
+  for (auto to_destroy : m_pending_for_destruction)
   {
-    return entities.data();
+    this->destroy_entity_internal(to_destroy);
   }
 
-  return nullptr;
+  m_pending_for_destruction.clear();
 }
 
 //==============================================================================
-template<typename EntityType>
-u64 EntityPool<EntityType>::get_cnt() const
+void EntityRegistry::add_listener(IEntityListener* listener)
 {
-  return entities.size();
+  nc_assert(std::find(m_listeners.begin(), m_listeners.end(), listener) == m_listeners.end());
+  m_listeners.push_back(listener);
 }
 
 //==============================================================================
-template<typename EntityType>
-u64 EntityPool<EntityType>::get_stride() const
+void EntityRegistry::remove_listener(IEntityListener* listener)
 {
-  return sizeof(EntityType);
+  u64 num_erased = std::erase(m_listeners, listener);
+  nc_assert(num_erased == 1);
 }
 
 //==============================================================================
-template<typename EntityType>
-void EntityPool<EntityType>::destroy(EntityID id)
+void EntityRegistry::on_entity_move_internal(EntityID id)
 {
-  auto it = this->id_to_idx.find(id.idx);
-  if (it == this->id_to_idx.end())
+  // Moving the same entity more times before the flush is reported only once
+  bool first_move = false;
+  this->visit_pool(id.type, [&](auto& pool)
   {
-    return;
-  }
+    first_move = pool.mark_moved(id);
+  });
 
-  // Swap with the last one if the size is more than 1
-  if (this->entities.size() > 1)
+  if (first_move)
   {
-    u32 my_idx  = it->second;
-    u32 last_id = this->entities.back().get_id().idx;
-    nc_assert(this->id_to_idx.contains(last_id));
-    this->id_to_idx[last_id] = my_idx;
-    std::swap(this->entities[my_idx], this->entities.back());
+    m_moved_entities.push_back(id);
   }
-
-  // Pop the last one
-  this->entities.pop_back();
-  this->id_to_idx.erase(id.idx);
 }
 
 //==============================================================================
-template<typename EntityType>
-Entity* EntityPool<EntityType>::create(u32& idx_out)
+void EntityRegistry::flush_moves()
 {
-  u32 id = this->next_id++;
-  idx_out = id;
-  id_to_idx[id] = cast<u32>(this->entities.size());
-  return &this->entities.emplace_back();
-}
-
-//==============================================================================
-template<typename EntityType>
-void EntityPool<EntityType>::serialize(Buffer& buffer)
-{
-  if (!(EntityType::get_static_flags() & EntityStaticFlags::save_load))
+  while (!m_moved_entities.empty())
   {
-    // No serialization for this type
-    return;
-  }
+    m_move_batch.clear();
 
-  buffer.serialize<u32>(this->next_id);
+    for (EntityID id : m_moved_entities)
+    {
+      const Entity* entity = nullptr;
+      this->visit_pool(id.type, [&](auto& pool)
+      {
+        entity = pool.take_moved(id);
+      });
+
+      if (entity)
+      {
+        m_move_batch.push_back(EntityMove
+        {
+          .id       = id,
+          .position = entity->get_position(),
+          .radius   = entity->get_radius(),
+          .height   = entity->get_height(),
+        });
+      }
+    }
 
-  u32 cnt = cast<u32>(this->entities.size());
-  buffer.serialize<u32>(cnt);
+    // The listeners might move other entities, those end up in the next batch
+    m_moved_entities.clear();
 
-  if (buffer.is_deserializing())
-  {
-    this->entities.resize(cnt);
+    for (IEntityListener* listener : m_listeners)
+    {
+      listener->on_entities_moved(m_move_batch);
+    }
   }
+}
 
-  buffer.serialize_array<EntityType>(this->entities.data(), cnt);
+//==============================================================================
+void EntityRegistry::serialize(Buffer& buffer)
+{
+  nc_assert(m_pending_for_destruction.empty());
 
   if (buffer.is_deserializing())
   {
-    // Fill the hash-table on deserialization
-    this->id_to_idx.clear();      // First remove the old garbage
-    this->id_to_idx.reserve(cnt); // Then reserve a new space
-    for (u32 i = 0; i < cast<u32>(this->entities.size()); ++i)
-    {
-      // And the connect them
-      this->id_to_idx[this->entities[i].get_id().idx] = i;
-    }
+    // The moves were done on the entities that are about to be replaced
+    m_moved_entities.clear();
+  }
+  else if (!buffer.is_hashing())
+  {
+    // Do not save the move marks. Hashing must not change the state, so it
+    // hashes the marks as they are.
+    this->flush_moves();
   }
+
+  std::apply([&](auto&...pools)
+  {
+    (pools.serialize(buffer), ...);
+  }, m_pools->pools);
 }
 
 //==============================================================================
-#define ENTITY_TYPES(xx) \
-  xx(SkyBox)             \
-  xx(PointLight)         \
-  xx(DirectionalLight)   \
-  xx(AmbientLight)       \
-  xx(Prop)               \
-  xx(Enemy)              \
-  xx(Player)             \
-  xx(SoundEmitter)       \
-  xx(Pickup)             \
-  xx(Particle)           \
-  xx(Projectile)         \
-  xx(Teleport)
+void EntityRegistry::setup_entity(Entity& entity, EntityID id)
+{
+  entity.m_id_and_type = id;
+}
 
 //==============================================================================
-consteval u64 get_entity_type_count()
+void EntityRegistry::post_init_entity(Entity& entity)
 {
-  u32 type_counter = 0;
-  #define COUNT_TYPE(_type) type_counter += 1;
-  ENTITY_TYPES(COUNT_TYPE);
-  return type_counter;
+  for (IEntityListener* listener : m_listeners)
+  {
+    listener->on_entity_create
+    (
+      entity.get_id(),
+      entity.get_position(),
+      entity.get_radius(),
+      entity.get_height()
+    );
+  }
 }
 
 //==============================================================================
-EntityRegistry::EntityRegistry()
+void EntityRegistry::destroy_entity_internal(EntityID id)
 {
-  // I know this is stupid, but it was the simples option with the least amount of
-  // code required.
-  m_pools.resize(EntityTypes::count);
-
-  #define REGISTER_TYPE(_type) \
-    m_pools[_type :: get_type_static()] = std::make_unique<EntityPool<_type>>();
+  this->visit_pool(id.type, [&](auto& pool)
+  {
+    if (pool.get(id))
+    {
+      for (IEntityListener* listener : m_listeners)
+      {
+        listener->on_entity_destroy(id);
+      }
 
-  ENTITY_TYPES(REGISTER_TYPE);
-  static_assert(get_entity_type_count() == EntityTypes::count,
-    "You probably forgot to add the new type into the ENTITY_TYPES x-macro.");
+      // destroys the entity
+      pool.destroy(id);
+    }
+  });
 }
 
 //==============================================================================
-EntityRegistry::~EntityRegistry() = default;
-
-//==============================================================================
-void EntityRegistry::destroy_entity(EntityID id)
+#if NC_TESTS
+static bool entity_system_test_generations(unit_test::TestCtx& /*ctx*/)
 {
-  nc_assert(id.type < EntityTypes::count);
+  EntityRegistry registry;
 
-  auto beg = m_pending_for_destruction.begin();
-  auto end = m_pending_for_destruction.end();
+  auto create_particle = [&]()
+  {
+    return registry.create_entity<Particle>(VEC3_ZERO, 1.0f, colors::BLACK, 0.0f)->get_id();
+  };
 
-  if (std::find(beg, end, id) == end)
+  const EntityID first  = create_particle();
+  const EntityID second = create_particle();
+  const EntityID third  = create_particle();
+
+  registry.destroy_entity(second);
+  registry.cleanup();
+
+  if (registry.get_entity(second) != nullptr)
   {
-    m_pending_for_destruction.push_back(id);
+    nc_warn("A destroyed entity can still be found.");
+    NC_TEST_FAIL;
+  }
 
-    for (IEntityListener* listener : m_listeners)
+  // The slot is reused, but the old ID must not point to the new entity
+  const EntityID fourth = create_particle();
+  if (fourth.idx != second.idx || fourth.generation == second.generation)
+  {
+    nc_warn("The slot of the destroyed entity was not reused with a new generation.");
+    NC_TEST_FAIL;
+  }
+
+  if (registry.get_entity(second) != nullptr)
+  {
+    nc_warn("A stale ID resolves to the entity created in its slot.");
+    NC_TEST_FAIL;
+  }
+
+  // The ones moved around by the destruction are still found
+  for (EntityID id : {first, third, fourth})
+  {
+    const Entity* entity = registry.get_entity(id);
+    if (!entity || entity->get_id() != id)
     {
-      listener->on_entity_garbaged(id);
+      nc_warn("Entity [{}] is not found after another one was destroyed.", id.idx);
+      NC_TEST_FAIL;
     }
   }
-}
 
-//==============================================================================
-void EntityRegistry::cleanup()
-{
-  for (auto to_destroy : m_pending_for_destruction)
+  u32 cnt = 0;
+  registry.for_each<Particle>([&](Particle&) { cnt += 1; });
+  if (cnt != 3)
   {
-    this->destroy_entity_internal(to_destroy);
+    nc_warn("Iterated over {} particles instead of 3.", cnt);
+    NC_TEST_FAIL;
   }
 
-  m_pending_for_destruction.clear();
+  // Churn one slot until its generation saturates, then it must be retired
+  EntityID churned = fourth;
+  while (churned.generation != EntityPool<Particle>::MAX_GENERATION)
+  {
+    registry.destroy_entity(churned);
+    registry.cleanup();
+    churned = create_particle();
+
+    if (churned.idx != fourth.idx)
+    {
+      nc_warn("The slot was not reused before its generation saturated.");
+      NC_TEST_FAIL;
+    }
+  }
+
+  registry.destroy_entity(churned);
+  registry.cleanup();
+
+  const EntityID after_saturation = create_particle();
+  if (after_saturation.idx == churned.idx || registry.get_entity(second) != nullptr)
+  {
+    nc_warn("A slot with a saturated generation was reused.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
 }
+NC_UNIT_TEST(entity_system_test_generations)->name("Entity Pool Generations");
 
 //==============================================================================
-void EntityRegistry::add_listener(IEntityListener* listener)
+static bool entity_system_test_move_batch(unit_test::TestCtx& /*ctx*/)
 {
-  nc_assert(std::find(m_listeners.begin(), m_listeners.end(), listener) == m_listeners.end());
-  m_listeners.push_back(listener);
+  struct MoveRecorder : IEntityListener
+  {
+    virtual void on_entities_moved(std::span<const EntityMove> moves) override
+    {
+      batches.push_back(std::vector<EntityMove>(moves.begin(), moves.end()));
+    }
+
+    virtual void on_entity_garbaged(EntityID)                 override {}
+    virtual void on_entity_destroy(EntityID)                  override {}
+    virtual void on_entity_create(EntityID, vec3, f32, f32)   override {}
+
+    std::vector<std::vector<EntityMove>> batches;
+  };
+
+  EntityRegistry registry;
+  MoveRecorder   recorder;
+  registry.add_listener(&recorder);
+
+  const vec3     position = vec3{1.0f, 2.0f, 3.0f};
+  const EntityID first    = registry.create_entity<Particle>(position, 1.0f, colors::BLACK, 0.0f)->get_id();
+  const EntityID second   = registry.create_entity<Particle>(position, 1.0f, colors::BLACK, 0.0f)->get_id();
+
+  // Moving more times before the sync point is reported once
+  registry.on_entity_move_internal(second);
+  registry.on_entity_move_internal(first);
+  registry.on_entity_move_internal(second);
+  registry.flush_moves();
+
+  if (recorder.batches.size() != 1 || recorder.batches[0].size() != 2
+   || recorder.batches[0][0].id != second || recorder.batches[0][1].id != first
+   || recorder.batches[0][0].position != position)
+  {
+    nc_warn("The moves were not batched as expected.");
+    NC_TEST_FAIL;
+  }
+
+  // Nothing moved since
+  registry.flush_moves();
+  if (recorder.batches.size() != 1)
+  {
+    nc_warn("The moves were reported twice.");
+    NC_TEST_FAIL;
+  }
+
+  // The cleanup flushes the last move before the entity dies
+  registry.on_entity_move_internal(first);
+  registry.destroy_entity(first);
+  registry.cleanup();
+  if (recorder.batches.size() != 2 || recorder.batches[1].size() != 1)
+  {
+    nc_warn("The move before the destruction was not flushed.");
+    NC_TEST_FAIL;
+  }
+
+  registry.remove_listener(&recorder);
+  NC_TEST_SUCCESS;
 }
+NC_UNIT_TEST(entity_system_test_move_batch)->name("Entity Move Batching");
+#endif
 
+#if NC_BENCHMARK
 //==============================================================================
-void EntityRegistry::remove_listener(IEntityListener* listener)
-{
-  u64 num_erased = std::erase(m_listeners, listener);
-  nc_assert(num_erased == 1);
-}
+// Particles and projectiles come and go all the time, there might be a lot of
+// them in a fight.
+constexpr u32 BENCHMARK_ENTITY_CNT = 10'000;
 
 //==============================================================================
-void EntityRegistry::on_entity_move_internal(EntityID id, vec3 pos, f32 r, f32 h)
+static std::vector<EntityID> create_benchmark_particles(EntityRegistry& registry)
 {
-  for (IEntityListener* listener : m_listeners)
+  std::vector<EntityID> ids;
+  ids.reserve(BENCHMARK_ENTITY_CNT);
+
+  for (u32 i = 0; i < BENCHMARK_ENTITY_CNT; ++i)
   {
-    listener->on_entity_move(id, pos, r, h);
+    ids.push_back
+    (
+      registry.create_entity<Particle>(VEC3_ZERO, 1.0f, colors::BLACK, 0.0f)->get_id()
+    );
   }
+
+  return ids;
 }
 
 //==============================================================================
-void EntityRegistry::serialize(Buffer& buffer)
+static void benchmark_entity_pool_get(benchmark::State& state)
 {
-  nc_assert(m_pending_for_destruction.empty());
+  EntityRegistry registry;
+  const std::vector<EntityID> ids = create_benchmark_particles(registry);
 
-  for (auto& pool : m_pools)
+  for (auto _ : state)
   {
-    pool->serialize(buffer);
+    for (EntityID id : ids)
+    {
+      benchmark::DoNotOptimize(registry.get_entity(id));
+    }
   }
+
+  state.SetItemsProcessed(state.iterations() * ids.size());
 }
+BENCHMARK(benchmark_entity_pool_get)->Unit(benchmark::kMicrosecond);
 
 //==============================================================================
-void EntityRegistry::setup_entity(Entity& entity, EntityID id)
+// Destroys every fourth entity and creates the same amount again
+static void benchmark_entity_pool_churn(benchmark::State& state)
 {
-  entity.m_id_and_type = id;
+  EntityRegistry registry;
+  std::vector<EntityID> ids = create_benchmark_particles(registry);
+
+  for (auto _ : state)
+  {
+    for (u32 i = 0; i < ids.size(); i += 4)
+    {
+      registry.destroy_entity(ids[i]);
+    }
+
+    registry.cleanup();
+
+    for (u32 i = 0; i < ids.size(); i += 4)
+    {
+      ids[i] = registry.create_entity<Particle>(VEC3_ZERO, 1.0f, colors::BLACK, 0.0f)->get_id();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * ids.size() / 4);
 }
+BENCHMARK(benchmark_entity_pool_churn)->Unit(benchmark::kMicrosecond);
 
 //==============================================================================
-void EntityRegistry::post_init_entity(Entity& entity)
+// Stands in for a particle so the pools can be measured without the registry
+struct BenchmarkEntity
 {
-  for (IEntityListener* listener : m_listeners)
+  EntityID id = INVALID_ENTITY_ID;
+  byte     data[sizeof(Particle) - sizeof(EntityID)]{};
+
+  EntityID get_id() const
   {
-    listener->on_entity_create
-    (
-      entity.get_id(),
-      entity.get_position(),
-      entity.get_radius(),
-      entity.get_height()
-    );
+    return id;
   }
-}
+};
 
 //==============================================================================
-void EntityRegistry::destroy_entity_internal(EntityID id)
+// The pool as it was before the slot table, kept as a baseline. The index of
+// an ID is a key into a hash map of the dense indices and it is never reused.
+template<typename T>
+struct HashMapEntityPool
 {
-  nc_assert(id.type < EntityTypes::count);
+  std::unordered_map<u32, u32> id_to_idx;
+  std::vector<T>               entities;
+  u32                          next_id = 0;
 
-  IEntityPool* pool = m_pools[id.type].get();
-  if (pool->get(id))
+  //============================================================================
+  T* get(EntityID id)
   {
-    for (IEntityListener* listener : m_listeners)
+    if (auto it = this->id_to_idx.find(id.idx); it != this->id_to_idx.end())
+    {
+      return &this->entities[it->second];
+    }
+
+    return nullptr;
+  }
+
+  //============================================================================
+  void destroy(EntityID id)
+  {
+    auto it = this->id_to_idx.find(id.idx);
+    if (it == this->id_to_idx.end())
     {
-      listener->on_entity_destroy(id);
+      return;
     }
 
-    // destroys the entity
-    pool->destroy(id);
+    if (this->entities.size() > 1)
+    {
+      u32 my_idx  = it->second;
+      u32 last_id = this->entities.back().get_id().idx;
+      this->id_to_idx[last_id] = my_idx;
+      std::swap(this->entities[my_idx], this->entities.back());
+    }
+
+    this->entities.pop_back();
+    this->id_to_idx.erase(id.idx);
   }
+
+  //============================================================================
+  T* create(EntityID& id_out)
+  {
+    id_out.idx = this->next_id++;
+    id_to_idx[id_out.idx] = cast<u32>(this->entities.size());
+    return &this->entities.emplace_back();
+  }
+};
+
+//==============================================================================
+template<typename Pool>
+static EntityID create_benchmark_entity(Pool& pool)
+{
+  EntityID id = INVALID_ENTITY_ID;
+  pool.create(id)->id = id;
+  return id;
 }
 
 //==============================================================================
-Entity* EntityRegistry::get_entity(EntityID id)
+// Same as "benchmark_entity_pool_get", but on the pool alone
+template<typename Pool>
+static void benchmark_entity_pool_raw_get(benchmark::State& state)
 {
-  if (id == INVALID_ENTITY_ID)
+  Pool pool;
+  std::vector<EntityID> ids;
+  for (u32 i = 0; i < BENCHMARK_ENTITY_CNT; ++i)
   {
-    return nullptr;
+    ids.push_back(create_benchmark_entity(pool));
   }
 
-  nc_assert(id.type < EntityTypes::count);
+  for (auto _ : state)
+  {
+    for (EntityID id : ids)
+    {
+      benchmark::DoNotOptimize(pool.get(id));
+    }
+  }
 
-  IEntityPool* pool = m_pools[id.type].get();
-  return pool->get(id);
+  state.SetItemsProcessed(state.iterations() * ids.size());
 }
+BENCHMARK_TEMPLATE(benchmark_entity_pool_raw_get, EntityPool<BenchmarkEntity>)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_entity_pool_raw_get, HashMapEntityPool<BenchmarkEntity>)->Unit(benchmark::kMicrosecond);
 
 //==============================================================================
-const Entity* EntityRegistry::get_entity(EntityID id) const
+// Same as "benchmark_entity_pool_churn", but on the pool alone
+template<typename Pool>
+static void benchmark_entity_pool_raw_churn(benchmark::State& state)
 {
-  return const_cast<EntityRegistry*>(this)->get_entity(id);
+  Pool pool;
+  std::vector<EntityID> ids;
+  for (u32 i = 0; i < BENCHMARK_ENTITY_CNT; ++i)
+  {
+    ids.push_back(create_benchmark_entity(pool));
+  }
+
+  for (auto _ : state)
+  {
+    for (u32 i = 0; i < ids.size(); i += 4)
+    {
+      pool.destroy(ids[i]);
+    }
+
+    for (u32 i = 0; i < ids.size(); i += 4)
+    {
+      ids[i] = create_benchmark_entity(pool);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * ids.size() / 4);
 }
+BENCHMARK_TEMPLATE(benchmark_entity_pool_raw_churn, EntityPool<BenchmarkEntity>)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_entity_pool_raw_churn, HashMapEntityPool<BenchmarkEntity>)->Unit(benchmark::kMicrosecond);
+#endif
 
 }
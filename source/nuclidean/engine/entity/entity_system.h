@@ -1,6 +1,8 @@
 // Project Nuclidean Source File
 #pragma once
 #include <engine/entity/entity.h>
+#include <engine/entity/entity_pool.h>
+#include <engine/entity/entity_system_listener.h> // EntityMove
 
 #include <math/vector.h> // vec3
 
@@ -16,28 +18,12 @@ class  Entity;
 struct SectorMapping;
 struct IEntityListener;
 class  Buffer;
+struct EntityPools;
 }
 
 namespace nc
 {
 
-// We can get rid of the virtuals if we ever have problem with them and
-// rewrite it with just function pointers... Not worth it now tho.
-struct IEntityPool
-{
-  // Non virtual because called often
-  virtual Entity* get(EntityID id)     = 0;
-  virtual Entity* get_first()          = 0;
-  virtual u64     get_cnt()      const = 0;
-  virtual u64     get_stride()   const = 0;
-  virtual void    destroy(EntityID id) = 0;
-  virtual Entity* create(u32& idx_out) = 0;
-
-  virtual void serialize(Buffer& buffer) = 0;
-
-  virtual ~IEntityPool() = default;
-};
-
 class EntityRegistry
 {
 public:
@@ -60,23 +46,30 @@ public:
   // of a frame
   void destroy_entity(EntityID id);
 
-  // The signature of the lambda has to be "void(Entity&)"
+  // The lambda gets the concrete type of the entity, so its signature can be
+  // either "void(Entity&)" or "void(auto&)"
   template<typename L>
   void for_each(EntityTypeMask types, L lambda);
 
   template<typename T, typename L>
   void for_each(L lambda);
 
-  // Cleans up entities pending for destruction
+  // Flushes the moves and cleans up entities pending for destruction
   void cleanup();
 
   // Manipulate the listeners
   void add_listener(IEntityListener* listener);
   void remove_listener(IEntityListener* listener);
 
-  // Called from the entities themselves when moving or rescaling.
+  // Called from the entities themselves when moving or rescaling. Only marks
+  // the entity as moved, the listeners learn about it in "flush_moves".
   // Do not call on your own or stuff will break.
-  void on_entity_move_internal(EntityID id, vec3 pos, f32 r, f32 h);
+  void on_entity_move_internal(EntityID id);
+
+  // Sync point. Sends the entities moved since the last flush to the listeners
+  // in one batch. Entities moved by the listeners themselves (e.g. attached
+  // ones) are sent in another batch during the same flush.
+  void flush_moves();
 
   // (De)serialization. Performs serialization if "serialize" is true, otherwise
   // does deserialization.
@@ -89,14 +82,27 @@ private:
 
   void destroy_entity_internal(EntityID id);
 
+  template<typename T>
+  EntityPool<T>& get_pool();
+
+  // Calls the visitor with the pool of the given type. The signature of the
+  // visitor has to be "void(auto& pool)".
+  template<typename F>
+  void visit_pool(EntityType type, F&& visitor);
+
 private:
-  using Pools     = std::vector<std::unique_ptr<IEntityPool>>;
   using IDList    = std::vector<EntityID>;
   using Listeners = std::vector<IEntityListener*>;
+  using Moves     = std::vector<EntityMove>;
+
+  // Only forward declared here, the pools of all entity types come with the
+  // entity_system.inl
+  std::unique_ptr<EntityPools> m_pools;
 
-  Listeners m_listeners;
-  Pools     m_pools;
-  IDList    m_pending_for_destruction;
+  Listeners   m_listeners;
+  IDList      m_pending_for_destruction;
+  IDList      m_moved_entities; // in the order they moved first
+  Moves       m_move_batch;     // reused between the flushes
 };
 
 }
@@ -2,6 +2,11 @@
 
 #include <common.h>
 
+#include <engine/entity/entity_type_list.h> // EntityPools
+#include <engine/entity/entity_type_definitions.h>
+
+#include <utility> // std::index_sequence
+
 namespace nc
 {
 
@@ -10,57 +15,73 @@ template<typename T>
 T* EntityRegistry::get_entity(EntityID id)
 {
   nc_assert(id == INVALID_ENTITY_ID || id.type == T::get_type_static());
-  return static_cast<T*>(this->get_entity(id));
+  return this->get_pool<T>().get(id);
+}
+
+//==============================================================================
+inline Entity* EntityRegistry::get_entity(EntityID id)
+{
+  if (id == INVALID_ENTITY_ID)
+  {
+    return nullptr;
+  }
+
+  Entity* entity = nullptr;
+  this->visit_pool(id.type, [&](auto& pool)
+  {
+    entity = pool.get(id);
+  });
+
+  return entity;
+}
+
+//==============================================================================
+inline const Entity* EntityRegistry::get_entity(EntityID id) const
+{
+  return const_cast<EntityRegistry*>(this)->get_entity(id);
 }
 
 //==============================================================================
 template<typename L>
 void EntityRegistry::for_each(EntityTypeMask types, L lambda)
 {
-  // iterate all pools
-  for (EntityType t = 0; t < m_pools.size(); ++t)
+  // The index of the pool is its type, so the check of the mask is a constant
+  // per pool and the lambda gets the concrete type of the entity
+  [&]<u64...I>(std::index_sequence<I...>)
   {
-    // and check if the pool stores the type we are interested in
-    if (types & (1_u64 << t))
+    auto for_each_in_pool = [&]<typename T>(EntityPool<T>& pool, EntityType type)
     {
-      // if so then iterate all entities
-      IEntityPool* pool = m_pools[t].get();
-      nc_assert(pool);
-
-      u64   cnt    = pool->get_cnt();
-      u64   stride = pool->get_stride();
-      byte* ptr    = recast<byte*>(pool->get_first());
-
-      // iterate all entities within the pool
-      for (u64 i = 0; i < cnt; ++i)
+      if (types & entity_type_to_mask(type))
       {
-        Entity* entity = recast<Entity*>(&ptr[i * stride]);
-        lambda(*entity);
+        for (T& entity : pool.entities)
+        {
+          lambda(entity);
+        }
       }
-    }
-  }
+    };
+
+    (for_each_in_pool(std::get<I>(m_pools->pools), cast<EntityType>(I)), ...);
+  }(std::make_index_sequence<EntityTypes::count>{});
 }
 
 //==============================================================================
 template<typename T, typename L>
 void EntityRegistry::for_each(L lambda)
 {
-  this->for_each(entity_type_to_mask(T::get_type_static()), [&](Entity& entity)
+  for (T& entity : this->get_pool<T>().entities)
   {
-    lambda(*static_cast<T*>(&entity));
-  });
+    lambda(entity);
+  }
 }
 
 //==============================================================================
 template<typename T, typename...Args>
 T* EntityRegistry::create_entity(Args&&...args)
 {
-  nc_assert(T::get_type_static() < m_pools.size());
-
   EntityID id;
   id.type = T::get_type_static();
 
-  Entity* entity = m_pools[T::get_type_static()]->create(id.idx);
+  Entity* entity = this->get_pool<T>().create(id);
 
   // Setup ID
   nc_assert(entity);
@@ -80,4 +101,25 @@ T* EntityRegistry::create_entity(Args&&...args)
   return entity_typed;
 }
 
+//==============================================================================
+template<typename T>
+EntityPool<T>& EntityRegistry::get_pool()
+{
+  return std::get<EntityPool<T>>(m_pools->pools);
+}
+
+//==============================================================================
+template<typename F>
+void EntityRegistry::visit_pool(EntityType type, F&& visitor)
+{
+  nc_assert(type < EntityTypes::count);
+
+  // The pools are in the same order as the types, so the index of the pool is
+  // the type. Compiles down to a switch.
+  [&]<u64...I>(std::index_sequence<I...>)
+  {
+    ((type == I ? (visitor(std::get<I>(m_pools->pools)), true) : false) || ...);
+  }(std::make_index_sequence<EntityTypes::count>{});
+}
+
 }
@@ -5,15 +5,28 @@
 #include <math/vector.h>
 #include <engine/entity/entity_types.h>
 
+#include <span>
+
 namespace nc
 {
 
+// Where the entity is after it moved or its radius/height changed
+struct EntityMove
+{
+  EntityID id;
+  vec3     position;
+  f32      radius;
+  f32      height;
+};
+
 struct IEntityListener
 {
   virtual ~IEntityListener() {};
 
-  // Called when an entity moves or it's height/radius are changed.
-  virtual void on_entity_move(EntityID id, vec3 pos, f32 r, f32 h) = 0;
+  // Called with all entities that moved or had their height/radius changed
+  // since the last sync point. Each entity is there only once, with its
+  // latest position. See "EntityRegistry::flush_moves".
+  virtual void on_entities_moved(std::span<const EntityMove> moves) = 0;
 
   // Called just after the entity is marked as garbage. The entity is still
   // alive and can be accessed.
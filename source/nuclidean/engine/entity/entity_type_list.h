@@ -0,0 +1,78 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <engine/entity/entity_pool.h>
+#include <engine/entity/entity_type_definitions.h>
+
+#include <engine/graphics/entities/sky_box.h>
+#include <engine/graphics/entities/lights.h>
+#include <engine/graphics/entities/prop.h>
+#include <engine/enemies/enemy.h>
+#include <engine/player/player.h>
+#include <engine/sound/sound_emitter.h>
+#include <game/item.h>
+#include <game/particle.h>
+#include <game/projectile.h>
+#include <game/teleport.h>
+
+#include <tuple>
+
+// ================================================================
+// All entity types in the same order as "EntityTypes", each     //
+// with its value in "EntityTypes". The registry stores the      //
+// pools of these types in a tuple, so the type of an entity can //
+// be dispatched without virtual calls.                          //
+// This header includes all entity types, include it only in the //
+// translation units that really need the pools.                 //
+// ================================================================
+#define ENTITY_TYPES(xx)                    \
+  xx(Player,           player)              \
+  xx(Enemy,            enemy)               \
+  xx(Pickup,           pickup)              \
+  xx(Projectile,       projectile)          \
+  xx(AmbientLight,     ambient_light)       \
+  xx(DirectionalLight, directional_light)   \
+  xx(PointLight,       point_light)         \
+  xx(Prop,             prop)                \
+  xx(SkyBox,           sky_box)             \
+  xx(Particle,         particle)            \
+  xx(SoundEmitter,     sound_emitter)       \
+  xx(Teleport,         teleport)
+
+namespace nc
+{
+
+#define NC_ENTITY_POOL_TUPLE(_type, _value) std::tuple<EntityPool<_type>>{},
+using EntityPoolTuple = decltype(std::tuple_cat(ENTITY_TYPES(NC_ENTITY_POOL_TUPLE) std::tuple<>{}));
+#undef NC_ENTITY_POOL_TUPLE
+
+static_assert(std::tuple_size_v<EntityPoolTuple> == EntityTypes::count,
+  "You probably forgot to add the new type into the ENTITY_TYPES x-macro.");
+
+#define NC_ENTITY_TYPE_VALUE(_type, _value) EntityTypes::_value,
+constexpr EntityType ENTITY_TYPES_ORDER[] { ENTITY_TYPES(NC_ENTITY_TYPE_VALUE) };
+#undef NC_ENTITY_TYPE_VALUE
+
+// The pools are dispatched by their index in the tuple, which has to be the
+// type of the entities in the pool
+constexpr bool is_entity_types_order_valid()
+{
+  for (EntityType i = 0; i < EntityTypes::count; ++i)
+  {
+    if (ENTITY_TYPES_ORDER[i] != i)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+static_assert(is_entity_types_order_valid(), "ENTITY_TYPES is not in the same order as EntityTypes.");
+
+// A struct and not an alias so the registry can forward declare it
+struct EntityPools
+{
+  EntityPoolTuple pools;
+};
+
+}
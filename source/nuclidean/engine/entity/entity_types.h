@@ -18,7 +18,8 @@ struct EntityID
   constexpr bool operator==(const EntityID& other) const = default;
 
   EntityType type;
-  u32        idx;
+  u16        generation; // bumped each time the slot is reused
+  u32        idx;        // slot in the pool of the type
 
   // Converts to u64 so it can be treated as a normal integer.
   u32 as_u32() const
@@ -33,8 +34,9 @@ static_assert(sizeof(EntityID) == 8);
 
 constexpr EntityID INVALID_ENTITY_ID = EntityID
 {
-  .type = std::numeric_limits<EntityType>().max(),
-  .idx  = std::numeric_limits<u32>().max(),
+  .type       = std::numeric_limits<EntityType>().max(),
+  .generation = std::numeric_limits<u16>().max(),
+  .idx        = std::numeric_limits<u32>().max(),
  };
 
 constexpr EntityTypeMask entity_type_to_mask(EntityType type)
@@ -51,7 +53,9 @@ struct std::hash<nc::EntityID>
 {
   inline std::size_t operator()(const nc::EntityID& id) const
   {
-    return static_cast<nc::u64>(id.type) << 32 | static_cast<nc::u64>(id.idx);
+    return static_cast<nc::u64>(id.generation) << 40
+         | static_cast<nc::u64>(id.type)       << 32
+         | static_cast<nc::u64>(id.idx);
   }
 };
 
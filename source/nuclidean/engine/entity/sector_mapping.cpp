@@ -5,11 +5,17 @@
 #include <engine/map/map_system.h>
 #include <engine/entity/entity_type_definitions.h>
 
-#include <iterator>
+#include <intersect.h>
+#include <stack_vector.h>
+
+#include <algorithm> // std::stable_sort
 
 namespace nc
 {
 
+// Reused between the queries, so we do not allocate on every entity move
+static thread_local SectorSet g_query_sectors;
+
 //==============================================================================
 SectorMapping::SectorMapping(MapSectors& m)
 : map(m)
@@ -26,78 +32,286 @@ void SectorMapping::on_map_rebuild()
 
   sectors_to_entities.entities.resize(map.sectors.size());
   sectors_to_entities.transforms.resize(map.sectors.size());
+  entities_to_sectors.resize(EntityTypes::count);
 }
 
 //==============================================================================
-void SectorMapping::on_entity_move(EntityID id, vec3 pos, f32 r, f32 h)
+const SectorMapping::EntitySectors* SectorMapping::find_entity(EntityID id) const
 {
-  // TODO: dumb implementation - we can track in intersection in which sectors
-  //       the entity should be and add it
-  this->on_entity_destroy(id);
-  this->on_entity_create(id, pos, r, h);
+  if (id.type >= entities_to_sectors.size())
+  {
+    return nullptr;
+  }
+
+  // A stale ID must not find the entity that took over its slot
+  const auto& of_type = entities_to_sectors[id.type];
+  if (id.idx >= of_type.size() || !of_type[id.idx].mapped || of_type[id.idx].generation != id.generation)
+  {
+    return nullptr;
+  }
+
+  return &of_type[id.idx];
 }
 
 //==============================================================================
-void SectorMapping::on_entity_garbaged(EntityID /*id*/)
+SectorMapping::EntitySectors& SectorMapping::get_or_add_entity(EntityID id)
 {
+  if (id.type >= entities_to_sectors.size())
+  {
+    entities_to_sectors.resize(id.type + 1);
+  }
 
+  auto& of_type = entities_to_sectors[id.type];
+  if (id.idx >= of_type.size())
+  {
+    of_type.resize(id.idx + 1);
+  }
+
+  return of_type[id.idx];
 }
 
 //==============================================================================
-void SectorMapping::on_entity_destroy(EntityID id)
+void SectorMapping::add_to_sector
+(
+  EntityID       id,
+  EntitySectors& entity,
+  SectorID       sector,
+  const mat4&    transform
+)
 {
-  auto it = entities_to_sectors.find(id);
-  if (it == entities_to_sectors.end())
+  nc_assert(sector < sectors_to_entities.entities.size());
+
+  auto& entity_list    = sectors_to_entities.entities[sector];
+  auto& transform_list = sectors_to_entities.transforms[sector];
+
+  entity.slots.push_back(SectorSlot{sector, cast<u32>(entity_list.size())});
+  entity_list.push_back(id);
+  transform_list.push_back(transform);
+}
+
+//==============================================================================
+void SectorMapping::remove_from_sector(EntityID id, SectorSlot slot)
+{
+  nc_assert(slot.sector < sectors_to_entities.entities.size());
+
+  auto& entity_list    = sectors_to_entities.entities[slot.sector];
+  auto& transform_list = sectors_to_entities.transforms[slot.sector];
+
+  nc_assert(slot.index < entity_list.size(), "Can't be empty, the entity must be there");
+  nc_assert(entity_list[slot.index] == id);
+
+  const u32 last = cast<u32>(entity_list.size() - 1);
+  if (slot.index != last)
   {
-    // entity was not in the list in the first place
-    return;
+    // Move the last one into the hole and let it know about its new position
+    const EntityID moved = entity_list[last];
+    entity_list[slot.index]    = moved;
+    transform_list[slot.index] = transform_list[last];
+
+    EntitySectors& moved_entity = entities_to_sectors[moved.type][moved.idx];
+
+    [[maybe_unused]]bool fixed = false;
+    for (SectorSlot& moved_slot : moved_entity.slots)
+    {
+      if (moved_slot.sector == slot.sector && moved_slot.index == last)
+      {
+        moved_slot.index = slot.index;
+        fixed = true;
+        break;
+      }
+    }
+
+    nc_assert(fixed, "The moved entity does not know about its own slot");
+  }
+
+  entity_list.pop_back();
+  transform_list.pop_back();
+}
+
+//==============================================================================
+bool SectorMapping::stays_in_its_sector
+(
+  const EntitySectors& entity,
+  vec3                 pos,
+  f32                  r
+)
+const
+{
+  if (entity.slots.size() != 1)
+  {
+    // Overlaps multiple sectors or none, has to be recalculated
+    return false;
+  }
+
+  const SectorID sector_id = entity.slots[0].sector;
+  const vec2     pt        = pos.xz();
+
+  if (!map.is_point_in_sector(pt, sector_id))
+  {
+    return false;
+  }
+
+  // If the circle does not touch any wall then it lies entirely within the
+  // sector and can't overlap any other one.
+  const SectorData& sector = map.sectors[sector_id];
+  for (WallID wid = sector.first_wall; wid < sector.last_wall; ++wid)
+  {
+    const WallID nid = map_helpers::next_wall(map, sector_id, wid);
+    if (dist::point_line_2d(pt, map.walls[wid].pos, map.walls[nid].pos) <= r)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//==============================================================================
+void SectorMapping::on_entities_moved(std::span<const EntityMove> moves)
+{
+  pending_remaps.clear();
+
+  for (const EntityMove& move : moves)
+  {
+    const EntitySectors* found = this->find_entity(move.id);
+    if (!found)
+    {
+      this->on_entity_create(move.id, move.position, move.radius, move.height);
+      continue;
+    }
+
+    if (this->stays_in_its_sector(*found, move.position, move.radius))
+    {
+      // The most common case, the entity moved a bit within a single sector
+      continue;
+    }
+
+    pending_remaps.push_back(move);
   }
 
-  SectorsAndTransforms& sector_list = it->second;
-  for (auto sector_id : sector_list.sectors)
+  // Group the rest by the sector they leave, so the lists of one sector are
+  // updated together. Stable, the order of the entities in the lists has to
+  // be the same every run.
+  auto first_sector = [&](const EntityMove& move)
   {
-    nc_assert(sector_id < sectors_to_entities.entities.size());
+    const EntitySectors& entity = entities_to_sectors[move.id.type][move.id.idx];
+    return entity.slots.empty() ? INVALID_SECTOR_ID : entity.slots[0].sector;
+  };
 
-    auto& transform_list = sectors_to_entities.transforms[sector_id];
-    auto& entity_list    = sectors_to_entities.entities[sector_id];
+  std::stable_sort(pending_remaps.begin(), pending_remaps.end(), [&](const EntityMove& a, const EntityMove& b)
+  {
+    return first_sector(a) < first_sector(b);
+  });
 
-    u64 size = transform_list.size();
-    nc_assert(size, "Can't be empty, the entity must be there");
+  for (const EntityMove& move : pending_remaps)
+  {
+    this->remap_entity(entities_to_sectors[move.id.type][move.id.idx], move);
+  }
+}
 
-    [[maybe_unused]]bool removed_at_least_one = false;
+//==============================================================================
+void SectorMapping::remap_entity(EntitySectors& entity, const EntityMove& move)
+{
+  const EntityID id  = move.id;
+  const vec3     pos = move.position;
+  const f32      r   = move.radius;
 
-    u64 index = size;
-    while (index-->0)
+  SectorSet& sectors = g_query_sectors;
+  sectors.sectors.clear();
+  sectors.transforms.clear();
+
+  if (id.type == EntityTypes::point_light)
+  {
+    map.query_nearby_sectors_for_lights(pos.xz(), r, sectors);
+  }
+  else
+  {
+    map.query_nearby_sectors_short_distance(pos.xz(), r, sectors);
+  }
+
+  // Pair the new sectors with the old slots. The sector might be there more
+  // than once if the entity is half-way in a nuclidean portal.
+  const u64 old_cnt = entity.slots.size();
+  const u64 new_cnt = sectors.sectors.size();
+
+  StackVector<u8, 16> slot_kept; // not bool, we do not want the bit vector
+  StackVector<u8, 16> sector_kept;
+  slot_kept.resize(old_cnt, 0);
+  sector_kept.resize(new_cnt, 0);
+
+  for (u64 i = 0; i < new_cnt; ++i)
+  {
+    for (u64 j = 0; j < old_cnt; ++j)
     {
-      // the sector might contain the entity multiple times if it
-      // is half-way in an nuclidean portal
-      if (entity_list[index] == id)
+      if (!slot_kept[j] && entity.slots[j].sector == sectors.sectors[i])
       {
-        // remove the entity from here
-        auto e_it = std::next(entity_list.begin(),    index);
-        auto t_it = std::next(transform_list.begin(), index);
-        
-        entity_list.erase(e_it);
-        transform_list.erase(t_it);
-
-        removed_at_least_one = true;
+        // Still there, update the transform only
+        const SectorSlot& slot = entity.slots[j];
+        sectors_to_entities.transforms[slot.sector][slot.index] = sectors.transforms[i];
+
+        slot_kept[j]   = 1;
+        sector_kept[i] = 1;
         break;
       }
     }
+  }
+
+  // Remove the sectors we left. Backwards, so the indices of the remaining
+  // slots do not change.
+  for (u64 j = old_cnt; j-->0;)
+  {
+    if (!slot_kept[j])
+    {
+      this->remove_from_sector(id, entity.slots[j]);
+      entity.slots.erase(entity.slots.begin() + j);
+    }
+  }
 
-    // check here
-    nc_assert(removed_at_least_one);
+  // And add the ones we entered
+  for (u64 i = 0; i < new_cnt; ++i)
+  {
+    if (!sector_kept[i])
+    {
+      this->add_to_sector(id, entity, sectors.sectors[i], sectors.transforms[i]);
+    }
   }
+}
+
+//==============================================================================
+void SectorMapping::on_entity_garbaged(EntityID /*id*/)
+{
 
-  entities_to_sectors.erase(it);
+}
+
+//==============================================================================
+void SectorMapping::on_entity_destroy(EntityID id)
+{
+  if (!this->find_entity(id))
+  {
+    // entity was not in the list in the first place
+    return;
+  }
+
+  EntitySectors& entity = entities_to_sectors[id.type][id.idx];
+  for (u64 j = entity.slots.size(); j-->0;)
+  {
+    this->remove_from_sector(id, entity.slots[j]);
+    entity.slots.pop_back();
+  }
+
+  // Keep the memory, the pool reuses the slot for the next entity of the type
+  entity.mapped = false;
 }
 
 //==============================================================================
 void SectorMapping::on_entity_create(EntityID id, vec3 pos, f32 rad, f32 /*h*/)
 {
-  nc_assert(!entities_to_sectors.contains(id), "Duplicate entry!!!");
+  nc_assert(!this->find_entity(id), "Duplicate entry!!!");
+
+  SectorSet& sectors = g_query_sectors;
+  sectors.sectors.clear();
+  sectors.transforms.clear();
 
-  SectorSet sectors;
   if (id.type == EntityTypes::point_light)
   {
     map.query_nearby_sectors_for_lights(pos.xz(), rad, sectors);
@@ -107,26 +321,15 @@ void SectorMapping::on_entity_create(EntityID id, vec3 pos, f32 rad, f32 /*h*/)
     map.query_nearby_sectors_short_distance(pos.xz(), rad, sectors);
   }
 
-  // Emplace empty
-  auto[it, ok] = entities_to_sectors.emplace(id, SectorsAndTransforms{});
-  nc_assert(ok);
-
-  SectorsAndTransforms& entity_sectors = it->second;
+  EntitySectors& entity = this->get_or_add_entity(id);
+  nc_assert(!entity.mapped, "The previous entity of the slot was not destroyed");
+  entity.generation = id.generation;
+  entity.mapped     = true;
 
   for (u64 i = 0, cnt = sectors.sectors.size(); i < cnt; ++i)
   {
-    const mat4& transform = sectors.transforms[i];
-    const SectorID sector = sectors.sectors[i];
-
-    entity_sectors.sectors.push_back(sector);
-    entity_sectors.transforms.push_back(transform);
-
-    sectors_to_entities.entities[sector].push_back(id);
-    sectors_to_entities.transforms[sector].push_back(transform);
+    this->add_to_sector(id, entity, sectors.sectors[i], sectors.transforms[i]);
   }
 }
 
 }
-
-
-
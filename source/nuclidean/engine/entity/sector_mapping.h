@@ -8,7 +8,6 @@
 #include <math/matrix.h>
 
 #include <vector>
-#include <unordered_map>
 #include <tuple>
 
 namespace nc
@@ -28,7 +27,7 @@ struct SectorMapping : public IEntityListener
 
   void on_map_rebuild();
 
-  virtual void on_entity_move(EntityID id, vec3 pos, f32 r, f32 h)   override;
+  virtual void on_entities_moved(std::span<const EntityMove> moves)  override;
   virtual void on_entity_garbaged(EntityID id)                       override;
   virtual void on_entity_destroy(EntityID id)                        override;
   virtual void on_entity_create(EntityID id, vec3 pos, f32 r, f32 h) override;
@@ -47,27 +46,59 @@ struct SectorMapping : public IEntityListener
   template<typename F>
   void for_each_sector_of_entity(EntityID entity, F&& func) const;
 
-  struct SectorsAndTransforms
+  // Where the entity is stored in the per-sector lists
+  struct SectorSlot
   {
-    std::vector<mat4>     transforms;
-    std::vector<SectorID> sectors;
+    SectorID sector;
+    u32      index; // index into the lists of the sector
+  };
+
+  struct EntitySectors
+  {
+    std::vector<SectorSlot> slots;
+    u16                     generation = 0;     // of the mapped entity, the slot gets reused
+    bool                    mapped     = false; // false if the entity does not exist
   };
 
   // We need the relative transform when the entity is in a different sector,
   // but touches our sector through a nuclidean portal - in  that case we have
   // to be able to transform the entity's position into a position relative to
   // our sector.
+  // The entities are removed with swap-remove, so the order is not preserved.
   struct SectorsToEntities
   {
     std::vector<std::vector<mat4>>     transforms;
     std::vector<std::vector<EntityID>> entities;
   };
 
-  using EntitiesToSectors = std::unordered_map<EntityID, SectorsAndTransforms>;
+  // Indexed by the entity type first and then by the index of the entity in
+  // its pool. Dense, so we do not have to hash anything on every move.
+  using EntitiesToSectors = std::vector<std::vector<EntitySectors>>;
 
   SectorsToEntities sectors_to_entities;
   EntitiesToSectors entities_to_sectors;
   MapSectors&       map;
+
+private:
+  const EntitySectors* find_entity(EntityID id) const;
+  EntitySectors&       get_or_add_entity(EntityID id);
+
+  // Inserts the entity into the sector and remembers where
+  void add_to_sector(EntityID id, EntitySectors& entity, SectorID sector, const mat4& transform);
+
+  // Swap-removes the entity from the sector
+  void remove_from_sector(EntityID id, SectorSlot slot);
+
+  // True if the entity overlaps only the sector it is mapped into and will
+  // stay in it after the move, therefore nothing has to change
+  bool stays_in_its_sector(const EntitySectors& entity, vec3 pos, f32 r) const;
+
+  // Queries the sectors the entity overlaps after the move and updates the
+  // lists of the ones it left or entered
+  void remap_entity(EntitySectors& entity, const EntityMove& move);
+
+  // The moves that change sectors, reused between the batches
+  std::vector<EntityMove> pending_remaps;
 };
 
 }
@@ -37,16 +37,15 @@ void SectorMapping::for_each_in_sector(SectorID sector, F&& func) const
 template<typename F>
 void SectorMapping::for_each_sector_of_entity(EntityID entity, F&& func) const
 {
-  auto it = entities_to_sectors.find(entity);
-  if (it == entities_to_sectors.end())
+  const EntitySectors* sectors = this->find_entity(entity);
+  if (!sectors)
   {
     return;
   }
 
-  const SectorsAndTransforms& sectors = it->second;
-  for (u64 i = 0; i < sectors.transforms.size(); ++i)
+  for (const SectorSlot& slot : sectors->slots)
   {
-    func(sectors.sectors[i], sectors.transforms[i]);
+    func(slot.sector, sectors_to_entities.transforms[slot.sector][slot.index]);
   }
 }
 
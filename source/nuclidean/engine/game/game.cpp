@@ -13,6 +13,8 @@
 // Other
 #include <engine/map/map_system.h>
 #include <engine/map/map_dynamics.h>
+#include <engine/map/flow_field.h>
+#include <engine/game/game_scratch.h>
 #include <engine/entity/entity_system.h>
 #include <engine/entity/sector_mapping.h>
 #include <engine/entity/entity_type_definitions.h>
@@ -21,11 +23,18 @@
 #include <profiling.h>
 
 #include <engine/input/game_input.h>
+#include <engine/core/job_system.h>
 #include <buffer.h>
 
 namespace nc
 {
 
+// Number of enemies that think together in one job
+constexpr u64 ENEMY_THINK_BATCH = 4;
+
+// Path searches are expensive enough to be a job on their own
+constexpr u64 ENEMY_SEARCH_BATCH = 1;
+
 //==============================================================================
 void Game::on_destroy()
 {
@@ -56,6 +65,7 @@ void Game::update
   }
 
   time_since_start += dt;
+  path_queries_left = PATH_QUERIES_PER_FRAME;
 
   // Handle the player first
   {
@@ -64,15 +74,72 @@ void Game::update
     {
       player.update(curr_input, prev_input, dt);
     });
+
+    // The entities report their moves only at the sync points. There is one
+    // after each group so the next one sees the mapping up to date.
+    entities->flush_moves();
   }
 
-  // Handle enemies
+  // Most of the enemies chase the player, share one flow field towards them
+  if (Player* player = entities->get_entity<Player>(player_id))
+  {
+    flow_field->update(*map, player->get_position(), dynamics->sector_heights_revision);
+  }
+
+  // Handle enemies. The expensive part of the AI runs in parallel and only
+  // reads the game state, the results are then applied serially in the same
+  // order as always so the simulation stays deterministic.
   {
     NC_SCOPE_COUNTER(enemy_update)
+
+    auto& enemies   = scratch->enemies;
+    auto& thoughts  = scratch->thoughts;
+    auto& searchers = scratch->searchers;
+
+    enemies.clear();
     entities->for_each<Enemy>([&](Enemy& enemy)
     {
-      enemy.update(dt);
+      enemies.push_back(&enemy);
     });
+
+    thoughts.resize(enemies.size());
+
+    {
+      NC_SCOPE_COUNTER(enemy_think)
+      JobSystem::get().parallel_for(enemies.size(), ENEMY_THINK_BATCH, [&](u64 idx)
+      {
+        enemies[idx]->think(thoughts[idx]);
+      });
+    }
+
+    // Only the first few enemies (in the pool order, so deterministic) that
+    // need to search for a path get to do it this frame
+    searchers.clear();
+    for (u64 i = 0; i < enemies.size() && path_queries_left > 0; ++i)
+    {
+      if (thoughts[i].needs_search)
+      {
+        thoughts[i].has_path_slot = true;
+        path_queries_left -= 1;
+        searchers.push_back(i);
+      }
+    }
+
+    {
+      NC_SCOPE_COUNTER(enemy_search)
+      JobSystem::get().parallel_for(searchers.size(), ENEMY_SEARCH_BATCH, [&](u64 idx)
+      {
+        const u64 i = searchers[idx];
+        enemies[i]->think_search(thoughts[i]);
+      });
+    }
+
+    for (u64 i = 0; i < enemies.size(); ++i)
+    {
+      enemies[i]->update(dt, thoughts[i]);
+    }
+
+    entities->flush_moves();
   }
 
   // Handle projectiles
@@ -82,6 +149,8 @@ void Game::update
     {
       proj.update(dt);
     });
+
+    entities->flush_moves();
   }
 
   // Handle teleports
@@ -111,7 +180,7 @@ void Game::update
   // Push the frame index
   frame_idx += 1;
 
-  // And then clean up the dead entities
+  // And then clean up the dead entities, flushes the remaining moves as well
   entities->cleanup();
 }
 
@@ -133,6 +202,7 @@ void Game::serialize(Buffer& buffer)
   // Rebuild the mapping manually, probably faster than loading it
   if (buffer.is_deserializing())
   {
+    flow_field->invalidate();
     mapping->on_map_rebuild();
     entities->for_each(EntityTypes::all, [&](Entity& entity)
     {
@@ -147,4 +217,17 @@ void Game::serialize(Buffer& buffer)
   }
 }
 
+//==============================================================================
+u64 Game::calc_state_hash()
+{
+  // Whatever a save game stores is the state, so that is what we hash. This
+  // way nothing the game keeps (health, ammo, AI, timers...) gets missed.
+  // The pools write their entities as raw memory, which is fine as they are
+  // value-initialized on creation and their padding therefore starts zeroed.
+  // The hashing buffer goes through the data in place, without copying it.
+  Buffer hasher(SerializationType::hashing);
+  this->serialize(hasher);
+  return hasher.get_hash();
+}
+
 }
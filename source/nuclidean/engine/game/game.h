@@ -15,12 +15,18 @@ struct PlayerSpecificInputs;
 struct MapSectors;
 struct MapDynamics;
 struct SectorMapping;
+class  FlowField;
+struct GameScratch;
 class  EntityRegistry;
 class  EntityAttachment;
 class  Buffer;
 
 struct Game
 {
+  // How many enemies can search for a new path during one frame. The rest
+  // keeps following their old path and tries again the next frame.
+  static constexpr u32 PATH_QUERIES_PER_FRAME = 6;
+
   // Simulates one frame of the game
   void update
   (
@@ -35,14 +41,24 @@ struct Game
   // When loading, call this AFTER the map has been build.
   void serialize(Buffer& buffer);
 
+  // Hash of the serialized simulation state (entity pools, map heights,
+  // activators...) for comparing two runs of the same game, for example the
+  // same demo on different number of threads or against its recording.
+  // Goes through the same data as "serialize" in a single pass, without copying
+  // it and without changing the game (the pending entity moves stay pending).
+  u64 calc_state_hash();
+
   EntityID                          player_id = INVALID_ENTITY_ID;
   std::unique_ptr<MapSectors>       map;
   std::unique_ptr<EntityRegistry>   entities;
   std::unique_ptr<SectorMapping>    mapping;
   std::unique_ptr<MapDynamics>      dynamics;
   std::unique_ptr<EntityAttachment> attachment;
+  std::unique_ptr<FlowField>        flow_field; // towards the player, shared by the enemies
+  std::unique_ptr<GameScratch>      scratch;    // reused buffers of "update"
   LevelTransitionData               transition_data;
   u64                               frame_idx = 0;
+  u32                               path_queries_left = 0; // reset each frame, no need to save
   f64                               time_since_start = 0.0;
   bool                              is_level_completed = false;
   LevelName                         next_level_name    = INVALID_LEVEL_NAME;
@@ -81,6 +81,24 @@ vec3 GameHelpers::calc_shoot_from_pos
   return from;
 }
 
+//==============================================================================
+const FlowField& GameHelpers::get_flow_field() const
+{
+  return *m_game.flow_field;
+}
+
+//==============================================================================
+bool GameHelpers::try_consume_path_query()
+{
+  if (m_game.path_queries_left == 0)
+  {
+    return false;
+  }
+
+  m_game.path_queries_left -= 1;
+  return true;
+}
+
 //==============================================================================
 PhysLevel GameHelpers::get_level() const
 {
@@ -15,6 +15,7 @@ namespace nc
 
 struct Game;
 struct PhysLevel;
+class  FlowField;
 class  Projectile;
 class  Player;
 
@@ -33,6 +34,13 @@ public:
 
   PhysLevel get_level() const;
 
+  // Flow field towards the player, shared by all enemies
+  const FlowField& get_flow_field() const;
+
+  // Takes one path query from the budget of this frame. Returns false if the
+  // budget was already spent, the caller should try again the next frame.
+  bool try_consume_path_query();
+
   // Returns the pointer to the player
   Player* get_player();
 
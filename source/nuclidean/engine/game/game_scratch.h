@@ -0,0 +1,26 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+#include <engine/enemies/enemy.h>
+#include <engine/map/map_system.h> // SectorDynData
+
+#include <vector> // std::vector
+
+namespace nc
+{
+
+// Buffers reused between the frames of one game so its update does not need to
+// allocate. Owned by the game and not by the functions using them, so two games
+// (e.g. the running one and a benchmark one) never share them. Not saved.
+struct GameScratch
+{
+  std::vector<Enemy*>          enemies;   // in the pool order
+  std::vector<Enemy::Thoughts> thoughts;  // one per enemy
+  std::vector<u64>             searchers; // indices of the enemies with a path slot
+
+  // The sector heights before "GameSnapshot::restore", to find the moved ones
+  std::vector<SectorDynData>   restore_old_sectors;
+};
+
+}
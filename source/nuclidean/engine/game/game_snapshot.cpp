@@ -0,0 +1,395 @@
+// Project Nuclidean Source File
+#include <common.h>
+
+#include <engine/game/game_snapshot.h>
+#include <engine/game/game.h>
+#include <engine/game/game_scratch.h>
+
+#include <engine/map/map_system.h>
+#include <engine/map/map_dynamics.h>
+
+#include <buffer.h>
+#include <profiling.h>
+
+#include <algorithm> // std::min
+#include <memory>    // std::make_unique
+
+#if NC_TESTS || NC_BENCHMARK
+#include <engine/entity/entity_system.h>
+#include <engine/entity/sector_mapping.h>
+#include <engine/enemies/enemy.h>
+#include <engine/map/flow_field.h>
+#include <game/entity_attachment_manager.h>
+#endif
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+#if NC_BENCHMARK
+#include <benchmark/benchmark.h>
+#include <engine/game/game_system.h>
+#include <engine/player/level_types.h>
+#include <game/item.h>
+
+#include <fstream>
+#include <json/json.hpp>
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+void GameSnapshot::capture(Game& game)
+{
+  NC_SCOPE_PROFILER(GameSnapshotCapture)
+
+  // One pass, "data" grows only if the state got bigger than ever before
+  Buffer write_buffer(this->data);
+  game.serialize(write_buffer);
+  this->size = write_buffer.get_written_size();
+
+  this->frame_idx = game.frame_idx;
+  this->time      = game.time_since_start;
+}
+
+//==============================================================================
+void GameSnapshot::restore(Game& game) const
+{
+  NC_SCOPE_PROFILER(GameSnapshotRestore)
+
+  nc_assert(!this->is_empty());
+
+  // To find out which sectors moved
+  std::vector<SectorDynData>& old_sectors = game.scratch->restore_old_sectors;
+  old_sectors = game.map->sectors_dynamic;
+
+  // The buffer does not write anything when deserializing
+  Buffer read_buffer
+  (
+    const_cast<byte*>(this->data.data()), this->size, SerializationType::deserialize
+  );
+
+  game.serialize(read_buffer);
+  nc_assert(read_buffer.get_remaining_buffer_size() == 0);
+
+  const MapSectors& map = *game.map;
+  nc_assert(old_sectors.size() == map.sectors_dynamic.size());
+
+  bool heights_changed = false;
+  for (SectorID sid = 0; sid < map.sectors_dynamic.size(); ++sid)
+  {
+    const SectorDynData& before = old_sectors[sid];
+    const SectorDynData& after  = map.sectors_dynamic[sid];
+
+    if (before.floor_height == after.floor_height && before.ceil_height == after.ceil_height)
+    {
+      continue;
+    }
+
+    heights_changed = true;
+    if (game.dynamics->sector_change_callback)
+    {
+      game.dynamics->sector_change_callback(sid);
+    }
+  }
+
+  if (heights_changed)
+  {
+    game.dynamics->sector_heights_revision += 1;
+  }
+}
+
+//==============================================================================
+bool GameSnapshot::is_empty() const
+{
+  return this->size == 0;
+}
+
+//==============================================================================
+void GameSnapshot::clear()
+{
+  this->size      = 0;
+  this->frame_idx = 0;
+  this->time      = 0.0;
+}
+
+//==============================================================================
+void SnapshotRing::init(u32 capacity)
+{
+  m_slots.clear();
+  m_slots.resize(capacity);
+  m_newest = 0;
+  m_cnt    = 0;
+}
+
+//==============================================================================
+void SnapshotRing::clear()
+{
+  for (GameSnapshot& slot : m_slots)
+  {
+    slot.clear();
+  }
+
+  m_newest = 0;
+  m_cnt    = 0;
+}
+
+//==============================================================================
+void SnapshotRing::push(Game& game)
+{
+  const u32 capacity = this->get_capacity();
+  if (!capacity)
+  {
+    return;
+  }
+
+  // The first one goes into the slot 0
+  const u32 previous = m_newest;
+  m_newest = m_cnt ? (m_newest + 1) % capacity : 0;
+
+  // A fresh slot starts with the size of the previous state, otherwise the
+  // growing buffer could end up twice as big as needed in every slot
+  GameSnapshot& slot = m_slots[m_newest];
+  if (m_cnt && slot.data.empty())
+  {
+    slot.data.resize(m_slots[previous].size);
+  }
+
+  m_cnt = std::min(m_cnt + 1, capacity);
+  slot.capture(game);
+}
+
+//==============================================================================
+bool SnapshotRing::rewind(Game& game, f64 seconds)
+{
+  if (!m_cnt)
+  {
+    return false;
+  }
+
+  const u32 capacity = this->get_capacity();
+  const f64 target   = game.time_since_start - seconds;
+
+  // From the newest to the oldest, stop on the oldest one if none is old enough
+  u32 steps_back = 0;
+  u32 slot       = m_newest;
+  while (m_slots[slot].time > target && steps_back + 1 < m_cnt)
+  {
+    steps_back += 1;
+    slot = (slot + capacity - 1) % capacity;
+  }
+
+  m_slots[slot].restore(game);
+
+  // The restored one becomes the newest
+  for (u32 i = 0; i < steps_back; ++i)
+  {
+    m_slots[(slot + 1 + i) % capacity].clear();
+  }
+
+  m_newest = slot;
+  m_cnt   -= steps_back;
+
+  return true;
+}
+
+//==============================================================================
+u32 SnapshotRing::get_cnt() const
+{
+  return m_cnt;
+}
+
+//==============================================================================
+u32 SnapshotRing::get_capacity() const
+{
+  return cast<u32>(m_slots.size());
+}
+
+#if NC_TESTS || NC_BENCHMARK
+//==============================================================================
+// The same systems as "GameSystem::build_map" creates, without any of the
+// callbacks into the engine.
+static void create_game_systems(Game& game)
+{
+  game.map        = std::make_unique<MapSectors>();
+  game.mapping    = std::make_unique<SectorMapping>(*game.map);
+  game.entities   = std::make_unique<EntityRegistry>();
+  game.dynamics   = std::make_unique<MapDynamics>(*game.map, *game.entities, *game.mapping);
+  game.attachment = std::make_unique<EntityAttachment>(*game.entities);
+  game.flow_field = std::make_unique<FlowField>(Enemy::get_flow_field_agent());
+  game.scratch    = std::make_unique<GameScratch>();
+
+  game.entities->add_listener(game.mapping.get());
+  game.entities->add_listener(game.attachment.get());
+}
+#endif
+
+//==============================================================================
+#if NC_TESTS
+static bool game_snapshot_test_ring_rewind(unit_test::TestCtx& /*ctx*/)
+{
+  Game game;
+  create_game_systems(game);
+  game.mapping->on_map_rebuild();
+
+  constexpr u32 CAPACITY = 4;
+
+  SnapshotRing ring;
+  ring.init(CAPACITY);
+
+  // Ten frames of 0.5s, the ring keeps only the last four (3.0s to 4.5s)
+  for (u64 i = 0; i < 10; ++i)
+  {
+    game.frame_idx        = i;
+    game.time_since_start = cast<f64>(i) * 0.5;
+    ring.push(game);
+  }
+
+  if (ring.get_cnt() != CAPACITY)
+  {
+    nc_warn("Snapshot test failed. Expected {} snapshots, got {}.", CAPACITY, ring.get_cnt());
+    NC_TEST_FAIL;
+  }
+
+  // One second back from 4.5s is the frame 7
+  if (!ring.rewind(game, 1.0) || game.frame_idx != 7 || ring.get_cnt() != 2)
+  {
+    nc_warn("Snapshot test failed. Rewind ended on frame {} with {} snapshots left.", game.frame_idx, ring.get_cnt());
+    NC_TEST_FAIL;
+  }
+
+  // Further than we have, ends on the oldest one
+  if (!ring.rewind(game, 100.0) || game.frame_idx != 6 || ring.get_cnt() != 1)
+  {
+    nc_warn("Snapshot test failed. Long rewind ended on frame {}.", game.frame_idx);
+    NC_TEST_FAIL;
+  }
+
+  // New frames continue after the restored one
+  game.frame_idx = 42;
+  ring.push(game);
+  if (!ring.rewind(game, 0.0) || game.frame_idx != 42 || ring.get_cnt() != 2)
+  {
+    nc_warn("Snapshot test failed. The ring did not continue after a rewind.");
+    NC_TEST_FAIL;
+  }
+
+  ring.clear();
+  if (ring.rewind(game, 0.0))
+  {
+    nc_warn("Snapshot test failed. Rewind of an empty ring succeeded.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(game_snapshot_test_ring_rewind)->name("Game Snapshot Ring Rewind");
+#endif
+
+#if NC_BENCHMARK
+//==============================================================================
+// The geometry of the first level together with its enemies and pickups,
+// which is most of what gets saved. Loaded once and kept for the other
+// benchmarks.
+static Game* get_benchmark_game()
+{
+  static std::unique_ptr<Game> game;
+  if (game)
+  {
+    return game.get();
+  }
+
+  const LevelName& level_name = Levels::LEVEL_1;
+
+  std::ifstream file(get_full_level_path(level_name));
+  if (!file.is_open())
+  {
+    return nullptr;
+  }
+
+  const nlohmann::json data = nlohmann::json::parse(file);
+
+  game = std::make_unique<Game>();
+  create_game_systems(*game);
+
+  if (!GameSystem::build_level_geometry(level_name, *game->map))
+  {
+    game = nullptr;
+    return nullptr;
+  }
+
+  game->mapping->on_map_rebuild();
+
+  auto load_position = [](const nlohmann::json& js) -> vec3
+  {
+    return vec3{js["position"][0].get<f32>(), js["position"][2].get<f32>(), js["position"][1].get<f32>()};
+  };
+
+  for (const auto& js_entity : data["entities"])
+  {
+    // The player needs the UI
+    if (js_entity["is_player"] == true)
+    {
+      continue;
+    }
+
+    const EnemyType type = js_entity["entity_type"];
+    game->entities->create_entity<Enemy>(load_position(js_entity), VEC3_X, type);
+  }
+
+  for (const auto& js_pickup : data["pickups"])
+  {
+    const PickupType type = js_pickup["type"];
+    game->entities->create_entity<Pickup>(load_position(js_pickup), type);
+  }
+
+  return game.get();
+}
+
+//==============================================================================
+static void benchmark_game_snapshot_capture(benchmark::State& state)
+{
+  Game* game = get_benchmark_game();
+  if (!game)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  GameSnapshot snapshot;
+  for (auto _ : state)
+  {
+    snapshot.capture(*game);
+    benchmark::DoNotOptimize(snapshot.data.data());
+  }
+
+  state.SetBytesProcessed(state.iterations() * snapshot.size);
+}
+BENCHMARK(benchmark_game_snapshot_capture)->Unit(benchmark::kMicrosecond);
+
+//==============================================================================
+static void benchmark_game_snapshot_restore(benchmark::State& state)
+{
+  Game* game = get_benchmark_game();
+  if (!game)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  GameSnapshot snapshot;
+  snapshot.capture(*game);
+
+  for (auto _ : state)
+  {
+    snapshot.restore(*game);
+  }
+
+  state.SetBytesProcessed(state.iterations() * snapshot.size);
+}
+BENCHMARK(benchmark_game_snapshot_restore)->Unit(benchmark::kMicrosecond);
+#endif
+
+}
@@ -0,0 +1,69 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <vector> // std::vector
+
+namespace nc
+{
+
+struct Game;
+
+// The state of the game kept in memory. Contains the same data as a save file
+// ("Game::serialize"), which is only a handful of memcpys of the sector,
+// entity, activator and attachment arrays. Restoring it does not rebuild the
+// level geometry, only the meshes of the sectors that changed their heights.
+// The sector mapping however is rebuilt from scratch (every entity is mapped
+// again, as when loading a save), so a restore costs about as much as mapping
+// all entities of the level.
+struct GameSnapshot
+{
+  std::vector<byte> data;            // keeps its capacity between the captures
+  u64               size      = 0;   // number of valid bytes in "data"
+  u64               frame_idx = 0;   // "Game::frame_idx" at the time of capture
+  f64               time      = 0.0; // "Game::time_since_start" at the time of capture
+
+  // Copies the current state of the game into the snapshot in a single pass.
+  // Allocates only if the state grew bigger than in any previous capture.
+  void capture(Game& game);
+
+  // Loads the snapshot into the game. The game must be running the same level
+  // as when the snapshot was captured. Only the sectors that changed their
+  // heights get their meshes rebuilt, the sector mapping is rebuilt whole.
+  void restore(Game& game) const;
+
+  bool is_empty() const;
+  void clear();
+};
+
+// A fixed number of snapshots, one per frame. When full, the oldest snapshot
+// gets overwritten and its memory is reused for the new one.
+class SnapshotRing
+{
+public:
+  // Drops all of the snapshots and sets the number of slots
+  void init(u32 capacity);
+
+  // Drops all of the snapshots, but keeps their memory
+  void clear();
+
+  // Captures the game into the slot of the oldest snapshot
+  void push(Game& game);
+
+  // Restores the latest snapshot that is at least "seconds" older than the
+  // current state of the game, or the oldest one if there is none that old.
+  // The snapshots newer than the restored one are dropped.
+  // Returns false if there are no snapshots.
+  bool rewind(Game& game, f64 seconds);
+
+  u32 get_cnt()      const;
+  u32 get_capacity() const;
+
+private:
+  std::vector<GameSnapshot> m_slots;
+  u32                       m_newest = 0; // slot of the newest snapshot
+  u32                       m_cnt    = 0;
+};
+
+}
@@ -1,6 +1,7 @@
 // Project Nuclidean Source File
 #include <common.h>
 #include <cvars.h>
+#include <frame_arena.h>
 
 #include <engine/game/game_system.h>
 #include <engine/game/game_helpers.h>
@@ -19,6 +20,9 @@
 #include <engine/map/physics.h>
 #include <engine/map/map_system.h>
 #include <engine/map/map_dynamics.h>
+#include <engine/map/flow_field.h>
+#include <engine/game/game_scratch.h>
+#include <engine/map/cooked_level.h>
 
 #include <engine/graphics/entities/lights.h>
 #include <engine/graphics/entities/sky_box.h>
@@ -151,19 +155,31 @@ static bool load_json_flag(const nlohmann::json& js, const cstr key)
 }
 
 //==============================================================================
-static SurfaceData load_json_surface(const nlohmann::json &js) 
+static TextureID get_level_texture_id(const std::string& texture_name)
+{
+  if (get_engine().is_headless())
+  {
+    // No textures without a GL context, the simulation does not need them
+    return INVALID_TEXTURE_ID;
+  }
+
+  return TextureManager::get()[texture_name].get_texture_id();
+}
+
+//==============================================================================
+static SurfaceData load_json_surface(const nlohmann::json &js, const TextureResolver& textures) 
 {
   if (const bool should_show = js["show"])
   {
     std::string texture_name = js["id"];
 
-    TextureID tid     = TextureManager::get()[texture_name].get_texture_id();
+    TextureID tid     = textures(texture_name);
     TextureID alt_tid = tid;
 
     if (js.contains("id_triggered"))
     {
       std::string alt_texture_name = js["id_triggered"];
-      alt_tid = TextureManager::get()[alt_texture_name].get_texture_id();
+      alt_tid = textures(alt_texture_name);
     }
 
     return SurfaceData
@@ -210,11 +226,12 @@ static TriggerData load_json_trigger
 //==============================================================================
 static std::vector<WallSegmentData> load_json_wall_surface
 (
-  const nlohmann::json& js,
-  const ActivatorMap&   activators,
-  TriggerTable&         triggers,
-  SectorID              sid,
-  WallRelID             wrelid
+  const nlohmann::json&  js,
+  const ActivatorMap&    activators,
+  TriggerTable&          triggers,
+  SectorID               sid,
+  WallRelID              wrelid,
+  const TextureResolver& textures
 )
 {
   std::vector<WallSegmentData> ret;
@@ -224,7 +241,7 @@ static std::vector<WallSegmentData> load_json_wall_surface
   for (auto&& js_entry : js)
   {
     WallSegmentData& entry = ret.emplace_back();
-    entry.surface = load_json_surface(js_entry);
+    entry.surface = load_json_surface(js_entry, textures);
     entry.end_height = js_entry["end_height"];
     load_json_optional(entry.begin_up_tesselation.xzy, js_entry, "begin_up_direction", load_json_vector<3>);
     load_json_optional(entry.end_up_tesselation.xzy, js_entry, "end_up_direction", load_json_vector<3>);
@@ -282,174 +299,172 @@ static void load_empty_map
   dynamics.on_map_rebuild_and_entities_created();
 }
 
+// Activator hooks are loaded after all of the entities got created, as they
+// refer to them by their tags
+struct DeferredActivatorLoad
+{
+  const nlohmann::json* js;
+  IActivatorHook*       hook;
+};
+
 //==============================================================================
-static void load_json_map
+// Activators have to go first, the triggers refer to them by their names
+static void load_json_activators
 (
-  const LevelName& level_name,
-  MapSectors&      map,
-  SectorMapping&   mapping,
-  EntityRegistry&  entities,
-  MapDynamics&     dynamics,
-  EntityID&        player_id
+  nlohmann::json&                     data,
+  ActivatorTable&                     activator_table,
+  ActivatorMap&                       activator_map,
+  std::vector<DeferredActivatorLoad>& hooks_to_load
 )
 {
-  using namespace map_building;
-
-  get_engine().get_module<GameSystem>().reset_enemy_count();
-  get_engine().get_module<GameSystem>().reset_secret_count();
-
-  std::ifstream f(get_full_level_path(level_name));
-  nc_assert(f.is_open());
-  auto data = nlohmann::json::parse(f);
-
-  std::vector<vec2> points;
-  std::vector<map_building::SectorBuildData> sectors;
-
-  ActivatorTable activator_table;
-  ActivatorMap   activator_map;
-  TriggerTable   trigger_table;
-
-
-  struct DeferredActivatorLoad {
-    const nlohmann::json* js;
-    IActivatorHook* hook;
-  };
-  std::vector<DeferredActivatorLoad> hooks_to_load;
-
-  const auto load_entity_triggers = [&trigger_table, &activator_map](const nlohmann::json &js_entity, const Entity *const entity) {
-    if (js_entity.contains("triggers"))
-    {
-      for (auto&& js_trigger : js_entity["triggers"])
-      {
-        TriggerData td = load_json_trigger(js_trigger, activator_map);
-        td.type = TriggerData::entity;
-        td.entity_type.entity = entity->get_id();
-        trigger_table.push_back(td);
-      }
+  for (auto&& js_activator : data["activators"])
+  {
+    std::string name = js_activator["name"];
+    nc_assert(!activator_map.contains(name));
+    activator_map[name] = cast<ActivatorID>(activator_table.size());
+    s32 threshold = js_activator["threshold"];
+    ActivatorData &ad = activator_table.emplace_back(ActivatorData{cast<u16>(threshold)});
+    for (const auto& hook_js : js_activator["hooks"]) {
+      std::string hook_type = hook_js["type"];
+      auto hook = create_hook_by_type(hook_type);
+      //hook->load(hook_js);
+      auto &hook_ptr = ad.hooks.emplace_back(std::move(hook));
+      hooks_to_load.emplace_back(DeferredActivatorLoad{ .js = &hook_js, .hook = hook_ptr.get() });
     }
-    };
+  }
+}
 
-  try
+//==============================================================================
+// Points and sectors together with their triggers, everything "build_map" needs
+static void load_json_geometry
+(
+  nlohmann::json&                             data,
+  const TextureResolver&                      textures,
+  ActivatorMap&                               activator_map,
+  TriggerTable&                               trigger_table,
+  std::vector<vec2>&                          points,
+  std::vector<map_building::SectorBuildData>& sectors
+)
+{
+  for (auto&& js_point : data["points"])
   {
+    points.emplace_back(load_json_vector<2>(js_point));
+  }
 
-    for (auto&& js_activator : data["activators"])
+  SectorID sid = 0;
+  for (auto&& js_sector : data["sectors"])
+  {
+    const f32 floor = js_sector["floor"];
+    const f32 ceil = js_sector["ceiling"];
+
+    s32 damage = 0;
+    if (js_sector.contains("damage"))
     {
-      std::string name = js_activator["name"];
-      nc_assert(!activator_map.contains(name));
-      activator_map[name] = cast<ActivatorID>(activator_table.size());
-      s32 threshold = js_activator["threshold"];
-      ActivatorData &ad = activator_table.emplace_back(ActivatorData{cast<u16>(threshold)});
-      for (const auto& hook_js : js_activator["hooks"]) {
-        std::string hook_type = hook_js["type"];
-        auto hook = create_hook_by_type(hook_type);
-        //hook->load(hook_js);
-        auto &hook_ptr = ad.hooks.emplace_back(std::move(hook));
-        hooks_to_load.emplace_back(DeferredActivatorLoad{ .js = &hook_js, .hook = hook_ptr.get() });
-      }
+      damage = js_sector["damage"];
     }
 
-    for (auto&& js_point : data["points"])
+    bool force_walkable = false;
+    if (js_sector.contains("force_walkability"))
     {
-      points.emplace_back(load_json_vector<2>(js_point));
+      force_walkable = js_sector["force_walkability"];
     }
 
-    SectorID sid = 0;
-    for (auto&& js_sector : data["sectors"])
+    bool door_sfx_override = false;
+    if (js_sector.contains("door_sfx_override"))
     {
-      const f32 floor = js_sector["floor"];
-      const f32 ceil = js_sector["ceiling"];
-
-      s32 damage = 0;
-      if (js_sector.contains("damage"))
-      {
-        damage = js_sector["damage"];
-      }
+      door_sfx_override = js_sector["door_sfx_override"];
+    }
 
-      bool force_walkable = false;
-      if (js_sector.contains("force_walkability"))
-      {
-        force_walkable = js_sector["force_walkability"];
-      }
+    const SectorID portal_sector = js_sector["portal_target"];
+    const int portal_wall = js_sector["portal_wall"];
+    const WallRelID portal_destination_wall = js_sector["portal_destination_wall"];
 
-      bool door_sfx_override = false;
-      if (js_sector.contains("door_sfx_override"))
-      {
-        door_sfx_override = js_sector["door_sfx_override"];
-      }
+    std::vector<u16> point_indices;
+    for (auto&& js_point : js_sector["points"])
+    {
+      point_indices.emplace_back((u16)(int)js_point);
+    }
 
-      const SectorID portal_sector = js_sector["portal_target"];
-      const int portal_wall = js_sector["portal_wall"];
-      const WallRelID portal_destination_wall = js_sector["portal_destination_wall"];
+    auto floor_surface   = load_json_surface(js_sector["floor_surface"], textures);
+    auto ceiling_surface = load_json_surface(js_sector["ceiling_surface"], textures);
 
-      std::vector<u16> point_indices;
-      for (auto&& js_point : js_sector["points"])
-      {
-        point_indices.emplace_back((u16)(int)js_point);
-      }
+    std::vector<std::vector<WallSegmentData>> wall_surfaces;
 
-      auto floor_surface   = load_json_surface(js_sector["floor_surface"]);
-      auto ceiling_surface = load_json_surface(js_sector["ceiling_surface"]);
+    // Surfaces
+    WallRelID wrelid = 0;
+    for (auto&& js_wall_surface : js_sector["wall_surfaces"])
+    {
+      std::vector<WallSegmentData> sd = load_json_wall_surface
+      (
+        js_wall_surface, activator_map, trigger_table, sid, wrelid, textures
+      );
 
-      std::vector<std::vector<WallSegmentData>> wall_surfaces;
+      wall_surfaces.push_back(std::move(sd));
+      wrelid += 1;
+    }
 
-      // Surfaces
-      WallRelID wrelid = 0;
-      for (auto&& js_wall_surface : js_sector["wall_surfaces"])
-      {
-        std::vector<WallSegmentData> sd = load_json_wall_surface
-        (
-          js_wall_surface, activator_map, trigger_table, sid, wrelid
-        );
+    make_sector_helper(floor, ceil, damage, force_walkable ,point_indices, sectors, portal_wall, portal_destination_wall, portal_sector, floor_surface, ceiling_surface, wall_surfaces);
+    map_building::SectorBuildData& build_data = sectors.back();
+    build_data.door_sfx_override = door_sfx_override;
 
-        wall_surfaces.push_back(std::move(sd));
-        wrelid += 1;
+    // Multiple states
+    if (js_sector.contains("alt_states"))
+    {
+      for (auto&& js_alt_state : js_sector["alt_states"]) {
+        build_data.has_more_states = true;
+        build_data.floor_y[1] = js_alt_state["floor"];
+        build_data.ceil_y[1] = js_alt_state["ceiling"];
+        build_data.move_speed = js_alt_state["move_speed"];
+
+        std::string activator_name = js_alt_state["activator"];
+        build_data.activator = activator_map[activator_name];
+        nc_assert(activator_map.contains(activator_name));
       }
+    }
 
-      make_sector_helper(floor, ceil, damage, force_walkable ,point_indices, sectors, portal_wall, portal_destination_wall, portal_sector, floor_surface, ceiling_surface, wall_surfaces);
-      map_building::SectorBuildData& build_data = sectors.back();
-      build_data.door_sfx_override = door_sfx_override;
-
-      // Multiple states
-      if (js_sector.contains("alt_states"))
+    // Triggers
+    if (js_sector.contains("triggers"))
+    {
+      for (auto&& js_trigger : js_sector["triggers"])
       {
-        for (auto&& js_alt_state : js_sector["alt_states"]) {
-          build_data.has_more_states = true;
-          build_data.floor_y[1] = js_alt_state["floor"];
-          build_data.ceil_y[1] = js_alt_state["ceiling"];
-          build_data.move_speed = js_alt_state["move_speed"];
-
-          std::string activator_name = js_alt_state["activator"];
-          build_data.activator = activator_map[activator_name];
-          nc_assert(activator_map.contains(activator_name));
-        }
+        TriggerData td = load_json_trigger(js_trigger, activator_map);
+        td.type = TriggerData::sector;
+        td.sector_type.sector = sid;
+        trigger_table.push_back(td);
       }
+    }
 
-      // Triggers
-      if (js_sector.contains("triggers"))
+    sid += 1;
+  }
+}
+
+//==============================================================================
+// Entities, lights, activator hooks and music. The map has to be built and the
+// mapping initialized by now.
+static void load_json_entities
+(
+  nlohmann::json&                           data,
+  EntityRegistry&                           entities,
+  MapDynamics&                              dynamics,
+  EntityID&                                 player_id,
+  ActivatorTable&                           activator_table,
+  const ActivatorMap&                       activator_map,
+  TriggerTable&                             trigger_table,
+  const std::vector<DeferredActivatorLoad>& hooks_to_load
+)
+{
+  const auto load_entity_triggers = [&trigger_table, &activator_map](const nlohmann::json &js_entity, const Entity *const entity) {
+    if (js_entity.contains("triggers"))
+    {
+      for (auto&& js_trigger : js_entity["triggers"])
       {
-        for (auto&& js_trigger : js_sector["triggers"])
-        {
-          TriggerData td = load_json_trigger(js_trigger, activator_map);
-          td.type = TriggerData::sector;
-          td.sector_type.sector = sid;
-          trigger_table.push_back(td);
-        }
+        TriggerData td = load_json_trigger(js_trigger, activator_map);
+        td.type = TriggerData::entity;
+        td.entity_type.entity = entity->get_id();
+        trigger_table.push_back(td);
       }
-
-      sid += 1;
     }
-  }
-  //catch (nlohmann::json::type_error e)
-  //{
-  //  nc_crit("{0}", e.what());
-  //  nc_assert(false);
-  //}
-  catch(int){}
-
-  map_building::build_map(points, sectors, map, MapBuildFlag::assert_on_fail);
-
-  // Mapping has to be initialized BEFORE creating any entities!!!
-  mapping.on_map_rebuild();
+    };
 
   std::unordered_map<unsigned, EntityID> entity_tag_to_id;
   const auto register_entity = [&entity_tag_to_id](const Entity* const entity, const nlohmann::json& js) ->void {
@@ -567,7 +582,8 @@ static void load_json_map
     const std::string texture = js_skybox["texture"];
     const float exposure = js_skybox["exposure"];
     const bool use_gamma = js_skybox["use_gamma_correction"];
-    const GLuint sky_box_map = TextureManager::get().get_equirectangular_map(texture, ResLifetime::Game);
+    const GLuint sky_box_map = get_engine().is_headless()
+      ? 0 : TextureManager::get().get_equirectangular_map(texture, ResLifetime::Game);
     Entity* const skybox = entities.create_entity<SkyBox>(sky_box_map, exposure, use_gamma);
     register_entity(skybox, js_skybox);
     load_entity_triggers(js_skybox, skybox);
@@ -597,11 +613,208 @@ static void load_json_map
   dynamics.on_map_rebuild_and_entities_created();
 }
 
+//==============================================================================
+static void load_json_map
+(
+  const LevelName& level_name,
+  MapSectors&      map,
+  SectorMapping&   mapping,
+  EntityRegistry&  entities,
+  MapDynamics&     dynamics,
+  EntityID&        player_id
+)
+{
+  get_engine().get_module<GameSystem>().reset_enemy_count();
+  get_engine().get_module<GameSystem>().reset_secret_count();
+
+  std::ifstream f(get_full_level_path(level_name));
+  nc_assert(f.is_open());
+  auto data = nlohmann::json::parse(f);
+
+  std::vector<vec2> points;
+  std::vector<map_building::SectorBuildData> sectors;
+
+  ActivatorTable activator_table;
+  ActivatorMap   activator_map;
+  TriggerTable   trigger_table;
+
+  std::vector<DeferredActivatorLoad> hooks_to_load;
+
+  try
+  {
+    load_json_activators(data, activator_table, activator_map, hooks_to_load);
+    load_json_geometry(data, get_level_texture_id, activator_map, trigger_table, points, sectors);
+  }
+  //catch (nlohmann::json::type_error e)
+  //{
+  //  nc_crit("{0}", e.what());
+  //  nc_assert(false);
+  //}
+  catch(int){}
+
+  map_building::build_map(points, sectors, map, map_building::MapBuildFlag::assert_on_fail);
+
+  // Mapping has to be initialized BEFORE creating any entities!!!
+  mapping.on_map_rebuild();
+
+  load_json_entities
+  (
+    data, entities, dynamics, player_id,
+    activator_table, activator_map, trigger_table, hooks_to_load
+  );
+}
+
+//==============================================================================
+// Same as "load_json_map", but the sectors come already built from the cooked
+// level. Returns false if there is no up to date cooked level for this level.
+static bool load_cooked_map
+(
+  const LevelName& level_name,
+  MapSectors&      map,
+  SectorMapping&   mapping,
+  EntityRegistry&  entities,
+  MapDynamics&     dynamics,
+  EntityID&        player_id
+)
+{
+  CookedLevel cooked;
+  if (!load_cooked_level(level_name, get_level_texture_id, map, cooked))
+  {
+    return false;
+  }
+
+  get_engine().get_module<GameSystem>().reset_enemy_count();
+  get_engine().get_module<GameSystem>().reset_secret_count();
+
+  // Only the activators and entities, the sectors are not there
+  auto data = nlohmann::json::from_cbor(cooked.json_cbor);
+
+  ActivatorTable activator_table;
+  ActivatorMap   activator_map;
+
+  std::vector<DeferredActivatorLoad> hooks_to_load;
+  load_json_activators(data, activator_table, activator_map, hooks_to_load);
+
+  // Mapping has to be initialized BEFORE creating any entities!!!
+  mapping.on_map_rebuild();
+
+  load_json_entities
+  (
+    data, entities, dynamics, player_id,
+    activator_table, activator_map, cooked.triggers, hooks_to_load
+  );
+
+  return true;
+}
+
+//==============================================================================
+// Only the sectors of the level JSON, the same stages as "load_json_map" runs
+// but without textures, entities and activator hooks
+static bool build_json_level_geometry(const LevelName& level_name, MapSectors& map_out)
+{
+  std::ifstream f(get_full_level_path(level_name));
+  if (!f.is_open())
+  {
+    nc_warn("Can not build level \"{}\", its JSON does not exist.", level_name.to_string());
+    return false;
+  }
+
+  auto data = nlohmann::json::parse(f);
+
+  const TextureResolver no_textures = [](const std::string&)
+  {
+    return INVALID_TEXTURE_ID;
+  };
+
+  std::vector<vec2> points;
+  std::vector<map_building::SectorBuildData> sectors;
+
+  ActivatorTable activator_table;
+  ActivatorMap   activator_map;
+  TriggerTable   trigger_table;
+
+  std::vector<DeferredActivatorLoad> hooks_to_load;
+
+  // The activators are needed for the alternative states of the sectors
+  load_json_activators(data, activator_table, activator_map, hooks_to_load);
+  load_json_geometry(data, no_textures, activator_map, trigger_table, points, sectors);
+
+  if (!map_building::build_map(points, sectors, map_out))
+  {
+    nc_warn("Level \"{}\" failed to build.", level_name.to_string());
+    return false;
+  }
+
+  return true;
+}
+
+//==============================================================================
+// Parses the level JSON, builds the sectors and stores them as a cooked level
+static bool cook_json_level(const LevelName& level_name)
+{
+  std::ifstream f(get_full_level_path(level_name));
+  if (!f.is_open())
+  {
+    nc_warn("Can not cook level \"{}\", its JSON does not exist.", level_name.to_string());
+    return false;
+  }
+
+  auto data = nlohmann::json::parse(f);
+
+  CookedLevel cooked;
+
+  // The cooked surfaces store indices into the texture name table instead of
+  // the texture IDs, which differ between the runs
+  std::map<std::string, TextureID> texture_indices;
+  const TextureResolver textures = [&](const std::string& name) -> TextureID
+  {
+    const TextureID next_idx = cast<TextureID>(cooked.texture_names.size());
+    auto [it, inserted] = texture_indices.try_emplace(name, next_idx);
+    if (inserted)
+    {
+      cooked.texture_names.push_back(name);
+    }
+
+    return it->second;
+  };
+
+  std::vector<vec2> points;
+  std::vector<map_building::SectorBuildData> sectors;
+
+  ActivatorTable activator_table;
+  ActivatorMap   activator_map;
+
+  std::vector<DeferredActivatorLoad> hooks_to_load;
+
+  load_json_activators(data, activator_table, activator_map, hooks_to_load);
+  load_json_geometry(data, textures, activator_map, cooked.triggers, points, sectors);
+
+  MapSectors map;
+  if (!map_building::build_map(points, sectors, map))
+  {
+    nc_warn("Level \"{}\" failed to build, it was not cooked.", level_name.to_string());
+    return false;
+  }
+
+  // The rest gets loaded from the JSON the same way as without cooking
+  data.erase("points");
+  data.erase("sectors");
+  cooked.json_cbor = nlohmann::json::to_cbor(data);
+
+  return save_cooked_level(level_name, map, cooked);
+}
+
 }
 
 namespace nc
 {
 
+// A state hash is stored every N recorded frames of a demo
+constexpr u64 DEMO_CHECKPOINT_INTERVAL = 30;
+
+// And a full snapshot of the game once in a while for seeking
+constexpr f32 DEMO_SNAPSHOT_INTERVAL = 10.0f;
+
 #if NC_HOT_RELOAD
 struct HotReloadData
 {
@@ -680,12 +893,30 @@ void GameSystem::frame_start()
 
   NextRequestedState& scheduled_state_ref = *scheduled_state;
 
+  const bool has_quick_snapshot
+    = !quick_snapshot.is_empty() && quick_snapshot_level == level_name;
+
   if (scheduled_state_ref.load_from_file.size())
   {
-    this->handle_load_game(scheduled_state_ref.load_from_file);
+    if (scheduled_state_ref.quick && has_quick_snapshot)
+    {
+      // Still the same level, no need to rebuild it
+      quick_snapshot.restore(*game);
+      rewind_snapshots.clear();
+    }
+    else
+    {
+      this->handle_load_game(scheduled_state_ref.load_from_file);
+    }
   }
   else if (scheduled_state_ref.save_to_file.size())
   {
+    if (scheduled_state_ref.quick)
+    {
+      quick_snapshot.capture(*game);
+      quick_snapshot_level = level_name;
+    }
+
     this->handle_save_game(scheduled_state_ref.save_to_file);
   }
   else
@@ -694,7 +925,8 @@ void GameSystem::frame_start()
     (
       scheduled_state_ref.level,
       scheduled_state_ref.transition,
-      scheduled_state_ref.demo
+      scheduled_state_ref.demo,
+      scheduled_state_ref.checkpoints
     );
   }
 
@@ -753,6 +985,16 @@ void GameSystem::game_update(f32 delta)
   this->handle_hot_reload();
 #endif
 
+  if (journal.state == JournalState::playing && journal.skip_to >= 0)
+  {
+    this->handle_demo_skip();
+  }
+
+  if (rewind_request > 0.0f)
+  {
+    this->handle_rewind();
+  }
+
   u64 num_frames_to_simulate = 1;
 
   if (get_engine().is_game_paused())
@@ -784,28 +1026,6 @@ void GameSystem::game_update(f32 delta)
 
   while (num_frames_to_simulate-->0)
   {
-    auto demo_inputs = [this]()
-    {
-      PlayerSpecificInputs empty_inputs;
-      PlayerSpecificInputs prev_inputs;
-      PlayerSpecificInputs curr_inputs;
-      f32                  delta_time = 0.0f;
-
-      nc_assert(journal.rover < journal.frames.size());
-
-      const DemoDataFrames& frames = journal.frames;
-      const DemoDataFrame&  frame = frames[journal.rover];
-
-      bool first_frame = !journal.rover;
-      prev_inputs = first_frame ? empty_inputs : frames[journal.rover-1].inputs;
-      curr_inputs = frame.inputs;
-      delta_time  = frame.delta;
-
-      journal.rover += 1;
-
-      return std::make_tuple(delta_time, curr_inputs, prev_inputs);
-    };
-
     auto game_inputs = [this, delta]()
     {
       GameInputs curr_input = InputSystem::get().get_inputs();
@@ -830,11 +1050,19 @@ void GameSystem::game_update(f32 delta)
 
     if (journal.state == JournalState::playing)
     {
-      simulate_one_frame(*game, demo_inputs);
+      this->simulate_demo_frame();
+      this->verify_demo_checkpoint();
     }
     else
     {
       simulate_one_frame(*game, game_inputs);
+
+      if (journal.state == JournalState::recording)
+      {
+        this->record_demo_checkpoint();
+      }
+
+      rewind_snapshots.push(*game);
     }
   }
 
@@ -863,6 +1091,236 @@ void GameSystem::game_update(f32 delta)
   }
 }
 
+//==============================================================================
+void GameSystem::simulate_demo_headless
+(
+  LevelName              level,
+  LevelTransitionData    transition,
+  const DemoDataFrames&  frames,
+  const DemoCheckpoints& checkpoints,
+  std::vector<f64>&      frame_times_out
+)
+{
+  using Clock = std::chrono::high_resolution_clock;
+
+  nc_assert(frames.size());
+  this->handle_start_new_level_optionally_with_demo(level, transition, frames, checkpoints);
+  nc_assert(journal.state == JournalState::playing);
+
+  frame_times_out.clear();
+  frame_times_out.reserve(journal.frames.size());
+
+  // Feeds the inputs the same way as the demo playback in "game_update"
+  while (journal.rover < journal.frames.size() && !game->is_level_completed)
+  {
+    const auto start = Clock::now();
+    this->simulate_demo_frame();
+    const auto end   = Clock::now();
+
+    frame_times_out.push_back(std::chrono::duration<f64>(end - start).count());
+    this->verify_demo_checkpoint();
+
+    // No cleanup event here, so the frame arena has to be reset manually
+    FrameArena::get().reset();
+  }
+}
+
+//==============================================================================
+void GameSystem::simulate_demo_frame()
+{
+  nc_assert(journal.state == JournalState::playing);
+  nc_assert(journal.rover < journal.frames.size());
+
+  const DemoDataFrames& frames = journal.frames;
+  const DemoDataFrame&  frame  = frames[journal.rover];
+
+  bool first_frame = !journal.rover;
+  PlayerSpecificInputs prev_inputs = first_frame
+    ? PlayerSpecificInputs{}
+    : frames[journal.rover - 1].inputs;
+
+  game->update(frame.delta, frame.inputs, prev_inputs);
+  journal.rover += 1;
+}
+
+//==============================================================================
+void GameSystem::record_demo_checkpoint()
+{
+  nc_assert(journal.state == JournalState::recording);
+  nc_assert(journal.frames.size());
+
+  journal.time_since_snapshot += journal.frames.back().delta;
+
+  const u64 frame = journal.frames.size();
+  if (frame % DEMO_CHECKPOINT_INTERVAL)
+  {
+    return;
+  }
+
+  DemoCheckpoint& checkpoint = journal.checkpoints.emplace_back();
+  checkpoint.frame      = frame;
+  checkpoint.state_hash = game->calc_state_hash();
+
+  // Only once in a while, these are much larger than the hash
+  if (journal.time_since_snapshot >= DEMO_SNAPSHOT_INTERVAL)
+  {
+    checkpoint.snapshot = this->save_game_snapshot();
+    journal.time_since_snapshot = 0.0f;
+  }
+}
+
+//==============================================================================
+void GameSystem::verify_demo_checkpoint()
+{
+  nc_assert(journal.state == JournalState::playing);
+
+  const DemoCheckpoints& checkpoints = journal.checkpoints;
+
+  // Skip those we have jumped over
+  while (journal.next_checkpoint < checkpoints.size() && checkpoints[journal.next_checkpoint].frame < journal.rover)
+  {
+    journal.next_checkpoint += 1;
+  }
+
+  if (journal.next_checkpoint >= checkpoints.size() || checkpoints[journal.next_checkpoint].frame != journal.rover)
+  {
+    return;
+  }
+
+  const DemoCheckpoint& checkpoint = checkpoints[journal.next_checkpoint];
+  journal.next_checkpoint += 1;
+
+  if (journal.divergent_frame || game->calc_state_hash() == checkpoint.state_hash)
+  {
+    // Report only the first one, after that it is going to differ anyway
+    return;
+  }
+
+  journal.divergent_frame = checkpoint.frame;
+
+  const u64 last_matching = journal.next_checkpoint >= 2
+    ? checkpoints[journal.next_checkpoint - 2].frame
+    : 0;
+
+  nc_warn
+  (
+    "The demo does not follow its recording anymore. The game state diverged between frames {} and {}.",
+    last_matching, checkpoint.frame
+  );
+}
+
+//==============================================================================
+void GameSystem::handle_demo_skip()
+{
+  nc_assert(journal.state == JournalState::playing && journal.skip_to >= 0);
+  nc_assert(journal.frames.size());
+
+  const u64 target = std::min<u64>(journal.skip_to, journal.frames.size() - 1);
+  journal.skip_to = -1;
+
+  // The latest snapshot before the target
+  const DemoCheckpoint* closest = nullptr;
+  for (const DemoCheckpoint& checkpoint : journal.checkpoints)
+  {
+    if (checkpoint.frame > target)
+    {
+      break;
+    }
+
+    if (checkpoint.snapshot.size())
+    {
+      closest = &checkpoint;
+    }
+  }
+
+  // Jump to the snapshot only if it is closer to the target than we are. When
+  // going back without any snapshot we have to start from the beginning.
+  if (closest && (closest->frame > journal.rover || target < journal.rover))
+  {
+    this->restore_game_snapshot(closest->snapshot);
+    journal.rover = closest->frame;
+  }
+  else if (target < journal.rover)
+  {
+    this->restore_game_snapshot({});
+    journal.rover = 0;
+  }
+
+  journal.next_checkpoint = 0;
+  journal.extra_delta     = 0.0f;
+
+  // And simulate the rest right away
+  while (journal.rover < target && !game->is_level_completed)
+  {
+    this->simulate_demo_frame();
+    this->verify_demo_checkpoint();
+  }
+}
+
+//==============================================================================
+void GameSystem::handle_rewind()
+{
+  const f32 seconds = rewind_request;
+  rewind_request = 0.0f;
+
+  if (journal.state == JournalState::playing || !rewind_snapshots.rewind(*game, seconds))
+  {
+    return;
+  }
+
+  if (journal.state == JournalState::recording)
+  {
+    // The recorded inputs would not lead to the rewound state anymore
+    nc_log("Rewinding the game, the demo recording of this level stops.");
+    journal.reset_and_clear(JournalState::none);
+  }
+}
+
+//==============================================================================
+std::vector<byte> GameSystem::save_game_snapshot() const
+{
+  // Count the size first
+  Buffer size_counter;
+  game->serialize(size_counter);
+
+  std::vector<byte> snapshot(size_counter.get_counted_size());
+  Buffer write_buffer(snapshot.data(), snapshot.size(), SerializationType::serialize);
+  game->serialize(write_buffer);
+
+  return snapshot;
+}
+
+//==============================================================================
+void GameSystem::restore_game_snapshot(const std::vector<byte>& snapshot)
+{
+  LevelTransitionData transition = game->transition_data;
+
+  this->pre_level_load();
+  this->load_level(level_name, !snapshot.empty());
+  game->transition_data = transition;
+
+  if (snapshot.size())
+  {
+    // The buffer does not write anything when deserializing
+    Buffer read_buffer
+    (
+      const_cast<byte*>(snapshot.data()), snapshot.size(), SerializationType::deserialize
+    );
+
+    game->serialize(read_buffer);
+    nc_assert(read_buffer.get_remaining_buffer_size() == 0);
+  }
+
+  this->post_level_load();
+}
+
+//==============================================================================
+u64 GameSystem::calc_game_state_hash() const
+{
+  nc_assert(game);
+  return game->calc_state_hash();
+}
+
 //==============================================================================
 void GameSystem::on_level_end()
 {
@@ -898,7 +1356,8 @@ void GameSystem::save_current_demo()
   std::string demoname = std::format("{}_{:%S_%M_%H_%d_%m_%Y}", lvl.data(), now);
   save_demo_to_file
   (
-    demoname, lvl.data(), journal.frames.data(), journal.frames.size()
+    demoname, lvl.data(), journal.transition_data,
+    journal.frames.data(), journal.frames.size(), journal.checkpoints
   );
 }
 
@@ -1003,18 +1462,10 @@ void GameSystem::save_game(const char*const save_name) const
 //==============================================================================
 void GameSystem::quick_save() const
 {
-  // Generate the filename
-  auto now = floor<std::chrono::seconds>(std::chrono::system_clock::now());
-  auto lvl = level_name.to_string();
-
-  std::string save_path = std::format
-  (
-    "{}/{}{}", SAVE_DIR_RELATIVE, "quicksave", SAVE_FILE_SUFFIX
-  );
-
   scheduled_state = NextRequestedState
   {
-    .save_to_file = std::move(save_path),
+    .save_to_file = get_quick_save_path(),
+    .quick        = true,
   };
 }
 
@@ -1027,6 +1478,31 @@ void GameSystem::load_game(const std::string& path)
   };
 }
 
+//==============================================================================
+void GameSystem::quick_load()
+{
+  scheduled_state = NextRequestedState
+  {
+    .load_from_file = get_quick_save_path(),
+    .quick          = true,
+  };
+}
+
+//==============================================================================
+/*static*/ std::string GameSystem::get_quick_save_path()
+{
+  return std::format("{}/{}{}", SAVE_DIR_RELATIVE, "quicksave", SAVE_FILE_SUFFIX);
+}
+
+//==============================================================================
+void GameSystem::request_rewind(f32 seconds)
+{
+  if (journal.state != JournalState::playing)
+  {
+    rewind_request += seconds;
+  }
+}
+
 //==============================================================================
 LevelTransitionData GameSystem::get_transition_data() const
 {
@@ -1051,6 +1527,39 @@ const DemoDataFrames& GameSystem::get_demo_frames() const
   return journal.frames;
 }
 
+//==============================================================================
+const DemoCheckpoints& GameSystem::get_demo_checkpoints() const
+{
+  return journal.checkpoints;
+}
+
+//==============================================================================
+bool GameSystem::is_playing_demo() const
+{
+  return journal.state == JournalState::playing;
+}
+
+//==============================================================================
+u64 GameSystem::get_demo_frame() const
+{
+  return journal.rover;
+}
+
+//==============================================================================
+std::optional<u64> GameSystem::get_demo_divergent_frame() const
+{
+  return journal.divergent_frame;
+}
+
+//==============================================================================
+void GameSystem::request_demo_skip(u64 frame)
+{
+  if (this->is_playing_demo())
+  {
+    journal.skip_to = cast<int>(std::min<u64>(frame, INT32_MAX));
+  }
+}
+
 //==============================================================================
 void GameSystem::request_play_level(const LevelName& new_level)
 {
@@ -1075,14 +1584,18 @@ void GameSystem::request_level_restart()
 //==============================================================================
 void GameSystem::request_level_change
 (
-  const LevelName& new_level, DemoDataFrames&& frames, LevelTransitionData transition
+  const LevelName&    new_level,
+  DemoDataFrames&&    frames,
+  LevelTransitionData transition,
+  DemoCheckpoints&&   checkpoints
 )
 {
   this->scheduled_state = NextRequestedState
   {
-    .level      = new_level,
-    .demo       = std::move(frames),
-    .transition = transition
+    .level       = new_level,
+    .demo        = std::move(frames),
+    .checkpoints = std::move(checkpoints),
+    .transition  = transition
   };
 }
 
@@ -1151,9 +1664,10 @@ void GameSystem::cleanup_map()
 //==============================================================================
 void GameSystem::handle_start_new_level_optionally_with_demo
 (
-  LevelName             level,
-  LevelTransitionData   transition_data,
-  const DemoDataFrames& demo_optional
+  LevelName              level,
+  LevelTransitionData    transition_data,
+  const DemoDataFrames&  demo_optional,
+  const DemoCheckpoints& checkpoints
 )
 {
   this->pre_level_load();
@@ -1169,7 +1683,8 @@ void GameSystem::handle_start_new_level_optionally_with_demo
   {
     // Install frames and play them
     journal.reset_and_clear(JournalState::playing);
-    journal.frames = demo_optional;
+    journal.frames      = demo_optional;
+    journal.checkpoints = checkpoints;
   }
   else
   {
@@ -1177,6 +1692,8 @@ void GameSystem::handle_start_new_level_optionally_with_demo
     journal.reset_and_clear(JournalState::recording);
   }
 
+  journal.transition_data = transition_data;
+
   this->post_level_load();
 
 #if NC_HOT_RELOAD
@@ -1194,6 +1711,9 @@ void GameSystem::load_level(LevelName level, [[maybe_unused]]bool skip_save_load
   this->build_map(level);
 
   this->level_name = level;
+
+  // The snapshots of the previous level are useless now
+  rewind_snapshots.init(cast<u32>(CVars::rewind_frames));
 }
 
 //==============================================================================
@@ -1318,6 +1838,18 @@ static bool recalc_snap_entity_height
   return best_h != default_h;
 }
 
+//==============================================================================
+/*static*/ bool GameSystem::cook_level(const LevelName& level)
+{
+  return map_helpers::cook_json_level(level);
+}
+
+//==============================================================================
+/*static*/ bool GameSystem::build_level_geometry(const LevelName& level, MapSectors& map_out)
+{
+  return map_helpers::build_json_level_geometry(level, map_out);
+}
+
 //==============================================================================
 void GameSystem::build_map(LevelName level)
 {
@@ -1331,25 +1863,31 @@ void GameSystem::build_map(LevelName level)
     *game->map, *game->entities, *game->mapping
   );
   game->attachment = std::make_unique<EntityAttachment>(*game->entities);
+  game->flow_field = std::make_unique<FlowField>(Enemy::get_flow_field_agent());
+  game->scratch    = std::make_unique<GameScratch>();
 
   game->dynamics->sector_change_callback = [](SectorID sector)
   {
     const MapSectors&    map      = GameSystem::get().get_map();
     const SectorMapping& mapping  = GameSystem::get().get_sector_mapping();
 
-    // Rebuild the sector geometry
-    GraphicsSystem::get().mark_sector_dirty(sector);
+    // There is no geometry to rebuild when running headless
+    if (!get_engine().is_headless())
+    {
+      // Rebuild the sector geometry
+      GraphicsSystem::get().mark_sector_dirty(sector);
 
-    // Update sector height on the GPU
-    GraphicsSystem::get().update_sector_heights(sector);
+      // Update sector height on the GPU
+      GraphicsSystem::get().update_sector_heights(sector);
 
-    // Rebuild the geometry for surroundings as well
-    map.for_each_portal_of_sector(sector, [&](WallID wall)
-    {
-      const WallData& wd = map.walls[wall];
-      nc_assert(map.is_valid_sector_id(wd.portal_sector_id));
-      GraphicsSystem::get().mark_sector_dirty(wd.portal_sector_id);
-    });
+      // Rebuild the geometry for surroundings as well
+      map.for_each_portal_of_sector(sector, [&](WallID wall)
+      {
+        const WallData& wd = map.walls[wall];
+        nc_assert(map.is_valid_sector_id(wd.portal_sector_id));
+        GraphicsSystem::get().mark_sector_dirty(wd.portal_sector_id);
+      });
+    }
 
     EntityRegistry& registry = GameSystem::get().get_entities();
 
@@ -1398,7 +1936,22 @@ void GameSystem::build_map(LevelName level)
   game->entities->add_listener(game->mapping.get());
   game->entities->add_listener(game->attachment.get());
 
-  if (level != Levels::EMPTY_LEVEL)
+  // The cooked level skips the JSON parsing and the sector building
+  const bool cooked = level != Levels::EMPTY_LEVEL && map_helpers::load_cooked_map
+  (
+    level,
+    *game->map,
+    *game->mapping,
+    *game->entities,
+    *game->dynamics,
+    game->player_id
+  );
+
+  if (cooked)
+  {
+    nc_log("Level \"{}\" loaded from the cooked level.", level.to_string());
+  }
+  else if (level != Levels::EMPTY_LEVEL)
   {
     map_helpers::load_json_map
     (
@@ -1442,7 +1995,12 @@ void GameSystem::Journal::reset(GameSystem::JournalState to_state)
   state       = to_state;
   paused      = false;
   rover       = 0;
+  skip_to     = -1;
   extra_delta = 0.0f;
+
+  next_checkpoint     = 0;
+  time_since_snapshot = 0.0f;
+  divergent_frame.reset();
 }
 
 //==============================================================================
@@ -1450,6 +2008,7 @@ void GameSystem::Journal::reset_and_clear(GameSystem::JournalState to_state)
 {
   reset(to_state);
   frames.clear();
+  checkpoints.clear();
 }
 
 //==============================================================================
@@ -7,6 +7,7 @@
 #include <engine/core/engine_module.h>
 
 #include <engine/entity/entity_types.h>
+#include <engine/game/game_snapshot.h>
 #include <engine/player/level_types.h>
 #include <engine/player/save_types.h>
 
@@ -47,6 +48,16 @@ public:
   static EngineModuleId get_module_id();
   static GameSystem&    get();
 
+  // Parses the level JSON and writes its cooked form next to it, which is then
+  // loaded instead of the JSON until the JSON changes. Does not need the
+  // engine to be initialized. Returns false on failure.
+  static bool cook_level(const LevelName& level);
+
+  // Parses the level JSON and builds only its sectors, without textures,
+  // entities and activator hooks. For the benchmarks, does not need the engine
+  // to be initialized. Returns false on failure.
+  static bool build_level_geometry(const LevelName& level, MapSectors& map_out);
+
   GameSystem();
   ~GameSystem();
 
@@ -58,16 +69,43 @@ public:
 
   // Saves the game into a file.
   void save_game(const char* const save_name="") const;
+
+  // Saves the game into the quick save file and keeps a copy in memory
   void quick_save() const;
 
   // Loads the game from a file.
   void load_game(const std::string& path);
 
+  // Loads the quick save. Uses the copy in memory if it is from the current
+  // level, otherwise loads it from the file.
+  void quick_load();
+
+  // Rewinds the game by the given number of seconds on the start of the next
+  // update, but only as far as the in-memory snapshots go. Stops the demo
+  // recording. Does nothing during a demo playback.
+  void request_rewind(f32 seconds);
+
   LevelTransitionData get_transition_data() const;
   LevelName           get_level_name()      const;
   LevelName           get_next_level_name() const;
 
-  const DemoDataFrames& get_demo_frames() const;
+  const DemoDataFrames&  get_demo_frames()      const;
+  const DemoCheckpoints& get_demo_checkpoints() const;
+
+  // True if a demo is being played back
+  bool is_playing_demo() const;
+
+  // Number of demo frames simulated so far
+  u64 get_demo_frame() const;
+
+  // The first checkpoint at which the played demo stopped following its
+  // recording, empty if it did not happen (yet).
+  std::optional<u64> get_demo_divergent_frame() const;
+
+  // Jumps to the given frame of the played demo on the start of the next
+  // update. Continues from the closest checkpoint with a snapshot if there is
+  // one, otherwise from the current frame or from the start of the level.
+  void request_demo_skip(u64 frame);
 
   EntityRegistry&         get_entities();
   MapDynamics&            get_map_dynamics();
@@ -94,13 +132,29 @@ public:
   void request_level_change
   (
     const LevelName&    new_level,
-    DemoDataFrames&&    frames     = {},
-    LevelTransitionData transition = {}
+    DemoDataFrames&&    frames      = {},
+    LevelTransitionData transition  = {},
+    DemoCheckpoints&&   checkpoints = {}
   );
 
   // Called from the action trigger
   void end_level_and_go_to_another_one_from_gamemode(const LevelName& new_level);
 
+  // Loads the level and simulates all demo frames right away without any pacing
+  // against the real time. Stops early if the level gets completed.
+  // Outputs the simulation time of each frame in seconds.
+  void simulate_demo_headless
+  (
+    LevelName              level,
+    LevelTransitionData    transition,
+    const DemoDataFrames&  frames,
+    const DemoCheckpoints& checkpoints,
+    std::vector<f64>&      frame_times_out
+  );
+
+  // Hash of the current game state, see "Game::calc_state_hash"
+  u64 calc_game_state_hash() const;
+
   // map stats, use in level transition
   void increment_enemy_count() { enemy_count++; }
   void increment_kill_count() { kill_count++; }
@@ -123,11 +177,36 @@ private:
   // Starts a new game
   void handle_start_new_level_optionally_with_demo
   (
-    LevelName             level,
-    LevelTransitionData   transition_data,
-    const DemoDataFrames& demo_optional
+    LevelName              level,
+    LevelTransitionData    transition_data,
+    const DemoDataFrames&  demo_optional,
+    const DemoCheckpoints& checkpoints = {}
   );
 
+  // Simulates the next frame of the played demo
+  void simulate_demo_frame();
+
+  // Adds a checkpoint to the recorded demo if it is the time for it
+  void record_demo_checkpoint();
+
+  // Compares the game state with the recorded checkpoint for the current
+  // frame of the played demo, if there is one
+  void verify_demo_checkpoint();
+
+  // Jumps to the frame requested by "request_demo_skip"
+  void handle_demo_skip();
+
+  // Restores the snapshot requested by "request_rewind"
+  void handle_rewind();
+
+  static std::string get_quick_save_path();
+
+  std::vector<byte> save_game_snapshot() const;
+
+  // Rebuilds the current level and then loads the snapshot into it. Starts the
+  // level from scratch if the snapshot is empty.
+  void restore_game_snapshot(const std::vector<byte>& snapshot);
+
   // Loads the game from this savefile
   void handle_load_game(const std::string& savefile);
 
@@ -189,12 +268,17 @@ private:
   {
     LevelTransitionData transition_data;
     DemoDataFrames      frames;
+    DemoCheckpoints     checkpoints;
     JournalState        state       = DEFAULT_JOURNAL_STATE;
     u64                 rover       = 0;
     bool                paused      = false;
     int                 skip_to     = -1;
     f32                 extra_delta = 0.0f;
 
+    u64                 next_checkpoint     = 0;    // the first one not verified yet
+    f32                 time_since_snapshot = 0.0f; // when recording
+    std::optional<u64>  divergent_frame;
+
     void reset(JournalState to_state);
     void reset_and_clear(JournalState to_state);
   };
@@ -203,9 +287,11 @@ private:
   {
     LevelName           level;
     DemoDataFrames      demo;
+    DemoCheckpoints     checkpoints;
     std::string         load_from_file;
     std::string         save_to_file;
     LevelTransitionData transition;
+    bool                quick = false; // uses the in-memory quick save as well
   };
 
   GamePtr   game;
@@ -214,6 +300,13 @@ private:
 
   mutable std::optional<NextRequestedState> scheduled_state;
 
+  // One snapshot per simulated frame for rewinding
+  SnapshotRing rewind_snapshots;
+  f32          rewind_request = 0.0f;
+
+  GameSnapshot quick_snapshot;
+  LevelName    quick_snapshot_level = INVALID_LEVEL_NAME;
+
   u32 enemy_count = 0;
   u32 kill_count  = 0;
 
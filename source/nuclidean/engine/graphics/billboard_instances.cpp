@@ -0,0 +1,183 @@
+// Project Nuclidean Source File
+#include <engine/graphics/billboard_instances.h>
+#include <engine/appearance.h>
+
+#include <common.h>
+
+#include <math/utils.h>
+#include <math/lingebra.h>
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+void BillboardInstanceList::reset(const mat4& view, bool rotate_with_camera)
+{
+  m_camera_rotation    = transpose(mat3(view));
+  m_camera_position    = (inverse(view) * vec4{VEC3_ZERO, 1.0f}).xyz();
+  m_rotate_with_camera = rotate_with_camera;
+
+  m_instances.clear();
+}
+
+//==============================================================================
+void BillboardInstanceList::add
+(
+  const Appearance& appearance,
+  vec3              position,
+  vec2              texture_pos,
+  vec2              texture_size,
+  u32               sector_id,
+  u32               visible_id
+)
+{
+  const bool bottom_mode  = appearance.pivot == Appearance::PivotMode::bottom;
+  const bool rot_only_hor = appearance.rotation == Appearance::RotationMode::only_horizontal;
+
+  const mat4 full_rotation
+  {
+    vec4{-m_camera_rotation[0], 0},
+    vec4{m_camera_rotation[1],  0},
+    vec4{-m_camera_rotation[2], 0},
+    vec4{0, 0, 0, 1}
+  };
+
+  mat4 rotation = full_rotation;
+  if (rot_only_hor && m_rotate_with_camera)
+  {
+    // Extracting X and Y components from the forward vector.
+    rotation = eulerAngleY(atan2(-m_camera_rotation[2][0], -m_camera_rotation[2][2]));
+  }
+  else if (rot_only_hor)
+  {
+    vec3 to_camera_dir   = normalize_or(position - m_camera_position, VEC3_X);
+    vec2 to_camera_2     = normalize_or(to_camera_dir.xz(), VEC2_X);
+    vec3 to_camera_hor   = vec3{to_camera_2.x, 0.0f, to_camera_2.y};
+    vec3 to_camera_right = vec3{to_camera_2.y, 0.0f, -to_camera_2.x};
+
+    rotation = mat4
+    {
+      vec4{to_camera_right, 0.0f},
+      vec4{UP_DIR,          0.0f},
+      vec4{to_camera_hor,   0.0f},
+      vec4{VEC3_ZERO,       1.0f}
+    };
+  }
+
+  const vec3 root_offset = bottom_mode ? VEC3_Y * 0.5f : VEC3_ZERO;
+  const f32  height_move = bottom_mode ? 0.0f : (BILLBOARD_TEXTURE_SCALE * 0.5f);
+
+  const bool tex_size_scaling = appearance.scaling == Appearance::ScalingMode::texture_size;
+  const f32 t_height = tex_size_scaling ? texture_size.y : 64.0f;
+  const f32 t_width  = tex_size_scaling ? texture_size.x : 64.0f;
+
+  const vec3 pivot_offset(0.0f, t_height * height_move, 0.0f);
+  const vec3 scale
+  (
+    t_width  * appearance.scale * BILLBOARD_TEXTURE_SCALE,
+    t_height * appearance.scale * BILLBOARD_TEXTURE_SCALE,
+    1.0f
+  );
+
+  m_instances.push_back(BillboardInstanceGPU
+  {
+    .transform    = translation(position + pivot_offset) * rotation * scaling(scale) * translation(root_offset),
+    .texture_pos  = texture_pos,
+    .texture_size = texture_size,
+    .sector_id    = sector_id,
+    .visible_id   = visible_id,
+    ._padding     = {0, 0},
+  });
+}
+
+//==============================================================================
+const std::vector<BillboardInstanceGPU>& BillboardInstanceList::get_instances() const
+{
+  return m_instances;
+}
+
+//==============================================================================
+bool BillboardInstanceList::empty() const
+{
+  return m_instances.empty();
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool billboard_instances_test_build(unit_test::TestCtx& /*ctx*/)
+{
+  constexpr f32 SCALE = BillboardInstanceList::BILLBOARD_TEXTURE_SCALE;
+
+  BillboardInstanceList list;
+  list.reset(mat4(1.0f), true);
+
+  Appearance centered;
+  centered.scaling = Appearance::ScalingMode::texture_size;
+  centered.pivot   = Appearance::PivotMode::centered;
+
+  Appearance bottom = centered;
+  bottom.pivot   = Appearance::PivotMode::bottom;
+  bottom.scaling = Appearance::ScalingMode::fixed;
+  bottom.scale   = 2.0f;
+
+  const vec3 position = vec3{1.0f, 2.0f, 3.0f};
+  list.add(centered, position, vec2{16.0f, 32.0f}, vec2{64.0f, 32.0f}, 5, 7);
+  list.add(bottom,   position, vec2{0.0f,  0.0f},  vec2{8.0f,  8.0f},  6, 8);
+
+  const auto& instances = list.get_instances();
+  if (instances.size() != 2)
+  {
+    nc_warn("Expected 2 billboard instances, got {}.", instances.size());
+    NC_TEST_FAIL;
+  }
+
+  const BillboardInstanceGPU& first = instances[0];
+  if (first.sector_id != 5 || first.visible_id != 7
+    || first.texture_pos != vec2{16.0f, 32.0f} || first.texture_size != vec2{64.0f, 32.0f})
+  {
+    nc_warn("Billboard instance does not carry its texture rect and IDs.");
+    NC_TEST_FAIL;
+  }
+
+  // Centered pivot is lifted by half of the texture height, the size follows
+  // the texture resolution
+  const vec3 first_origin   = first.transform[3].xyz();
+  const vec3 first_expected = position + vec3{0.0f, 32.0f * SCALE * 0.5f, 0.0f};
+  if (!is_zero(first_origin - first_expected, 0.0001f)
+    || !is_zero(length(first.transform[0].xyz()) - 64.0f * SCALE, 0.0001f)
+    || !is_zero(length(first.transform[1].xyz()) - 32.0f * SCALE, 0.0001f))
+  {
+    nc_warn("Centered billboard has a wrong transform.");
+    NC_TEST_FAIL;
+  }
+
+  // Bottom pivot with a fixed scaling is 64 pixels big regardless of the texture
+  const BillboardInstanceGPU& second = instances[1];
+  const vec3 quad_bottom     = (second.transform * vec4{0.0f, -0.5f, 0.0f, 1.0f}).xyz();
+  const f32  expected_height = 64.0f * 2.0f * SCALE;
+  if (!is_zero(quad_bottom - position, 0.0001f)
+    || !is_zero(length(second.transform[1].xyz()) - expected_height, 0.0001f))
+  {
+    nc_warn("Bottom pivoted billboard has a wrong transform.");
+    NC_TEST_FAIL;
+  }
+
+  // Reset keeps nothing from the previous pass
+  list.reset(mat4(1.0f), false);
+  if (!list.empty())
+  {
+    nc_warn("Billboard instance list was not emptied by the reset.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(billboard_instances_test_build)->name("Billboard Instance Build");
+#endif
+
+}
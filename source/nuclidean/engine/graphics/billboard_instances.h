@@ -0,0 +1,65 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <math/vector.h>
+#include <math/matrix.h>
+
+#include <vector>
+
+namespace nc
+{
+
+struct Appearance;
+
+// Per-instance data of one billboard, read by "billboard.vert" from an SSBO
+// with "gl_InstanceID". Keep in sync with "BillboardInstance" in the shader,
+// the layout follows std430 rules.
+struct BillboardInstanceGPU
+{
+  mat4 transform;
+  vec2 texture_pos;  // in pixels of the atlas
+  vec2 texture_size; // in pixels of the atlas
+  u32  sector_id;
+  u32  visible_id;   // visible sector record with the lights and the portal matrix
+  u32  _padding[2];
+};
+static_assert(sizeof(BillboardInstanceGPU) == 96, "Has to match the std430 array stride");
+
+// Builds the instances of all billboards drawn by a single instanced draw
+// call. Does not touch OpenGL nor the texture manager, the texture rects are
+// passed in already resolved.
+class BillboardInstanceList
+{
+public:
+  // Size of one texture pixel in world units
+  static constexpr f32 BILLBOARD_TEXTURE_SCALE = 1.0f / 2048.0f;
+
+  // Removes all instances but keeps the memory. With "rotate_with_camera" the
+  // billboards copy the rotation of the camera, otherwise they turn towards
+  // its position.
+  void reset(const mat4& view, bool rotate_with_camera);
+
+  void add
+  (
+    const Appearance& appearance,
+    vec3              position,
+    vec2              texture_pos,
+    vec2              texture_size,
+    u32               sector_id,
+    u32               visible_id
+  );
+
+  const std::vector<BillboardInstanceGPU>& get_instances() const;
+  bool empty() const;
+
+private:
+  mat3 m_camera_rotation    = mat3(1.0f);
+  vec3 m_camera_position    = VEC3_ZERO;
+  bool m_rotate_with_camera = true;
+
+  std::vector<BillboardInstanceGPU> m_instances;
+};
+
+}
@@ -28,8 +28,6 @@
 #include <string>
 #include <format>
 #include <cmath>    // std::abs
-#include <iterator> // std::next
-#include <numeric>  // std::accumulate
 
 namespace nc
 {
@@ -261,15 +259,15 @@ void TopDownDebugRenderer::draw_sector_grid()
 {
   auto& map = GameSystem::get().get_map();
 
-  if (map.sector_grid.m_cells.empty())
+  if (!map.sector_grid.is_built())
   {
     return;
   }
 
   vec2 from = map.sector_grid.m_min;
   vec2 to   = map.sector_grid.m_max;
-  s64  w    = cast<s64>(map.sector_grid.m_cells.size());
-  s64  h    = cast<s64>(map.sector_grid.m_cells[0].size());
+  s64  w    = cast<s64>(map.sector_grid.get_width());
+  s64  h    = cast<s64>(map.sector_grid.get_height());
   f32  cell_w = (to.x - from.x) / w;
   f32  cell_h = (to.y - from.y) / h;
 
@@ -315,8 +313,7 @@ void TopDownDebugRenderer::draw_sector_grid()
       f32 cy  = cast<f32>(y) / h;
       f32 yp  = cy * to.y + (1.0f - cy) * from.y + cell_h * 0.5f;
 
-      auto& cells = map.sector_grid.m_cells[x][y];
-      u64 cnt = cells.size();
+      u64 cnt = map.sector_grid.get_cell_object_count(x, y);
 
       std::string coord = std::format("({},{})", x, y);
       std::string txt   = std::to_string(cnt);
@@ -328,16 +325,17 @@ void TopDownDebugRenderer::draw_sector_grid()
 
         if (this->show_sector_grid_list)
         {
-          std::string list_of_sectors = std::accumulate
-          (
-            std::next(cells.begin()),
-            cells.end(),
-            std::to_string(cells.front().data),
-            [](std::string a, auto b)
+          std::string list_of_sectors;
+          map.sector_grid.for_each_in_cell(x, y, [&](aabb2, SectorID sid)
+          {
+            if (!list_of_sectors.empty())
             {
-              return std::move(a) + "," + std::to_string(b.data);
+              list_of_sectors += ",";
             }
-          );
+
+            list_of_sectors += std::to_string(sid);
+            return false;
+          });
 
           this->draw_text
           (
@@ -514,7 +512,7 @@ void TopDownDebugRenderer::render(const VisibilityTree& visible_sectors)
   {
     glEnable(GL_STENCIL_TEST);
 
-    for (const auto& [sector_id, frustums] : visible_sectors.sectors)
+    for (const auto& [sector_id, frustums] : visible_sectors.get_sectors())
     {
       glStencilMask(0xFF);
       glStencilFunc(GL_ALWAYS, 1, 0xFF);
@@ -61,7 +61,9 @@ struct PointLightGPU
   color3 color;
   f32    falloff;
   u32    sector_id;
-  f32    _padding[3];
+  u32    bake_offset; // range of the shadow bake entries, see "LightShadowBake"
+  u32    bake_count;  // zero if the light has no bake
+  f32    _padding;
 };
 
 class PointLight : public Entity
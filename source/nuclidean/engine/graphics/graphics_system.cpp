@@ -3,6 +3,7 @@
 #include <config.h>
 #include <cvars.h>
 #include <intersect.h>
+#include <frame_arena.h>
 
 #include <math/utils.h>
 #include <math/lingebra.h>
@@ -22,6 +23,7 @@
 
 #include <engine/map/map_system.h>
 #include <engine/map/map_dynamics.h>
+#include <engine/map/visibility_cache.h>
 
 #include <engine/entity/entity_system.h>
 #include <engine/entity/entity_type_definitions.h>
@@ -248,7 +250,8 @@ void GraphicsSystem::on_event(ModuleEvent& event)
   {
     case ModuleEventType::post_init:
     {
-      m_renderer = std::make_unique<Renderer>(m_window_width, m_window_height);
+      m_renderer         = std::make_unique<Renderer>(m_window_width, m_window_height);
+      m_visibility_cache = std::make_unique<VisibilityCache>();
 
 #if NC_DEBUG_DRAW
       m_debug_renderer = std::make_unique<TopDownDebugRenderer>(m_window_width, m_window_height);
@@ -285,6 +288,17 @@ void GraphicsSystem::on_event(ModuleEvent& event)
 //==============================================================================
 void GraphicsSystem::terminate()
 {
+  if (m_visibility_cache)
+  {
+    // So the hit rate of a whole run (e.g. a demo) can be compared
+    const VisibilityCache::Stats& vis = m_visibility_cache->get_stats();
+    nc_log
+    (
+      "Visibility cache: {} hits, {} misses, {} narrow queries.",
+      vis.hits, vis.misses, vis.narrow_queries
+    );
+  }
+
 #if NC_IMGUI
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL2_Shutdown();
@@ -293,6 +307,7 @@ void GraphicsSystem::terminate()
 #endif
 
   MeshManager::get().unload(ResLifetime::Game);
+  m_level_mesh.unload();
 
   SDL_GL_DeleteContext(m_gl_context);
   m_gl_context = nullptr;
@@ -302,17 +317,20 @@ void GraphicsSystem::terminate()
 }
 
 //==============================================================================
-void GraphicsSystem::query_visibility(VisibilityTree& tree) const
+const VisibilityTree& GraphicsSystem::query_visibility()
 {
   constexpr u8 DEFAULT_RECURSION_DEPTH = 64;
 
-  nc_assert(tree.sectors.empty());
+  nc_assert(m_visibility_cache);
 
   const auto& map = get_engine().get_map();
 
   const Camera* camera = Camera::get();
   if (!camera)
-    return;
+  {
+    m_visibility_cache->clear();
+    return m_visibility_cache->get_tree();
+  }
 
   const vec3 pos = camera->get_position();
   const vec3 dir = camera->get_forward();
@@ -321,38 +339,43 @@ void GraphicsSystem::query_visibility(VisibilityTree& tree) const
 
   const f32 horizontal_fov = 2.0f * atan(tan(FOV / 2.0f) * aspect);
   const f32 vertical_fov   = FOV;
-  map.query_visible
+  return m_visibility_cache->query
   (
-    pos, dir, horizontal_fov, vertical_fov, tree, DEFAULT_RECURSION_DEPTH
+    map, pos, dir, horizontal_fov, vertical_fov, DEFAULT_RECURSION_DEPTH
   );
 }
 
 //==============================================================================
-const MeshHandle& GraphicsSystem::get_and_update_sector_mesh(SectorID sid)
+const LevelMesh& GraphicsSystem::get_and_update_level_mesh()
 {
-  nc_assert(sid < m_sector_meshes.size());
+  const MapSectors& map = GameSystem::get().get_map();
 
-  if (m_dirty_sectors[sid])
+  for (SectorID sid : m_dirty_sector_list)
   {
-    std::vector<f32> vertices;
-    GameSystem::get().get_map().sector_to_vertices(sid, vertices);
-
-    MeshManager::get().recreate_sector
-    (
-      m_sector_meshes[sid], vertices.data(), cast<u32>(vertices.size())
-    );
-
+    m_level_mesh.update_sector(map, sid);
     m_dirty_sectors[sid] = false;
   }
 
-  return m_sector_meshes[sid];
+  m_dirty_sector_list.clear();
+  return m_level_mesh;
 }
 
 //==============================================================================
 void GraphicsSystem::mark_sector_dirty(SectorID sid)
 {
   nc_assert(sid < m_dirty_sectors.size());
-  m_dirty_sectors[sid] = true;
+
+  if (!m_dirty_sectors[sid])
+  {
+    m_dirty_sectors[sid] = true;
+    m_dirty_sector_list.push_back(sid);
+  }
+
+  // The sector changed its shape, so the visibility might have changed too
+  if (m_visibility_cache)
+  {
+    m_visibility_cache->invalidate();
+  }
 }
 
 //==============================================================================
@@ -440,8 +463,7 @@ void GraphicsSystem::render()
   handle_sector_height_debug();
 #endif
 
-  VisibilityTree visible_sectors;
-  query_visibility(visible_sectors);
+  const VisibilityTree& visible_sectors = query_visibility();
 
   RenderGunProperties gun_props;
   grab_render_gun_props(gun_props);
@@ -669,6 +691,41 @@ static void draw_level_selection()
   }
 }
 
+//==============================================================================
+static void draw_demo_menu()
+{
+  auto& game = GameSystem::get();
+
+  if (!game.is_playing_demo())
+  {
+    ImGui::Text("No demo is playing.");
+    return;
+  }
+
+  const u64 frame_cnt = game.get_demo_frames().size();
+  ImGui::Text("Frame: %llu / %llu", cast<unsigned long long>(game.get_demo_frame()), cast<unsigned long long>(frame_cnt));
+  ImGui::Text("Checkpoints: %llu", cast<unsigned long long>(game.get_demo_checkpoints().size()));
+
+  if (std::optional<u64> divergent = game.get_demo_divergent_frame())
+  {
+    ImGui::TextColored(ImVec4{1.0f, 0.3f, 0.3f, 1.0f}, "Diverged from the recording at frame %llu", cast<unsigned long long>(*divergent));
+  }
+  else
+  {
+    ImGui::Text("No divergence so far");
+  }
+
+  ImGui::Separator();
+
+  static int skip_to = 0;
+  ImGui::SliderInt("Frame", &skip_to, 0, cast<int>(frame_cnt ? frame_cnt - 1 : 0));
+
+  if (ImGui::Button("Skip"))
+  {
+    game.request_demo_skip(cast<u64>(skip_to));
+  }
+}
+
 //==============================================================================
 static void export_pickups(cstr file_path)
 {
@@ -703,6 +760,8 @@ enum class MainPlotType
 {
   delta_time = 0,
   num_calls,
+  num_allocs,
+  alloc_bytes,
 };
 
 //==============================================================================
@@ -737,7 +796,10 @@ static void draw_main_plot()
     return data;
   }();
 
-  constexpr cstr NAMES[2] = {"Delta Time Plot", "Number Of Calls Plot"};
+  constexpr cstr NAMES[4] =
+  {
+    "Delta Time Plot", "Number Of Calls Plot", "Number Of Allocations Plot", "Allocated Bytes Plot"
+  };
 
   const auto& samples = Profiler::get().get_profiling_data_for_all_scopes();
 
@@ -762,9 +824,14 @@ static void draw_main_plot()
       }
       else
       {
+        const Profiler::RingBuffer<u32>& values
+          = TYPE == MainPlotType::num_calls  ? data.num_calls
+          : TYPE == MainPlotType::num_allocs ? data.num_allocs
+          :                                    data.alloc_bytes;
+
         ImPlot::PlotShaded
         (
-          name.c_str(), XS_U32.data(), data.num_calls.data(),
+          name.c_str(), XS_U32.data(), values.data(),
           cast<int>(XS_U32.size()), -INFINITY, 0
         );
       }
@@ -788,16 +855,44 @@ static void draw_main_plot()
 }
 
 //==============================================================================
-void draw_profiling()
+void draw_profiling(const VisibilityCache* visibility_cache)
 {
   NC_SCOPE_PROFILER(DrawProfiler)
 
-  static bool draw_delta_time = false;
-  static bool draw_num_calls  = false;
+  static bool draw_delta_time  = false;
+  static bool draw_num_calls   = false;
+  static bool draw_num_allocs  = false;
+  static bool draw_alloc_bytes = false;
   
   ImGui::Checkbox("Plot Delta Time", &draw_delta_time);
   ImGui::SameLine();
   ImGui::Checkbox("Plot Num Calls", &draw_num_calls);
+
+#if NC_ALLOC_TRACKING
+  // Allocations made directly in the scope, not in the nested ones
+  ImGui::Checkbox("Plot Num Allocs", &draw_num_allocs);
+  ImGui::SameLine();
+  ImGui::Checkbox("Plot Alloc Bytes", &draw_alloc_bytes);
+#endif
+
+  const FrameArena::Stats& arena = FrameArena::get().get_stats();
+  ImGui::Text
+  (
+    "Frame Arena: %.1f kB last frame, %.1f kB peak, %.1f kB capacity",
+    arena.last_frame_bytes / 1024.0, arena.peak_frame_bytes / 1024.0, arena.capacity / 1024.0
+  );
+
+  if (visibility_cache)
+  {
+    const VisibilityCache::Stats& vis = visibility_cache->get_stats();
+    const u64 queries = vis.hits + vis.misses;
+    ImGui::Text
+    (
+      "Visibility Cache: %.1f%% hits of %llu queries, %llu narrow",
+      queries ? 100.0 * vis.hits / queries : 0.0, cast<unsigned long long>(queries),
+      cast<unsigned long long>(vis.narrow_queries)
+    );
+  }
   ImGui::Separator();
 
   if (draw_delta_time)
@@ -809,6 +904,16 @@ void draw_profiling()
   {
     draw_main_plot<MainPlotType::num_calls>();
   }
+
+  if (draw_num_allocs)
+  {
+    draw_main_plot<MainPlotType::num_allocs>();
+  }
+
+  if (draw_alloc_bytes)
+  {
+    draw_main_plot<MainPlotType::alloc_bytes>();
+  }
 }
 #endif
 
@@ -941,6 +1046,12 @@ void GraphicsSystem::draw_debug_window()
         ImGui::EndTabItem();
       }
 
+      if (ImGui::BeginTabItem("Demo"))
+      {
+        draw_demo_menu();
+        ImGui::EndTabItem();
+      }
+
       if (ImGui::BeginTabItem("Saves"))
       {
         //draw_saves_menu();
@@ -956,7 +1067,7 @@ void GraphicsSystem::draw_debug_window()
 #if NC_PROFILING
       if (ImGui::BeginTabItem("Profiling"))
       {
-        draw_profiling();
+        draw_profiling(m_visibility_cache.get());
         ImGui::EndTabItem();
       }
 #endif
@@ -971,30 +1082,21 @@ void GraphicsSystem::draw_debug_window()
 //==============================================================================
 void GraphicsSystem::create_sector_meshes()
 {
-  const MapSectors& map          = GameSystem::get().get_map();
-  MeshManager&      mesh_manager = MeshManager::get();
-  std::vector<f32>  vertices;
+  const MapSectors& map = GameSystem::get().get_map();
 
-  m_sector_meshes.clear();
   m_dirty_sectors.clear();
-  m_sector_meshes.reserve(map.sectors.size());
+  m_dirty_sector_list.clear();
   m_dirty_sectors.resize(map.sectors.size(), false);
 
-  for (SectorID sector_id = 0; sector_id < map.sectors.size(); ++sector_id)
-  {
-    vertices.clear();
-    map.sector_to_vertices(sector_id, vertices);
-
-    const auto mesh = mesh_manager.create_sector
-    (
-      ResLifetime::Level,
-      vertices.data(),
-      cast<u32>(vertices.size())
-    );
-    m_sector_meshes.push_back(mesh);
-  }
+  m_level_mesh.build(map);
 
   m_renderer->update_sector_ssbos();
+  m_renderer->bake_light_shadows();
+
+  if (m_visibility_cache)
+  {
+    m_visibility_cache->clear();
+  }
 }
 
 //==============================================================================
@@ -9,6 +9,7 @@
 #include <engine/core/engine_module.h>
 #include <engine/core/engine_module_id.h>
 #include <engine/graphics/resources/model.h>
+#include <engine/graphics/resources/level_mesh.h>
 #include <engine/map/map_types.h>            // SectorID
 
 #include <game/game_types.h>
@@ -60,9 +61,9 @@ public:
   bool init();
   void on_event(ModuleEvent& event) override;
 
-  // This returns the mesh handle. If the sector is dirty (was changed)
-  // then it is recomputed.
-  const MeshHandle& get_and_update_sector_mesh(SectorID sector);
+  // This returns the geometry of the level. The sectors that are dirty (were
+  // changed) get recomputed first.
+  const LevelMesh&  get_and_update_level_mesh();
   void              mark_sector_dirty(SectorID sector);
   void              update_sector_heights(SectorID sector);
 
@@ -78,7 +79,9 @@ private:
   void render();
   void terminate();
 
-  void query_visibility(VisibilityTree& out) const;
+  // Returns the tree cached from the previous frame if the camera did not
+  // move or turn too much
+  const VisibilityTree& query_visibility();
   void create_sector_meshes();
 
 #if NC_DEBUG_DRAW
@@ -90,14 +93,17 @@ private:
 
 private:
   // Because we do not want to include the whole renderer with this header
-  using RendererPtr = std::unique_ptr<class Renderer>;
+  using RendererPtr       = std::unique_ptr<class Renderer>;
+  using VisibilityCachePtr = std::unique_ptr<class VisibilityCache>;
 
   SDL_Window* m_window     = nullptr;
   void*       m_gl_context = nullptr;
 
   RendererPtr             m_renderer = nullptr;
-  std::vector<MeshHandle> m_sector_meshes;
+  VisibilityCachePtr      m_visibility_cache = nullptr;
+  LevelMesh               m_level_mesh;
   std::vector<bool>       m_dirty_sectors;
+  std::vector<SectorID>   m_dirty_sector_list;
 
 #if NC_DEBUG_DRAW
   using DebugRendererPtr = std::unique_ptr<class TopDownDebugRenderer>;
@@ -0,0 +1,406 @@
+// Project Nuclidean Source File
+#include <engine/graphics/light_shadow_bake.h>
+#include <engine/graphics/entities/lights.h>
+
+#include <engine/map/map_system.h>
+#include <engine/entity/entity_system.h>
+#include <engine/entity/sector_mapping.h>
+
+#include <common.h>
+
+#include <math/lingebra.h>
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+// True if the light at "light_pos" in sector "light_sector" sees every point
+// of "sector" without anything in the way. The sectors are convex, so this is
+// trivially true for the sector of the light. A neighbor is seen fully if all
+// of its corners lie in the wedge the light casts through the portal, and if
+// its floor/ceiling opening fits into the one of the light sector.
+static bool is_sector_unoccluded
+(
+  const MapSectors& map,
+  vec3              light_pos,
+  SectorID          light_sector,
+  SectorID          sector
+)
+{
+  constexpr f32 EPS = 0.0001f;
+
+  const SectorDynData& to = map.sectors_dynamic[sector];
+  if (light_pos.y < to.floor_height || light_pos.y > to.ceil_height)
+  {
+    return false;
+  }
+
+  if (sector == light_sector)
+  {
+    return true;
+  }
+
+  const SectorDynData& from = map.sectors_dynamic[light_sector];
+  if (to.floor_height < from.floor_height || to.ceil_height > from.ceil_height)
+  {
+    // Rays would leave the opening of the portal
+    return false;
+  }
+
+  // Find the classic portal between the sectors
+  WallID portal = INVALID_WALL_ID;
+  const SectorData& light_sector_data = map.sectors[light_sector];
+  for (WallID wid = light_sector_data.first_wall; wid < light_sector_data.last_wall; ++wid)
+  {
+    const WallData& wall = map.walls[wid];
+    if (wall.portal_sector_id == sector && wall.get_portal_type() == PortalType::classic)
+    {
+      portal = wid;
+      break;
+    }
+  }
+
+  if (portal == INVALID_WALL_ID)
+  {
+    return false;
+  }
+
+  const vec2 q = light_pos.xz();
+  const vec2 a = map.walls[portal].pos - q;
+  const vec2 b = map.walls[map_helpers::next_wall(map, light_sector, portal)].pos - q;
+
+  const f32 orientation = cross(a, b);
+  if (abs(orientation) < EPS)
+  {
+    // The light lies on the line of the portal
+    return false;
+  }
+
+  const f32 side = orientation > 0.0f ? 1.0f : -1.0f;
+
+  const SectorData& sector_data = map.sectors[sector];
+  for (WallID wid = sector_data.first_wall; wid < sector_data.last_wall; ++wid)
+  {
+    const vec2 p = map.walls[wid].pos - q;
+    if (cross(a, p) * side < -EPS || cross(p, b) * side < -EPS)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//==============================================================================
+/*static*/ void LightShadowBake::bake_light
+(
+  const MapSectors& map,
+  vec3              light_pos,
+  const SectorSet&  reach,
+  std::vector<u32>& out
+)
+{
+  const SectorID light_sector = map.get_sector_from_point(light_pos.xz());
+  const mat4     identity_t   = identity<mat4>();
+
+  for (u64 i = 0; i < reach.sectors.size(); ++i)
+  {
+    const SectorID sector = reach.sectors[i];
+
+    const bool unoccluded = light_sector != INVALID_SECTOR_ID
+      && reach.transforms[i] == identity_t
+      && is_sector_unoccluded(map, light_pos, light_sector, sector);
+
+    out.push_back((cast<u32>(sector) << 1) | (unoccluded ? UNOCCLUDED_BIT : 0));
+  }
+}
+
+//==============================================================================
+void LightShadowBake::clear()
+{
+  m_lights.clear();
+  m_entries.clear();
+  m_garbage = 0;
+  m_dirty   = true;
+}
+
+//==============================================================================
+void LightShadowBake::bake_all
+(
+  const MapSectors&    map,
+  const SectorMapping& mapping,
+  EntityRegistry&      registry
+)
+{
+  this->clear();
+
+  registry.for_each<PointLight>([&](PointLight& light)
+  {
+    this->bake(map, mapping, light);
+  });
+}
+
+//==============================================================================
+void LightShadowBake::invalidate_sector(const SectorMapping& mapping, SectorID sector)
+{
+  mapping.for_each_in_sector<PointLight>(sector, [&](EntityID id, mat4 /*t*/)
+  {
+    if (id.idx >= m_lights.size())
+    {
+      return;
+    }
+
+    LightBake& light = m_lights[id.idx];
+    if (light.state == State::baked && light.generation == id.generation)
+    {
+      m_garbage  += light.range.count;
+      light.range = Range{};
+      light.state = State::not_baked;
+    }
+  });
+}
+
+//==============================================================================
+LightShadowBake::Range LightShadowBake::get_range
+(
+  const MapSectors&    map,
+  const SectorMapping& mapping,
+  const PointLight&    light
+)
+{
+  const EntityID id    = light.get_id();
+  LightBake&     baked = this->get_or_add(id.idx);
+
+  if (baked.generation != id.generation)
+  {
+    // A different light took the slot of a destroyed one
+    m_garbage += baked.range.count;
+    baked      = LightBake{.generation = id.generation};
+  }
+
+  if (baked.state == State::not_baked)
+  {
+    this->bake(map, mapping, light);
+    return m_lights[id.idx].range;
+  }
+
+  const bool changed = baked.position != light.get_position() || baked.radius != light.radius;
+  if (baked.state == State::baked && changed)
+  {
+    // Moved (or grew) since baked, it will most likely change again
+    m_garbage  += baked.range.count;
+    baked.range = Range{};
+    baked.state = State::dynamic;
+  }
+
+  return baked.range;
+}
+
+//==============================================================================
+const std::vector<u32>& LightShadowBake::get_entries() const
+{
+  return m_entries;
+}
+
+//==============================================================================
+bool LightShadowBake::take_dirty()
+{
+  const bool dirty = m_dirty;
+  m_dirty = false;
+  return dirty;
+}
+
+//==============================================================================
+LightShadowBake::LightBake& LightShadowBake::get_or_add(u32 light_idx)
+{
+  if (light_idx >= m_lights.size())
+  {
+    m_lights.resize(light_idx + 1);
+  }
+
+  return m_lights[light_idx];
+}
+
+//==============================================================================
+void LightShadowBake::bake
+(
+  const MapSectors&    map,
+  const SectorMapping& mapping,
+  const PointLight&    light
+)
+{
+  if (m_garbage > m_entries.size() / 2)
+  {
+    this->compact();
+  }
+
+  SectorSet reach;
+  mapping.for_each_sector_of_entity(light.get_id(), [&](SectorID sector, mat4 t)
+  {
+    reach.sectors.push_back(sector);
+    reach.transforms.push_back(t);
+  });
+
+  if (reach.sectors.empty())
+  {
+    // Not mapped yet, try again next time
+    return;
+  }
+
+  const u32 offset = cast<u32>(m_entries.size());
+  bake_light(map, light.get_position(), reach, m_entries);
+
+  LightBake& baked = this->get_or_add(light.get_id().idx);
+  baked.position   = light.get_position();
+  baked.radius     = light.radius;
+  baked.range      = Range{.offset = offset, .count = cast<u32>(m_entries.size()) - offset};
+  baked.generation = light.get_id().generation;
+  baked.state      = State::baked;
+
+  m_dirty = true;
+}
+
+//==============================================================================
+void LightShadowBake::compact()
+{
+  std::vector<u32> live;
+  live.reserve(m_entries.size() - m_garbage);
+
+  for (LightBake& light : m_lights)
+  {
+    if (light.state != State::baked)
+    {
+      continue;
+    }
+
+    const u32 offset = cast<u32>(live.size());
+    live.insert
+    (
+      live.end(),
+      m_entries.begin() + light.range.offset,
+      m_entries.begin() + light.range.offset + light.range.count
+    );
+    light.range.offset = offset;
+  }
+
+  m_entries = std::move(live);
+  m_garbage = 0;
+  m_dirty   = true;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool light_shadow_bake_test_sectors(unit_test::TestCtx& /*ctx*/)
+{
+  using namespace map_building;
+
+  // A square, a trapezoid wider than the portal into it and a rectangle with a
+  // lower ceiling, all in a row with classic portals between them
+  const std::vector<vec2> points
+  {
+    vec2{0.0f, 0.0f},  vec2{1.0f, 0.0f}, vec2{1.0f, 1.0f},  vec2{0.0f, 1.0f},
+    vec2{2.0f, -2.0f}, vec2{2.0f, 3.0f}, vec2{3.0f, -2.0f}, vec2{3.0f, 3.0f},
+  };
+
+  auto make_sector = [&](std::initializer_list<WallID> indices, f32 ceil)
+  {
+    SectorBuildData sector
+    {
+      .floor_y = {0.0f, 0.0f},
+      .ceil_y  = {ceil, ceil},
+    };
+
+    for (WallID idx : indices)
+    {
+      sector.points.push_back(WallBuildData
+      {
+        .point_index            = idx,
+        .nc_portal_point_index  = INVALID_WALL_REL_ID,
+        .nc_portal_sector_index = INVALID_SECTOR_ID,
+        .surface                = {WallSegmentData{}},
+      });
+    }
+
+    return sector;
+  };
+
+  const std::vector<SectorBuildData> sectors
+  {
+    make_sector({0, 1, 2, 3}, 2.0f),
+    make_sector({1, 4, 5, 2}, 2.0f),
+    make_sector({4, 6, 7, 5}, 1.0f),
+  };
+
+  MapSectors map;
+  if (!build_map(points, sectors, map))
+  {
+    nc_warn("Light shadow bake test failed. The test map did not build.");
+    NC_TEST_FAIL;
+  }
+
+  auto is_unoccluded = [](const std::vector<u32>& entries, SectorID sector)
+  {
+    for (u32 entry : entries)
+    {
+      if ((entry >> 1) == sector)
+      {
+        return (entry & LightShadowBake::UNOCCLUDED_BIT) != 0;
+      }
+    }
+    return false;
+  };
+
+  SectorSet reach;
+  reach.sectors    = {0, 1, 2};
+  reach.transforms = {identity<mat4>(), identity<mat4>(), identity<mat4>()};
+
+  // From the middle of the first sector the corners of the trapezoid are
+  // hidden behind the walls, but the own sector is always lit
+  std::vector<u32> entries;
+  LightShadowBake::bake_light(map, vec3{0.5f, 1.0f, 0.5f}, reach, entries);
+  if (entries.size() != 3 || !is_unoccluded(entries, 0) || is_unoccluded(entries, 1))
+  {
+    nc_warn("Light in the first sector was baked wrong.");
+    NC_TEST_FAIL;
+  }
+
+  // Right next to the portal the light sees the whole neighbor, but the
+  // sector behind it is not a direct neighbor
+  entries.clear();
+  LightShadowBake::bake_light(map, vec3{0.999f, 0.5f, 0.5f}, reach, entries);
+  if (!is_unoccluded(entries, 0) || !is_unoccluded(entries, 1) || is_unoccluded(entries, 2))
+  {
+    nc_warn("Light next to the portal was baked wrong.");
+    NC_TEST_FAIL;
+  }
+
+  // The light is above the lower ceiling of the last sector
+  entries.clear();
+  LightShadowBake::bake_light(map, vec3{1.999f, 1.5f, 0.5f}, reach, entries);
+  if (!is_unoccluded(entries, 1) || is_unoccluded(entries, 2))
+  {
+    nc_warn("Light above the neighbor's ceiling was baked as unoccluded.");
+    NC_TEST_FAIL;
+  }
+
+  // Reaching a sector through a nuclidean portal never counts
+  reach.transforms[1] = translation(vec3{5.0f, 0.0f, 0.0f});
+  entries.clear();
+  LightShadowBake::bake_light(map, vec3{0.999f, 0.5f, 0.5f}, reach, entries);
+  if (is_unoccluded(entries, 1))
+  {
+    nc_warn("Sector behind a nuclidean portal was baked as unoccluded.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(light_shadow_bake_test_sectors)->name("Light Shadow Bake");
+#endif
+
+}
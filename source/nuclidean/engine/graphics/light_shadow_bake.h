@@ -0,0 +1,105 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <math/vector.h>
+#include <engine/map/map_types.h>
+
+#include <vector>
+
+namespace nc
+{
+
+struct MapSectors;
+struct SectorMapping;
+struct SectorSet;
+class  EntityRegistry;
+class  PointLight;
+
+// Precomputed shadow visibility of the static point lights, used by
+// "light.frag" to skip the shadow ray march through the sectors.
+//
+// For every light there is a list of the sectors it reaches (the same ones as
+// in the sector mapping). A pixel in a sector that is not on the list can not
+// be lit by the light at all. A sector is marked unoccluded if no wall, floor
+// nor ceiling can stand between the light and any point of the sector, which
+// holds for the sector of the light and for the neighbors seen fully through
+// a classic portal.
+//
+// A light that moves (or changes its radius) after it was baked is considered
+// dynamic and is never baked again, the shader marches the rays for it as
+// before. A change of the sector heights throws away the bakes of the lights
+// that reach the sector.
+class LightShadowBake
+{
+public:
+  // Each entry is "sector_id << 1 | UNOCCLUDED_BIT"
+  static constexpr u32 UNOCCLUDED_BIT = 1;
+
+  struct Range
+  {
+    u32 offset = 0;
+    u32 count  = 0; // zero if the light has no bake
+  };
+
+  // Computes the entries of one light. The reached sectors come from the
+  // sector mapping, only the ones reached without a nuclidean portal (with an
+  // identity transform) can be unoccluded.
+  static void bake_light
+  (
+    const MapSectors& map,
+    vec3              light_pos,
+    const SectorSet&  reach,
+    std::vector<u32>& out
+  );
+
+  // Throws away all bakes, e.g. when a new level is loaded
+  void clear();
+
+  // Bakes all point lights from scratch
+  void bake_all(const MapSectors& map, const SectorMapping& mapping, EntityRegistry& registry);
+
+  // The bakes of the lights reaching this sector are thrown away and done
+  // again the next time they are needed.
+  void invalidate_sector(const SectorMapping& mapping, SectorID sector);
+
+  // Returns the entries of the light, bakes it first if needed. Empty if the
+  // light is dynamic.
+  Range get_range(const MapSectors& map, const SectorMapping& mapping, const PointLight& light);
+
+  const std::vector<u32>& get_entries() const;
+
+  // True once after the entries changed and have to be uploaded again
+  bool take_dirty();
+
+private:
+  enum class State : u8
+  {
+    not_baked,
+    baked,
+    dynamic,
+  };
+
+  struct LightBake
+  {
+    vec3  position   = VEC3_ZERO;
+    f32   radius     = 0.0f;
+    Range range;
+    u16   generation = 0; // of the light's ID, slots get reused
+    State state      = State::not_baked;
+  };
+
+  LightBake& get_or_add(u32 light_idx);
+  void       bake(const MapSectors& map, const SectorMapping& mapping, const PointLight& light);
+
+  // Moves the live entries to the front once there is too much garbage
+  void compact();
+
+  std::vector<LightBake> m_lights;  // indexed by the index of the light in its pool
+  std::vector<u32>       m_entries;
+  u32                    m_garbage = 0; // entries of the thrown away bakes
+  bool                   m_dirty   = false;
+};
+
+}
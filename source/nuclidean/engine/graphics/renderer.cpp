@@ -4,11 +4,15 @@
 #include <common.h>
 #include <logging.h>
 #include <cvars.h>
+#include <frame_arena.h>
+#include <profiling.h>
+#include <stack_vector.h>
 
 #include <math/utils.h>
 #include <math/lingebra.h>
 
 #include <engine/graphics/camera.h>
+#include <engine/graphics/billboard_instances.h>
 #include <engine/graphics/debug/gizmo.h>
 #include <engine/graphics/graphics_system.h>
 #include <engine/graphics/shaders/shaders.h>
@@ -27,6 +31,7 @@
 
 #include <array>
 #include <filesystem>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace nc
@@ -93,7 +98,6 @@ Renderer::Renderer(u32 win_w, u32 win_h)
 , m_gun_material(ShaderProgramHandle::from_files(shaders::gun::VERTEX_FILE, shaders::gun::FRAGMENT_FILE))
 , m_light_material(ShaderProgramHandle::from_files(shaders::light::VERTEX_FILE, shaders::light::FRAGMENT_FILE))
 , m_sector_material(ShaderProgramHandle::from_files(shaders::sector::VERTEX_FILE, shaders::sector::FRAGMENT_FILE))
-, m_light_culling_shader(ShaderProgramHandle::from_file(shaders::light_culling::COMPUTE_FILE))
 , m_sky_box_material(ShaderProgramHandle::from_files(shaders::sky_box::VERTEX_FILE, shaders::sky_box::FRAGMENT_FILE))
 , m_window_size(win_w, win_h)
 {
@@ -119,16 +123,8 @@ Renderer::Renderer(u32 win_w, u32 win_h)
     m_textures_ssbo.update_gpu_data(true);
   }
 
-  // setup light culling ssbos
-  {
-    const size_t num_tiles_x = (win_w + LIGHT_CULLING_TILE_SIZE_X - 1) / LIGHT_CULLING_TILE_SIZE_X;
-    const size_t num_tiles_y = (win_h + LIGHT_CULLING_TILE_SIZE_Y - 1) / LIGHT_CULLING_TILE_SIZE_Y;
-    const size_t num_tiles = num_tiles_x * num_tiles_y;
-
-    m_light_index_ssbo = SSBOBuffer<u32>(MAX_LIGHTS_PER_TILE * num_tiles);
-    m_light_tiles_ssbo = SSBOBuffer<u32>(num_tiles * 2);
-    m_light_counter_ssbo = SSBOBuffer<u32>(1);
-  }
+  // Draw commands of the sectors, refilled by every "render_sectors" pass
+  glGenBuffers(1, &m_sector_indirect_buffer);
 
   // Register all shader programs for hot-reload monitoring.
   register_shader(m_solid_material,        {shaders::solid::VERTEX_FILE,        shaders::solid::FRAGMENT_FILE});
@@ -136,7 +132,6 @@ Renderer::Renderer(u32 win_w, u32 win_h)
   register_shader(m_gun_material,          {shaders::gun::VERTEX_FILE,          shaders::gun::FRAGMENT_FILE});
   register_shader(m_light_material,        {shaders::light::VERTEX_FILE,        shaders::light::FRAGMENT_FILE});
   register_shader(m_sector_material,       {shaders::sector::VERTEX_FILE,       shaders::sector::FRAGMENT_FILE});
-  register_shader(m_light_culling_shader,  {shaders::light_culling::COMPUTE_FILE});
   register_shader(m_sky_box_material,      {shaders::sky_box::VERTEX_FILE,      shaders::sky_box::FRAGMENT_FILE});
 }
 
@@ -149,16 +144,6 @@ void Renderer::on_window_resized(u32 width, u32 height)
   this->destroy_g_buffers();
   this->create_g_buffers(width, height);
   this->recompute_projection(width, height, GraphicsSystem::FOV);
-
-  // resize ssbo buffers
-  {
-    const size_t num_tiles_x = (width + LIGHT_CULLING_TILE_SIZE_X - 1) / LIGHT_CULLING_TILE_SIZE_X;
-    const size_t num_tiles_y = (height + LIGHT_CULLING_TILE_SIZE_Y - 1) / LIGHT_CULLING_TILE_SIZE_Y;
-    const size_t num_tiles = num_tiles_x * num_tiles_y;
-
-    m_light_index_ssbo.resize(MAX_LIGHTS_PER_TILE * num_tiles);
-    m_light_tiles_ssbo.resize(num_tiles * 2);
-  }
 }
 
 //==============================================================================
@@ -183,22 +168,25 @@ const
     .position = camera->get_position(),
     .view = camera->get_view(),
     .vis_tree = visibility_tree,
+    .vis_node = VisibilityTree::ROOT,
     .portal_dest_to_src = mat4(1.0f),
   };
 
   do_geometry_pass(camera_data, gun_data);
   update_ssbos();
-  do_light_culling_pass(camera_data);
   do_lighting_pass(camera_data.position);
 
   m_dir_light_ssbo.clear();
   m_point_light_ssbo.clear();
   m_sector_matrices_ssbo.clear();
+  m_billboard_instances_ssbo.clear();
+  m_sector_draws_ssbo.clear();
+  m_visible_sectors_ssbo.clear();
+  m_light_index_ssbo.clear();
 
-  m_light_gpu_data_indices.clear();
   m_sector_matrices.clear();
+  m_sector_lights.reset();
 
-  m_light_checker.registry.clear();
   m_entity_checker.registry.clear();
 }
 
@@ -286,6 +274,16 @@ void Renderer::update_sector_heights(SectorID sector_id) const
   };
   // Update only floor_y and ceil_y (first 8 bytes of SectorGPU)
   m_sectors_ssbo.update_gpu_item_bytes(sector_id, 0, heights, sizeof(heights));
+
+  // Lights reaching the sector might see more or less of it now
+  m_light_bake.invalidate_sector(GameSystem::get().get_sector_mapping(), sector_id);
+}
+
+//==============================================================================
+void Renderer::bake_light_shadows() const
+{
+  GameSystem& game = GameSystem::get();
+  m_light_bake.bake_all(game.get_map(), game.get_sector_mapping(), game.get_entities());
 }
 
 
@@ -477,8 +475,9 @@ const
   GizmoManager::get().draw_gizmos();
 #endif
 
-  render_sectors(camera);
-  render_entities(camera);
+  const u32 first_visible = assign_sector_lights(camera);
+  render_sectors(camera, first_visible);
+  render_entities(camera, first_visible);
   render_portals(camera);
   render_gun(camera, gun);
   render_sky_box(camera);
@@ -486,34 +485,6 @@ const
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-//==============================================================================
-void Renderer::do_light_culling_pass(const CameraData& camera) const
-{
-  m_light_culling_shader.use();
-
-  m_point_light_ssbo.bind(0);
-  m_light_index_ssbo.bind(1);
-  m_light_tiles_ssbo.bind(2);
-  m_light_counter_ssbo.bind(3);
-
-  m_light_counter_ssbo.clear();
-  m_light_counter_ssbo.push_back(0);
-  m_light_counter_ssbo.update_gpu_data();
-
-  m_light_culling_shader.set_uniform(shaders::light_culling::VIEW, camera.view);
-  m_light_culling_shader.set_uniform(shaders::light_culling::INV_PROJECTION, inverse(m_default_projection));
-  m_light_culling_shader.set_uniform(shaders::light_culling::WINDOW_SIZE, cast<vec2>(m_window_size));
-  m_light_culling_shader.set_uniform(shaders::light_culling::FAR_PLANE, FAR);
-  m_light_culling_shader.set_uniform(shaders::light_culling::NUM_LIGHTS, m_point_light_ssbo.gpu_size_u32());
-
-  const size_t num_tiles_x = (cast<size_t>(m_window_size.x) + LIGHT_CULLING_TILE_SIZE_X - 1)
-    / LIGHT_CULLING_TILE_SIZE_X;
-  const size_t num_tiles_y = (cast<size_t>(m_window_size.y) + LIGHT_CULLING_TILE_SIZE_Y - 1) 
-    / LIGHT_CULLING_TILE_SIZE_Y;
-
-  m_light_culling_shader.dispatch(num_tiles_x, num_tiles_y, 1, true);
-}
-
 //==============================================================================
 void Renderer::do_lighting_pass(const vec3& view_position) const
 {
@@ -537,20 +508,18 @@ void Renderer::do_lighting_pass(const vec3& view_position) const
   m_dir_light_ssbo.bind(0);
   m_point_light_ssbo.bind(1);
   m_light_index_ssbo.bind(2);
-  m_light_tiles_ssbo.bind(3);
+  m_visible_sectors_ssbo.bind(3);
   m_sectors_ssbo.bind(4);
   m_walls_ssbo.bind(5);
   m_portal_matrices_ssbo.bind(6);
   m_sector_matrices_ssbo.bind(7);
-
-  const size_t num_tiles_x = (cast<size_t>(m_window_size.x) + LIGHT_CULLING_TILE_SIZE_X - 1) 
-    / LIGHT_CULLING_TILE_SIZE_X;
+  m_light_bake_ssbo.bind(8);
 
   // prepare shader
   m_light_material.use();
   m_light_material.set_uniform(shaders::light::VIEW_POSITION, view_position);
   // m_light_material.set_uniform(shaders::light::NUM_DIR_LIGHTS, m_dir_light_ssbo.gpu_size_u32()); // Disabled for now
-  m_light_material.set_uniform(shaders::light::NUM_TILES_X, cast<u32>(num_tiles_x));
+  m_light_material.set_uniform(shaders::light::NUM_VISIBLE_SECTORS, m_visible_sectors_ssbo.gpu_size_u32());
   m_light_material.set_uniform(shaders::light::NUM_SECTORS, m_sectors_ssbo.gpu_size_u32());
   m_light_material.set_uniform(shaders::light::NUM_WALLS, m_walls_ssbo.gpu_size_u32());
   m_light_material.set_uniform(shaders::light::DO_SHADOWS, m_shadows);
@@ -582,13 +551,30 @@ void Renderer::update_ssbos() const
   m_dir_light_ssbo.update_gpu_data();
   m_point_light_ssbo.update_gpu_data();
   m_sector_matrices_ssbo.update_gpu_data_with(m_sector_matrices);
+  m_visible_sectors_ssbo.update_gpu_data_with(m_sector_lights.get_visible_sectors());
+  m_light_index_ssbo.update_gpu_data_with(m_sector_lights.get_light_indices());
+
+  // The bakes change only when loading a level or when sectors move
+  if (m_light_bake.take_dirty())
+  {
+    m_light_bake_ssbo.clear();
+    m_light_bake_ssbo.update_gpu_data_with(m_light_bake.get_entries());
+    nc_assert(m_light_bake_ssbo.gpu_size() == m_light_bake.get_entries().size(), "Too many light bake entries");
+  }
+
+  nc_assert
+  (
+    m_visible_sectors_ssbo.gpu_size() == m_sector_lights.get_visible_sectors().size()
+    && m_light_index_ssbo.gpu_size() == m_sector_lights.get_light_indices().size(),
+    "Too many visible sectors or lights in this frame"
+  );
 }
 
 //==============================================================================
-void Renderer::render_sectors(const CameraData& camera) const
+void Renderer::render_sectors(const CameraData& camera, u32 first_visible) const
 {
   auto& gfx = GraphicsSystem::get();
-  const auto& sectors_to_render = camera.vis_tree.sectors;
+  const auto  sectors_to_render = camera.vis_tree.get_sectors(camera.vis_node);
 
   const auto& game_atlas = TextureManager::get().get_atlas_bundle(ResLifetime::Game);
   const auto& level_atlas = TextureManager::get().get_atlas_bundle(ResLifetime::Level);
@@ -611,22 +597,70 @@ void Renderer::render_sectors(const CameraData& camera) const
   m_sector_material.set_uniform(shaders::sector::VIEW, camera.view);
   m_sector_material.set_uniform(shaders::sector::PORTAL_DEST_TO_SRC, camera.portal_dest_to_src);
 
-  for (const auto& [sector_id, _] : sectors_to_render)
+  // This returns the level geometry and updates the dirty sectors first.
+  const LevelMesh& level_mesh = gfx.get_and_update_level_mesh();
+
+  // Draws of the previous passes in this frame are still in the SSBO, the
+  // "base_instance" of each command points to its own record.
+  const u32 first_draw = m_sector_draws_ssbo.gpu_size_u32();
+
+  m_sector_draws.clear();
+  m_sector_draw_commands.clear();
+
+  for (u32 i = 0; i < sectors_to_render.size(); ++i)
   {
-    const u32 matrix_id = cast<u32>(m_sector_matrices.size());
-    m_sector_matrices.push_back(camera.portal_dest_to_src);
+    const SectorID sector_id = sectors_to_render[i].sector;
+    const LevelMesh::SectorRange& range = level_mesh.get_range(sector_id);
+    if (range.count == 0)
+    {
+      continue;
+    }
+
+    m_sector_draw_commands.push_back(DrawArraysIndirectCommand
+    {
+      .count          = range.count,
+      .instance_count = 1,
+      .first          = range.first,
+      .base_instance  = first_draw + cast<u32>(m_sector_draws.size()),
+    });
+
+    m_sector_draws.push_back(SectorDrawGPU
+    {
+      .sector_id  = cast<u32>(sector_id),
+      .visible_id = first_visible + i,
+    });
+  }
 
-    m_sector_material.set_uniform(shaders::sector::SECTOR_ID, cast<u32>(sector_id));
-    m_sector_material.set_uniform(shaders::sector::MATRIX_ID, matrix_id);
+  m_sector_draws_ssbo.update_gpu_data_with(m_sector_draws);
 
-    // This returns the mesh and optionally updates it before if it is dirty.
-    const MeshHandle& mesh = gfx.get_and_update_sector_mesh(sector_id);
+  // Both the SSBO and the draw ID attribute are limited, drop what overflows
+  const u32 draw_count = min
+  (
+    m_sector_draws_ssbo.gpu_size_u32() - first_draw,
+    LevelMesh::MAX_DRAWS_PER_FRAME - min(first_draw, LevelMesh::MAX_DRAWS_PER_FRAME)
+  );
+  nc_assert(draw_count == m_sector_draws.size(), "Too many sector draws in this frame");
 
-    glBindVertexArray(mesh.get_vao());
-    glDrawArrays(mesh.get_draw_mode(), 0, mesh.get_vertex_count());
+  if (draw_count == 0)
+  {
+    return;
   }
 
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_sector_indirect_buffer);
+  glBufferData
+  (
+    GL_DRAW_INDIRECT_BUFFER,
+    draw_count * sizeof(DrawArraysIndirectCommand),
+    m_sector_draw_commands.data(),
+    GL_STREAM_DRAW
+  );
+
+  m_sector_draws_ssbo.bind(9);
+  glBindVertexArray(level_mesh.get_vao());
+  glMultiDrawArraysIndirect(level_mesh.get_draw_mode(), nullptr, draw_count, 0);
+
   glBindVertexArray(0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
 //==============================================================================
@@ -638,12 +672,30 @@ static TextureHandle pick_texture_handle_from_appearance
   const Renderer::CameraData& camera
 )
 {
+  const TextureManager& textures = TextureManager::get();
+  const SpriteTextures* sprite   = textures.find_sprite(appear.sprite);
+  nc_assert(sprite, "Sprite has no textures");
+
+  if (!sprite) [[unlikely]]
+  {
+    return TextureHandle::invalid();
+  }
+
+  // Looks up the texture of one of the directions
+  auto get_dir_texture = [&](SpriteDirection::evalue dir) -> TextureHandle
+  {
+    const TextureID texture_id = sprite->dirs[dir];
+    nc_assert(texture_id != INVALID_TEXTURE_ID, "Sprite is missing a direction");
+    return texture_id != INVALID_TEXTURE_ID ? textures[texture_id] : TextureHandle::invalid();
+  };
+
   switch (appear.mode)
   {
     // 1 directional sprite
     case Appearance::SpriteMode::mono:
     {
-      return TextureManager::get()[appear.sprite.to_string()];
+      nc_assert(sprite->mono != INVALID_TEXTURE_ID, "Sprite is not a mono sprite");
+      return sprite->mono != INVALID_TEXTURE_ID ? textures[sprite->mono] : TextureHandle::invalid();
       break;
     }
 
@@ -658,7 +710,7 @@ static TextureHandle pick_texture_handle_from_appearance
       if (dir_2d == VEC2_ZERO) [[unlikely]]
       {
         // Not sure if this can even happen legaly
-        return TextureManager::get()[appear.sprite.to_string() + "_d"];
+        return get_dir_texture(SpriteDirection::d);
       }
 
       // ( 0.0f, -1.0f) ->  0.0f   (looking straight at us)
@@ -678,23 +730,23 @@ static TextureHandle pick_texture_handle_from_appearance
       u8 idx = side * 5 + face;
       nc_assert(idx < 10);
 
-      constexpr cstr SUFFIX_LUT[]
+      constexpr SpriteDirection::evalue DIRECTION_LUT[]
       {
         // RIGHT
-        "_d",  // 0 + 0 = 0
-        "_dr", // 0 + 1 = 1
-        "_r",  // 0 + 2 = 2
-        "_ur", // 0 + 3 = 3
-        "_u",  // 0 + 4 = 4
+        SpriteDirection::d,  // 0 + 0 = 0
+        SpriteDirection::dr, // 0 + 1 = 1
+        SpriteDirection::r,  // 0 + 2 = 2
+        SpriteDirection::ur, // 0 + 3 = 3
+        SpriteDirection::u,  // 0 + 4 = 4
         // LEFT
-        "_d",  // 5 + 0 = 5
-        "_dl", // 5 + 1 = 6
-        "_l",  // 5 + 2 = 7
-        "_ul", // 5 + 3 = 8
-        "_u",  // 5 + 4 = 9
+        SpriteDirection::d,  // 5 + 0 = 5
+        SpriteDirection::dl, // 5 + 1 = 6
+        SpriteDirection::l,  // 5 + 2 = 7
+        SpriteDirection::ul, // 5 + 3 = 8
+        SpriteDirection::u,  // 5 + 4 = 9
       };
 
-      return TextureManager::get()[appear.sprite.to_string() + SUFFIX_LUT[idx]];
+      return get_dir_texture(DIRECTION_LUT[idx]);
       break;
     }
 
@@ -706,67 +758,6 @@ static TextureHandle pick_texture_handle_from_appearance
   }
 }
 
-//==============================================================================
-static mat4 calc_billboard_rotation
-(
-  const Renderer::CameraData& camera, vec3 position, bool with_camera, bool only_hor
-)
-{
-  if (with_camera)
-  {
-    // Extracting X and Y components from the forward vector.
-    mat3 camera_rotation = transpose(mat3(camera.view));
-
-    if (only_hor)
-    {
-      return eulerAngleY(atan2(-camera_rotation[2][0], -camera_rotation[2][2]));
-    }
-    else
-    {
-      return mat4
-      {
-        vec4{-camera_rotation[0], 0},
-        vec4{camera_rotation[1],  0},
-        vec4{-camera_rotation[2], 0},
-        vec4{0, 0, 0, 1}
-      };
-    }
-  }
-  else
-  {
-    vec3 camera_position_rel = (inverse(camera.view) * vec4{VEC3_ZERO, 1.0f}).xyz();
-
-    vec3 to_camera_dir   = normalize_or(position - camera_position_rel, VEC3_X);
-    vec2 to_camera_2     = normalize_or(to_camera_dir.xz(), VEC2_X);
-    vec3 to_camera_hor   = vec3{to_camera_2.x, 0.0f, to_camera_2.y};
-    vec3 to_camera_right = vec3{to_camera_2.y, 0.0f, -to_camera_2.x};
-    vec3 to_camera_up    = UP_DIR;
-
-    mat3 camera_rotation = transpose(mat3(camera.view));
-
-    if (only_hor)
-    {
-      return mat4
-      {
-        vec4{to_camera_right, 0.0f},
-        vec4{to_camera_up,    0.0f},
-        vec4{to_camera_hor,   0.0f},
-        vec4{VEC3_ZERO,       1.0f}
-      };
-    }
-    else
-    {
-      return mat4
-      {
-        vec4{-camera_rotation[0], 0},
-        vec4{camera_rotation[1],  0},
-        vec4{-camera_rotation[2], 0},
-        vec4{0, 0, 0, 1}
-      };
-    }
-  }
-}
-
 //==============================================================================
 static f32 calc_light_radius_mod(const PointLight& light)
 {
@@ -795,110 +786,144 @@ static f32 calc_light_radius_mod(const PointLight& light)
 }
 
 //==============================================================================
-void Renderer::render_entities(const CameraData& camera) const
+u32 Renderer::assign_sector_lights(const CameraData& camera) const
 {
-  constexpr f32 BILLBOARD_TEXTURE_SCALE = 1.0f / 2048.0f;
+  const auto& mapping  = GameSystem::get().get_sector_mapping();
+  const auto& map      = GameSystem::get().get_map();
+  const auto& registry = GameSystem::get().get_entities();
+
+  // All sectors of this pass share the same portal matrix
+  const u32 matrix_id = cast<u32>(m_sector_matrices.size());
+  m_sector_matrices.push_back(camera.portal_dest_to_src);
+
+  const u32 first_visible = cast<u32>(m_sector_lights.get_visible_sectors().size());
+
+  for (const auto& frustum : camera.vis_tree.get_sectors(camera.vis_node))
+  {
+    m_sector_lights.begin_sector(matrix_id);
+
+    mapping.for_each_in_sector<PointLight>(frustum.sector, [&](EntityID id, mat4 t)
+    {
+      // Has to exist because it is in sector mapping
+      const PointLight* light = registry.get_entity(id)->as<PointLight>();
+      nc_assert(light);
+
+      const vec3 light_pos  = light->get_position();
+      const vec3 camera_pos = (camera.view * t * vec4{light_pos, 1.0f}).xyz();
+
+      // One light can shine on us from two different portals at the same
+      // time. Therefore, we have to distinguish them by their ID and then by
+      // their position.
+      u32 gpu_index = m_sector_lights.find_light(id.idx, camera_pos);
+      if (gpu_index == SectorLightLists::INVALID_LIGHT)
+      {
+        const vec3 stich_pos = camera.portal_dest_to_src * t * vec4(light_pos, 1.0f);
+
+        SectorID light_sector_id = map.get_sector_from_point(light_pos.xz());
+        if (light_sector_id == INVALID_SECTOR_ID)
+        {
+          light_sector_id = frustum.sector;
+        }
+
+        f32 radius_mod = calc_light_radius_mod(*light);
+        PointLightGPU gpu_data = light->get_gpu_data(light_pos, stich_pos, light_sector_id, radius_mod);
+
+        const LightShadowBake::Range bake = m_light_bake.get_range(map, mapping, *light);
+        gpu_data.bake_offset = bake.offset;
+        gpu_data.bake_count  = bake.count;
+
+        gpu_index = cast<u32>(m_point_light_ssbo.push_back(std::move(gpu_data)));
+
+        m_sector_lights.register_light(id.idx, camera_pos, gpu_index);
+      }
+
+      m_sector_lights.add_to_sector(gpu_index);
+    });
+  }
+
+  return first_visible;
+}
+
+//==============================================================================
+void Renderer::render_entities(const CameraData& camera, u32 first_visible) const
+{
+  NC_SCOPE_COUNTER(render_entities)
 
   // group entities by texture atlas
   const auto& mapping = GameSystem::get().get_sector_mapping();
   const EntityRegistry& registry = GameSystem::get().get_entities();
 
+  // Rebuilt every frame, so all of it lives in the frame arena. Most entities
+  // are seen only once, the rest spills into the arena as well.
   struct EntityRenderData
   {
-    Appearance        appear;
-    vec3              world_pos;
-    std::vector<mat4> transforms;
-    u32               sector_id;
-    u32               matrix_id;
+    EntityRenderData(std::pmr::memory_resource* arena)
+    : transforms(arena)
+    {}
+
+    Appearance           appear;
+    vec3                 world_pos;
+    StackVector<mat4, 2> transforms;
+    u32                  sector_id;
+    u32                  visible_id;
   };
 
-  std::unordered_map<u64, EntityRenderData> groups[3]{};
+  std::pmr::memory_resource* arena = FrameArena::get_resource();
+  std::pmr::unordered_map<u64, EntityRenderData> groups[3]
+  {
+    std::pmr::unordered_map<u64, EntityRenderData>(arena),
+    std::pmr::unordered_map<u64, EntityRenderData>(arena),
+    std::pmr::unordered_map<u64, EntityRenderData>(arena),
+  };
 
-  for (const auto& frustum : camera.vis_tree.sectors)
+  const auto sectors_to_render = camera.vis_tree.get_sectors(camera.vis_node);
+  for (u32 i = 0; i < sectors_to_render.size(); ++i)
   {
-    const SectorID sector_id = frustum.sector;
+    const SectorID sector_id  = sectors_to_render[i].sector;
+    const u32      visible_id = first_visible + i;
 
     mapping.for_each_in_sector(sector_id, [&](EntityID id, mat4 t)
     {
+      if (id.type == EntityTypes::point_light)
+      {
+        // Already handled by "assign_sector_lights"
+        return;
+      }
+
       const Entity* entity = registry.get_entity(id);
       nc_assert(entity);
-      vec3 world_pos  = entity->get_position();
-      vec3 camera_pos = (camera.view * t * vec4{world_pos, 1.0f}).xyz();
+      vec3 world_pos = entity->get_position();
 
       const SectorID entity_sector_id = GameSystem::get().get_map().get_sector_from_point(world_pos.xz());
 
-      if (id.type == EntityTypes::point_light)
+      const Appearance* appearance = entity->get_appearance();
+      if (!appearance)
       {
-        // Now, we have to make sure to not include any light twice..
-        // However, this is not an easy task, as one light can shine on us from
-        // two different portals at the same time. Therefore, we have to first
-        // distinguish them by their ID and then by their position.
-        auto [is_unique, index] = m_light_checker.check_redundant(id.as_u32(), camera_pos);
-        if (is_unique)
-        {
-          // Has to exist because it is in sector mapping
-          nc_assert(registry.get_entity(id));
-
-          const PointLight* light = registry.get_entity(id)->as<PointLight>();
-          // Has to be a light because we would not get here otherwise
-          nc_assert(light); 
-
-          const vec3 light_pos = world_pos;
-          const vec3 stich_pos = camera.portal_dest_to_src * t * vec4(light_pos, 1.0f);
-
-          SectorID light_sector_id = GameSystem::get().get_map().get_sector_from_point(light_pos.xz());
-          if (light_sector_id == INVALID_SECTOR_ID)
-          { 
-            light_sector_id = entity_sector_id;
-          }
-
-          f32 radius_mod = calc_light_radius_mod(*light);
-          const size_t light_gpu_index = m_point_light_ssbo.push_back
-          (
-            light->get_gpu_data(light_pos, stich_pos, light_sector_id, radius_mod)
-          );
-
-          m_light_gpu_data_indices.emplace
-          (
-            (cast<u64>(id.as_u32()) << 32) + index,
-            light_gpu_index
-          );
-        }
+        return;
       }
-      else
-      {
-        const Appearance* appearance = entity->get_appearance();
-        if (!appearance)
-        {
-          return;
-        }
 
-        // Do not render player's sprite from up close because it produces a weird looking
-        // lines when looking up/down.
-        vec3 stich_pos = camera.portal_dest_to_src * t * vec4(world_pos, 1.0f);
-        if (distance(stich_pos.xz(), camera.position.xz()) < 0.05f)
-        {
-          return;
-        }
+      // Do not render player's sprite from up close because it produces a weird looking
+      // lines when looking up/down.
+      vec3 stich_pos = camera.portal_dest_to_src * t * vec4(world_pos, 1.0f);
+      if (distance(stich_pos.xz(), camera.position.xz()) < 0.05f)
+      {
+        return;
+      }
 
-        NC_TODO("Add multiple lifetimes to rendering of entities.");
+      NC_TODO("Add multiple lifetimes to rendering of entities.");
 
-        // NOTE: The entity will be renderer multiple times, but at least it solves the
-        //       bug with billboards disappearing behind portal.s
-        //if (m_entity_checker.check_redundant(id.as_u32(), camera_pos).first)
-        if (true)
-        {
-          auto& group = groups[cast<u64>(ResLifetime::Game)];
-          EntityRenderData& render_data = group[id.as_u32()];
-          const u32 matrix_id = cast<u32>(m_sector_matrices.size());
-          m_sector_matrices.push_back(camera.portal_dest_to_src);
-
-          render_data.appear    = *appearance;
-          render_data.world_pos = world_pos + vec3{0.0f, appearance->offset, 0.0f};
-          render_data.sector_id = cast<u32>(entity_sector_id);
-          render_data.matrix_id = matrix_id;
-          render_data.transforms.push_back(t);
-        }
+      // NOTE: The entity will be renderer multiple times, but at least it solves the
+      //       bug with billboards disappearing behind portal.s
+      //if (m_entity_checker.check_redundant(id.as_u32(), camera_pos).first)
+      if (true)
+      {
+        auto& group = groups[cast<u64>(ResLifetime::Game)];
+        EntityRenderData& render_data = group.try_emplace(id.as_u32(), arena).first->second;
+        render_data.appear     = *appearance;
+        render_data.world_pos  = world_pos + vec3{0.0f, appearance->offset, 0.0f};
+        render_data.sector_id  = cast<u32>(entity_sector_id);
+        render_data.visible_id = visible_id;
+        render_data.transforms.push_back(t);
       }
     });
   }
@@ -910,23 +935,21 @@ void Renderer::render_entities(const CameraData& camera) const
   const MeshHandle& texturable_quad = MeshManager::get().get_texturable_quad();
   glBindVertexArray(texturable_quad.get_vao());
   glActiveTexture(GL_TEXTURE0);
+  m_billboard_instances_ssbo.bind(8);
 
+  // One instanced draw call per atlas. The instances are appended after the
+  // ones of the previous draws in this frame, so the data of the draws that
+  // are still in flight is never overwritten.
   for (u64 l = cast<u64>(ResLifetime::Level); l <= cast<u64>(ResLifetime::Game); ++l)
   {
     const auto& group = groups[l];
-    const TextureAtlasBundle& atlas = TextureManager::get().get_atlas_bundle(cast<ResLifetime>(l));
-    glBindTexture(GL_TEXTURE_2D, atlas.diffuse_handle);
-    m_billboard_material.set_uniform(shaders::billboard::ATLAS_SIZE, atlas.get_size());
-    m_billboard_material.set_uniform(shaders::billboard::ENABLE_SHADOWS, true);
+    m_billboard_instances.reset(camera.view, CVars::billboard_cam_rot);
 
     for (const auto& [entity, render_data] : group)
     {
       const Appearance& base_appearance = render_data.appear;
       const vec3 base_position = render_data.world_pos;
 
-      m_billboard_material.set_uniform(shaders::billboard::SECTOR_ID, render_data.sector_id);
-      m_billboard_material.set_uniform(shaders::billboard::MATRIX_ID, render_data.matrix_id);
-
       for (const mat4& entity_transform : render_data.transforms)
       {
         Appearance appearance = base_appearance;
@@ -938,41 +961,34 @@ void Renderer::render_entities(const CameraData& camera) const
           appearance, camera
         );
 
-        m_billboard_material.set_uniform(shaders::billboard::TEXTURE_POS, texture.get_pos());
-        m_billboard_material.set_uniform(shaders::billboard::TEXTURE_SIZE, texture.get_size());
-
-        const bool bottom_mode = appearance.pivot == Appearance::PivotMode::bottom;
-        const vec3 root_offset = bottom_mode ? VEC3_Y * 0.5f : VEC3_ZERO;
-
-        const bool rot_only_hor = appearance.rotation == Appearance::RotationMode::only_horizontal;
-        const mat4 rotation = calc_billboard_rotation
+        m_billboard_instances.add
         (
-          camera, position, CVars::billboard_cam_rot, rot_only_hor
+          appearance, position, texture.get_pos(), texture.get_size(),
+          render_data.sector_id, render_data.visible_id
         );
+      }
+    }
 
-        const mat4 offset_transform = translation(root_offset);
-        const f32  height_move = bottom_mode ? 0.0f : (BILLBOARD_TEXTURE_SCALE * 0.5f);
-
-        const bool tex_size_scaling = appearance.scaling == Appearance::ScalingMode::texture_size;
-        const f32 t_height = tex_size_scaling ? texture.get_height() : 64.0f;
-        const f32 t_width  = tex_size_scaling ? texture.get_width()  : 64.0f;
+    if (m_billboard_instances.empty())
+    {
+      continue;
+    }
 
-        const vec3 pivot_offset(0.0f, t_height * height_move, 0.0f);
-        const vec3 scale(
-          t_width  * appearance.scale * BILLBOARD_TEXTURE_SCALE,
-          t_height * appearance.scale * BILLBOARD_TEXTURE_SCALE,
-          1.0f
-        );
+    const u32 first_instance = m_billboard_instances_ssbo.gpu_size_u32();
+    m_billboard_instances_ssbo.update_gpu_data_with(m_billboard_instances.get_instances());
+    const u32 instance_count = m_billboard_instances_ssbo.gpu_size_u32() - first_instance;
+    nc_assert(instance_count == m_billboard_instances.get_instances().size(), "Too many billboards");
 
-        const mat4 transform = translation(position + pivot_offset)
-          * rotation
-          * scaling(scale)
-          * offset_transform;
+    const TextureAtlasBundle& atlas = TextureManager::get().get_atlas_bundle(cast<ResLifetime>(l));
+    glBindTexture(GL_TEXTURE_2D, atlas.diffuse_handle);
+    m_billboard_material.set_uniform(shaders::billboard::ATLAS_SIZE, atlas.get_size());
+    m_billboard_material.set_uniform(shaders::billboard::ENABLE_SHADOWS, true);
+    m_billboard_material.set_uniform(shaders::billboard::FIRST_INSTANCE, first_instance);
 
-        m_billboard_material.set_uniform(shaders::billboard::TRANSFORM, transform); 
-        glDrawArrays(texturable_quad.get_draw_mode(), 0, texturable_quad.get_vertex_count());
-      }
-    }
+    glDrawArraysInstanced
+    (
+      texturable_quad.get_draw_mode(), 0, texturable_quad.get_vertex_count(), instance_count
+    );
   }
 
   glBindTexture(GL_TEXTURE_2D, 0);
@@ -986,8 +1002,15 @@ void Renderer::render_portals(const CameraData& camera) const
 
   glEnable(GL_STENCIL_TEST);
 
-  for (const auto& subtree : camera.vis_tree.children)
+  if (camera.vis_tree.is_empty())
+  {
+    return;
+  }
+
+  const auto& node = camera.vis_tree.nodes[camera.vis_node];
+  for (auto child = node.children_begin; child < node.children_end; ++child)
   {
+    const auto& subtree = camera.vis_tree.nodes[child];
     const auto portal_id = subtree.portal_wall;
     const auto& wall = map.walls[portal_id];
     nc_assert(wall.get_portal_type() == PortalType::non_euclidean);
@@ -998,7 +1021,8 @@ void Renderer::render_portals(const CameraData& camera) const
     {
       .position   = camera.position,
       .view       = camera.view,
-      .vis_tree   = subtree,
+      .vis_tree   = camera.vis_tree,
+      .vis_node   = child,
       .portal_dest_to_src = mat4(1.0f),
       .portal_id = subtree.portal_wall,
     };
@@ -1019,7 +1043,7 @@ void Renderer::render_gun
 )
 const
 {
-  namespace sb = shaders::billboard;
+  namespace sb = shaders::gun;
 
   if (gun.sprite.empty())
   {
@@ -1044,8 +1068,24 @@ const
   const vec2 player_position = ((Entity*)GameHelpers::get().get_player())->get_position().xz;
   const SectorID sector_id = GameSystem::get().get_map().get_sector_from_point(player_position);
 
-  const u32 matrix_id = cast<u32>(m_sector_matrices.size());
-  m_sector_matrices.push_back(camera.portal_dest_to_src);
+  // The gun is lit as the sector of the player seen directly by the camera.
+  // The sectors of the root pass are the first ones registered in the frame.
+  const auto root_sectors = camera.vis_tree.get_sectors(VisibilityTree::ROOT);
+  u32 visible_id = 0;
+  for (u32 i = 0; i < root_sectors.size(); ++i)
+  {
+    if (root_sectors[i].sector == sector_id)
+    {
+      visible_id = i;
+      break;
+    }
+  }
+
+  if (root_sectors.empty())
+  {
+    // Nothing is visible, the gun still needs a record to read
+    visible_id = m_sector_lights.begin_sector(0);
+  }
 
   glBindVertexArray(texturable_quad.get_vao());
 
@@ -1057,7 +1097,7 @@ const
   m_gun_material.set_uniform(sb::TEXTURE_POS,    texture.get_pos());
   m_gun_material.set_uniform(sb::TEXTURE_SIZE,   texture.get_size());
   m_gun_material.set_uniform(sb::SECTOR_ID,      cast<u32>(sector_id));
-  m_gun_material.set_uniform(sb::MATRIX_ID,      matrix_id);
+  m_gun_material.set_uniform(sb::VISIBLE_ID,     visible_id);
   m_gun_material.set_uniform(sb::ENABLE_SHADOWS, true);
 
   glBindTexture(GL_TEXTURE_2D, texture.get_atlas_bundle().diffuse_handle);
@@ -1126,8 +1166,9 @@ void Renderer::render_portal_to_color(const CameraData& camera, u8 recursion) co
   glStencilFunc(GL_LEQUAL, recursion + 1, 0xFF);
   glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
-  render_sectors(camera);
-  render_entities(camera);
+  const u32 first_visible = assign_sector_lights(camera);
+  render_sectors(camera, first_visible);
+  render_entities(camera, first_visible);
   render_sky_box(camera);
 }
 
@@ -1197,6 +1238,7 @@ void Renderer::render_portal(const CameraData& camera, const Portal& portal, u8
     .position = camera.position,
     .view = virtual_view,
     .vis_tree = camera.vis_tree,
+    .vis_node = camera.vis_node,
     .portal_dest_to_src = camera.portal_dest_to_src * portal.dest_to_src,
     .portal_id = camera.portal_id,
   };
@@ -1205,8 +1247,10 @@ void Renderer::render_portal(const CameraData& camera, const Portal& portal, u8
   render_portal_to_depth(camera, portal, true, recursion);
   render_portal_to_color(virtual_camera_data, recursion);
 
-  for (const auto& subtree : camera.vis_tree.children)
+  const auto& node = camera.vis_tree.nodes[camera.vis_node];
+  for (auto child = node.children_begin; child < node.children_end; ++child)
   {
+    const auto& subtree = camera.vis_tree.nodes[child];
     const WallData& wall = map.walls[subtree.portal_wall];
     nc_assert(wall.get_portal_type() == PortalType::non_euclidean);
 
@@ -1215,7 +1259,8 @@ void Renderer::render_portal(const CameraData& camera, const Portal& portal, u8
     {
       .position   = virtual_camera_data.position,
       .view       = virtual_camera_data.view,
-      .vis_tree   = subtree,
+      .vis_tree   = camera.vis_tree,
+      .vis_node   = child,
       .portal_dest_to_src = virtual_camera_data.portal_dest_to_src,
       .portal_id = subtree.portal_wall,
     };
@@ -5,6 +5,10 @@
 
 #include <engine/graphics/gl_types.h>
 #include <engine/graphics/ssbo_buffer.h>
+#include <engine/graphics/billboard_instances.h>
+#include <engine/graphics/sector_lights.h>
+#include <engine/graphics/light_shadow_bake.h>
+#include <engine/graphics/resources/level_mesh.h>
 #include <engine/graphics/entities/lights.h>
 #include <engine/graphics/resources/texture.h>
 #include <engine/graphics/resources/shader_program.h>
@@ -32,21 +36,21 @@ class Renderer
 public:
   static constexpr size_t MAX_DIR_LIGHTS = 8;
   static constexpr size_t MAX_VISIBLE_POINT_LIGHTS = 1024;
-
-  // WARNING: Keep value of this constant same as MAX_LIGHTS_PER_TILE in light_culling.comp.
-  static constexpr size_t MAX_LIGHTS_PER_TILE = 64;
-  static constexpr size_t LIGHT_CULLING_TILE_SIZE_X = 16;
-  static constexpr size_t LIGHT_CULLING_TILE_SIZE_Y = 16;
+  static constexpr size_t MAX_VISIBLE_SECTORS = 16384; // per frame, all recursion levels together
+  static constexpr size_t MAX_SECTOR_LIGHTS = 65536;   // lights in the lists of all visible sectors
+  static constexpr size_t MAX_LIGHT_BAKE_ENTRIES = 65536;
 
   static constexpr size_t MAX_SECTORS = 4096;
   static constexpr size_t MAX_WALLS = MAX_SECTORS * 8;
   static constexpr size_t MAX_PORTALS = MAX_SECTORS * 4;
+  static constexpr size_t MAX_BILLBOARD_INSTANCES = 16384; // per frame, all recursion levels together
 
   struct CameraData
   {
     const vec3& position;
     const mat4& view;
     const VisibilityTree& vis_tree;
+    u32 vis_node; // node of the "vis_tree" this camera sees
     const mat4& portal_dest_to_src;
     WallID portal_id = INVALID_WALL_ID;
   };
@@ -72,6 +76,9 @@ public:
   void update_sector_ssbos() const;
   void update_sector_heights(SectorID sector_id) const;
 
+  // Precomputes the shadow visibility of all point lights of the level
+  void bake_light_shadows() const;
+
   void set_shadows(bool shadows);
 
 private:
@@ -97,6 +104,13 @@ private:
     u32  walls_count;
   };
 
+  // Per-draw data of a sector, indexed by "a_draw_id" in "sector.vert"
+  struct SectorDrawGPU
+  {
+    u32 sector_id;
+    u32 visible_id; // record in the visible sectors SSBO with the lights
+  };
+
   struct WallGPU
   {
     vec2 start;
@@ -126,19 +140,14 @@ private:
   mutable ShaderProgramHandle m_gun_material;
   mutable ShaderProgramHandle m_light_material;
   mutable ShaderProgramHandle m_sector_material;
-  mutable ShaderProgramHandle m_light_culling_shader;
   mutable ShaderProgramHandle m_sky_box_material;
 
   // Registry used by the hot-reload loop.
   mutable std::vector<ShaderEntry> m_shader_entries;
 
-  mutable EntityRedundancyChecker m_light_checker;
   mutable EntityRedundancyChecker m_entity_checker;
 
   mutable SSBOBuffer<TextureGPU> m_textures_ssbo;
-  mutable SSBOBuffer<u32>        m_light_index_ssbo;
-  mutable SSBOBuffer<u32>        m_light_tiles_ssbo;
-  mutable SSBOBuffer<u32>        m_light_counter_ssbo;
 
   mutable SSBOBuffer<DirLightGPU>   m_dir_light_ssbo       { MAX_DIR_LIGHTS           };
   mutable SSBOBuffer<PointLightGPU> m_point_light_ssbo     { MAX_VISIBLE_POINT_LIGHTS };
@@ -147,8 +156,22 @@ private:
   mutable SSBOBuffer<mat4>          m_portal_matrices_ssbo { MAX_PORTALS              };
   mutable SSBOBuffer<mat4>          m_sector_matrices_ssbo { MAX_SECTORS              };
 
+  mutable SSBOBuffer<VisibleSectorGPU> m_visible_sectors_ssbo{ MAX_VISIBLE_SECTORS };
+  mutable SSBOBuffer<u32>              m_light_index_ssbo{ MAX_SECTOR_LIGHTS };
+  mutable SSBOBuffer<u32>              m_light_bake_ssbo{ MAX_LIGHT_BAKE_ENTRIES };
+
+  mutable SSBOBuffer<BillboardInstanceGPU> m_billboard_instances_ssbo{ MAX_BILLBOARD_INSTANCES };
+  mutable SSBOBuffer<SectorDrawGPU>        m_sector_draws_ssbo{ LevelMesh::MAX_DRAWS_PER_FRAME };
+
+  // Per-pass scratch of "render_sectors", kept to reuse the memory
+  mutable std::vector<SectorDrawGPU>             m_sector_draws;
+  mutable std::vector<DrawArraysIndirectCommand> m_sector_draw_commands;
+  GLuint                                         m_sector_indirect_buffer = 0;
+  mutable BillboardInstanceList            m_billboard_instances;
+  mutable SectorLightLists                 m_sector_lights;
+  mutable LightShadowBake                  m_light_bake;
+
   mutable std::vector<mat4> m_sector_matrices;
-  mutable std::unordered_map<u64, size_t> m_light_gpu_data_indices;
 
   GLuint m_g_buffer            = 0;
   GLuint m_g_position          = 0;
@@ -173,13 +196,17 @@ private:
   void check_shader_hot_reload() const;
 
   void do_geometry_pass(const CameraData& camera, const RenderGunProperties& gun) const;
-  void do_light_culling_pass(const CameraData& camera) const;
   void do_lighting_pass(const vec3& view_position) const;
 
   void update_ssbos() const;
 
-  void render_sectors(const CameraData& camera)  const;
-  void render_entities(const CameraData& camera) const;
+  // Starts a pass. Registers the visible sectors of the camera together with
+  // the lights that reach them and returns the ID of the first one, the rest
+  // follow in the order of the visibility tree.
+  u32  assign_sector_lights(const CameraData& camera) const;
+
+  void render_sectors(const CameraData& camera, u32 first_visible)  const;
+  void render_entities(const CameraData& camera, u32 first_visible) const;
   void render_portals(const CameraData& camera) const;
   void render_gun(const CameraData& cam, const RenderGunProperties& gun) const;
   void render_sky_box(const CameraData& camera) const;
@@ -0,0 +1,374 @@
+// Project Nuclidean Source File
+#include <engine/graphics/resources/level_mesh.h>
+#include <engine/map/map_system.h>
+
+#include <common.h>
+
+#include <glad/glad.h>
+
+#include <algorithm> // std::max, std::copy
+#include <cstring>   // std::memcmp
+#include <numeric>   // std::iota
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+/**
+ *  3 floats per position
+ *  3 floats per normal
+ *  1 float  per cumulative wall length
+ *  1 float  per texture id
+ *  1 float  per texture scale
+ *  1 float  per texture rotation
+ *  1 float  per texture tile rotations count
+ *  1 float  per texture tile rotation increment
+ *  2 floats per texture offset
+ * -------------------------------------
+ * 14 floats total
+ */
+constexpr u32 SECTOR_VERTEX_SIZE  = 14;
+constexpr u32 SECTOR_VERTEX_BYTES = SECTOR_VERTEX_SIZE * sizeof(f32);
+
+// Attribute location of the draw ID, see "sector.vert"
+constexpr GLuint DRAW_ID_ATTRIBUTE = 9;
+
+// Changed runs of vertices closer than this get uploaded together, a few
+// unchanged vertices are cheaper than another "glBufferSubData" call
+constexpr u32 MERGE_GAP_VERTICES = 6;
+
+//==============================================================================
+// Calls "on_run(first, count)" for every run of vertices that differ between
+// "old_vertices" and "new_vertices", both "count" vertices long.
+template<typename F>
+static void for_each_changed_run
+(
+  const f32* old_vertices,
+  const f32* new_vertices,
+  u32        count,
+  F&&        on_run
+)
+{
+  constexpr u32 NOT_FOUND = ~0u;
+
+  u32 run_begin = NOT_FOUND;
+  u32 run_end   = 0; // one past the last changed vertex
+
+  for (u32 i = 0; i < count; ++i)
+  {
+    const u32 offset  = i * SECTOR_VERTEX_SIZE;
+    const bool change = std::memcmp
+    (
+      old_vertices + offset, new_vertices + offset, SECTOR_VERTEX_BYTES
+    ) != 0;
+
+    if (!change)
+    {
+      continue;
+    }
+
+    if (run_begin != NOT_FOUND && i - run_end > MERGE_GAP_VERTICES)
+    {
+      on_run(run_begin, run_end - run_begin);
+      run_begin = NOT_FOUND;
+    }
+
+    if (run_begin == NOT_FOUND)
+    {
+      run_begin = i;
+    }
+
+    run_end = i + 1;
+  }
+
+  if (run_begin != NOT_FOUND)
+  {
+    on_run(run_begin, run_end - run_begin);
+  }
+}
+
+//==============================================================================
+LevelMesh::~LevelMesh()
+{
+  this->unload();
+}
+
+//==============================================================================
+void LevelMesh::build(const MapSectors& map)
+{
+  this->unload();
+
+  m_ranges.resize(map.sectors.size());
+
+  for (SectorID sector_id = 0; sector_id < map.sectors.size(); ++sector_id)
+  {
+    const u32 first = cast<u32>(m_vertices.size() / SECTOR_VERTEX_SIZE);
+    map.sector_to_vertices(sector_id, m_vertices);
+
+    const u32 count    = cast<u32>(m_vertices.size() / SECTOR_VERTEX_SIZE) - first;
+    const u32 capacity = calc_sector_capacity(count);
+
+    m_ranges[sector_id] = SectorRange{.first = first, .count = count, .capacity = capacity};
+
+    // The spare space is never drawn
+    m_vertices.resize((first + capacity) * SECTOR_VERTEX_SIZE, 0.0f);
+  }
+
+  m_vertex_end = cast<u32>(m_vertices.size() / SECTOR_VERTEX_SIZE);
+
+  // Leave some space at the end for the sectors that outgrow their range
+  this->create_vertex_buffer(std::max(m_vertex_end + m_vertex_end / 4, 1u));
+  this->upload_vertices(0, m_vertex_end);
+
+  // Per-draw ID, the vertex shader gets the "base_instance" of the command
+  std::vector<u32> draw_ids(MAX_DRAWS_PER_FRAME);
+  std::iota(draw_ids.begin(), draw_ids.end(), 0u);
+
+  glGenBuffers(1, &m_draw_id_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_draw_id_vbo);
+  glBufferData(GL_ARRAY_BUFFER, draw_ids.size() * sizeof(u32), draw_ids.data(), GL_STATIC_DRAW);
+
+  glGenVertexArrays(1, &m_vao);
+  this->setup_vertex_array();
+}
+
+//==============================================================================
+void LevelMesh::update_sector(const MapSectors& map, SectorID sector_id)
+{
+  nc_assert(sector_id < m_ranges.size());
+
+  m_scratch.clear();
+  map.sector_to_vertices(sector_id, m_scratch);
+
+  SectorRange& range = m_ranges[sector_id];
+  const u32 count = cast<u32>(m_scratch.size() / SECTOR_VERTEX_SIZE);
+
+  if (count <= range.capacity)
+  {
+    // Patch only what has changed in place, the stale vertices after "count"
+    // are not drawn.
+    f32* old_vertices = m_vertices.data() + range.first * SECTOR_VERTEX_SIZE;
+    for_each_changed_run(old_vertices, m_scratch.data(), count, [&](u32 first, u32 run_count)
+    {
+      std::copy
+      (
+        m_scratch.begin() + first * SECTOR_VERTEX_SIZE,
+        m_scratch.begin() + (first + run_count) * SECTOR_VERTEX_SIZE,
+        old_vertices + first * SECTOR_VERTEX_SIZE
+      );
+
+      this->upload_vertices(range.first + first, run_count);
+    });
+
+    range.count = count;
+  }
+  else
+  {
+    // Does not fit anymore, move the sector to the end of the buffer. The old
+    // range stays unused until the next rebuild of the level.
+    const u32 capacity = calc_sector_capacity(count);
+    if (m_vertex_end + capacity > m_vertex_capacity)
+    {
+      const GLuint old_vbo = m_vbo;
+
+      glGenBuffers(1, &m_vbo);
+      glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+      m_vertex_capacity = std::max(m_vertex_capacity * 2, m_vertex_end + capacity);
+      glBufferData(GL_ARRAY_BUFFER, m_vertex_capacity * SECTOR_VERTEX_BYTES, nullptr, GL_DYNAMIC_DRAW);
+      m_vertices.resize(m_vertex_capacity * SECTOR_VERTEX_SIZE, 0.0f);
+
+      glBindBuffer(GL_COPY_READ_BUFFER, old_vbo);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, m_vertex_end * SECTOR_VERTEX_BYTES);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+      glDeleteBuffers(1, &old_vbo);
+
+      this->setup_vertex_array();
+    }
+
+    range.first    = m_vertex_end;
+    range.count    = count;
+    range.capacity = capacity;
+    m_vertex_end  += capacity;
+
+    std::copy(m_scratch.begin(), m_scratch.end(), m_vertices.begin() + range.first * SECTOR_VERTEX_SIZE);
+    this->upload_vertices(range.first, count);
+  }
+}
+
+//==============================================================================
+void LevelMesh::unload()
+{
+  if (m_vao != 0)
+  {
+    glDeleteVertexArrays(1, &m_vao);
+    m_vao = 0;
+  }
+
+  const GLuint buffers[] = {m_vbo, m_draw_id_vbo};
+  if (m_vbo != 0 || m_draw_id_vbo != 0)
+  {
+    glDeleteBuffers(2, buffers);
+  }
+
+  m_vbo             = 0;
+  m_draw_id_vbo     = 0;
+  m_vertex_capacity = 0;
+  m_vertex_end      = 0;
+  m_ranges.clear();
+  m_vertices.clear();
+}
+
+//==============================================================================
+const LevelMesh::SectorRange& LevelMesh::get_range(SectorID sector) const
+{
+  nc_assert(sector < m_ranges.size());
+  return m_ranges[sector];
+}
+
+//==============================================================================
+GLuint LevelMesh::get_vao() const
+{
+  return m_vao;
+}
+
+//==============================================================================
+GLenum LevelMesh::get_draw_mode() const
+{
+  return GL_TRIANGLES;
+}
+
+//==============================================================================
+void LevelMesh::create_vertex_buffer(u32 vertex_capacity)
+{
+  m_vertex_capacity = vertex_capacity;
+  m_vertices.resize(m_vertex_capacity * SECTOR_VERTEX_SIZE, 0.0f);
+
+  glGenBuffers(1, &m_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+  glBufferData(GL_ARRAY_BUFFER, m_vertex_capacity * SECTOR_VERTEX_BYTES, nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//==============================================================================
+void LevelMesh::upload_vertices(u32 first, u32 count)
+{
+  glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+  glBufferSubData
+  (
+    GL_ARRAY_BUFFER,
+    first * SECTOR_VERTEX_BYTES,
+    count * SECTOR_VERTEX_BYTES,
+    m_vertices.data() + first * SECTOR_VERTEX_SIZE
+  );
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//==============================================================================
+void LevelMesh::setup_vertex_array()
+{
+  glBindVertexArray(m_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+
+  //position attribute
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(0));
+  glEnableVertexAttribArray(0);
+  // normal attribute
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(3 * sizeof(f32)));
+  glEnableVertexAttribArray(1);
+  // cumulative wall length attribute
+  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(6 * sizeof(f32)));
+  glEnableVertexAttribArray(2);
+  // texture id attribute
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(7 * sizeof(f32)));
+  glEnableVertexAttribArray(3);
+  // texture scale attribute
+  glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(8 * sizeof(f32)));
+  glEnableVertexAttribArray(4);
+  // texture rotation attribute
+  glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(9 * sizeof(f32)));
+  glEnableVertexAttribArray(5);
+  // texture tile rotations count attribute
+  glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(10 * sizeof(f32)));
+  glEnableVertexAttribArray(6);
+  // texture tile rotation increment attribute
+  glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(11 * sizeof(f32)));
+  glEnableVertexAttribArray(7);
+  // texture offset attribute
+  glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, SECTOR_VERTEX_BYTES, recast<void*>(12 * sizeof(f32)));
+  glEnableVertexAttribArray(8);
+
+  // draw id attribute, advances once per instance and starts at "base_instance"
+  glBindBuffer(GL_ARRAY_BUFFER, m_draw_id_vbo);
+  glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(u32), recast<void*>(0));
+  glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+  glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//==============================================================================
+u32 LevelMesh::calc_sector_capacity(u32 vertex_count)
+{
+  // One extra wall quad and a quarter on top of that
+  return vertex_count + vertex_count / 4 + 6;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool level_mesh_test_changed_runs(unit_test::TestCtx& /*ctx*/)
+{
+  constexpr u32 VERTEX_COUNT = 32;
+
+  std::vector<f32> old_vertices(VERTEX_COUNT * SECTOR_VERTEX_SIZE, 1.0f);
+  std::vector<f32> new_vertices = old_vertices;
+
+  // Floor at the start, two walls close to each other and one far away
+  new_vertices[0  * SECTOR_VERTEX_SIZE + 1] = 2.0f;
+  new_vertices[1  * SECTOR_VERTEX_SIZE + 1] = 2.0f;
+  new_vertices[10 * SECTOR_VERTEX_SIZE + 1] = 2.0f;
+  new_vertices[12 * SECTOR_VERTEX_SIZE + 1] = 2.0f;
+  new_vertices[30 * SECTOR_VERTEX_SIZE + 1] = 2.0f;
+
+  std::vector<std::pair<u32, u32>> runs;
+  for_each_changed_run
+  (
+    old_vertices.data(), new_vertices.data(), VERTEX_COUNT,
+    [&](u32 first, u32 count) { runs.emplace_back(first, count); }
+  );
+
+  const std::vector<std::pair<u32, u32>> expected
+  {
+    {0, 2}, {10, 3}, {30, 1},
+  };
+
+  if (runs != expected)
+  {
+    nc_warn("Unexpected runs of changed vertices, got {} runs.", runs.size());
+    NC_TEST_FAIL;
+  }
+
+  // Nothing changed, nothing to upload
+  runs.clear();
+  for_each_changed_run
+  (
+    old_vertices.data(), old_vertices.data(), VERTEX_COUNT,
+    [&](u32 first, u32 count) { runs.emplace_back(first, count); }
+  );
+
+  if (!runs.empty())
+  {
+    nc_warn("Unchanged vertices should not be uploaded.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(level_mesh_test_changed_runs)->name("Level Mesh Changed Runs");
+#endif
+
+}
@@ -0,0 +1,90 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <engine/graphics/gl_types.h>
+#include <engine/map/map_types.h>
+
+#include <vector>
+
+namespace nc
+{
+
+struct MapSectors;
+
+// Layout of one "glMultiDrawArraysIndirect" command
+struct DrawArraysIndirectCommand
+{
+  u32 count;
+  u32 instance_count;
+  u32 first;
+  u32 base_instance;
+};
+
+// Geometry of all sectors of the level in a single vertex buffer. Every
+// sector owns a range of it, so all visible sectors can be drawn by one
+// indirect multi-draw call.
+//
+// The "base_instance" of a draw command is fed into the vertex shader as the
+// "a_draw_id" attribute, which indexes the per-draw data (sector ID, matrix
+// ID) in an SSBO. This works in core OpenGL 4.3 without the draw parameters
+// extension.
+class LevelMesh
+{
+public:
+  // Max number of draw commands within one frame over all portal recursions.
+  // The "a_draw_id" attribute can not address more than that.
+  static constexpr u32 MAX_DRAWS_PER_FRAME = 16384;
+
+  // Range of vertices of a sector in the vertex buffer
+  struct SectorRange
+  {
+    u32 first    = 0;
+    u32 count    = 0;
+    u32 capacity = 0; // max vertex count before the sector has to move
+  };
+
+  LevelMesh() = default;
+  ~LevelMesh();
+
+  LevelMesh(const LevelMesh&)            = delete;
+  LevelMesh& operator=(const LevelMesh&) = delete;
+
+  // Builds the geometry of all sectors, throws away the old one.
+  void build(const MapSectors& map);
+
+  // Rebuilds the geometry of one sector, e.g. after its height changed. Only
+  // the vertices that actually changed are uploaded, a moving door patches
+  // just its floor/ceiling and the wall segments around it. If the sector no
+  // longer fits then it is moved to the end of the buffer.
+  // Does not allocate once the scratch buffer grew to the sector size.
+  void update_sector(const MapSectors& map, SectorID sector);
+
+  void unload();
+
+  const SectorRange& get_range(SectorID sector) const;
+  GLuint             get_vao() const;
+  GLenum             get_draw_mode() const;
+
+private:
+  void create_vertex_buffer(u32 vertex_capacity);
+  void upload_vertices(u32 first, u32 count);
+  void setup_vertex_array();
+
+  // Sectors get a bit of a space to grow, so moving doors do not have to be
+  // relocated all the time.
+  static u32 calc_sector_capacity(u32 vertex_count);
+
+  std::vector<SectorRange> m_ranges;
+  std::vector<f32>         m_vertices; // CPU copy of the vertex buffer
+  std::vector<f32>         m_scratch;  // vertices of a single sector
+
+  GLuint m_vao             = 0;
+  GLuint m_vbo             = 0;
+  GLuint m_draw_id_vbo     = 0;
+  u32    m_vertex_capacity = 0; // of the whole buffer
+  u32    m_vertex_end      = 0; // end of the last sector range
+};
+
+}
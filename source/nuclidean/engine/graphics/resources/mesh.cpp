@@ -256,108 +256,6 @@ MeshHandle MeshManager::create_texturable(ResLifetime lifetime, const f32* data,
   return mesh;
 }
 
-//==============================================================================
-void MeshManager::populate_sector_mesh(MeshHandle& mesh, const f32* data, u32 count)
-{
-  /**
-   *  3 floats per position
-   *  3 floats per normal
-   *  1 float  per cumulative wall length
-   *  1 float  per texture id
-   *  1 float  per texture scale
-   *  1 float  per texture rotation
-   *  1 float  per texture tile rotations count
-   *  1 float  per texture tile rotation increment
-   *  2 floats per texture offset
-   * -------------------------------------
-   * 14 floats total
-   */
-  constexpr u32 VERTEX_SIZE = 14;
-
-  mesh.m_vertex_count = count / VERTEX_SIZE;
-
-  // generate buffers
-  glGenVertexArrays(1, &mesh.m_vao);
-  glGenBuffers(1, &mesh.m_vbo);
-
-  // setup vao
-  glBindVertexArray(mesh.m_vao);
-  // vertex buffer
-  glBindBuffer(GL_ARRAY_BUFFER, mesh.m_vbo);
-  glBufferData(GL_ARRAY_BUFFER, count * sizeof(f32), data, GL_STATIC_DRAW);
-  //position attribute
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(0));
-  glEnableVertexAttribArray(0);
-  // normal attribute
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(3 * sizeof(f32)));
-  glEnableVertexAttribArray(1);
-  // cumulative wall length attribute
-  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(6 * sizeof(f32)));
-  glEnableVertexAttribArray(2);
-  // texture id attribute
-  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(7 * sizeof(f32)));
-  glEnableVertexAttribArray(3);
-  // texture scale attribute
-  glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(8 * sizeof(f32)));
-  glEnableVertexAttribArray(4);
-  // texture rotation attribute
-  glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(9 * sizeof(f32)));
-  glEnableVertexAttribArray(5);
-  // texture tile rotations count attribute
-  glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(10 * sizeof(f32)));
-  glEnableVertexAttribArray(6);
-  // texture tile rotation increment attribute
-  glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(11 * sizeof(f32)));
-  glEnableVertexAttribArray(7);
-  // texture offset attribute
-  glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(f32), recast<void*>(12 * sizeof(f32)));
-  glEnableVertexAttribArray(8);
-
-  glBindVertexArray(0);
-}
-
-//==============================================================================
-MeshHandle MeshManager::create_sector(ResLifetime lifetime, const f32* data, u32 count, GLenum draw_mode)
-{
-  MeshHandle mesh;
-  mesh.m_lifetime = lifetime;
-  mesh.m_generation = MeshManager::m_generation;
-  mesh.m_draw_mode = draw_mode;
-
-  populate_sector_mesh(mesh, data, count);
-
-  // store created mesh
-  auto& storage = this->get_storage(lifetime);
-  mesh.m_index = cast<u16>(storage.size());
-  storage.push_back(mesh);
-
-  return mesh;
-}
-
-//==============================================================================
-void MeshManager::recreate_sector(MeshHandle& mesh, const f32* data, u32 count)
-{
-  // clean it up
-  if (mesh.m_vao != 0)
-  {
-    glDeleteVertexArrays(1, &mesh.m_vao);
-    mesh.m_vao = 0;
-  }
-
-  if (mesh.m_vbo != 0)
-  {
-    glDeleteBuffers(1, &mesh.m_vbo);
-    mesh.m_vbo = 0;
-  }
-
-  // repopulate it with a new data
-  populate_sector_mesh(mesh, data, count);
-
-  // and replace it in the storage
-  auto& storage = this->get_storage(mesh.m_lifetime);
-  storage[mesh.m_index] = mesh;
-}
-
 //==============================================================================
 void MeshManager::unload(ResLifetime lifetime)
 {
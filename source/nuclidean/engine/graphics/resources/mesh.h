@@ -15,7 +15,7 @@ namespace nc
  * Mesh contains information about object geometry. This class represent a only a light-weight handler. Real mesh is
  * stored in GPU memory.
  * 
- * WARNING: Later on, there will be change to indirect rendering, so this class content will probably change!
+ * NOTE: Sector geometry is not stored in meshes, see "LevelMesh".
  */
 class MeshHandle
 {
@@ -48,8 +48,6 @@ private:
 class MeshManager
 {
 /*
-  * TODO: In future, there will be need for function for which would indicate start and end of batch mesh
-  * loading/creation in order to support indirect rendering
   * TODO: Load mesh form file
 */
 public:
@@ -66,14 +64,6 @@ public:
    * Creates mesh, on which texture can be applied, from vertex data and stores it in GPU memory.
    */
   MeshHandle create_texturable(ResLifetime lifetime, const f32* data, u32 count, GLenum draw_mode = GL_TRIANGLES);
-  /**
-   * Creates mesh, for a sector, from vertex data and stores it in GPU memory.
-   */
-  MeshHandle create_sector(ResLifetime lifetime, const f32* data, u32 count, GLenum draw_mode = GL_TRIANGLES);
-  /*
-  * Unloads the old mesh and recreates it once again.
-  */
-  void recreate_sector(MeshHandle& handle, const f32* data, u32 count);
   /**
    * Unloads all meshes with specified lifetime. 
    */
@@ -89,8 +79,6 @@ private:
   inline static std::unique_ptr<MeshManager> m_instance = nullptr;
   MeshManager() {}
 
-  void populate_sector_mesh(MeshHandle& mesh, const f32* data, u32 count);
-
   static inline u16 m_generation = 0;
 
   std::vector<MeshHandle>& get_storage(ResLifetime lifetime);
@@ -1,14 +1,23 @@
 // Project Nuclidean Source File
 #include <engine/graphics/resources/texture.h>
 
+#include <engine/core/job_system.h>
+
 #include <common.h>
 #include <logging.h>
+#include <mapped_file.h>
+#include <profiling.h>
+#include <math/utils.h>
 
 #include <glad/glad.h>
 #include <stb/stb_image.h>
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <string_view>
 #include <vector>
 
 namespace nc
@@ -106,12 +115,101 @@ TextureHandle::TextureHandle
   m_height(height)
 {}
 
+//==============================================================================
+SpriteTextures::SpriteTextures()
+{
+  dirs.fill(INVALID_TEXTURE_ID);
+}
+
 //==============================================================================
 vec2 TextureAtlasBundle::get_size() const
 {
   return vec2(width, height);
 }
 
+//==============================================================================
+static constexpr u32 ATLAS_MAX_MIP_LEVEL = 4;
+static constexpr u32 ATLAS_GUTTER = 1u << ATLAS_MAX_MIP_LEVEL;
+
+// The packed atlases of a directory are cached next to it in "<directory>.ncatlas".
+// Bump the version when the packing or the format of the atlases changes.
+static constexpr cstr ATLAS_CACHE_SUFFIX  = ".ncatlas";
+static constexpr u32  ATLAS_CACHE_VERSION = 1;
+
+NC_PUSH_PACKED
+struct AtlasCacheHeader
+{
+  static constexpr u64  SIGNATURE_SIZE = 6;
+  static constexpr cstr SIGNATURE      = "ncatls";
+
+  char signature[SIGNATURE_SIZE];
+  u32  version     = ATLAS_CACHE_VERSION;
+  u64  source_hash = 0; // of the paths, sizes and write times of all the source textures
+  u32  width       = 0;
+  u32  height      = 0;
+  u32  texture_cnt = 0;
+};
+NC_POP_PACKED
+
+// One texture in the cache, followed by "name_length" characters of its name.
+// The textures are in the order of their IDs and are followed by the pixels of
+// the atlases in the order of "ATLAS_FORMATS".
+NC_PUSH_PACKED
+struct AtlasCacheEntry
+{
+  u32 x           = 0;
+  u32 y           = 0;
+  u32 width       = 0;
+  u32 height      = 0;
+  u32 name_length = 0;
+};
+NC_POP_PACKED
+
+// How each of the atlases of a bundle is stored on the GPU
+struct AtlasFormat
+{
+  GLint  internal_format;
+  GLenum format;
+  u32    channels;
+  GLint  min_filter;
+  GLint  mag_filter;
+  bool   mipmaps;
+};
+
+static constexpr u32 ATLAS_CNT = 4;
+static constexpr AtlasFormat ATLAS_FORMATS[ATLAS_CNT]
+{
+  {GL_RGBA8, GL_RGBA, 4, GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST, true},  // diffuse
+  {GL_RGB8,  GL_RGB,  3, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR,  true},  // normal
+  {GL_R8,    GL_RED,  1, GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST, true},  // specular
+  {GL_RGB8,  GL_RGB,  3, GL_LINEAR,               GL_NEAREST, false}, // emissive
+};
+
+//==============================================================================
+// In the order of "ATLAS_FORMATS"
+static std::array<GLuint*, ATLAS_CNT> get_atlas_handles(TextureAtlasBundle& bundle)
+{
+  return {&bundle.diffuse_handle, &bundle.normal_handle, &bundle.specular_handle, &bundle.emissive_handle};
+}
+
+//==============================================================================
+// Creates the atlas texture and leaves it bound, "data" can be null
+static GLuint create_atlas_texture(const AtlasFormat& format, int width, int height, const void* data)
+{
+  GLuint handle = 0;
+  glGenTextures(1, &handle);
+  glBindTexture(GL_TEXTURE_2D, handle);
+  glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width, height, 0, format.format, GL_UNSIGNED_BYTE, data);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, format.min_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, format.mag_filter);
+  if (format.mipmaps)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MAX_MIP_LEVEL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  return handle;
+}
+
 //==============================================================================
 TextureManager& TextureManager::get()
 {
@@ -126,6 +224,13 @@ TextureManager& TextureManager::get()
 //==============================================================================
 void TextureManager::load_directory(ResLifetime lifetime, const std::string& path)
 {
+  NC_SCOPE_PROFILER(LoadTextureDirectory)
+
+  std::vector<std::filesystem::path> texture_paths;
+
+  // Identifies the version of all of the source textures without reading them
+  u64 source_hash = ATLAS_CACHE_VERSION;
+
   for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
   {
     const std::filesystem::path& entry_path = entry.path();
@@ -136,11 +241,19 @@ void TextureManager::load_directory(ResLifetime lifetime, const std::string& pat
     const std::filesystem::path extension = entry_path.extension();
     if (extension == ".png" || extension == ".jpg")
     {
+      std::error_code error;
+      const u64 file_size  = entry.file_size(error);
+      const u64 write_time = cast<u64>(entry.last_write_time(error).time_since_epoch().count());
+
+      source_hash = hash_combine(source_hash, std::hash<std::string>{}(entry_path.string()));
+      source_hash = hash_combine(source_hash, file_size);
+      source_hash = hash_combine(source_hash, write_time);
+
       const std::string stem = entry_path.stem().string();
       if (stem.ends_with("_normal") || stem.ends_with("_specular") || stem.ends_with("_emissive"))
         continue;
 
-      load_texture(entry_path);
+      texture_paths.push_back(entry_path);
     }
     // not only cube maps have .hdr extension, but for now we are using HDR textures only for cube maps
     else if (extension == ".hdr")
@@ -149,7 +262,55 @@ void TextureManager::load_directory(ResLifetime lifetime, const std::string& pat
     }
   }
 
+  const std::string cache_path = path + ATLAS_CACHE_SUFFIX;
+  if (load_atlas_cache(lifetime, cache_path, source_hash))
+  {
+    return;
+  }
+
+  // Decoding dominates the startup, so it runs on all threads. Each texture
+  // gets its own slot in the order of the directory walk, so the texture IDs
+  // stay the same as when loading them one by one.
+  std::vector<LoadData> decoded(texture_paths.size());
+  JobSystem::get().parallel_for(texture_paths.size(), 1, [&](u64 idx)
+  {
+    decode_texture(texture_paths[idx], decoded[idx]);
+  });
+
+  for (LoadData& load_data : decoded)
+  {
+    for (const std::string& error : load_data.errors)
+    {
+      nc_crit("{}", error);
+    }
+
+    if (load_data.diffuse_data.empty())
+    {
+      continue;
+    }
+
+    m_load_rects.push_back(stbrp_rect
+    {
+      .id = cast<int>(m_load_rects.size()),
+      .w = load_data.width  + cast<int>(ATLAS_GUTTER) * 2,
+      .h = load_data.height + cast<int>(ATLAS_GUTTER) * 2,
+      .x = 0,
+      .y = 0,
+      .was_packed = 0,
+    });
+    m_load_data.push_back(std::move(load_data));
+  }
+
+  std::vector<std::string> names;
+  for (const LoadData& load_data : m_load_data)
+  {
+    names.push_back(load_data.name);
+  }
+
+  const TextureID first_texture = cast<TextureID>(m_textures.size());
   finish_load(lifetime);
+
+  save_atlas_cache(lifetime, cache_path, source_hash, names, first_texture);
 }
 
 //==============================================================================
@@ -166,6 +327,11 @@ void TextureManager::unload(ResLifetime lifetime)
   bundle.emissive_handle = 0;
   bundle.textures.clear();
 
+  if (lifetime == ResLifetime::Game)
+  {
+    m_sprites.clear();
+  }
+
   m_generation++;
 
   // TODO: delete texture from m_textures
@@ -220,6 +386,13 @@ GLuint TextureManager::get_equirectangular_map(const std::string& name, ResLifet
   return get_equirectangular_maps(lifetime).at(name);
 }
 
+//==============================================================================
+const SpriteTextures* TextureManager::find_sprite(const Token& sprite) const
+{
+  const auto it = m_sprites.find(sprite);
+  return it != m_sprites.end() ? &it->second : nullptr;
+}
+
 //==============================================================================
 TextureManager::TextureManager()
 {
@@ -297,6 +470,45 @@ void TextureManager::create_error_texture()
   glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+//==============================================================================
+void TextureManager::register_sprite_texture(ResLifetime lifetime, const std::string& name, TextureID texture_id)
+{
+  // The sprites are looked up only among the game textures
+  if (lifetime != ResLifetime::Game)
+  {
+    return;
+  }
+
+  const bool fits_token = name.size() <= Token::MAX_LENGTH && std::all_of(name.begin(), name.end(), [](char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+  });
+
+  if (!fits_token)
+  {
+    return;
+  }
+
+  // Every texture can be a mono sprite
+  m_sprites[Token(name)].mono = texture_id;
+
+  // And a direction of an 8 directional one
+  constexpr std::array<std::string_view, SpriteDirection::count> SUFFIXES
+  {
+    "_d", "_dr", "_r", "_ur", "_u", "_ul", "_l", "_dl",
+  };
+
+  for (u8 dir = 0; dir < SpriteDirection::count; ++dir)
+  {
+    const std::string_view suffix = SUFFIXES[dir];
+    if (name.size() > suffix.size() && name.ends_with(suffix))
+    {
+      const std::string_view prefix(name.data(), name.size() - suffix.size());
+      m_sprites[Token(prefix)].dirs[dir] = texture_id;
+    }
+  }
+}
+
 //==============================================================================
 std::string TextureManager::get_name(const std::string& path) const
 {
@@ -321,10 +533,6 @@ static GLenum gl_format_from_channels(int channels)
   }
 }
 
-//==============================================================================
-static constexpr u32 ATLAS_MAX_MIP_LEVEL = 4;
-static constexpr u32 ATLAS_GUTTER = 1u << ATLAS_MAX_MIP_LEVEL;
-
 //==============================================================================
 static std::vector<unsigned char> pad_with_edge_extend(
   const unsigned char* source, int width, int height, u32 channels, u32 gutter)
@@ -350,7 +558,7 @@ static std::vector<unsigned char> pad_with_edge_extend(
 }
 
 //==============================================================================
-void TextureManager::load_texture(const std::filesystem::path& path)
+void TextureManager::decode_texture(const std::filesystem::path& path, LoadData& out) const
 {
   // TODO: use error texture when loading fails
 
@@ -358,14 +566,30 @@ void TextureManager::load_texture(const std::filesystem::path& path)
   const std::string path_stem = path.stem().string();
   const std::string path_extension = path.extension().string();
 
+  out.name = get_name(path_string);
+
   int width, height, channels;
   unsigned char* diffuse_data = stbi_load(path_string.c_str(), &width, &height, &channels, 0);
   if (diffuse_data == nullptr)
   {
-    nc_crit("Cannot load texture \"{}\": {}", path_string, stbi_failure_reason());
+    out.errors.push_back(std::format("Cannot load texture \"{}\": {}", path_string, stbi_failure_reason()));
+    return;
+  }
+
+  const GLenum diffuse_format = gl_format_from_channels(channels);
+  if (diffuse_format != GL_RGB && diffuse_format != GL_RGBA)
+  {
+    out.errors.push_back(std::format("Cannot load image \"{}\": {}", path_string, "Texture format not supported."));
+    stbi_image_free(diffuse_data);
     return;
   }
 
+  out.width            = width;
+  out.height           = height;
+  out.diffuse_channels = channels;
+  out.diffuse_data     = pad_with_edge_extend(diffuse_data, width, height, cast<u32>(channels), ATLAS_GUTTER);
+  stbi_image_free(diffuse_data);
+
   const std::filesystem::path parent = path.parent_path();
   const std::array<std::string, 3> texture_paths
   {
@@ -373,65 +597,39 @@ void TextureManager::load_texture(const std::filesystem::path& path)
     (parent / (path_stem + "_specular" + path_extension)).string(),
     (parent / (path_stem + "_emissive" + path_extension)).string(),
   };
-  std::array<unsigned char*, 3> texture_data{};
-  std::array<int, 3> texture_channels{};
+  const std::array<LoadData::Pixels*, 3> texture_data
+  {
+    &out.normal_data, &out.specular_data, &out.emissive_data,
+  };
+  const std::array<int*, 3> texture_channels
+  {
+    &out.normal_channels, &out.specular_channels, &out.emissive_channels,
+  };
   for (size_t i = 0; i < texture_paths.size(); ++i)
   {
     if (!std::filesystem::exists(texture_paths[i]))
       continue;
 
     int aux_width, aux_height, aux_channels;
-    texture_data[i] = stbi_load(texture_paths[i].c_str(), &aux_width, &aux_height, &aux_channels, 0);
-    if (texture_data[i] == nullptr)
+    unsigned char* aux_data = stbi_load(texture_paths[i].c_str(), &aux_width, &aux_height, &aux_channels, 0);
+    if (aux_data == nullptr)
     {
-      nc_crit("Cannot load texture \"{}\": {}", texture_paths[i], stbi_failure_reason());
+      out.errors.push_back(std::format("Cannot load texture \"{}\": {}", texture_paths[i], stbi_failure_reason()));
       continue;
     }
     if (aux_width != width || aux_height != height)
     {
-      nc_crit(
+      out.errors.push_back(std::format(
         "Auxiliary texture \"{}\" dimensions ({}x{}) do not match base \"{}\" ({}x{}). Skipping.",
-        texture_paths[i], aux_width, aux_height, path_string, width, height);
-      stbi_image_free(texture_data[i]);
-      texture_data[i] = nullptr;
+        texture_paths[i], aux_width, aux_height, path_string, width, height));
+      stbi_image_free(aux_data);
       continue;
     }
-    texture_channels[i] = aux_channels;
-  }
 
-  const GLenum diffuse_format = gl_format_from_channels(channels);
-  if (diffuse_format != GL_RGB && diffuse_format != GL_RGBA)
-  {
-    nc_crit("Cannot load image \"{}\": {}", path_string, "Texture format not supported.");
-    stbi_image_free(diffuse_data);
-    for (unsigned char* data : texture_data)
-      stbi_image_free(data);
-    return;
+    *texture_channels[i] = aux_channels;
+    *texture_data[i]     = pad_with_edge_extend(aux_data, width, height, cast<u32>(aux_channels), ATLAS_GUTTER);
+    stbi_image_free(aux_data);
   }
-
-  m_load_rects.push_back(stbrp_rect
-  {
-    .id = cast<int>(m_load_rects.size()),
-    .w = width  + cast<int>(ATLAS_GUTTER) * 2,
-    .h = height + cast<int>(ATLAS_GUTTER) * 2,
-    .x = 0,
-    .y = 0,
-    .was_packed = 0,
-  });
-  m_load_data.push_back(LoadData
-  {
-    .width = width,
-    .height = height,
-    .diffuse_channels  = channels,
-    .normal_channels   = texture_channels[0],
-    .specular_channels = texture_channels[1],
-    .emissive_channels = texture_channels[2],
-    .diffuse_data = diffuse_data,
-    .normal_data = texture_data[0],
-    .specular_data = texture_data[1],
-    .emissive_data = texture_data[2],
-    .name = get_name(path_string),
-  });
 }
 
 //==============================================================================
@@ -501,24 +699,13 @@ void TextureManager::finish_load(ResLifetime lifetime)
 
   // diffuse texture atlas
   {
-    glGenTextures(1, &bundle.diffuse_handle);
-    glBindTexture(GL_TEXTURE_2D, bundle.diffuse_handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_width, target_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MAX_MIP_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    bundle.diffuse_handle = create_atlas_texture(ATLAS_FORMATS[0], target_width, target_height, nullptr);
 
     for (u32 i = 0; i < m_load_rects.size(); ++i)
     {
       const auto& rect = m_load_rects[i];
       const auto& load_data = m_load_data[i];
 
-      const std::vector<unsigned char> padded = pad_with_edge_extend(
-        load_data.diffuse_data, load_data.width, load_data.height,
-        cast<u32>(load_data.diffuse_channels), ATLAS_GUTTER);
-
       glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
@@ -528,9 +715,8 @@ void TextureManager::finish_load(ResLifetime lifetime)
         rect.h,
         gl_format_from_channels(load_data.diffuse_channels),
         GL_UNSIGNED_BYTE,
-        padded.data()
+        load_data.diffuse_data.data()
       );
-      stbi_image_free(load_data.diffuse_data);
 
       const TextureHandle handle(
         lifetime,
@@ -542,7 +728,10 @@ void TextureManager::finish_load(ResLifetime lifetime)
         cast<TextureID>(m_textures.size())
       );
 
-      bundle.textures.emplace(load_data.name, handle);
+      if (bundle.textures.emplace(load_data.name, handle).second)
+      {
+        register_sprite_texture(lifetime, load_data.name, handle.get_texture_id());
+      }
       m_textures.push_back(handle);
     }
 
@@ -551,14 +740,7 @@ void TextureManager::finish_load(ResLifetime lifetime)
 
   // normal texture atlas
   {
-    glGenTextures(1, &bundle.normal_handle);
-    glBindTexture(GL_TEXTURE_2D, bundle.normal_handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, target_width, target_height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MAX_MIP_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    bundle.normal_handle = create_atlas_texture(ATLAS_FORMATS[1], target_width, target_height, nullptr);
 
     std::vector<unsigned char> identity(cast<size_t>(target_width * target_height * 3));
     for (size_t texel = 0; texel < identity.size(); texel += 3)
@@ -574,13 +756,9 @@ void TextureManager::finish_load(ResLifetime lifetime)
       const auto& rect = m_load_rects[i];
       const auto& load_data = m_load_data[i];
 
-      if (load_data.normal_data == nullptr)
+      if (load_data.normal_data.empty())
         continue;
 
-      const std::vector<unsigned char> padded = pad_with_edge_extend(
-        load_data.normal_data, load_data.width, load_data.height,
-        cast<u32>(load_data.normal_channels), ATLAS_GUTTER);
-
       glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
@@ -590,9 +768,8 @@ void TextureManager::finish_load(ResLifetime lifetime)
         rect.h,
         gl_format_from_channels(load_data.normal_channels),
         GL_UNSIGNED_BYTE,
-        padded.data()
+        load_data.normal_data.data()
       );
-      stbi_image_free(load_data.normal_data);
     }
 
     glGenerateMipmap(GL_TEXTURE_2D);
@@ -600,14 +777,7 @@ void TextureManager::finish_load(ResLifetime lifetime)
 
   // specular texture atlas
   {
-    glGenTextures(1, &bundle.specular_handle);
-    glBindTexture(GL_TEXTURE_2D, bundle.specular_handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, target_width, target_height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MAX_MIP_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    bundle.specular_handle = create_atlas_texture(ATLAS_FORMATS[2], target_width, target_height, nullptr);
 
     const std::vector<unsigned char> zero(cast<size_t>(target_width * target_height), 0);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, target_width, target_height, GL_RED, GL_UNSIGNED_BYTE, zero.data());
@@ -617,13 +787,9 @@ void TextureManager::finish_load(ResLifetime lifetime)
       const auto& rect = m_load_rects[i];
       const auto& load_data = m_load_data[i];
 
-      if (load_data.specular_data == nullptr)
+      if (load_data.specular_data.empty())
         continue;
 
-      const std::vector<unsigned char> padded = pad_with_edge_extend(
-        load_data.specular_data, load_data.width, load_data.height,
-        cast<u32>(load_data.specular_channels), ATLAS_GUTTER);
-
       glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
@@ -633,9 +799,8 @@ void TextureManager::finish_load(ResLifetime lifetime)
         rect.h,
         gl_format_from_channels(load_data.specular_channels),
         GL_UNSIGNED_BYTE,
-        padded.data()
+        load_data.specular_data.data()
       );
-      stbi_image_free(load_data.specular_data);
     }
 
     glGenerateMipmap(GL_TEXTURE_2D);
@@ -643,26 +808,16 @@ void TextureManager::finish_load(ResLifetime lifetime)
 
   // emissive texture atlas
   {
-    glGenTextures(1, &bundle.emissive_handle);
-    glBindTexture(GL_TEXTURE_2D, bundle.emissive_handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, target_width, target_height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    bundle.emissive_handle = create_atlas_texture(ATLAS_FORMATS[3], target_width, target_height, nullptr);
 
     for (u32 i = 0; i < m_load_rects.size(); ++i)
     {
       const auto& rect = m_load_rects[i];
       const auto& load_data = m_load_data[i];
 
-      if (load_data.emissive_data == nullptr)
+      if (load_data.emissive_data.empty())
         continue;
 
-      const std::vector<unsigned char> padded = pad_with_edge_extend(
-        load_data.emissive_data, load_data.width, load_data.height,
-        cast<u32>(load_data.emissive_channels), ATLAS_GUTTER);
-
       glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
@@ -672,9 +827,8 @@ void TextureManager::finish_load(ResLifetime lifetime)
         rect.h,
         gl_format_from_channels(load_data.emissive_channels),
         GL_UNSIGNED_BYTE,
-        padded.data()
+        load_data.emissive_data.data()
       );
-      stbi_image_free(load_data.emissive_data);
     }
   }
 
@@ -682,4 +836,194 @@ void TextureManager::finish_load(ResLifetime lifetime)
   m_load_data.clear();
 }
 
+//==============================================================================
+bool TextureManager::load_atlas_cache(ResLifetime lifetime, const std::string& cache_path, u64 source_hash)
+{
+  NC_SCOPE_PROFILER(LoadAtlasCache)
+
+  nc_assert(lifetime == ResLifetime::Game || lifetime == ResLifetime::Level);
+
+  MappedFile file;
+  if (!file.open(cache_path) || file.size() < sizeof(AtlasCacheHeader))
+  {
+    return false;
+  }
+
+  AtlasCacheHeader header;
+  std::memcpy(&header, file.data(), sizeof(AtlasCacheHeader));
+
+  const bool header_ok = std::memcmp
+  (
+    header.signature, AtlasCacheHeader::SIGNATURE, AtlasCacheHeader::SIGNATURE_SIZE
+  ) == 0
+    && header.version     == ATLAS_CACHE_VERSION
+    && header.source_hash == source_hash;
+
+  if (!header_ok)
+  {
+    nc_log("Texture atlas cache \"{}\" is out of date, packing the textures again.", cache_path);
+    return false;
+  }
+
+  // Validate the whole table before touching anything
+  const byte* it  = file.data() + sizeof(AtlasCacheHeader);
+  const byte* end = file.data() + file.size();
+
+  if (header.texture_cnt > cast<u64>(end - it) / sizeof(AtlasCacheEntry))
+  {
+    return false;
+  }
+
+  struct CachedTexture
+  {
+    AtlasCacheEntry  entry;
+    std::string_view name;
+  };
+  std::vector<CachedTexture> textures(header.texture_cnt);
+
+  for (CachedTexture& texture : textures)
+  {
+    if (cast<u64>(end - it) < sizeof(AtlasCacheEntry))
+    {
+      return false;
+    }
+
+    std::memcpy(&texture.entry, it, sizeof(AtlasCacheEntry));
+    it += sizeof(AtlasCacheEntry);
+
+    if (cast<u64>(end - it) < texture.entry.name_length)
+    {
+      return false;
+    }
+
+    texture.name = std::string_view(recast<const char*>(it), texture.entry.name_length);
+    it += texture.entry.name_length;
+  }
+
+  const u64 texel_cnt = cast<u64>(header.width) * header.height;
+
+  u64 pixels_size = 0;
+  for (const AtlasFormat& format : ATLAS_FORMATS)
+  {
+    pixels_size += texel_cnt * format.channels;
+  }
+
+  if (cast<u64>(end - it) != pixels_size)
+  {
+    return false;
+  }
+
+  auto& bundle = get_atlas_bundle_mut(lifetime);
+  bundle.width  = header.width;
+  bundle.height = header.height;
+
+  // Straight from the mapped file into the driver
+  const std::array<GLuint*, ATLAS_CNT> handles = get_atlas_handles(bundle);
+  for (u32 i = 0; i < ATLAS_CNT; ++i)
+  {
+    const AtlasFormat& format = ATLAS_FORMATS[i];
+    *handles[i] = create_atlas_texture(format, header.width, header.height, it);
+    if (format.mipmaps)
+      glGenerateMipmap(GL_TEXTURE_2D);
+
+    it += texel_cnt * format.channels;
+  }
+
+  for (const CachedTexture& texture : textures)
+  {
+    const TextureHandle handle(
+      lifetime,
+      texture.entry.x,
+      texture.entry.y,
+      texture.entry.width,
+      texture.entry.height,
+      m_generation,
+      cast<TextureID>(m_textures.size())
+    );
+
+    if (bundle.textures.emplace(std::string(texture.name), handle).second)
+    {
+      register_sprite_texture(lifetime, std::string(texture.name), handle.get_texture_id());
+    }
+    m_textures.push_back(handle);
+  }
+
+  return true;
+}
+
+//==============================================================================
+void TextureManager::save_atlas_cache
+(
+  ResLifetime                     lifetime,
+  const std::string&              cache_path,
+  u64                             source_hash,
+  const std::vector<std::string>& names,
+  TextureID                       first_texture
+) const
+{
+  NC_SCOPE_PROFILER(SaveAtlasCache)
+
+  nc_assert(first_texture + names.size() == m_textures.size());
+
+  const TextureAtlasBundle& bundle = get_atlas_bundle(lifetime);
+
+  std::ofstream out(cache_path, std::ios::binary);
+  if (!out.is_open())
+  {
+    nc_warn("Can not write the texture atlas cache \"{}\".", cache_path);
+    return;
+  }
+
+  AtlasCacheHeader header
+  {
+    .source_hash = source_hash,
+    .width       = bundle.width,
+    .height      = bundle.height,
+    .texture_cnt = cast<u32>(names.size()),
+  };
+  std::memcpy(header.signature, AtlasCacheHeader::SIGNATURE, AtlasCacheHeader::SIGNATURE_SIZE);
+  out.write(recast<const char*>(&header), sizeof(AtlasCacheHeader));
+
+  for (u64 i = 0; i < names.size(); ++i)
+  {
+    const TextureHandle& handle = m_textures[first_texture + i];
+    const AtlasCacheEntry entry
+    {
+      .x           = handle.get_x(),
+      .y           = handle.get_y(),
+      .width       = handle.get_width(),
+      .height      = handle.get_height(),
+      .name_length = cast<u32>(names[i].size()),
+    };
+
+    out.write(recast<const char*>(&entry), sizeof(AtlasCacheEntry));
+    out.write(names[i].data(), names[i].size());
+  }
+
+  // The atlases are only on the GPU by now, only the base level is needed
+  const std::array<GLuint, ATLAS_CNT> handles
+  {
+    bundle.diffuse_handle, bundle.normal_handle, bundle.specular_handle, bundle.emissive_handle
+  };
+
+  std::vector<unsigned char> pixels;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  for (u32 i = 0; i < ATLAS_CNT; ++i)
+  {
+    const AtlasFormat& format = ATLAS_FORMATS[i];
+    pixels.resize(cast<size_t>(bundle.width) * bundle.height * format.channels);
+
+    glBindTexture(GL_TEXTURE_2D, handles[i]);
+    glGetTexImage(GL_TEXTURE_2D, 0, format.format, GL_UNSIGNED_BYTE, pixels.data());
+    out.write(recast<const char*>(pixels.data()), pixels.size());
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (!out.good())
+  {
+    nc_warn("Failed to write the texture atlas cache \"{}\".", cache_path);
+  }
+}
+
 }
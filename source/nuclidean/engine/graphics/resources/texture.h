@@ -9,6 +9,9 @@
 #include <engine/graphics/resources/res_lifetime.h>
 #include <engine/graphics/resources/texture_id.h>
 
+#include <token.h>
+
+#include <array>
 #include <filesystem>
 #include <string>
 
@@ -77,6 +80,27 @@ private:
 
 using TextureMap = std::unordered_map<std::string, TextureHandle>;
 
+// Direction suffixes of 8 directional sprites "[sprite]_[suffix]", see
+// "Appearance::SpriteMode::dir8"
+namespace SpriteDirection
+{
+  enum evalue : u8
+  {
+    d, dr, r, ur, u, ul, l, dl,
+    count
+  };
+}
+
+// Texture IDs of a single sprite resolved from the texture names once after
+// loading, so the renderer does not have to build the names every frame.
+struct SpriteTextures
+{
+  TextureID                                     mono = INVALID_TEXTURE_ID; // "[sprite]"
+  std::array<TextureID, SpriteDirection::count> dirs;                      // "[sprite]_[suffix]"
+
+  SpriteTextures();
+};
+
 // Bundles texture atlasses which shares UV space.
 struct TextureAtlasBundle
 {
@@ -112,6 +136,10 @@ public:
 
   GLuint get_equirectangular_map(const std::string& name, ResLifetime lifetime) const;
 
+  // Texture IDs of a sprite of the game textures, nullptr if there are none.
+  // Cheap enough to be called for every rendered billboard.
+  const SpriteTextures* find_sprite(const Token& sprite) const;
+
   constexpr static u32 ERROR_TEXTURE_SIZE = 1024;
 
 private:
@@ -128,23 +156,44 @@ private:
   EquirectangularMapMap& get_equirectangular_maps(ResLifetime lifetime);
   const EquirectangularMapMap& get_equirectangular_maps(ResLifetime lifetime) const;
   void create_error_texture();
+  // Adds the texture into the sprite it belongs to, if its name fits into a token
+  void register_sprite_texture(ResLifetime lifetime, const std::string& name, TextureID texture_id);
 
   // Get asset name based on it's path.
   std::string get_name(const std::string& path) const;
   /**
-   * Loads texture from the file. After loading all textures of a specified lifetime, you must call
-   * TextureManager::finish_load which will actually load the textures.
+   * Decodes the texture and its normal, specular and emissive variants from the files and pads them for the atlas.
+   * Touches only "out" and no GL, so multiple textures can be decoded in parallel. The decoded textures are then
+   * added to the atlas by TextureManager::finish_load.
    */
-  void load_texture(const std::filesystem::path& path);
+  void decode_texture(const std::filesystem::path& path, LoadData& out) const;
   void load_equirectangular_map(const std::string& path, ResLifetime lifetime);
   // Finishes loading of multiple textures of a specified lifetime. Creates a texture atlas.
   void finish_load(ResLifetime lifetime);
+  /**
+   * Loads the packed atlases and the texture rects from a cache file written by TextureManager::save_atlas_cache.
+   * Returns false if the file does not exist or was made from different source textures ("source_hash").
+   */
+  bool load_atlas_cache(ResLifetime lifetime, const std::string& cache_path, u64 source_hash);
+  /**
+   * Reads the atlases of a just finished load back from the GPU and writes them into a cache file together with the
+   * rects of the textures. "names" are the names of the loaded textures starting from "first_texture" in m_textures.
+   */
+  void save_atlas_cache
+  (
+    ResLifetime                     lifetime,
+    const std::string&              cache_path,
+    u64                             source_hash,
+    const std::vector<std::string>& names,
+    TextureID                       first_texture
+  ) const;
 
   TextureAtlasBundle m_game_atlas_bundle;
   TextureAtlasBundle m_level_atlas_bundle;
   EquirectangularMapMap m_game_equirectangular_maps;
   EquirectangularMapMap m_level_equirectangular_maps;
   std::vector<TextureHandle> m_textures;
+  std::unordered_map<Token, SpriteTextures> m_sprites;
 
   GLuint m_error_texture = 0;
 
@@ -159,24 +208,28 @@ private:
   // Holds the pixel data and properties of a single image which is currently being loaded from disk.
   struct LoadData
   {
-    // The width of the image in pixels.
+    using Pixels = std::vector<unsigned char>;
+
+    // The width of the image in pixels, without the atlas gutter.
     int            width  = 0;
-    // The height of the image in pixels.
+    // The height of the image in pixels, without the atlas gutter.
     int            height = 0;
     int            diffuse_channels  = 0;
     int            normal_channels   = 0;
     int            specular_channels = 0;
     int            emissive_channels = 0;
-    // A pointer to the pixel data of the diffuse texture.
-    unsigned char* diffuse_data = nullptr;
-    // A pointer to the pixel data of the normal texture.
-    unsigned char* normal_data = nullptr;
-    // A pointer to the pixel data of the specular texture.
-    unsigned char* specular_data = nullptr;
-    // A pointer to the pixel data of the emissive texture.
-    unsigned char* emissive_data = nullptr;
+    // Pixel data of the diffuse texture, already padded by the atlas gutter.
+    Pixels         diffuse_data;
+    // Pixel data of the normal texture, padded. Empty if the texture has no normal map.
+    Pixels         normal_data;
+    // Pixel data of the specular texture, padded. Empty if the texture has no specular map.
+    Pixels         specular_data;
+    // Pixel data of the emissive texture, padded. Empty if the texture has no emissive map.
+    Pixels         emissive_data;
     // Name of the texture.
     std::string    name   = "";
+    // Problems found while decoding, logged on the main thread. The texture is skipped if "diffuse_data" is empty.
+    std::vector<std::string> errors;
   };
 };
 
@@ -0,0 +1,167 @@
+// Project Nuclidean Source File
+#include <engine/graphics/sector_lights.h>
+
+#include <common.h>
+
+#include <math/lingebra.h>
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+void SectorLightLists::reset()
+{
+  for (u32 light_idx : m_touched_lights)
+  {
+    m_first_instance[light_idx] = INVALID_LIGHT;
+  }
+
+  m_touched_lights.clear();
+  m_instances.clear();
+  m_visible_sectors.clear();
+  m_light_indices.clear();
+}
+
+//==============================================================================
+u32 SectorLightLists::begin_sector(u32 matrix_id)
+{
+  const u32 visible_id = cast<u32>(m_visible_sectors.size());
+
+  m_visible_sectors.push_back(VisibleSectorGPU
+  {
+    .matrix_id     = matrix_id,
+    .lights_offset = cast<u32>(m_light_indices.size()),
+    .lights_count  = 0,
+    ._padding      = 0,
+  });
+
+  return visible_id;
+}
+
+//==============================================================================
+u32 SectorLightLists::find_light(u32 light_idx, vec3 camera_pos) const
+{
+  if (light_idx >= m_first_instance.size())
+  {
+    return INVALID_LIGHT;
+  }
+
+  for (u32 i = m_first_instance[light_idx]; i != INVALID_LIGHT; i = m_instances[i].next)
+  {
+    const LightInstance& instance = m_instances[i];
+    if (distance2(instance.camera_pos, camera_pos) <= DIST_THRESHOLD * DIST_THRESHOLD)
+    {
+      return instance.gpu_index;
+    }
+  }
+
+  // Never seen or seen from a different spot through a different portal
+  return INVALID_LIGHT;
+}
+
+//==============================================================================
+void SectorLightLists::register_light(u32 light_idx, vec3 camera_pos, u32 gpu_index)
+{
+  if (light_idx >= m_first_instance.size())
+  {
+    m_first_instance.resize(light_idx + 1, INVALID_LIGHT);
+  }
+
+  u32& first = m_first_instance[light_idx];
+  if (first == INVALID_LIGHT)
+  {
+    m_touched_lights.push_back(light_idx);
+  }
+
+  m_instances.push_back(LightInstance
+  {
+    .camera_pos = camera_pos,
+    .gpu_index  = gpu_index,
+    .next       = first,
+  });
+
+  first = cast<u32>(m_instances.size() - 1);
+}
+
+//==============================================================================
+void SectorLightLists::add_to_sector(u32 gpu_index)
+{
+  nc_assert(!m_visible_sectors.empty(), "No sector was started");
+
+  m_light_indices.push_back(gpu_index);
+  m_visible_sectors.back().lights_count += 1;
+}
+
+//==============================================================================
+const std::vector<VisibleSectorGPU>& SectorLightLists::get_visible_sectors() const
+{
+  return m_visible_sectors;
+}
+
+//==============================================================================
+const std::vector<u32>& SectorLightLists::get_light_indices() const
+{
+  return m_light_indices;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool sector_lights_test_lists(unit_test::TestCtx& /*ctx*/)
+{
+  SectorLightLists lists;
+
+  // The first pass sees two sectors, the same light shines into both
+  const u32 first = lists.begin_sector(0);
+  lists.register_light(3, vec3{1.0f, 0.0f, 0.0f}, 0);
+  lists.add_to_sector(0);
+  lists.register_light(7, vec3{0.0f, 0.0f, 5.0f}, 1);
+  lists.add_to_sector(1);
+
+  const u32 second = lists.begin_sector(0);
+  const u32 found  = lists.find_light(3, vec3{1.1f, 0.0f, 0.0f});
+  if (found != 0)
+  {
+    nc_warn("The light seen in the previous sector was not found.");
+    NC_TEST_FAIL;
+  }
+  lists.add_to_sector(found);
+
+  // The same light seen through a portal somewhere else is a new instance
+  if (lists.find_light(3, vec3{10.0f, 0.0f, 0.0f}) != SectorLightLists::INVALID_LIGHT
+   || lists.find_light(4, vec3{1.0f, 0.0f, 0.0f})  != SectorLightLists::INVALID_LIGHT)
+  {
+    nc_warn("A light was matched with a different one.");
+    NC_TEST_FAIL;
+  }
+
+  const auto& sectors = lists.get_visible_sectors();
+  const auto& indices = lists.get_light_indices();
+  if (first != 0 || second != 1 || sectors.size() != 2 || indices.size() != 3
+   || sectors[0].lights_offset != 0 || sectors[0].lights_count != 2
+   || sectors[1].lights_offset != 2 || sectors[1].lights_count != 1
+   || indices[2] != 0)
+  {
+    nc_warn("The sector light lists are not laid out as expected.");
+    NC_TEST_FAIL;
+  }
+
+  // Nothing survives into the next frame
+  lists.reset();
+  if (!lists.get_visible_sectors().empty() || !lists.get_light_indices().empty()
+   || lists.find_light(3, vec3{1.0f, 0.0f, 0.0f}) != SectorLightLists::INVALID_LIGHT)
+  {
+    nc_warn("The sector light lists were not reset.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(sector_lights_test_lists)->name("Sector Light Lists");
+#endif
+
+}
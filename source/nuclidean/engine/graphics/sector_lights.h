@@ -0,0 +1,79 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <math/vector.h>
+
+#include <vector>
+
+namespace nc
+{
+
+// One sector seen in one rendering pass, read by "light.frag" from an SSBO.
+// The geometry of the sector (and the billboards in it) store the index of
+// this record into the G-buffer, so the lighting pass looks up its lights
+// directly. Keep in sync with "VisibleSector" in the shader.
+struct VisibleSectorGPU
+{
+  u32 matrix_id;     // portal matrix of the pass the sector was seen in
+  u32 lights_offset; // range in the light index list
+  u32 lights_count;
+  u32 _padding;
+};
+static_assert(sizeof(VisibleSectorGPU) == 16, "Has to match the std430 array stride");
+
+// Assigns the point lights to the sectors visible in this frame. Every pass
+// starts a sector with "begin_sector" and adds the lights that reach it
+// (taken from the sector mapping), the lights of one sector are always
+// stored next to each other.
+//
+// One light can be seen multiple times through different portals, it is
+// deduplicated by its index and its position in the camera space. The lookup
+// goes through a flat array indexed by the light, nothing is hashed and the
+// memory is kept between frames.
+class SectorLightLists
+{
+public:
+  static constexpr u32 INVALID_LIGHT = ~u32{0};
+
+  // Lights closer than this in the camera space are the same light
+  static constexpr f32 DIST_THRESHOLD = 0.25f; // 25cm
+
+  // Removes all sectors and lights, but keeps the memory
+  void reset();
+
+  // Starts a list of lights for the next visible sector and returns its ID
+  u32 begin_sector(u32 matrix_id);
+
+  // Returns the GPU index of the light if it was already registered in this
+  // frame at this position, "INVALID_LIGHT" otherwise
+  u32 find_light(u32 light_idx, vec3 camera_pos) const;
+
+  void register_light(u32 light_idx, vec3 camera_pos, u32 gpu_index);
+
+  // Appends the light to the sector started last
+  void add_to_sector(u32 gpu_index);
+
+  const std::vector<VisibleSectorGPU>& get_visible_sectors() const;
+  const std::vector<u32>&              get_light_indices()   const;
+
+private:
+  struct LightInstance
+  {
+    vec3 camera_pos;
+    u32  gpu_index;
+    u32  next; // next instance of the same light
+  };
+
+  std::vector<VisibleSectorGPU> m_visible_sectors;
+  std::vector<u32>              m_light_indices;
+
+  // First instance of each light, indexed by the index of the light in its
+  // pool. Only the touched entries are reset.
+  std::vector<u32>           m_first_instance;
+  std::vector<u32>           m_touched_lights;
+  std::vector<LightInstance> m_instances;
+};
+
+}
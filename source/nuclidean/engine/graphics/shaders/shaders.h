@@ -33,16 +33,14 @@ namespace nc
       inline constexpr const char* VERTEX_FILE   = "billboard.vert";
       inline constexpr const char* FRAGMENT_FILE = "billboard.frag";
 
-      inline constexpr Uniform<0, mat4> TRANSFORM;
-      inline constexpr Uniform<1, mat4> VIEW;
-      inline constexpr Uniform<2, mat4> PROJECTION;
-      inline constexpr Uniform<3, vec2> ATLAS_SIZE;
-      inline constexpr Uniform<4, vec2> TEXTURE_POS;
-      inline constexpr Uniform<5, vec2> TEXTURE_SIZE;
-      inline constexpr Uniform<6, u32>  SECTOR_ID;
-      inline constexpr Uniform<7, mat4> PORTAL_DEST_TO_SRC;
-      inline constexpr Uniform<8, u32>  MATRIX_ID;
-      inline constexpr Uniform<9, bool> ENABLE_SHADOWS;
+      // Transform, texture rect, sector and visible sector ID come per instance
+      // from the SSBO at binding 8, see "BillboardInstanceGPU"
+      inline constexpr Uniform<1,  mat4> VIEW;
+      inline constexpr Uniform<2,  mat4> PROJECTION;
+      inline constexpr Uniform<3,  vec2> ATLAS_SIZE;
+      inline constexpr Uniform<7,  mat4> PORTAL_DEST_TO_SRC;
+      inline constexpr Uniform<9,  bool> ENABLE_SHADOWS;
+      inline constexpr Uniform<10, u32>  FIRST_INSTANCE;
     }
 
     namespace gun
@@ -58,7 +56,7 @@ namespace nc
       inline constexpr Uniform<5, vec2> TEXTURE_SIZE;
       inline constexpr Uniform<6, u32>  SECTOR_ID;
       inline constexpr Uniform<7, mat4> PORTAL_DEST_TO_SRC;
-      inline constexpr Uniform<8, u32>  MATRIX_ID;
+      inline constexpr Uniform<8, u32>  VISIBLE_ID;
       inline constexpr Uniform<9, bool> ENABLE_SHADOWS;
     }
 
@@ -70,7 +68,7 @@ namespace nc
 
       inline constexpr Uniform<0, vec3> VIEW_POSITION;
       // inline constexpr Uniform<1, u32>  NUM_DIR_LIGHTS; // Not using anymore
-      inline constexpr Uniform<2, u32>  NUM_TILES_X;
+      inline constexpr Uniform<2, u32>  NUM_VISIBLE_SECTORS;
       inline constexpr Uniform<3, f32>  AMBIENT_STRENGTH;
       inline constexpr Uniform<4, u32>  NUM_SECTORS;
       inline constexpr Uniform<5, u32>  NUM_WALLS;
@@ -88,19 +86,7 @@ namespace nc
       inline constexpr Uniform<2, vec2> GAME_ATLAS_SIZE;
       inline constexpr Uniform<3, vec2> LEVEL_ATLAS_SIZE;
       inline constexpr Uniform<4, mat4> PORTAL_DEST_TO_SRC;
-      inline constexpr Uniform<5, u32>  SECTOR_ID;
-      inline constexpr Uniform<6, u32>  MATRIX_ID;
-    }
-
-    namespace light_culling
-    {
-      inline constexpr const char* COMPUTE_FILE = "light_culling.comp";
-
-      inline constexpr Uniform<0, mat4> VIEW;
-      inline constexpr Uniform<1, mat4> INV_PROJECTION;
-      inline constexpr Uniform<2, vec2> WINDOW_SIZE;
-      inline constexpr Uniform<3, f32>  FAR_PLANE;
-      inline constexpr Uniform<4, u32>  NUM_LIGHTS;
+      // Sector and visible sector ID come per draw from the SSBO at binding 9
     }
 
     namespace ui_button
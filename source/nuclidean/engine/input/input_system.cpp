@@ -132,12 +132,14 @@ void InputSystem::update_window_and_pump_messages()
         GameSystem::get().quick_save();
         get_engine().get_module<UserInterfaceSystem>().get_hud()->show_saved();
       }
+      else if (event.key.keysym.scancode == SDL_SCANCODE_F7)
+      {
+        // One second back
+        GameSystem::get().request_rewind(1.0f);
+      }
       else if (event.key.keysym.scancode == SDL_SCANCODE_F9)
       {
-        GameSystem::get().load_game(std::format
-        (
-          "{}/{}{}", SAVE_DIR_RELATIVE, "quicksave", SAVE_FILE_SUFFIX
-        ));
+        GameSystem::get().quick_load();
       }
     }
   }
@@ -0,0 +1,89 @@
+// Project Nuclidean Source File
+#include <engine/map/benchmark_level.h>
+
+#if NC_BENCHMARK
+
+#include <common.h>
+
+#include <engine/game/game_system.h>
+
+#include <memory>  // std::unique_ptr
+#include <utility> // std::pair
+#include <vector>
+
+namespace nc
+{
+
+//==============================================================================
+bool BenchmarkLevel::load(const LevelName& level)
+{
+  if (!GameSystem::build_level_geometry(level, map))
+  {
+    return false;
+  }
+
+  mapping.on_map_rebuild();
+  return true;
+}
+
+//==============================================================================
+PhysLevel BenchmarkLevel::get_phys_level() const
+{
+  return PhysLevel
+  {
+    .entities = entities,
+    .map      = map,
+    .mapping  = mapping,
+  };
+}
+
+//==============================================================================
+std::vector<vec3> BenchmarkLevel::get_sector_centers(f32 height) const
+{
+  std::vector<vec3> centers;
+  centers.reserve(map.sectors.size());
+
+  for (SectorID sid = 0; sid < map.sectors.size(); ++sid)
+  {
+    const SectorData& sector = map.sectors[sid];
+
+    vec2 sum = VEC2_ZERO;
+    for (WallID wid = sector.first_wall; wid < sector.last_wall; ++wid)
+    {
+      sum += map.walls[wid].pos;
+    }
+
+    const vec2 center = sum / cast<f32>(sector.last_wall - sector.first_wall);
+    const f32  floor  = map.sectors_dynamic[sid].floor_height;
+    centers.push_back(vec3{center.x, floor + height, center.y});
+  }
+
+  return centers;
+}
+
+//==============================================================================
+const BenchmarkLevel* get_benchmark_level(const LevelName& level)
+{
+  using Loaded = std::pair<LevelName, std::unique_ptr<BenchmarkLevel>>;
+  static std::vector<Loaded> loaded_levels;
+
+  for (const auto&[name, loaded] : loaded_levels)
+  {
+    if (name == level)
+    {
+      return loaded.get();
+    }
+  }
+
+  auto new_level = std::make_unique<BenchmarkLevel>();
+  if (!new_level->load(level))
+  {
+    new_level = nullptr;
+  }
+
+  return loaded_levels.emplace_back(level, std::move(new_level)).second.get();
+}
+
+}
+
+#endif
@@ -0,0 +1,47 @@
+// Project Nuclidean Source File
+#pragma once
+
+// Helpers for benchmarks that need a real level, but can not rely on the engine
+// being initialized (benchmarks run before the engine starts).
+
+#include <config.h>
+
+#if NC_BENCHMARK
+
+#include <engine/map/map_system.h>
+#include <engine/map/physics.h>
+#include <engine/entity/entity_system.h>
+#include <engine/entity/sector_mapping.h>
+#include <engine/player/level_types.h>
+
+#include <vector>
+
+namespace nc
+{
+
+// Only the sector geometry of a level, without textures, entities, activators
+// and triggers. Good enough for physics and visibility benchmarks.
+struct BenchmarkLevel
+{
+  MapSectors     map;
+  EntityRegistry entities;
+  SectorMapping  mapping{map};
+
+  // Builds the geometry with "GameSystem::build_level_geometry", so including
+  // the alternative sector states. Returns false on failure.
+  bool load(const LevelName& level);
+
+  PhysLevel get_phys_level() const;
+
+  // Deterministic list of points inside the level, one per sector, in the
+  // middle of the sector and "height" above its floor.
+  std::vector<vec3> get_sector_centers(f32 height) const;
+};
+
+// Loads the level on the first call and keeps it loaded for the rest of the
+// benchmarks. Returns nullptr if the level failed to load.
+const BenchmarkLevel* get_benchmark_level(const LevelName& level);
+
+}
+
+#endif
@@ -0,0 +1,602 @@
+// Project Nuclidean Source File
+#include <common.h>
+
+#include <engine/map/cooked_level.h>
+#include <engine/map/map_system.h>
+
+#include <buffer.h>
+#include <logging.h>
+#include <mapped_file.h>
+#include <profiling.h>
+
+#include <cstring>     // std::memcmp, std::memcpy
+#include <filesystem>  // std::filesystem::last_write_time
+#include <fstream>     // std::ofstream
+#include <type_traits> // std::is_trivially_copyable_v
+#include <utility>     // std::move
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+// Bump this when the format changes, the old cooked levels will get ignored
+constexpr u32 COOKED_LEVEL_VERSION = 1;
+
+NC_PUSH_PACKED
+struct CookedLevelHeader
+{
+  static constexpr u64  SIGNATURE_SIZE = 6;
+  static constexpr cstr SIGNATURE      = "nclevl";
+
+  char signature[SIGNATURE_SIZE];
+  u32  version     = COOKED_LEVEL_VERSION;
+  u64  layout      = 0; // sizes of the stored structures, see "get_layout_stamp"
+  u64  source_size = 0; // size of the level JSON the level was cooked from
+  s64  source_time = 0; // and its last write time
+};
+NC_POP_PACKED
+
+// "Portal" has const members, so it is stored through this and emplaced back
+// on load
+struct PortalRecord
+{
+  f32  rotation;
+  vec3 position;
+  mat4 transform;
+  mat4 dest_to_src;
+};
+
+//==============================================================================
+// The columns are memcpy-ed as they are, so a change in any of the structures
+// makes the cooked levels invalid even if nobody bumped the version.
+static constexpr u64 get_layout_stamp()
+{
+  u64 stamp = 0;
+  for (u64 size :
+  {
+    sizeof(SectorData), sizeof(SectorDynData), sizeof(WallData),
+    sizeof(WallSegmentData), sizeof(WallSegmentDynData), sizeof(PortalRecord),
+    sizeof(aabb3), sizeof(MapSectors::NcPortalSegment), sizeof(TriggerData),
+    sizeof(SectorID), sizeof(TextureID)
+  })
+  {
+    stamp = stamp * 31 + size;
+  }
+
+  return stamp;
+}
+
+//==============================================================================
+// Identifies the version of the level JSON without reading it.
+// Returns false if the JSON does not exist.
+static bool get_source_stamp(const LevelName& level, u64& size_out, s64& time_out)
+{
+  namespace fs = std::filesystem;
+
+  std::error_code error;
+  const fs::path  path = get_full_level_path(level);
+
+  size_out = fs::file_size(path, error);
+  if (error)
+  {
+    return false;
+  }
+
+  const fs::file_time_type time = fs::last_write_time(path, error);
+  if (error)
+  {
+    return false;
+  }
+
+  time_out = cast<s64>(time.time_since_epoch().count());
+  return true;
+}
+
+//==============================================================================
+// Returns false if there is not enough data left when reading
+template<typename T>
+static bool serialize_value(Buffer& buffer, T& value)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  if (buffer.is_deserializing() && buffer.get_remaining_buffer_size() < sizeof(T))
+  {
+    return false;
+  }
+
+  buffer.serialize(value);
+  return true;
+}
+
+//==============================================================================
+template<typename T>
+static bool serialize_column(Buffer& buffer, std::vector<T>& column)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  u64 cnt = column.size();
+  if (!serialize_value(buffer, cnt))
+  {
+    return false;
+  }
+
+  if (buffer.is_deserializing())
+  {
+    if (cnt > buffer.get_remaining_buffer_size() / sizeof(T))
+    {
+      return false;
+    }
+
+    column.resize(cnt);
+  }
+
+  buffer.serialize_array(column.data(), cnt);
+  return true;
+}
+
+//==============================================================================
+static bool serialize_string(Buffer& buffer, std::string& str)
+{
+  u64 len = str.size();
+  if (!serialize_value(buffer, len))
+  {
+    return false;
+  }
+
+  if (buffer.is_deserializing())
+  {
+    if (len > buffer.get_remaining_buffer_size())
+    {
+      return false;
+    }
+
+    str.resize(len);
+  }
+
+  buffer.serialize_array(str.data(), len);
+  return true;
+}
+
+//==============================================================================
+// The same for writing and reading, so the two can not get out of sync.
+// Returns false if the data ends prematurely when reading.
+static bool serialize_cooked_level
+(
+  Buffer&                    buffer,
+  MapSectors&                map,
+  std::vector<PortalRecord>& portals,
+  CookedLevel&               cooked
+)
+{
+  StatGridAABB2<SectorID>& grid = map.sector_grid;
+
+  const bool map_ok
+  (
+    serialize_column(buffer, map.sectors)                &&
+    serialize_column(buffer, map.sectors_dynamic)        &&
+    serialize_column(buffer, map.walls)                  &&
+    serialize_column(buffer, map.wall_segments)          &&
+    serialize_column(buffer, map.wall_segments_dynamic)  &&
+    serialize_column(buffer, portals)                    &&
+    serialize_column(buffer, map.sector_bboxes)          &&
+    serialize_column(buffer, map.nc_portal_segments)     &&
+    serialize_value (buffer, grid.m_min)                 &&
+    serialize_value (buffer, grid.m_max)                 &&
+    serialize_value (buffer, grid.m_width)               &&
+    serialize_value (buffer, grid.m_height)              &&
+    serialize_column(buffer, grid.m_bboxes.min_x)        &&
+    serialize_column(buffer, grid.m_bboxes.min_y)        &&
+    serialize_column(buffer, grid.m_bboxes.max_x)        &&
+    serialize_column(buffer, grid.m_bboxes.max_y)        &&
+    serialize_column(buffer, grid.m_data)                &&
+    serialize_column(buffer, grid.m_cell_offsets)        &&
+    serialize_column(buffer, grid.m_cell_objects)        &&
+    serialize_value (buffer, grid.m_initialized)         &&
+    serialize_value (buffer, grid.m_built)
+  );
+
+  if (!map_ok)
+  {
+    return false;
+  }
+
+  u64 texture_cnt = cooked.texture_names.size();
+  if (!serialize_value(buffer, texture_cnt))
+  {
+    return false;
+  }
+
+  if (buffer.is_deserializing())
+  {
+    // Each name takes at least its length
+    if (texture_cnt > buffer.get_remaining_buffer_size() / sizeof(u64))
+    {
+      return false;
+    }
+
+    cooked.texture_names.resize(texture_cnt);
+  }
+
+  for (std::string& name : cooked.texture_names)
+  {
+    if (!serialize_string(buffer, name))
+    {
+      return false;
+    }
+  }
+
+  return serialize_column(buffer, cooked.triggers)
+      && serialize_column(buffer, cooked.json_cbor);
+}
+
+//==============================================================================
+// Replaces the indices into the texture name table by the runtime IDs
+static bool resolve_cooked_textures
+(
+  MapSectors&                     map,
+  const std::vector<std::string>& names,
+  const TextureResolver&          textures
+)
+{
+  std::vector<TextureID> ids;
+  ids.reserve(names.size());
+  for (const std::string& name : names)
+  {
+    ids.push_back(textures(name));
+  }
+
+  auto resolve_surface = [&ids](SurfaceData& surface) -> bool
+  {
+    for (TextureID* tid : {&surface.texture_id_default, &surface.texture_id_triggered})
+    {
+      if (*tid == INVALID_TEXTURE_ID)
+      {
+        continue;
+      }
+
+      if (*tid >= ids.size())
+      {
+        return false;
+      }
+
+      *tid = ids[*tid];
+    }
+
+    return true;
+  };
+
+  for (SectorData& sector : map.sectors)
+  {
+    if (!resolve_surface(sector.floor_surface) || !resolve_surface(sector.ceil_surface))
+    {
+      return false;
+    }
+  }
+
+  for (WallSegmentData& segment : map.wall_segments)
+  {
+    if (!resolve_surface(segment.surface))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//==============================================================================
+// Writes the header and the level into one blob
+static std::vector<byte> write_cooked_level
+(
+  const MapSectors&  map,
+  const CookedLevel& cooked,
+  u64                source_size,
+  s64                source_time
+)
+{
+  std::vector<PortalRecord> portals;
+  portals.reserve(map.portals_render_data.size());
+  for (const Portal& portal : map.portals_render_data)
+  {
+    portals.push_back(PortalRecord
+    {
+      .rotation    = portal.rotation,
+      .position    = portal.position,
+      .transform   = portal.transform,
+      .dest_to_src = portal.dest_to_src,
+    });
+  }
+
+  // Nothing gets modified when serializing
+  MapSectors&  map_ref    = const_cast<MapSectors&>(map);
+  CookedLevel& cooked_ref = const_cast<CookedLevel&>(cooked);
+
+  Buffer counter;
+  serialize_cooked_level(counter, map_ref, portals, cooked_ref);
+
+  CookedLevelHeader header
+  {
+    .layout      = get_layout_stamp(),
+    .source_size = source_size,
+    .source_time = source_time,
+  };
+  std::memcpy(header.signature, CookedLevelHeader::SIGNATURE, CookedLevelHeader::SIGNATURE_SIZE);
+
+  std::vector<byte> blob(sizeof(CookedLevelHeader) + counter.get_counted_size());
+  std::memcpy(blob.data(), &header, sizeof(CookedLevelHeader));
+
+  Buffer writer
+  (
+    blob.data() + sizeof(CookedLevelHeader), counter.get_counted_size(), SerializationType::serialize
+  );
+
+  serialize_cooked_level(writer, map_ref, portals, cooked_ref);
+  nc_assert(writer.get_remaining_buffer_size() == 0);
+
+  return blob;
+}
+
+//==============================================================================
+// Reads the blob written by "write_cooked_level". If "check_source" is true
+// then the level has to be cooked from the given version of the JSON.
+static bool read_cooked_level
+(
+  const byte*  data,
+  u64          size,
+  bool         check_source,
+  u64          source_size,
+  s64          source_time,
+  MapSectors&  map_out,
+  CookedLevel& cooked_out
+)
+{
+  if (size < sizeof(CookedLevelHeader))
+  {
+    return false;
+  }
+
+  CookedLevelHeader header;
+  std::memcpy(&header, data, sizeof(CookedLevelHeader));
+
+  const bool header_ok = std::memcmp
+  (
+    header.signature, CookedLevelHeader::SIGNATURE, CookedLevelHeader::SIGNATURE_SIZE
+  ) == 0
+    && header.version == COOKED_LEVEL_VERSION
+    && header.layout  == get_layout_stamp();
+
+  if (!header_ok)
+  {
+    return false;
+  }
+
+  if (check_source && (header.source_size != source_size || header.source_time != source_time))
+  {
+    return false;
+  }
+
+  // The buffer does not write anything when deserializing
+  Buffer reader
+  (
+    const_cast<byte*>(data + sizeof(CookedLevelHeader)),
+    size - sizeof(CookedLevelHeader),
+    SerializationType::deserialize
+  );
+
+  MapSectors                map;
+  CookedLevel               cooked;
+  std::vector<PortalRecord> portals;
+  if (!serialize_cooked_level(reader, map, portals, cooked) || reader.get_remaining_buffer_size())
+  {
+    return false;
+  }
+
+  map.portals_render_data.reserve(portals.size());
+  for (const PortalRecord& record : portals)
+  {
+    map.portals_render_data.emplace_back
+    (
+      record.rotation, record.position, record.transform, record.dest_to_src
+    );
+  }
+
+  map_out    = std::move(map);
+  cooked_out = std::move(cooked);
+  return true;
+}
+
+//==============================================================================
+bool save_cooked_level
+(
+  const LevelName&   level,
+  const MapSectors&  map,
+  const CookedLevel& cooked
+)
+{
+  u64 source_size = 0;
+  s64 source_time = 0;
+  if (!get_source_stamp(level, source_size, source_time))
+  {
+    nc_warn("Can not cook level \"{}\", its JSON does not exist.", level.to_string());
+    return false;
+  }
+
+  const std::vector<byte> blob = write_cooked_level(map, cooked, source_size, source_time);
+
+  std::ofstream out(get_cooked_level_path(level), std::ios::binary);
+  if (!out.is_open())
+  {
+    nc_warn("Can not write the cooked level \"{}\".", get_cooked_level_path(level));
+    return false;
+  }
+
+  out.write(recast<const char*>(blob.data()), blob.size());
+  return out.good();
+}
+
+//==============================================================================
+bool load_cooked_level
+(
+  const LevelName&       level,
+  const TextureResolver& textures,
+  MapSectors&            map_out,
+  CookedLevel&           cooked_out
+)
+{
+  NC_SCOPE_PROFILER(LoadCookedLevel)
+
+  MappedFile file;
+  if (!file.open(get_cooked_level_path(level)))
+  {
+    return false;
+  }
+
+  // A build without the level JSON uses the cooked level as it is
+  u64 source_size = 0;
+  s64 source_time = 0;
+  const bool has_source = get_source_stamp(level, source_size, source_time);
+
+  MapSectors  map;
+  CookedLevel cooked;
+
+  const bool read_ok = read_cooked_level
+  (
+    file.data(), file.size(), has_source, source_size, source_time, map, cooked
+  );
+
+  if (!read_ok || !resolve_cooked_textures(map, cooked.texture_names, textures))
+  {
+    nc_log("Cooked level \"{}\" is out of date, loading the JSON instead.", level.to_string());
+    return false;
+  }
+
+  map_out    = std::move(map);
+  cooked_out = std::move(cooked);
+  return true;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool cooked_level_test_round_trip(unit_test::TestCtx& /*ctx*/)
+{
+  using namespace map_building;
+
+  // Two squares next to each other with a portal between them
+  const std::vector<vec2> points
+  {
+    vec2{0.0f, 0.0f}, vec2{1.0f, 0.0f}, vec2{1.0f, 1.0f}, vec2{0.0f, 1.0f},
+    vec2{2.0f, 0.0f}, vec2{2.0f, 1.0f},
+  };
+
+  const WallSegmentData segment
+  {
+    .surface = SurfaceData{.texture_id_default = 1, .texture_id_triggered = 0},
+  };
+
+  auto make_sector = [&](std::initializer_list<WallID> indices, f32 floor)
+  {
+    SectorBuildData sector
+    {
+      .floor_y       = {floor, floor},
+      .ceil_y        = {floor + 2.0f, floor + 2.0f},
+      .floor_surface = SurfaceData{.texture_id_default = 0, .texture_id_triggered = 0},
+    };
+
+    for (WallID idx : indices)
+    {
+      sector.points.push_back(WallBuildData
+      {
+        .point_index            = idx,
+        .nc_portal_point_index  = INVALID_WALL_REL_ID,
+        .nc_portal_sector_index = INVALID_SECTOR_ID,
+        .surface                = {segment},
+      });
+    }
+
+    return sector;
+  };
+
+  const std::vector<SectorBuildData> sectors
+  {
+    make_sector({0, 1, 2, 3}, 0.0f),
+    make_sector({1, 4, 5, 2}, 0.5f),
+  };
+
+  MapSectors map;
+  if (!build_map(points, sectors, map))
+  {
+    nc_warn("Cooked level test failed. The test map did not build.");
+    NC_TEST_FAIL;
+  }
+
+  CookedLevel cooked;
+  cooked.texture_names = {"floor", "wall"};
+  cooked.triggers.push_back(TriggerData{.activator = 3, .timeout = 1.5f});
+  cooked.json_cbor     = {1, 2, 3};
+
+  const std::vector<byte> blob = write_cooked_level(map, cooked, 42, 7);
+
+  // Stale JSON and a truncated file are refused and leave the output alone
+  MapSectors  loaded_map;
+  CookedLevel loaded;
+  if (read_cooked_level(blob.data(), blob.size(), true, 43, 7, loaded_map, loaded)
+   || read_cooked_level(blob.data(), blob.size() - 1, false, 0, 0, loaded_map, loaded)
+   || !loaded_map.sectors.empty())
+  {
+    nc_warn("Cooked level test failed. An invalid cooked level was accepted.");
+    NC_TEST_FAIL;
+  }
+
+  if (!read_cooked_level(blob.data(), blob.size(), true, 42, 7, loaded_map, loaded))
+  {
+    nc_warn("Cooked level test failed. The cooked level did not load.");
+    NC_TEST_FAIL;
+  }
+
+  auto same_column = [](const auto& a, const auto& b)
+  {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0;
+  };
+
+  const bool same_map = same_column(map.sectors, loaded_map.sectors)
+    && same_column(map.walls, loaded_map.walls)
+    && same_column(map.wall_segments, loaded_map.wall_segments)
+    && same_column(map.sector_grid.m_cell_objects, loaded_map.sector_grid.m_cell_objects)
+    && map.portals_render_data.size() == loaded_map.portals_render_data.size()
+    && loaded_map.sector_grid.is_built();
+
+  const bool same_rest = loaded.texture_names == cooked.texture_names
+    && loaded.triggers.size() == 1 && loaded.triggers[0].activator == 3
+    && loaded.json_cbor == cooked.json_cbor;
+
+  if (!same_map || !same_rest)
+  {
+    nc_warn("Cooked level test failed. The loaded level differs from the cooked one.");
+    NC_TEST_FAIL;
+  }
+
+  // The "wall" texture is the second one
+  const TextureResolver textures = [](const std::string& name) -> TextureID
+  {
+    return name == "wall" ? 20 : 10;
+  };
+
+  if (!resolve_cooked_textures(loaded_map, loaded.texture_names, textures)
+   || loaded_map.wall_segments[0].surface.texture_id_default != 20
+   || loaded_map.sectors[0].floor_surface.texture_id_default != 10
+   || loaded_map.sectors[0].ceil_surface.texture_id_default  != INVALID_TEXTURE_ID)
+  {
+    nc_warn("Cooked level test failed. The textures were not resolved.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(cooked_level_test_round_trip)->name("Cooked Level Round Trip");
+#endif
+
+}
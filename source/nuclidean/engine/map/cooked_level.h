@@ -0,0 +1,59 @@
+// Project Nuclidean Source File
+#pragma once
+
+// Cooked level (".ncl" next to the level JSON) is the level after the JSON got
+// parsed and the sectors got built by "map_building::build_map". Loading it is
+// a handful of memcpys out of a mapped file instead of parsing a few MB of JSON
+// and running all of the map checks again.
+// The activators, entities and everything else that does not end up in the
+// "MapSectors" are kept as the original JSON (in CBOR), as the activator hooks
+// load themselves from it.
+// The cooked level is used only if it was cooked from the current version of
+// the level JSON, otherwise the game falls back to the JSON.
+
+#include <types.h>
+#include <engine/map/map_dynamics.h>
+#include <engine/player/level_types.h>
+#include <engine/graphics/resources/texture_id.h>
+
+#include <functional> // std::function
+#include <string>     // std::string
+#include <vector>     // std::vector
+
+namespace nc
+{
+
+struct MapSectors;
+
+// Returns the runtime ID of a texture of the given name
+using TextureResolver = std::function<TextureID(const std::string&)>;
+
+// The rest of the level that is not part of the "MapSectors"
+struct CookedLevel
+{
+  std::vector<std::string> texture_names; // surfaces of the cooked map store indices into this
+  std::vector<TriggerData> triggers;      // sector and wall triggers, the entity ones are in the JSON
+  std::vector<u8>          json_cbor;     // rest of the level JSON (activators, entities, lights...)
+};
+
+// Stores the level into the cooked level file. The texture IDs of the map
+// surfaces have to be indices into "texture_names".
+bool save_cooked_level
+(
+  const LevelName&   level,
+  const MapSectors&  map,
+  const CookedLevel& cooked
+);
+
+// Loads the cooked level if it exists and is not older than the level JSON.
+// The texture IDs of the surfaces are resolved by their names. Nothing is
+// changed on failure.
+bool load_cooked_level
+(
+  const LevelName&       level,
+  const TextureResolver& textures,
+  MapSectors&            map_out,
+  CookedLevel&           cooked_out
+);
+
+}
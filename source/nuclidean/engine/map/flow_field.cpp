@@ -0,0 +1,286 @@
+// Project Nuclidean Source File
+#include <common.h>
+
+#include <engine/map/flow_field.h>
+#include <engine/map/map_system.h>
+
+#include <math/lingebra.h>
+#include <profiling.h>
+
+#include <algorithm> // std::push_heap, std::pop_heap
+
+namespace nc
+{
+
+//==============================================================================
+// Returns the wall of "neighbor" through which we get into "sector" via its
+// "wall". INVALID_WALL_ID if there is no such wall.
+static WallID get_opposing_wall
+(
+  const MapSectors& map,
+  SectorID          sector,
+  WallID            wall
+)
+{
+  const WallData& wd       = map.walls[wall];
+  const SectorID  neighbor = wd.portal_sector_id;
+
+  if (wd.get_portal_type() == PortalType::non_euclidean)
+  {
+    return map_helpers::get_nc_opposing_wall(map, sector, wall);
+  }
+
+  // Classic portal, the neighbor has the same wall, just in the opposite
+  // direction
+  const vec2 next_pos = map.walls[map_helpers::next_wall(map, sector, wall)].pos;
+
+  const SectorData& nsd = map.sectors[neighbor];
+  for (WallID wid = nsd.first_wall; wid < nsd.last_wall; ++wid)
+  {
+    const WallData& nwd = map.walls[wid];
+    if (nwd.portal_sector_id == sector && nwd.get_portal_type() == PortalType::classic && nwd.pos == next_pos)
+    {
+      return wid;
+    }
+  }
+
+  return INVALID_WALL_ID;
+}
+
+//==============================================================================
+static vec2 calc_wall_midpoint(const MapSectors& map, SectorID sector, WallID wall)
+{
+  const WallID next = map_helpers::next_wall(map, sector, wall);
+  return (map.walls[wall].pos + map.walls[next].pos) * 0.5f;
+}
+
+//==============================================================================
+FlowField::FlowField(const Agent& agent)
+: m_agent(agent)
+{
+
+}
+
+//==============================================================================
+void FlowField::update(const MapSectors& map, vec3 target_pos, u32 revision)
+{
+  const SectorID target_sector = map.get_sector_from_point(target_pos.xz());
+  if (target_sector == INVALID_SECTOR_ID)
+  {
+    // Out of the map, keep the old field and wait until the target gets back
+    return;
+  }
+
+  if (m_valid && target_sector == m_target_sector && revision == m_revision)
+  {
+    return;
+  }
+
+  this->rebuild(map, target_sector);
+  m_revision = revision;
+}
+
+//==============================================================================
+void FlowField::invalidate()
+{
+  m_valid = false;
+}
+
+//==============================================================================
+SectorID FlowField::get_target_sector() const
+{
+  return m_valid ? m_target_sector : INVALID_SECTOR_ID;
+}
+
+//==============================================================================
+bool FlowField::can_reach_target(SectorID sector) const
+{
+  return m_valid && sector < m_cells.size() && m_cells[sector].reachable;
+}
+
+//==============================================================================
+bool FlowField::can_traverse(const MapSectors& map, SectorID sector, WallID wall) const
+{
+  const WallData& wd       = map.walls[wall];
+  const SectorID  neighbor = wd.portal_sector_id;
+
+  f32 step_size;
+  map.calc_step_height_of_portal(sector, wall, &step_size);
+  if (step_size > m_agent.step_up || step_size < -m_agent.step_down)
+  {
+    return false;
+  }
+
+  const SectorData&    nsd  = map.sectors[neighbor];
+  const SectorDynData& nsdd = map.sectors_dynamic[neighbor];
+  if (nsdd.ceil_height - nsdd.floor_height <= m_agent.height)
+  {
+    // We wouldn't fit into this sector, unless it can be opened by enemies
+    if (!map.is_activator_enemy_sensitive(nsd.activator))
+    {
+      return false;
+    }
+  }
+
+  // Side to side clearance
+  const WallData& next_wd = map.walls[map_helpers::next_wall(map, sector, wall)];
+  const f32 wall_length = distance(wd.pos, next_wd.pos);
+  return nsd.force_walkable || wd.force_walkable || next_wd.force_walkable || wall_length > m_agent.radius * 2.0f;
+}
+
+//==============================================================================
+void FlowField::rebuild(const MapSectors& map, SectorID target_sector)
+{
+  NC_SCOPE_PROFILER(FlowFieldRebuild)
+
+  m_cells.assign(map.sectors.size(), Cell{});
+  m_open.clear();
+
+  m_target_sector = target_sector;
+  m_valid         = true;
+
+  // Dijkstra from the target backwards. Distances are measured between the
+  // middle points of the portals, which is good enough on sector level.
+  m_cells[target_sector].reachable = true;
+  m_cells[target_sector].dist      = 0.0f;
+  m_open.push_back(OpenItem{0.0f, target_sector});
+
+  while (!m_open.empty())
+  {
+    std::pop_heap(m_open.begin(), m_open.end());
+    const OpenItem cur = m_open.back();
+    m_open.pop_back();
+
+    const Cell& cur_cell = m_cells[cur.sector];
+    if (cur.dist > cur_cell.dist)
+    {
+      // Outdated entry, the sector was reached by a shorter path later
+      continue;
+    }
+
+    // Where the path continues from this sector towards the target
+    const bool is_target = cur.sector == target_sector;
+    const vec2 exit_pt   = is_target ? VEC2_ZERO : calc_wall_midpoint(map, cur.sector, cur_cell.next_wall);
+
+    map.for_each_portal_of_sector(cur.sector, [&](WallID wall)
+    {
+      const SectorID neighbor = map.walls[wall].portal_sector_id;
+
+      // The wall of the neighbor through which it gets to us
+      const WallID neighbor_wall = get_opposing_wall(map, cur.sector, wall);
+      if (neighbor_wall == INVALID_WALL_ID || !this->can_traverse(map, neighbor, neighbor_wall))
+      {
+        return;
+      }
+
+      f32 segment = 0.0f;
+      if (!is_target)
+      {
+        segment = distance(calc_wall_midpoint(map, cur.sector, wall), exit_pt);
+      }
+
+      const f32 total = cur.dist + segment;
+
+      Cell& cell = m_cells[neighbor];
+      if (cell.reachable && cell.dist <= total)
+      {
+        return;
+      }
+
+      cell.reachable = true;
+      cell.dist      = total;
+      cell.next_wall = neighbor_wall;
+
+      m_open.push_back(OpenItem{total, neighbor});
+      std::push_heap(m_open.begin(), m_open.end());
+    });
+  }
+}
+
+//==============================================================================
+u64 FlowField::calc_path_relative
+(
+  const MapSectors& map,
+  vec3              from,
+  vec3              target_pos,
+  f32               radius,
+  vec3*             points_out,
+  u64               max_points,
+  mat4&             nc_transform_out
+)
+const
+{
+  nc_assert(points_out || !max_points);
+
+  SectorID sector = map.get_sector_from_point(from.xz());
+  if (!this->can_reach_target(sector))
+  {
+    return 0;
+  }
+
+  // Transform from the space of our starting sector to the space of the
+  // current one
+  mat4 accumulated = identity<mat4>();
+  mat4 accumulated_inv = identity<mat4>();
+  vec3 current_pt  = from;
+  u64  point_cnt   = 0;
+
+  // Each step gets us into a sector closer to the target, so we can't visit
+  // more sectors than there are
+  for (u64 steps = 0; sector != m_target_sector; ++steps)
+  {
+    if (steps >= m_cells.size()) [[unlikely]]
+    {
+      nc_assert(false, "Cycle in the flow field");
+      return 0;
+    }
+
+    const WallID    wall    = m_cells[sector].next_wall;
+    const WallData& wd      = map.walls[wall];
+    const SectorID  next    = wd.portal_sector_id;
+
+    // The closest point of the portal, moved away from the corners so we do
+    // not get stuck
+    vec2 p1  = wd.pos;
+    vec2 p2  = map.walls[map_helpers::next_wall(map, sector, wall)].pos;
+    vec2 dir = normalize_or_zero(p2 - p1);
+    f32  len = distance(p1, p2);
+    f32  off = min(radius * 1.005f, len * 0.5f);
+
+    p1 += dir * off;
+    p2 -= dir * off;
+
+    vec2 p1_to_p2 = p2 - p1;
+    f32  l2       = dot(p1_to_p2, p1_to_p2);
+    f32  t        = l2 > 0.0f ? clamp(dot(current_pt.xz() - p1, p1_to_p2) / l2, 0.0f, 1.0f) : 0.0f;
+    vec2 pt2      = p1 + p1_to_p2 * t;
+    vec3 pt       = vec3{pt2.x, map.sectors_dynamic[next].floor_height, pt2.y};
+
+    if (point_cnt < max_points)
+    {
+      points_out[point_cnt++] = (accumulated_inv * vec4{pt, 1.0f}).xyz();
+    }
+
+    current_pt = pt;
+    if (wd.get_portal_type() == PortalType::non_euclidean) [[unlikely]]
+    {
+      const mat4 projection = map.calc_portal_to_portal_projection(sector, wall);
+      accumulated     = projection * accumulated;
+      accumulated_inv = inverse(accumulated);
+      current_pt      = (projection * vec4{pt, 1.0f}).xyz();
+    }
+
+    sector = next;
+  }
+
+  // And the target itself
+  if (point_cnt < max_points)
+  {
+    points_out[point_cnt++] = (accumulated_inv * vec4{target_pos, 1.0f}).xyz();
+  }
+
+  nc_transform_out = accumulated;
+  return point_cnt;
+}
+
+}
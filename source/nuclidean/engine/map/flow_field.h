@@ -0,0 +1,104 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+#include <math/vector.h>
+#include <math/matrix.h>
+
+#include <engine/map/map_types.h>
+
+#include <vector>
+
+namespace nc
+{
+struct MapSectors;
+}
+
+namespace nc
+{
+
+// Sector-level flow field towards a single target, usually the player. Each
+// sector knows through which of its portals it should be left to get closer to
+// the target. Instead of every enemy searching for its own path to the player
+// the field is computed once and the enemies just follow it.
+// The field depends only on the sector the target is in and the heights of the
+// sectors, not on the exact target position.
+class FlowField
+{
+public:
+  // The field is computed for the most restrictive agent, so anyone that is
+  // not bigger can follow it.
+  struct Agent
+  {
+    f32 radius    = 0.0f;
+    f32 height    = 0.0f;
+    f32 step_up   = 0.0f;
+    f32 step_down = 0.0f;
+  };
+
+  FlowField(const Agent& agent);
+
+  // Rebuilds the field if the target moved into a different sector or the
+  // sector heights changed since the last rebuild.
+  void update(const MapSectors& map, vec3 target_pos, u32 sector_heights_revision);
+
+  // Forces a rebuild on the next update, for example after loading a save.
+  void invalidate();
+
+  // INVALID_SECTOR_ID if the field is empty
+  SectorID get_target_sector() const;
+
+  // True if the target can be reached from this sector
+  bool can_reach_target(SectorID sector) const;
+
+  // Follows the field from "from" to "target_pos" and writes up to "max_points"
+  // way points into "points_out". The points are relative to the sector of
+  // "from", in the same way as "PhysLevel::calc_path_relative" does it. The
+  // transform from this sector to the target sector is written into
+  // "nc_transform_out".
+  // Returns the number of the written points, 0 if the target is unreachable.
+  u64 calc_path_relative
+  (
+    const MapSectors& map,
+    vec3              from,
+    vec3              target_pos,
+    f32               radius,
+    vec3*             points_out,
+    u64               max_points,
+    mat4&             nc_transform_out
+  ) const;
+
+private:
+  void rebuild(const MapSectors& map, SectorID target_sector);
+
+  // Can the agent go from "sector" through the "wall" to the neighboring one?
+  bool can_traverse(const MapSectors& map, SectorID sector, WallID wall) const;
+
+  struct Cell
+  {
+    f32    dist      = 0.0f;            // Distance to the target
+    WallID next_wall = INVALID_WALL_ID; // Portal to leave through, invalid in the target sector
+    bool   reachable = false;
+  };
+
+  struct OpenItem
+  {
+    f32      dist;
+    SectorID sector;
+
+    // Min-heap, ties broken by the sector ID to stay deterministic
+    bool operator<(const OpenItem& other) const
+    {
+      return dist > other.dist || (dist == other.dist && sector > other.sector);
+    }
+  };
+
+  Agent                 m_agent;
+  std::vector<Cell>     m_cells; // indexed by the sector ID
+  std::vector<OpenItem> m_open;  // reused between the rebuilds
+  SectorID              m_target_sector = INVALID_SECTOR_ID;
+  u32                   m_revision      = 0;
+  bool                  m_valid         = false;
+};
+
+}
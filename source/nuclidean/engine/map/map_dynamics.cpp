@@ -13,6 +13,7 @@
 #include <math/lingebra.h>
 #include <math/utils.h>
 #include <buffer.h>
+#include <frame_arena.h>
 
 #include <algorithm> // std::count_if
 
@@ -69,6 +70,18 @@ void MapDynamics::on_map_rebuild_and_entities_created()
       activators[sd.activator].affected_sectors.push_back(sid);
     }
   }
+
+  // Let the path search know which doors the enemies can open, so it does not
+  // have to go through all triggers each time
+  map.enemy_sensitive_activators.assign(activators.size(), 0);
+  for (const TriggerData& td : triggers)
+  {
+    if (td.enemy_sensitive && td.activator != INVALID_ACTIVATOR_ID)
+    {
+      nc_assert(td.activator < activators.size());
+      map.enemy_sensitive_activators[td.activator] = 1;
+    }
+  }
 }
 
 //==============================================================================
@@ -205,7 +218,7 @@ bool MapDynamics::switch_wall_segment_trigger
 //==============================================================================
 void MapDynamics::evaluate_activators
 (
-  std::vector<s16>& activator_values, f32 delta, bool notify, std::vector<ActivatorHookArg>* const out_info /* = nullptr*/
+  std::span<s16> activator_values, f32 delta, bool notify, std::pmr::vector<ActivatorHookArg>* const out_info /* = nullptr*/
 )
 {
   nc_assert(triggers.size() <= MAX_TRIGGERS);
@@ -330,8 +343,17 @@ void MapDynamics::update(f32 delta)
   // Now iterate all sectors that can be activated and move them correctly
   nc_assert(activators.size() <= MAX_ACTIVATORS);
   ActivatorID activator_cnt = cast<ActivatorID>(activators.size());
-  std::vector<s16> activator_values(activator_cnt, 0);
-  std::vector<ActivatorHookArg> activator_hook_args(activator_cnt, ActivatorHookArg{.delta = delta});
+
+  // All of this is thrown away at the end of the update
+  std::pmr::memory_resource* arena = FrameArena::get_resource();
+  std::pmr::vector<s16> activator_values(activator_cnt, 0, arena);
+  std::pmr::vector<ActivatorHookArg> activator_hook_args(arena);
+  activator_hook_args.reserve(activator_cnt);
+  for (ActivatorID activator_id = 0; activator_id < activator_cnt; ++activator_id)
+  {
+    // Not a copy of a single arg, a copy would put the entities on the heap
+    activator_hook_args.push_back(ActivatorHookArg{.delta = delta, .entities = std::pmr::vector<EntityID>(arena)});
+  }
 
   // Iterate triggers
   evaluate_activators(activator_values, delta, true, &activator_hook_args);
@@ -373,6 +395,11 @@ void MapDynamics::update(f32 delta)
         moved = true;
       }
 
+      if (moved)
+      {
+        sector_heights_revision += 1;
+      }
+
       if (moved && sector_change_callback)
       {
         // The sector changed.. Notify potential listener.
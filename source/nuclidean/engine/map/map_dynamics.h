@@ -7,6 +7,8 @@
 
 #include <map>
 #include <functional>
+#include <memory_resource> // std::pmr::vector
+#include <span>
 #include <string>
 
 #include <json/json_fwd.hpp>
@@ -94,7 +96,7 @@ private:
 
 struct ActivatorHookArg {
   f32 delta;
-  std::vector<EntityID> entities;
+  std::pmr::vector<EntityID> entities; // lives only for a single update
 };
 class IActivatorHook
 {
@@ -136,7 +138,7 @@ struct MapDynamics
 
   void evaluate_activators
   (
-    std::vector<s16>& out_values, f32 update_dt = 0.0f, bool notify = false, std::vector<ActivatorHookArg> *const out_info = nullptr
+    std::span<s16> out_values, f32 update_dt = 0.0f, bool notify = false, std::pmr::vector<ActivatorHookArg> *const out_info = nullptr
   );
 
   bool switch_wall_segment_trigger(SectorID sector, WallID wall, u8 segment, bool& turned_on);
@@ -164,6 +166,10 @@ struct MapDynamics
   std::vector<EntityID>      sector_sounds; // Active sounds for moving sectors
   std::vector<bool>          moving_sectors;
 
+  // Incremented each time a sector changes its height. Lets the systems that
+  // depend on the heights know they should recompute their data.
+  u32                        sector_heights_revision = 0;
+
   SectorChangeCallback  sector_change_callback;
 };
 
@@ -85,7 +85,10 @@ namespace nc
     {
       revealed = true;
       get_engine().get_module<GameSystem>().increment_revealed_count();
-      get_engine().get_module<UserInterfaceSystem>().get_hud()->show_secret();
+      if (!get_engine().is_headless())
+      {
+        get_engine().get_module<UserInterfaceSystem>().get_hud()->show_secret();
+      }
       SoundSystem::get().play_oneshot(Sounds::secret, 1.0f);
     }
   }
@@ -10,22 +10,23 @@
 #include <buffer.h>
 
 #include <grid.h>
+#include <stack_vector.h>
 #include <profiling.h>
 #include <cvars.h>
 
 #include <algorithm>
 #include <array>
 #include <vector>
-#include <queue>
-#include <set>
-#include <map>
 #include <iterator> // std::back_inserter
 #include <cmath>    // std::acos
 #include <utility>  // std::pair
 
 #if NC_BENCHMARK
 #include <benchmark/benchmark.h>
+#include <engine/map/benchmark_level.h>
+#include <engine/player/level_types.h>
 #include <numbers>
+#include <map>
 #endif
 
 namespace nc
@@ -173,14 +174,27 @@ void MapSectors::query_visible
 )
 const
 {
-  NC_SCOPE_PROFILER(MapSystemQueryVisible)
-
   nc_assert(is_normal(view_dir));
-  nc_assert(ver_fov < HALF_PI, "Fix this elsewhere");
 
   // The angle of looking up/down
-  f32 angle_ver = std::atan2f(std::abs(view_dir.y), length(view_dir.xz()));
-  f32 threshold = HALF_PI - ver_fov * 0.5f;
+  const f32 angle_ver = std::atan2f(std::abs(view_dir.y), length(view_dir.xz()));
+
+  this->query_visible_with_hor_fov
+  (
+    position.xz(),
+    normalize(view_dir.xz()),
+    calc_query_hor_fov(angle_ver, hor_fov, ver_fov),
+    visible,
+    recursion_depth
+  );
+}
+
+//==============================================================================
+f32 MapSectors::calc_query_hor_fov(f32 angle_ver, f32 hor_fov, f32 ver_fov)
+{
+  nc_assert(ver_fov < HALF_PI, "Fix this elsewhere");
+
+  const f32 threshold = HALF_PI - ver_fov * 0.5f;
 
   // This interpolates the horizontal fov lineary between the original value
   // and 360 degrees based on our vertical view angle (because if we are looking
@@ -189,27 +203,40 @@ const
   // be transformed, but it looks ok so let's keep it that way for now.
   if (angle_ver >= threshold)
   {
-    hor_fov = PI;
-  }
-  else
-  {
-    f32 coeff = angle_ver / threshold; // 0 to 1
-    hor_fov = PI * coeff + hor_fov * (1.0f - coeff);
+    return PI;
   }
 
+  const f32 coeff = angle_ver / threshold; // 0 to 1
+  return PI * coeff + hor_fov * (1.0f - coeff);
+}
+
+//==============================================================================
+void MapSectors::query_visible_with_hor_fov
+(
+  vec2            position,
+  vec2            view_dir,
+  f32             hor_fov,
+  VisibilityTree& visible,
+  u8              recursion_depth
+)
+const
+{
+  NC_SCOPE_PROFILER(MapSystemQueryVisible)
+
+  nc_assert(is_normal(view_dir));
+
   const auto final_angle = hor_fov >= PI
     ? Frustum2::FULL_ANGLE
     : std::cosf(hor_fov * 0.5f);
 
   const auto frustum = Frustum2
   {
-    .center    = position.xz(),
-    .direction = normalize(view_dir.xz()),
+    .center    = position,
+    .direction = view_dir,
     .angle     = final_angle
   };
 
-  visible.portal_sector = INVALID_SECTOR_ID;
-  visible.portal_wall   = INVALID_WALL_ID;
+  visible.clear();
 
   constexpr u64 MAX_CAMERA_SECTORS = 8; // bump this up if the assert ever fires
   std::array<SectorID, MAX_CAMERA_SECTORS> sectors_out;
@@ -217,7 +244,7 @@ const
   const u32 sec_count = map_helpers::get_sectors_from_point
   (
     *this,
-    position.xz(),
+    position,
     sectors_out.data(),
     MAX_CAMERA_SECTORS
   );
@@ -228,10 +255,13 @@ const
     return;
   }
 
+  // The root node, the one we observe straight through our eyes
+  visible.nodes.emplace_back();
+
   const auto slots_temp = FrustumBuffer{frustum};
   this->query_visible_sectors_impl
   (
-    sectors_out.data(), sec_count, slots_temp, visible, recursion_depth
+    sectors_out.data(), sec_count, slots_temp, visible, VisibilityTree::ROOT, recursion_depth
   );
 }
 
@@ -247,13 +277,13 @@ const
   nc_assert(sectors_out.sectors.empty());
   nc_assert(sectors_out.transforms.empty());
 
-  using Pair = std::pair<SectorID, mat4>;
-
   // Perform a floodfill from the given point
   // NOTE: this algorithm assumes that we do not visit the same sectors through
   // different NC portals twice. In such case it might not work properly.
-  SectorSet        visited;
-  std::queue<Pair> to_visit;
+  // The output works as a BFS queue as well, sectors are visited in the same
+  // order as they are inserted. This way we do not allocate anything if the
+  // caller reuses the output.
+  SectorSet& visited = sectors_out;
 
   constexpr u64 MAX_START_SECTORS = 8;
   SectorID start_sectors[MAX_START_SECTORS]{};
@@ -275,16 +305,16 @@ const
     mat4     trans = identity<mat4>();
     SectorID sid   = start_sectors[i];
 
-    to_visit.push({sid, trans});
     visited.sectors.push_back(sid);
     visited.transforms.push_back(trans);
   }
 
   // Then go on
-  while (!to_visit.empty())
+  for (u64 visit_idx = 0; visit_idx < visited.sectors.size(); ++visit_idx)
   {
-    auto[sid, trans] = to_visit.front();
-    to_visit.pop();
+    // Copy, the arrays can reallocate
+    const SectorID sid   = visited.sectors[visit_idx];
+    const mat4     trans = visited.transforms[visit_idx];
 
     map_helpers::for_each_portal(*this, sid, [&](WallID wid)
     {
@@ -324,14 +354,10 @@ const
       }
 
       // Insert it
-      to_visit.push({neighbor, final_trans});
       visited.sectors.push_back(neighbor);
       visited.transforms.push_back(final_trans);
     });
   }
-
-  // Move it from the visited list to output
-  sectors_out = std::move(visited);
 }
 
 //==============================================================================
@@ -346,19 +372,20 @@ const
   nc_assert(sectors_out.sectors.empty());
   nc_assert(sectors_out.transforms.empty());
 
+  // The rest of the light range when entering the sector at the given index
+  // of the output
   struct Item
   {
-    SectorID sid;
-    vec2     pt;
-    f32      dist;
-    mat4     trans;
+    vec2 pt;
+    f32  dist;
   };
 
   // Perform a floodfill from the given point
   // NOTE: this algorithm assumes that we do not visit the same sectors through
   // different NC portals twice. In such case it might not work properly.
-  SectorSet        visited;
-  std::queue<Item> to_visit;
+  // The output works as a BFS queue, same as in the function above.
+  SectorSet&             visited = sectors_out;
+  StackVector<Item, 32>  items;
 
   constexpr u64 MAX_START_SECTORS = 8;
   SectorID start_sectors[MAX_START_SECTORS]{};
@@ -380,16 +407,18 @@ const
     mat4     trans = identity<mat4>();
     SectorID sid = start_sectors[i];
 
-    to_visit.push(Item{ sid, pos, range, trans });
+    items.push_back(Item{ pos, range });
     visited.sectors.push_back(sid);
     visited.transforms.push_back(trans);
   }
 
   // Then go on
-  while (!to_visit.empty())
+  for (u64 visit_idx = 0; visit_idx < visited.sectors.size(); ++visit_idx)
   {
-    auto [sid, pt, r, trans] = to_visit.front();
-    to_visit.pop();
+    // Copy, the arrays can reallocate
+    const SectorID sid   = visited.sectors[visit_idx];
+    const mat4     trans = visited.transforms[visit_idx];
+    const auto [pt, r]   = items[visit_idx];
 
     map_helpers::for_each_portal(*this, sid, [&](WallID wid)
       {
@@ -422,7 +451,7 @@ const
             mat4 full_trans = relative * trans;
             vec2 tpt = (relative * vec4{ midpt.x, 0.0f, midpt.y, 1.0f }).xz();
 
-            to_visit.push(Item{ neighbor, tpt, r - d, full_trans });
+            items.push_back(Item{ tpt, r - d });
             visited.sectors.push_back(neighbor);
             visited.transforms.push_back(full_trans);
           }
@@ -431,65 +460,132 @@ const
         {
           if (dist::point_line_2d(pt, wd.pos, wd2.pos) <= r)
           {
-            to_visit.push(Item{ neighbor, pt, r, trans });
+            items.push_back(Item{ pt, r });
             visited.sectors.push_back(neighbor);
             visited.transforms.push_back(trans);
           }
         }
       });
   }
-
-  // Move it from the visited list to output
-  sectors_out = std::move(visited);
 }
 
+//==============================================================================
+// Scratch memory of the visibility query. Reused between the queries so we do
+// not allocate every frame.
+struct VisibilityQueryScratch
+{
+  // Frustums of sectors from the current and the next BFS iteration, indexed
+  // by the sector ID. Only the sectors in the dirty lists are valid.
+  std::vector<FrustumBuffer> curr_slots;
+  std::vector<FrustumBuffer> next_slots;
+  std::vector<SectorID>      curr_dirty;
+  std::vector<SectorID>      next_dirty;
+  std::vector<u8>            in_next;
+
+  struct NucPortalStruct
+  {
+    WallID        wall;
+    SectorID      sector_out;
+    SectorID      sector_in;
+    FrustumBuffer buffer;
+  };
+
+  // Nuclidean portals seen from all the recursion levels, each level owns
+  // the range from its start till the end
+  std::vector<NucPortalStruct> nuclidean_portals;
+
+  //============================================================================
+  void begin(u64 sector_cnt)
+  {
+    if (curr_slots.size() < sector_cnt)
+    {
+      curr_slots.resize(sector_cnt);
+      next_slots.resize(sector_cnt);
+      in_next.resize(sector_cnt, 0);
+    }
+
+    nc_assert(curr_dirty.empty() && next_dirty.empty());
+  }
+
+  //============================================================================
+  // Returns the frustum buffer of the sector for the next iteration
+  FrustumBuffer& get_next(SectorID id)
+  {
+    if (!in_next[id])
+    {
+      in_next[id]    = 1;
+      next_slots[id] = FrustumBuffer{};
+      next_dirty.push_back(id);
+    }
+
+    return next_slots[id];
+  }
+
+  //============================================================================
+  // Makes the next iteration the current one
+  void swap()
+  {
+    std::swap(curr_slots, next_slots);
+    std::swap(curr_dirty, next_dirty);
+    next_dirty.clear();
+
+    for (SectorID id : curr_dirty)
+    {
+      in_next[id] = 0;
+    }
+
+    // Sorted, so the order of sectors in the visibility tree does not depend
+    // on the order of portals we came through
+    std::sort(curr_dirty.begin(), curr_dirty.end());
+  }
+};
+
+static thread_local VisibilityQueryScratch g_visibility_scratch;
+
 //==============================================================================
 void MapSectors::query_visible_sectors_impl
 (
-  const SectorID*      start_sector,
-  u32                  start_sector_cnt,
-  const FrustumBuffer& input_frustums,
-  VisibilityTree&      visible,
-  u8                   recursion_depth
+  const SectorID*        start_sector,
+  u32                    start_sector_cnt,
+  const FrustumBuffer&   input_frustums,
+  VisibilityTree&        visible,
+  VisibilityTree::NodeID node,
+  u8                     recursion_depth
 )
 const
 {
   nc_assert(input_frustums.frustum_slots[0] != INVALID_FRUSTUM);
   nc_assert(start_sector_cnt > 0);
   nc_assert(start_sector != nullptr);
+  nc_assert(node < visible.nodes.size());
 
-  // [Performance] According to a benchmark, the std::map here is actually
-  // faster than using std::unordered_map. Maybe due to poor cache locality?
-  // Did not investigate further.
-  std::map<SectorID, FrustumBuffer> curr_iteration;
-  std::map<SectorID, FrustumBuffer> next_iteration;
+  VisibilityQueryScratch& scratch = g_visibility_scratch;
+  scratch.begin(sectors.size());
 
-  struct NucPortalStruct
-  {
-    SectorID      sector_out;
-    SectorID      sector_in;
-    FrustumBuffer buffer;
-  };
-  std::map<WallID, NucPortalStruct> nuclidean_portals;
+  // Portals of this level start here, the ones before belong to the levels
+  // that called us
+  const u64 portals_begin = scratch.nuclidean_portals.size();
 
   const auto* begin_sector = start_sector;
   const auto* end_sector   = begin_sector + start_sector_cnt;
 
   for (u32 i = 0; i < start_sector_cnt; ++i)
   {
-    next_iteration.insert({start_sector[i], input_frustums});
+    scratch.get_next(start_sector[i]) = input_frustums;
   }
 
+  visible.nodes[node].sectors_begin = cast<u32>(visible.sectors.size());
+
   // Now do a BFS in our dimension
-  while (next_iteration.size())
+  while (scratch.next_dirty.size())
   {
     //swap the buffers
-    curr_iteration = std::move(next_iteration);
-    next_iteration.clear();
+    scratch.swap();
 
-    for (const auto&[id, content] : curr_iteration)
+    for (SectorID id : scratch.curr_dirty)
     {
       nc_assert(id < sectors.size());
+      const FrustumBuffer& content = scratch.curr_slots[id];
 
       // Save it to the tree
       visible.sectors.push_back({id, content});
@@ -567,42 +663,81 @@ const
             );
 
             // either creates and inserts or just merges in
-            if (nuclidean_portals.contains(wall1_idx))
+            auto& portals = scratch.nuclidean_portals;
+            auto  it      = std::find_if
+            (
+              portals.begin() + portals_begin, portals.end(),
+              [&](const auto& portal) { return portal.wall == wall1_idx; }
+            );
+
+            if (it == portals.end())
             {
-              nc_assert(nuclidean_portals[wall1_idx].sector_out == out_sector);
+              it = portals.insert(it, VisibilityQueryScratch::NucPortalStruct
+              {
+                .wall       = wall1_idx,
+                .sector_out = out_sector,
+                .sector_in  = in_sector,
+              });
             }
 
-            nuclidean_portals[wall1_idx].buffer.insert_frustum(new_frustum);
-            nuclidean_portals[wall1_idx].sector_out = out_sector;
-            nuclidean_portals[wall1_idx].sector_in = in_sector;
+            nc_assert(it->sector_out == out_sector);
+            it->buffer.insert_frustum(new_frustum);
+            it->sector_in = in_sector;
           }
           else if (!is_nuclidean)
           {
             // either creates and inserts or just merges in
-            next_iteration[next_sector].insert_frustum(new_frustum);
+            scratch.get_next(next_sector).insert_frustum(new_frustum);
           }
         });
       }
     }
   }
 
+  scratch.curr_dirty.clear();
+  visible.nodes[node].sectors_end = cast<u32>(visible.sectors.size());
+
+  const u64 portals_end = scratch.nuclidean_portals.size();
+
   // If the recursion depth is 0 then there should be NO requests
   // to recursively continue
-  nc_assert(recursion_depth > 0 || nuclidean_portals.empty());
+  nc_assert(recursion_depth > 0 || portals_begin == portals_end);
+
+  // Iterate the portals in the order of their IDs so the order of children
+  // is deterministic
+  std::sort
+  (
+    scratch.nuclidean_portals.begin() + portals_begin,
+    scratch.nuclidean_portals.end(),
+    [](const auto& a, const auto& b) { return a.wall < b.wall; }
+  );
+
+  // Children of this node are stored next to each other
+  const auto children_begin = cast<VisibilityTree::NodeID>(visible.nodes.size());
+  visible.nodes.resize(visible.nodes.size() + (portals_end - portals_begin));
+  visible.nodes[node].children_begin = children_begin;
+  visible.nodes[node].children_end   = cast<VisibilityTree::NodeID>(visible.nodes.size());
 
   // Now lets go to other dimensions in DFS manner recursively if we
   // did not run out of recursion limit
-  for (const auto&[portal_id, data] : nuclidean_portals)
+  for (u64 i = portals_begin; i < portals_end; ++i)
   {
-    auto& child = visible.children.emplace_back();
-    child.portal_wall = portal_id;
-    child.portal_sector = data.sector_in;
+    // Copy it, the recursion can reallocate the array
+    const auto data  = scratch.nuclidean_portals[i];
+    const auto child = cast<VisibilityTree::NodeID>(children_begin + i - portals_begin);
+
+    visible.nodes[child].portal_wall   = data.wall;
+    visible.nodes[child].portal_sector = data.sector_in;
+    visible.nodes[child].depth         = visible.nodes[node].depth + 1;
 
     this->query_visible_sectors_impl
     (
-      &data.sector_out, 1, data.buffer, child, recursion_depth - 1
+      &data.sector_out, 1, data.buffer, visible, child, recursion_depth - 1
     );
   }
+
+  // Give the memory back to the level that called us
+  scratch.nuclidean_portals.resize(portals_begin);
 }
 
 //==============================================================================
@@ -617,6 +752,13 @@ bool MapSectors::is_valid_wall_id(WallID id) const
   return id < this->walls.size();
 }
 
+//==============================================================================
+bool MapSectors::is_activator_enemy_sensitive(ActivatorID id) const
+{
+  // Also handles INVALID_ACTIVATOR_ID
+  return id < this->enemy_sensitive_activators.size() && this->enemy_sensitive_activators[id];
+}
+
 //==============================================================================
 void MapSectors::serialize(Buffer& buffer)
 {
@@ -1306,38 +1448,61 @@ f32 WallData::get_ground_offset() const
 }
 
 //==============================================================================
-static bool is_visible_int(const VisibilityTree& tree, SectorID id, u64& depth)
+void VisibilityTree::clear()
 {
-  auto it = std::find_if(tree.sectors.begin(), tree.sectors.end(), [id](const auto& pair)
-    {
-      return pair.sector == id;
-    });
-
-  bool visible = it != tree.sectors.end();
-  if (visible)
-  {
-    return true;
-  }
+  nodes.clear();
+  sectors.clear();
+}
 
-  u64 depth_copy = depth + 1;
+//==============================================================================
+bool VisibilityTree::is_empty() const
+{
+  return nodes.empty();
+}
 
-  for (const auto& subtree : tree.children)
+//==============================================================================
+std::span<const VisibilityTree::SectorFrustum> VisibilityTree::get_sectors
+(
+  NodeID node
+)
+const
+{
+  if (node >= nodes.size())
   {
-    if (subtree.is_visible(id, depth_copy))
-    {
-      depth = depth_copy;
-      return true;
-    }
+    nc_assert(node == ROOT, "Invalid node");
+    return {};
   }
 
-  return false;
+  const Node& n = nodes[node];
+  return std::span{sectors.data() + n.sectors_begin, sectors.data() + n.sectors_end};
 }
 
 //==============================================================================
 bool VisibilityTree::is_visible(SectorID id, u64& depth) const
 {
+  bool visible = false;
   depth = 0;
-  return is_visible_int(*this, id, depth);
+
+  for (const Node& node : nodes)
+  {
+    if (visible && node.depth >= depth)
+    {
+      // Can not find a better one
+      continue;
+    }
+
+    for (const SectorFrustum& sf : this->get_sectors(cast<NodeID>(&node - nodes.data())))
+    {
+      if (sf.sector == id)
+      {
+        visible = true;
+        depth   = node.depth;
+        break;
+      }
+    }
+  }
+
+  return visible;
 }
 
 //==============================================================================
@@ -1390,6 +1555,8 @@ static void build_sector_grid_and_bboxes(MapSectors& map)
     map.sector_bboxes.push_back(bbox3);
     map.sector_grid.insert(sector_aabb, sid);
   }
+
+  map.sector_grid.build();
 }
 
 //==============================================================================
@@ -1444,22 +1611,34 @@ static bool check_for_sector_overlaps
     grid.insert(bbox, sector_idx);
   }
 
+  grid.build();
+
+  // Sectors spanning multiple cells are reported multiple times, dedup them
+  std::vector<SectorID> possible_intersection_sectors;
+
   // check visible_sectors overlap
   for (SectorID sector_idx = 0; sector_idx < sectors.size(); ++sector_idx)
   {
     const auto& bbox = sector_bboxes[sector_idx];
     nc_assert(bbox.is_valid());
 
-    std::set<SectorID> possible_intersection_sectors;
+    possible_intersection_sectors.clear();
     grid.query_aabb(bbox, [&](aabb2, const SectorID& sector)->bool
       {
         if (sector != sector_idx)
         {
-          possible_intersection_sectors.insert(sector);
+          possible_intersection_sectors.push_back(sector);
         }
         return false;
       });
 
+    std::sort(possible_intersection_sectors.begin(), possible_intersection_sectors.end());
+    possible_intersection_sectors.erase
+    (
+      std::unique(possible_intersection_sectors.begin(), possible_intersection_sectors.end()),
+      possible_intersection_sectors.end()
+    );
+
     for (SectorID other_idx : possible_intersection_sectors)
     {
       nc_assert(other_idx != sector_idx);
@@ -1667,6 +1846,12 @@ static void compute_portal_render_data(MapSectors& map)
       const auto [dest_pos, dest_rotation, _] = compute_pos_rotation_scale(map, dest_sector_id, dest_wall_id);
       const mat4 dest_transform_no_scale = translation(dest_pos) * rotate(mat4(1.0f), dest_rotation, VEC3_Y);
 
+      map.nc_portal_segments.push_back(MapSectors::NcPortalSegment
+      {
+        .p1 = map.walls[wall_id].pos,
+        .p2 = map.walls[map_helpers::next_wall(map, sector_id, wall_id)].pos,
+      });
+
       map.walls[wall_id].render_data_index = static_cast<PortalRenderID>(map.portals_render_data.size());
       map.portals_render_data.emplace_back(
         src_rotation,
@@ -1877,3 +2062,251 @@ int build_map
 }
 
 }
+
+#if NC_BENCHMARK
+namespace nc
+{
+
+//==============================================================================
+// The visibility query as it was before the flat BFS, kept to have a baseline
+// for "benchmark_query_visible". Every BFS layer and the non-euclidean portals
+// live in a std::map and the tree is recursive, a fresh one for every query.
+struct MapVisibilityTree
+{
+  WallID                                     portal_wall   = INVALID_WALL_ID;
+  SectorID                                   portal_sector = INVALID_SECTOR_ID;
+  std::vector<VisibilityTree::SectorFrustum> sectors;
+  std::vector<MapVisibilityTree>             children;
+};
+
+//==============================================================================
+static void query_visible_sectors_std_map
+(
+  const MapSectors&    map,
+  const SectorID*      start_sector,
+  u32                  start_sector_cnt,
+  const FrustumBuffer& input_frustums,
+  MapVisibilityTree&   visible,
+  u8                   recursion_depth
+)
+{
+  nc_assert(input_frustums.frustum_slots[0] != INVALID_FRUSTUM);
+  nc_assert(start_sector_cnt > 0);
+  nc_assert(start_sector != nullptr);
+
+  std::map<SectorID, FrustumBuffer> curr_iteration;
+  std::map<SectorID, FrustumBuffer> next_iteration;
+
+  struct NucPortalStruct
+  {
+    SectorID      sector_out;
+    SectorID      sector_in;
+    FrustumBuffer buffer;
+  };
+  std::map<WallID, NucPortalStruct> nuclidean_portals;
+
+  const auto* begin_sector = start_sector;
+  const auto* end_sector   = begin_sector + start_sector_cnt;
+
+  for (u32 i = 0; i < start_sector_cnt; ++i)
+  {
+    next_iteration.insert({start_sector[i], input_frustums});
+  }
+
+  while (next_iteration.size())
+  {
+    curr_iteration = std::move(next_iteration);
+    next_iteration.clear();
+
+    for (const auto&[id, content] : curr_iteration)
+    {
+      nc_assert(id < map.sectors.size());
+      visible.sectors.push_back({id, content});
+
+      for (const auto& frustum : content.frustum_slots)
+      {
+        if (frustum == INVALID_FRUSTUM)
+        {
+          continue;
+        }
+
+        map_helpers::for_each_portal(map, id, [&](WallID wall1_idx)
+        {
+          const auto wall2_idx    = map_helpers::next_wall(map, id, wall1_idx);
+          const auto next_sector  = map.walls[wall1_idx].portal_sector_id;
+          const bool is_nuclidean = map.walls[wall1_idx].get_portal_type() == PortalType::non_euclidean;
+          nc_assert(next_sector != INVALID_SECTOR_ID);
+
+          const auto p1 = map.walls[wall1_idx].pos;
+          const auto p2 = map.walls[wall2_idx].pos;
+
+          const auto p1_to_p2  = p2 - p1;
+          const auto p1_to_cam = frustum.center - p1;
+
+          const bool visible_from_start
+            = std::find(begin_sector, end_sector, next_sector) != end_sector;
+
+          if (!is_nuclidean && visible_from_start)
+          {
+            return;
+          }
+
+          if (cross(p1_to_cam, p1_to_p2) > 0.0f)
+          {
+            return;
+          }
+
+          if (!frustum.intersects_segment(p1, p2))
+          {
+            return;
+          }
+
+          auto new_frustum = frustum.modified_with_portal(p1, p2);
+          if (new_frustum.is_empty())
+          {
+            return;
+          }
+
+          if (is_nuclidean && recursion_depth > 0) [[unlikely]]
+          {
+            map_helpers::modify_nuclidean_frustum(map, new_frustum, wall1_idx, id);
+
+            nuclidean_portals[wall1_idx].buffer.insert_frustum(new_frustum);
+            nuclidean_portals[wall1_idx].sector_out = next_sector;
+            nuclidean_portals[wall1_idx].sector_in  = id;
+          }
+          else if (!is_nuclidean)
+          {
+            next_iteration[next_sector].insert_frustum(new_frustum);
+          }
+        });
+      }
+    }
+  }
+
+  for (const auto&[portal_id, data] : nuclidean_portals)
+  {
+    auto& child = visible.children.emplace_back();
+    child.portal_wall   = portal_id;
+    child.portal_sector = data.sector_in;
+
+    query_visible_sectors_std_map
+    (
+      map, &data.sector_out, 1, data.buffer, child, recursion_depth - 1
+    );
+  }
+}
+
+//==============================================================================
+// Same as "MapSectors::query_visible", but through the std::map based BFS
+static void query_visible_std_map
+(
+  const MapSectors&  map,
+  vec3               position,
+  vec3               view_dir,
+  f32                hor_fov,
+  f32                ver_fov,
+  MapVisibilityTree& visible,
+  u8                 recursion_depth
+)
+{
+  const f32 angle_ver = std::atan2(std::abs(view_dir.y), length(view_dir.xz()));
+  const f32 query_fov = MapSectors::calc_query_hor_fov(angle_ver, hor_fov, ver_fov);
+
+  const auto frustum = Frustum2
+  {
+    .center    = position.xz(),
+    .direction = normalize(view_dir.xz()),
+    .angle     = query_fov >= PI ? Frustum2::FULL_ANGLE : std::cos(query_fov * 0.5f),
+  };
+
+  constexpr u32 MAX_CAMERA_SECTORS = 8;
+  std::array<SectorID, MAX_CAMERA_SECTORS> sectors_out;
+
+  const u32 sec_count = map_helpers::get_sectors_from_point
+  (
+    map, frustum.center, sectors_out.data(), MAX_CAMERA_SECTORS
+  );
+
+  if (sec_count == 0)
+  {
+    return;
+  }
+
+  query_visible_sectors_std_map
+  (
+    map, sectors_out.data(), sec_count, FrustumBuffer{frustum}, visible, recursion_depth
+  );
+}
+
+//==============================================================================
+// Queries the visibility from the middle of each sector of the level, looking
+// in a different direction each time, with the recursion depth the renderer
+// uses. The argument is an index into the LevelsDB.
+template<typename F>
+static void run_query_visible_benchmark(benchmark::State& state, F&& query)
+{
+  const LevelName&      level_name = LevelsDB[state.range(0)];
+  const BenchmarkLevel* level      = get_benchmark_level(level_name);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  state.SetLabel(level_name.to_string());
+
+  constexpr u8  RECURSION_DEPTH = 64;
+  constexpr f32 HOR_FOV         = std::numbers::pi_v<f32> * 0.5f;
+  constexpr f32 VER_FOV         = std::numbers::pi_v<f32> * 0.25f;
+
+  const std::vector<vec3> positions = level->get_sector_centers(1.0f);
+  if (positions.empty())
+  {
+    state.SkipWithError("The level has no sectors");
+    return;
+  }
+
+  u64 idx = 0;
+
+  for (auto _ : state)
+  {
+    const f32  angle = cast<f32>(idx) * 0.7f;
+    const vec3 dir   = vec3{std::cos(angle), 0.0f, std::sin(angle)};
+    const vec3 pos   = positions[idx++ % positions.size()];
+
+    query(level->map, pos, dir, HOR_FOV, VER_FOV, RECURSION_DEPTH);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+//==============================================================================
+static void benchmark_query_visible(benchmark::State& state)
+{
+  VisibilityTree tree;
+
+  run_query_visible_benchmark(state, [&](const MapSectors& map, vec3 pos, vec3 dir, f32 hor_fov, f32 ver_fov, u8 depth)
+  {
+    map.query_visible(pos, dir, hor_fov, ver_fov, tree, depth);
+    benchmark::DoNotOptimize(tree.sectors.data());
+  });
+}
+BENCHMARK(benchmark_query_visible)->DenseRange(0, LevelsDB.size() - 1);
+
+//==============================================================================
+// The baseline of "benchmark_query_visible", callers of the old query created a
+// new tree every time
+static void benchmark_query_visible_std_map(benchmark::State& state)
+{
+  run_query_visible_benchmark(state, [](const MapSectors& map, vec3 pos, vec3 dir, f32 hor_fov, f32 ver_fov, u8 depth)
+  {
+    MapVisibilityTree tree;
+    query_visible_std_map(map, pos, dir, hor_fov, ver_fov, tree, depth);
+    benchmark::DoNotOptimize(tree.sectors.data());
+  });
+}
+BENCHMARK(benchmark_query_visible_std_map)->DenseRange(0, LevelsDB.size() - 1);
+
+}
+#endif
@@ -27,6 +27,7 @@
 #include <engine/graphics/resources/texture_id.h>
 
 #include <vector>
+#include <span>
 #include <functional>
 
 namespace nc
@@ -35,23 +36,47 @@ namespace nc
 // This data structure lets us check which sectors and their parts are visible
 // and which are not.
 // Can be used for occlusion culling or detecting visible regions by AI
+// The tree is flattened into two arrays so it can be reused between the
+// queries without any allocations. Each node owns a continuous range of
+// visible sectors and the children of each node are stored next to each
+// other.
 struct VisibilityTree
 {
+  using NodeID = u32;
+  static constexpr NodeID ROOT = 0;
+
   struct SectorFrustum
   {
     SectorID      sector;  // part of this sector is visible
     FrustumBuffer frustum; // and this is that part
   };
 
-  // This is the portal we see into the sector through. If invalid
-  // then it means that we are observing the sector straight
-  // through our eyes and not through a portal
-  WallID                      portal_wall   = INVALID_WALL_ID;
-  SectorID                    portal_sector = INVALID_SECTOR_ID;
-  // This is a list of sectors that are visible
-  std::vector<SectorFrustum>  sectors;
-  // And this is a list of portals we see (might be empty)
-  std::vector<VisibilityTree> children;
+  struct Node
+  {
+    // This is the portal we see into the sector through. If invalid
+    // then it means that we are observing the sector straight
+    // through our eyes and not through a portal
+    WallID   portal_wall    = INVALID_WALL_ID;
+    SectorID portal_sector  = INVALID_SECTOR_ID;
+    u32      depth          = 0; // number of portals we see this node through
+    u32      sectors_begin  = 0; // range of visible sectors in "sectors"
+    u32      sectors_end    = 0;
+    NodeID   children_begin = 0; // range of portals we see in "nodes"
+    NodeID   children_end   = 0;
+  };
+
+  // All nodes of the tree, the root is the first one (if any)
+  std::vector<Node>          nodes;
+  // Visible sectors of all the nodes
+  std::vector<SectorFrustum> sectors;
+
+  // Removes all nodes, but keeps the memory
+  void clear();
+
+  bool is_empty() const;
+
+  // List of sectors visible in the given node
+  std::span<const SectorFrustum> get_sectors(NodeID node = ROOT) const;
 
   // Runs through the tree and checks if the given sector is visible.
   // If visible then also outputs the smallest depth at which this
@@ -239,6 +264,19 @@ struct MapSectors
   column<aabb3>              sector_bboxes;
   StatGridAABB2<SectorID>    sector_grid;
 
+  // Segments of all nuclidean portal walls, used by the path search heuristic
+  struct NcPortalSegment
+  {
+    vec2 p1;
+    vec2 p2;
+  };
+  column<NcPortalSegment>    nc_portal_segments;
+
+  // Indexed by the activator ID, true if the activator can be triggered by an
+  // enemy (and therefore enemies can open the door). Filled in by the map
+  // dynamics, as they own the triggers.
+  column<u8>                 enemy_sensitive_activators;
+
   using TraverseVisitor = std::function<void(SectorID, Frustum2, WallID)>;
   using WallVisitor     = std::function<void(WallID)>;
   // Traverses the sector system in a BFS order and calls the visitor
@@ -250,10 +288,26 @@ struct MapSectors
     vec3            view_dir,        // normalized view direction
     f32             hor_fov_rad,     // [0-Pi], in radians. >= Pi means 360 degrees of view
     f32             ver_fov_rad,     // Vertical FOV in radians, [0-Pi)
-    VisibilityTree& visibility_tree, // callback function that is called for each visited sector
+    VisibilityTree& visibility_tree, // output, gets cleared before the query
     u8              recursion_depth  // depth 0 means only the current "dimension" without any traversal of portals
   ) const;
 
+  // Same as above, but the horizontal FOV is used exactly as it is. See
+  // "calc_query_hor_fov" for how "query_visible" adjusts it.
+  void query_visible_with_hor_fov
+  (
+    vec2            position,
+    vec2            view_dir,        // normalized
+    f32             query_fov_rad,   // >= Pi means 360 degrees of view
+    VisibilityTree& visibility_tree,
+    u8              recursion_depth
+  ) const;
+
+  // The horizontal FOV of the visibility query, the FOV gets wider when
+  // looking up/down as we can see sectors behind us. "angle_ver" is the
+  // absolute angle of looking up/down in radians.
+  static f32 calc_query_hor_fov(f32 angle_ver, f32 hor_fov_rad, f32 ver_fov_rad);
+
   // Queries a sectors nearby a point. This includes sectors behind nuclidean
   // portals. Implemented as a floodfill.
   // Returns a set of sectors and their transforms relative to the point.
@@ -323,15 +377,19 @@ struct MapSectors
   bool is_valid_sector_id(SectorID id) const;
   bool is_valid_wall_id(WallID id)     const;
 
+  // False for INVALID_ACTIVATOR_ID
+  bool is_activator_enemy_sensitive(ActivatorID id) const;
+
   void serialize(class Buffer& buffer);
 
 private:
   void query_visible_sectors_impl(
-    const SectorID*      start_sectors,
-    u32                  start_sector_cnt,
-    const FrustumBuffer& frustum,
-    VisibilityTree&      visible,
-    u8                   recursion_depth) const;
+    const SectorID*        start_sectors,
+    u32                    start_sector_cnt,
+    const FrustumBuffer&   frustum,
+    VisibilityTree&        visible,
+    VisibilityTree::NodeID node,
+    u8                     recursion_depth) const;
 };
 
 namespace map_building
@@ -17,11 +17,19 @@
 #include <stack_vector.h>
 
 #include <algorithm> // std::sort
-#include <set>
 #include <utility>  // std::pair
 #include <type_traits>
 #include <queue>    // std::priority_queue
-#include <map>      // std::map
+
+#if NC_BENCHMARK
+#include <benchmark/benchmark.h>
+#include <engine/map/benchmark_level.h>
+#include <engine/player/level_types.h>
+#include <random>   // std::mt19937
+#include <set>
+#include <map>
+#include <functional>
+#endif
 
 namespace nc::phys_helpers
 {
@@ -61,6 +69,208 @@ static f32 calc_dist_to_bbox(T pt, const aabb3& bbox)
   }
 }
 
+//==============================================================================
+// Visited set of sectors used by the raycast broad phase. Instead of clearing
+// it each query we bump the generation, so a query only has to compare the
+// stamps. One instance per thread to allow raycasts from multiple threads.
+struct SectorVisitStamps
+{
+  std::vector<u32> stamps;         // indexed by the sector id
+  u32              generation = 0;
+
+  // Starts a new query on a map with the given number of sectors
+  void begin(u64 sector_cnt)
+  {
+    if (stamps.size() < sector_cnt)
+    {
+      stamps.resize(sector_cnt, 0);
+    }
+
+    generation += 1;
+    if (generation == 0) [[unlikely]]
+    {
+      // Wrapped around, old stamps could match again
+      std::fill(stamps.begin(), stamps.end(), 0);
+      generation = 1;
+    }
+  }
+
+  // Returns true if the sector was not visited yet during this query
+  bool visit(SectorID sid)
+  {
+    nc_assert(sid < stamps.size());
+    if (stamps[sid] == generation)
+    {
+      return false;
+    }
+
+    stamps[sid] = generation;
+    return true;
+  }
+};
+
+static thread_local SectorVisitStamps g_sector_visit_stamps;
+
+// The broad phase stays on the stack unless a ray overlaps more sectors
+constexpr u64 EXPECTED_OVERLAP_SECTORS = 64;
+
+//==============================================================================
+// Open and closed lists of the A* path search. Indexed by the sector id and
+// reused between the queries, the nodes are reset lazily with a stamp. One
+// instance per thread so the enemies can search for paths in parallel.
+struct PathSearchScratch
+{
+  static constexpr u32 CLOSED = static_cast<u32>(-1);
+
+  struct Node
+  {
+    vec3     point;       // Way point, in the space of the previous sector
+    vec3     local_point; // The same way point in the space of this sector
+    f32      dist;        // Length of the path to the way point
+    f32      estimate;    // dist + heuristic, the open list is sorted by this
+    SectorID prev_sector; // Previous sector
+    WallID   wall_index;  // Portal we used to get to this sector
+    u32      stamp;       // Node is valid only if this matches the query stamp
+    u32      heap_index;  // Position in the open list or CLOSED
+  };
+
+  std::vector<Node>     nodes;
+  std::vector<SectorID> open; // binary min-heap on Node::estimate
+  u32                   stamp = 0;
+
+  // Starts a new query on a map with the given number of sectors
+  void begin(u64 sector_cnt)
+  {
+    if (nodes.size() < sector_cnt)
+    {
+      nodes.resize(sector_cnt, Node{.stamp = 0});
+    }
+
+    open.clear();
+
+    stamp += 1;
+    if (stamp == 0) [[unlikely]]
+    {
+      // Wrapped around, old stamps could match again
+      for (Node& node : nodes)
+      {
+        node.stamp = 0;
+      }
+      stamp = 1;
+    }
+  }
+
+  // Returns nullptr if the sector was not reached yet during this query
+  Node* find(SectorID sid)
+  {
+    nc_assert(sid < nodes.size());
+    return nodes[sid].stamp == stamp ? &nodes[sid] : nullptr;
+  }
+
+  bool is_closed(SectorID sid) const
+  {
+    return nodes[sid].stamp == stamp && nodes[sid].heap_index == CLOSED;
+  }
+
+  // Inserts the node into the open list or lowers its estimate if already
+  // there
+  void push_or_decrease(SectorID sid)
+  {
+    Node& node = nodes[sid];
+    if (node.heap_index == CLOSED)
+    {
+      node.heap_index = cast<u32>(open.size());
+      open.push_back(sid);
+    }
+
+    sift_up(node.heap_index);
+  }
+
+  // Removes the node with the lowest estimate from the open list and closes it
+  SectorID pop()
+  {
+    nc_assert(!open.empty());
+
+    const SectorID top = open.front();
+    nodes[top].heap_index = CLOSED;
+
+    const SectorID last = open.back();
+    open.pop_back();
+
+    if (!open.empty())
+    {
+      open[0] = last;
+      nodes[last].heap_index = 0;
+      sift_down(0);
+    }
+
+    return top;
+  }
+
+private:
+  bool is_less(SectorID a, SectorID b) const
+  {
+    // Ties broken by the sector id so the result does not depend on the order
+    // of insertion
+    const f32 ea = nodes[a].estimate;
+    const f32 eb = nodes[b].estimate;
+    return ea < eb || (ea == eb && a < b);
+  }
+
+  void swap_items(u32 a, u32 b)
+  {
+    std::swap(open[a], open[b]);
+    nodes[open[a]].heap_index = a;
+    nodes[open[b]].heap_index = b;
+  }
+
+  void sift_up(u32 idx)
+  {
+    while (idx > 0)
+    {
+      const u32 parent = (idx - 1) / 2;
+      if (!is_less(open[idx], open[parent]))
+      {
+        break;
+      }
+
+      swap_items(idx, parent);
+      idx = parent;
+    }
+  }
+
+  void sift_down(u32 idx)
+  {
+    const u32 cnt = cast<u32>(open.size());
+    while (true)
+    {
+      const u32 left  = idx * 2 + 1;
+      const u32 right = left + 1;
+
+      u32 best = idx;
+      if (left < cnt && is_less(open[left], open[best]))
+      {
+        best = left;
+      }
+
+      if (right < cnt && is_less(open[right], open[best]))
+      {
+        best = right;
+      }
+
+      if (best == idx)
+      {
+        break;
+      }
+
+      swap_items(idx, best);
+      idx = best;
+    }
+  }
+};
+
+static thread_local PathSearchScratch g_path_search_scratch;
+
 //==============================================================================
 static vec2 vector_to_2d(vec2 v)
 {
@@ -73,6 +283,51 @@ static vec2 vector_to_2d(vec3 v)
   return v.xz();
 }
 
+//==============================================================================
+// The broad phase of the raycasts. Gathers the sectors the ray might hit,
+// sorted by their IDs.
+template<typename TVec, u64 N>
+static void query_overlap_sectors
+(
+  const MapSectors&         map,
+  TVec                      ray_from,
+  TVec                      ray_to,
+  f32                       expand,
+  StackVector<SectorID, N>& overlap_sectors
+)
+{
+  NC_SCOPE_COUNTER(query_sectors)
+
+  SectorVisitStamps& stamps = g_sector_visit_stamps;
+  stamps.begin(map.sectors.size());
+
+  auto add_sector = [&](aabb2, SectorID sid)
+  {
+    if (stamps.visit(sid))
+    {
+      overlap_sectors.push_back(sid);
+    }
+
+    return false; // continue iteration
+  };
+
+  if (vector_to_2d(ray_from) == vector_to_2d(ray_to))
+  {
+    // stationary
+    aabb2 bbox = calc_stationary_bbox(ray_from, expand);
+    map.sector_grid.query_aabb(bbox, add_sector);
+  }
+  else
+  {
+    // moving
+    map.sector_grid.query_ray(ray_from, ray_to, expand, add_sector);
+  }
+
+  // Keep the same order of iteration as before so that the equally distant
+  // hits get resolved the same way
+  std::sort(overlap_sectors.begin(), overlap_sectors.end());
+}
+
 //==============================================================================
 // bool(TVec ray_from, TVec ray_to, f32 expand, const WallData& w1, const SectorData& sector, const WallData& w2, f32& c, f32& n)
 template
@@ -105,30 +360,10 @@ static CollisionHit raycast_generic
   nc_assert(expand >= 0.0f, "Radius can not be negative!");
   static_assert(std::is_same_v<TVec, vec3> || std::is_same_v<TVec, vec2>);
 
-  std::set<SectorID> overlap_sectors;
-
-  {
-    NC_SCOPE_COUNTER(query_sectors)
-    if (vector_to_2d(ray_from) == vector_to_2d(ray_to))
-    {
-      // stationary
-      aabb2 bbox = calc_stationary_bbox(ray_from, expand);
-      world.map.sector_grid.query_aabb(bbox, [&](aabb2, SectorID sid)
-      {
-        overlap_sectors.insert(sid);
-        return false; // continue iteration
-      });
-    }
-    else
-    {
-      // moving
-      world.map.sector_grid.query_ray(ray_from, ray_to, expand, [&](aabb2, SectorID sid)
-      {
-        overlap_sectors.insert(sid);
-        return false; // continue iteration
-      });
-    }
-  }
+  // A sector can be in multiple grid cells, the stamps filter out duplicates.
+  // Stays on the stack unless the query is huge.
+  StackVector<SectorID, EXPECTED_OVERLAP_SECTORS> overlap_sectors;
+  query_overlap_sectors(world.map, ray_from, ray_to, expand, overlap_sectors);
 
   CollisionHit best_hit = CollisionHit::no_hit();
 
@@ -400,25 +635,6 @@ static bool calc_path_raw
   nc_assert(step_up   >= 0.0f);
   nc_assert(step_down >= 0.0f);
 
-  struct PrevPoint
-  {
-    SectorID prev_sector; // Previous sector
-    WallID   wall_index;  // Portal we used to get to this sector
-    vec3     point;       // Way point
-    f32      dist;
-  };
-
-  struct CurPoint
-  {
-    SectorID index;
-    f32      dist;
-
-    constexpr bool operator<(const CurPoint& other) const
-    {
-      return dist > other.dist;
-    }
-  };
-
   SectorID start_id = map.get_sector_from_point(start_pos.xz);
   SectorID end_id   = map.get_sector_from_point(end_pos.xz);
   if (start_id == INVALID_SECTOR_ID || end_id == INVALID_SECTOR_ID)
@@ -428,30 +644,46 @@ static bool calc_path_raw
     return false;
   }
 
-  SectorID cur_id = start_id;
-  std::priority_queue<CurPoint> fringe;
-  std::map<SectorID, PrevPoint> visited;
-
-  visited.insert
-  ({
-    start_id, PrevPoint
+  // A lower bound of the remaining distance to the target. A path either
+  // goes straight to the target or has to pass through a nuclidean portal
+  // first, which can shorten it arbitrarily. Therefore the heuristic is the
+  // distance to the target or to the closest nuclidean portal, whatever is
+  // smaller. Never overestimates.
+  const vec2 end_pos_2d = end_pos.xz();
+  auto calc_heuristic = [&](vec2 pt) -> f32
+  {
+    f32 h = distance(pt, end_pos_2d);
+    for (const MapSectors::NcPortalSegment& seg : map.nc_portal_segments)
     {
-      INVALID_SECTOR_ID,
-      INVALID_WALL_ID,
-      start_pos,
-      0
+      h = min(h, dist::point_line_2d(pt, seg.p1, seg.p2));
     }
-  });
 
-  fringe.push({start_id, 0});
+    return h;
+  };
 
-  while (fringe.size())
+  using Node = PathSearchScratch::Node;
+
+  PathSearchScratch& search = g_path_search_scratch;
+  search.begin(map.sectors.size());
+
+  search.nodes[start_id] = Node
   {
-    // Get sector from queue
-    CurPoint cur = fringe.top();
-    cur_id = cur.index;
-    f32 cur_dist = cur.dist;
-    fringe.pop();
+    .point       = start_pos,
+    .local_point = start_pos,
+    .dist        = 0.0f,
+    .estimate    = calc_heuristic(start_pos.xz()),
+    .prev_sector = INVALID_SECTOR_ID,
+    .wall_index  = INVALID_WALL_ID,
+    .stamp       = search.stamp,
+    .heap_index  = PathSearchScratch::CLOSED,
+  };
+  search.push_or_decrease(start_id);
+
+  SectorID cur_id = start_id;
+  while (!search.open.empty())
+  {
+    // Get sector from the open list, closes it as well
+    cur_id = search.pop();
 
     // Found path, end search
     if (cur_id == end_id)
@@ -459,11 +691,21 @@ static bool calc_path_raw
       break;
     }
 
+    // Copy, the node can't change anymore as it is closed
+    const vec3 prev_post = search.nodes[cur_id].local_point;
+    const f32  cur_dist  = search.nodes[cur_id].dist;
+
     map.for_each_portal_of_sector(cur_id, [&](WallID wall1_idx)
     {
       const auto next_sector = map.walls[wall1_idx].portal_sector_id;
       nc_assert(next_sector != INVALID_SECTOR_ID);
 
+      if (search.is_closed(next_sector))
+      {
+        // Already has the shortest path
+        return;
+      }
+
       f32 step_size;
       map.calc_step_height_of_portal(cur_id, wall1_idx, &step_size);
       if (step_size > step_up || step_size < -step_down)
@@ -477,115 +719,101 @@ static bool calc_path_raw
       const SectorDynData& next_sdd = map.sectors_dynamic[next_sector];
       const SectorData&    next_sd  = map.sectors[next_sector];
       f32 sector_height = next_sdd.ceil_height - next_sdd.floor_height;
-      if (sector_height <= height) // we check if this sector has an activator and if it can be triggered by enemies
+      if (sector_height <= height)
       {
-        if (next_sd.activator == INVALID_ACTIVATOR_ID)
+        // We wouldn't fit into this sector, unless it can be opened by enemies
+        if (!map.is_activator_enemy_sensitive(next_sd.activator))
         {
           return;
         }
+      }
 
-        bool found = false;
-        const std::vector<TriggerData>& trig = get_engine().get_module<GameSystem>().get_map_dynamics().triggers;
-        for (u32 i = 0; i < trig.size(); i++)
-        {
-          if (trig[i].activator != next_sd.activator)
-          {
-            continue;
-          }
+      const auto wall2_idx = map_helpers::next_wall(map, cur_id, wall1_idx);
 
-          if (trig[i].enemy_sensitive)
-          {
-            found = true;
-            break;
-          }
-        }
+      auto &wall1= map.walls[wall1_idx];
+      auto &wall2= map.walls[wall2_idx];
+      auto p1 = wall1.pos;
+      auto p2 = wall2.pos;
+      auto p1_to_p2 = p2 - p1;
+      auto wall_length = length(p1_to_p2);
+      if (!(next_sd.force_walkable || wall1.force_walkable || wall2.force_walkable || (wall_length > radius * 2.0f))) // side to side clearance
+      {
+        return;
+      }
 
-        // We wouldn't fit into this sector
-        if (!found)
-        {
-          return;
-        }
+      vec2 wall_dir;
+      wall_dir = normalize_or_zero(p1_to_p2);
+
+      if (abs(p1_to_p2.x) > abs(p1_to_p2.y))
+      {
+        wall_dir = wall_dir / abs(wall_dir.x);
+      }
+      else
+      {
+        wall_dir = wall_dir / abs(wall_dir.y);
       }
 
-      if (!visited.contains(next_sector))
+      p1 += wall_dir * radius * 1.005f;
+      p2 -= wall_dir * radius * 1.005f;
+      p1_to_p2 = p2 - p1;
+
+      // Calculate closest point on p1_to_p2 line
+      f32 l2 = length(p1_to_p2);
+      l2 *= l2;
+      const float t = max(0.0f, min(1.0f, dot(prev_post.xz - p1, p1_to_p2) / l2));
+      const vec2 projection = p1 + t * (p1_to_p2);
+
+      f32 segment_dist = distance(prev_post.xz(), projection);
+      f32 total_dist   = cur_dist + segment_dist;
+      if (max_len > 0.0f && total_dist > max_len)
       {
-        const auto wall2_idx = map_helpers::next_wall(map, cur_id, wall1_idx);
+        return;
+      }
 
-        // const bool is_nuclidean = walls[wall1_idx].get_portal_type() == PortalType::non_euclidean;      
-        auto &wall1= map.walls[wall1_idx];
-        auto &wall2= map.walls[wall2_idx];
-        auto p1 = wall1.pos;
-        auto p2 = wall2.pos;
-        auto p1_to_p2 = p2 - p1;
-        auto wall_length = length(p1_to_p2);
-        if (next_sd.force_walkable || wall1.force_walkable || wall2.force_walkable || (wall_length > radius * 2.0f)) // side to side clearance
-        {
-          vec2 wall_dir;
-          wall_dir = normalize_or_zero(p1_to_p2);
+      Node* existing = search.find(next_sector);
+      if (existing && existing->dist <= total_dist)
+      {
+        // Already reached by a path that is not longer
+        return;
+      }
 
-          if (abs(p1_to_p2.x) > abs(p1_to_p2.y))
-          {
-            wall_dir = wall_dir / abs(wall_dir.x);
-          }
-          else
-          {
-            wall_dir = wall_dir / abs(wall_dir.y);
-          }
+      f32  floor_y = next_sdd.floor_height;
+      vec3 point   = vec3(projection.x, floor_y, projection.y);
 
-          p1 += wall_dir * radius * 1.005f;
-          p2 -= wall_dir * radius * 1.005f;
-          p1_to_p2 = p2 - p1;
-          // Get a previous position, but also with portal transformation
-          vec3 prev_post = visited[cur_id].point;
-          WallID prev_wall = visited[cur_id].wall_index;
-          SectorID prev_sector = visited[cur_id].prev_sector;
-          if (prev_wall != INVALID_WALL_ID && map.walls[prev_wall].get_portal_type() == PortalType::non_euclidean)
-          {
-            mat4 transformation = map.calc_portal_to_portal_projection(prev_sector, prev_wall);
-            prev_post = (transformation * vec4{ prev_post, 1.0f }).xyz();
-          }
+      // The way point in the space of the next sector
+      vec3 local_point = point;
+      if (wall1.get_portal_type() == PortalType::non_euclidean)
+      {
+        mat4 transformation = map.calc_portal_to_portal_projection(cur_id, wall1_idx);
+        local_point = (transformation * vec4{ point, 1.0f }).xyz();
+      }
 
-          // Calculate closest point on p1_to_p2 line
-          f32 l2 = length(p1_to_p2);
-          l2 *= l2;
-          const float t = max(0.0f, min(1.0f, dot(prev_post.xz - p1, p1_to_p2) / l2));
-          const vec2 projection = p1 + t * (p1_to_p2);
+      Node& node = search.nodes[next_sector];
+      if (!existing)
+      {
+        node.stamp      = search.stamp;
+        node.heap_index = PathSearchScratch::CLOSED; // not in the open list yet
+      }
 
-          f32 segment_dist = distance(prev_post.xz(), projection);
-          f32 total_dist   = cur_dist + segment_dist;
-          if (max_len <= 0.0f || total_dist <= max_len)
-          {
-            f32 floor_y = map.sectors_dynamic[next_sector].floor_height;
+      node.point       = point;
+      node.local_point = local_point;
+      node.dist        = total_dist;
+      node.estimate    = total_dist + calc_heuristic(local_point.xz());
+      node.prev_sector = cur_id;
+      node.wall_index  = wall1_idx;
 
-            // Insert closest point to queue
-            visited.insert
-            ({
-              next_sector, PrevPoint
-              {
-                cur_id,
-                wall1_idx,
-                vec3(projection.x, floor_y, projection.y),
-                cur_dist + segment_dist
-              }
-            });
-
-            fringe.push({next_sector, cur_dist + segment_dist});
-          }
-        }
-      }
+      search.push_or_decrease(next_sector);
     });
   }
 
-  PrevPoint prev_point;
-
   bool found_path = cur_id == end_id;
 
   // reconstruct the path in reverse order
   while (true)
   {
-    prev_point = visited[cur_id];
+    const PathSearchScratch::Node& prev_point = search.nodes[cur_id];
     mat4 transform = identity<mat4>();
-    bool valid = prev_point.wall_index != INVALID_SECTOR_ID;
+    bool valid = prev_point.wall_index != INVALID_WALL_ID;
     if (valid && map.walls[prev_point.wall_index].is_nc_portal())
     {
       nc_assert(map.is_valid_wall_id(prev_point.wall_index));
@@ -2563,3 +2791,524 @@ const
 }
 
 }
+
+#if NC_BENCHMARK
+namespace nc
+{
+
+//==============================================================================
+// Pairs of points inside level_final1 to cast rays between. Generated with a
+// fixed seed so the runs are comparable.
+static const std::vector<std::pair<vec3, vec3>>& get_benchmark_rays
+(
+  const BenchmarkLevel& level
+)
+{
+  static std::vector<std::pair<vec3, vec3>> rays = [&]()
+  {
+    std::vector<std::pair<vec3, vec3>> out;
+
+    const std::vector<vec3> centers = level.get_sector_centers(1.0f);
+    if (centers.empty())
+    {
+      return out;
+    }
+
+    constexpr u32 RAY_CNT = 4096;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<u64> dist(0, centers.size() - 1);
+
+    out.reserve(RAY_CNT);
+    for (u32 i = 0; i < RAY_CNT; ++i)
+    {
+      out.emplace_back(centers[dist(gen)], centers[dist(gen)]);
+    }
+
+    return out;
+  }();
+
+  return rays;
+}
+
+//==============================================================================
+static void benchmark_ray_cast_3d(benchmark::State& state)
+{
+  const BenchmarkLevel* level = get_benchmark_level(Levels::LEVEL_1);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  const PhysLevel phys = level->get_phys_level();
+  const auto&     rays = get_benchmark_rays(*level);
+
+  u64 idx = 0;
+  for (auto _ : state)
+  {
+    const auto& [from, to] = rays[idx++ % rays.size()];
+    benchmark::DoNotOptimize(phys.ray_cast_3d(from, to));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(benchmark_ray_cast_3d);
+
+//==============================================================================
+static void benchmark_circle_cast_2d(benchmark::State& state)
+{
+  const BenchmarkLevel* level = get_benchmark_level(Levels::LEVEL_1);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  const PhysLevel phys = level->get_phys_level();
+  const auto&     rays = get_benchmark_rays(*level);
+
+  u64 idx = 0;
+  for (auto _ : state)
+  {
+    const auto& [from, to] = rays[idx++ % rays.size()];
+    benchmark::DoNotOptimize(phys.circle_cast_2d(from.xz(), to.xz(), 0.25f));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(benchmark_circle_cast_2d);
+
+//==============================================================================
+// Only the broad phase of "benchmark_ray_cast_3d"
+static void benchmark_ray_cast_broad_phase(benchmark::State& state)
+{
+  const BenchmarkLevel* level = get_benchmark_level(Levels::LEVEL_1);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  const auto& rays = get_benchmark_rays(*level);
+
+  u64 idx = 0;
+  for (auto _ : state)
+  {
+    const auto& [from, to] = rays[idx++ % rays.size()];
+
+    StackVector<SectorID, phys_helpers::EXPECTED_OVERLAP_SECTORS> sectors;
+    phys_helpers::query_overlap_sectors(level->map, from, to, 0.0f, sectors);
+    benchmark::DoNotOptimize(sectors.data());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(benchmark_ray_cast_broad_phase);
+
+//==============================================================================
+// The baseline of "benchmark_ray_cast_broad_phase", the broad phase as it was
+// before the visit stamps. The sectors went into a std::set and the grid took
+// the visitor as a std::function.
+static void benchmark_ray_cast_broad_phase_std_set(benchmark::State& state)
+{
+  const BenchmarkLevel* level = get_benchmark_level(Levels::LEVEL_1);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  const auto& rays = get_benchmark_rays(*level);
+
+  u64 idx = 0;
+  for (auto _ : state)
+  {
+    const auto& [from, to] = rays[idx++ % rays.size()];
+
+    std::set<SectorID> sectors;
+    const std::function<bool(aabb2, SectorID)> add_sector = [&](aabb2, SectorID sid)
+    {
+      sectors.insert(sid);
+      return false; // continue iteration
+    };
+
+    if (from.xz() == to.xz())
+    {
+      level->map.sector_grid.query_aabb(phys_helpers::calc_stationary_bbox(from, 0.0f), add_sector);
+    }
+    else
+    {
+      level->map.sector_grid.query_ray(from, to, 0.0f, add_sector);
+    }
+
+    benchmark::DoNotOptimize(sectors.size());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(benchmark_ray_cast_broad_phase_std_set);
+
+//==============================================================================
+// The sector path search as it was before the A*, kept as a baseline for the
+// path benchmarks. A Dijkstra with a std::priority_queue and a std::map of the
+// visited sectors.
+template
+<
+  typename OutPointsVector,
+  typename OutTransformsVector,
+  typename OutNcPortalVector
+>
+static bool calc_path_raw_dijkstra
+(
+  const PhysLevel&     lvl,
+  vec3                 start_pos,
+  vec3                 end_pos,
+  f32                  radius,
+  f32                  height,
+  f32                  step_up,
+  f32                  step_down,
+  OutPointsVector&     points,
+  OutTransformsVector& transforms,
+  OutNcPortalVector&   nc_portals,
+  f32                  max_len = 0.0f
+)
+{
+  const MapSectors& map = lvl.map;
+
+  struct PrevPoint
+  {
+    SectorID prev_sector; // Previous sector
+    WallID   wall_index;  // Portal we used to get to this sector
+    vec3     point;       // Way point
+    f32      dist;
+  };
+
+  struct CurPoint
+  {
+    SectorID index;
+    f32      dist;
+
+    constexpr bool operator<(const CurPoint& other) const
+    {
+      return dist > other.dist;
+    }
+  };
+
+  SectorID start_id = map.get_sector_from_point(start_pos.xz);
+  SectorID end_id   = map.get_sector_from_point(end_pos.xz);
+  if (start_id == INVALID_SECTOR_ID || end_id == INVALID_SECTOR_ID)
+  {
+    // MR says: Hotfix for the case when the enemy or player are outside of the
+    // map and therefore "get_sector_from_point" returns invalid sector ID.
+    return false;
+  }
+
+  SectorID cur_id = start_id;
+  std::priority_queue<CurPoint> fringe;
+  std::map<SectorID, PrevPoint> visited;
+
+  visited.insert
+  ({
+    start_id, PrevPoint
+    {
+      INVALID_SECTOR_ID,
+      INVALID_WALL_ID,
+      start_pos,
+      0
+    }
+  });
+
+  fringe.push({start_id, 0});
+
+  while (fringe.size())
+  {
+    // Get sector from queue
+    CurPoint cur = fringe.top();
+    cur_id = cur.index;
+    f32 cur_dist = cur.dist;
+    fringe.pop();
+
+    // Found path, end search
+    if (cur_id == end_id)
+    {
+      break;
+    }
+
+    map.for_each_portal_of_sector(cur_id, [&](WallID wall1_idx)
+    {
+      const auto next_sector = map.walls[wall1_idx].portal_sector_id;
+      nc_assert(next_sector != INVALID_SECTOR_ID);
+
+      f32 step_size;
+      map.calc_step_height_of_portal(cur_id, wall1_idx, &step_size);
+      if (step_size > step_up || step_size < -step_down)
+      {
+        // We would either have to make step that is too high, or drop down
+        // too much.
+        // Do not consider this path.
+        return;
+      }
+
+      const SectorDynData& next_sdd = map.sectors_dynamic[next_sector];
+      const SectorData&    next_sd  = map.sectors[next_sector];
+      f32 sector_height = next_sdd.ceil_height - next_sdd.floor_height;
+      if (sector_height <= height)
+      {
+        // The old search scanned all triggers of the map dynamics here, the
+        // benchmark has no game system to get them from
+        if (!map.is_activator_enemy_sensitive(next_sd.activator))
+        {
+          return;
+        }
+      }
+
+      if (!visited.contains(next_sector))
+      {
+        const auto wall2_idx = map_helpers::next_wall(map, cur_id, wall1_idx);
+
+        auto &wall1= map.walls[wall1_idx];
+        auto &wall2= map.walls[wall2_idx];
+        auto p1 = wall1.pos;
+        auto p2 = wall2.pos;
+        auto p1_to_p2 = p2 - p1;
+        auto wall_length = length(p1_to_p2);
+        if (next_sd.force_walkable || wall1.force_walkable || wall2.force_walkable || (wall_length > radius * 2.0f)) // side to side clearance
+        {
+          vec2 wall_dir;
+          wall_dir = normalize_or_zero(p1_to_p2);
+
+          if (abs(p1_to_p2.x) > abs(p1_to_p2.y))
+          {
+            wall_dir = wall_dir / abs(wall_dir.x);
+          }
+          else
+          {
+            wall_dir = wall_dir / abs(wall_dir.y);
+          }
+
+          p1 += wall_dir * radius * 1.005f;
+          p2 -= wall_dir * radius * 1.005f;
+          p1_to_p2 = p2 - p1;
+          // Get a previous position, but also with portal transformation
+          vec3 prev_post = visited[cur_id].point;
+          WallID prev_wall = visited[cur_id].wall_index;
+          SectorID prev_sector = visited[cur_id].prev_sector;
+          if (prev_wall != INVALID_WALL_ID && map.walls[prev_wall].get_portal_type() == PortalType::non_euclidean)
+          {
+            mat4 transformation = map.calc_portal_to_portal_projection(prev_sector, prev_wall);
+            prev_post = (transformation * vec4{ prev_post, 1.0f }).xyz();
+          }
+
+          // Calculate closest point on p1_to_p2 line
+          f32 l2 = length(p1_to_p2);
+          l2 *= l2;
+          const float t = max(0.0f, min(1.0f, dot(prev_post.xz - p1, p1_to_p2) / l2));
+          const vec2 projection = p1 + t * (p1_to_p2);
+
+          f32 segment_dist = distance(prev_post.xz(), projection);
+          f32 total_dist   = cur_dist + segment_dist;
+          if (max_len <= 0.0f || total_dist <= max_len)
+          {
+            f32 floor_y = map.sectors_dynamic[next_sector].floor_height;
+
+            // Insert closest point to queue
+            visited.insert
+            ({
+              next_sector, PrevPoint
+              {
+                cur_id,
+                wall1_idx,
+                vec3(projection.x, floor_y, projection.y),
+                cur_dist + segment_dist
+              }
+            });
+
+            fringe.push({next_sector, cur_dist + segment_dist});
+          }
+        }
+      }
+    });
+  }
+
+  PrevPoint prev_point;
+
+  bool found_path = cur_id == end_id;
+
+  // reconstruct the path in reverse order
+  while (true)
+  {
+    prev_point = visited[cur_id];
+    mat4 transform = identity<mat4>();
+    bool valid = prev_point.wall_index != INVALID_SECTOR_ID;
+    if (valid && map.walls[prev_point.wall_index].is_nc_portal())
+    {
+      nc_assert(map.is_valid_wall_id(prev_point.wall_index));
+      nc_assert(map.is_valid_sector_id(prev_point.prev_sector));
+
+      transform = map.calc_portal_to_portal_projection
+      (
+        prev_point.prev_sector, prev_point.wall_index
+      );
+
+      nc_portals.push_back(PhysLevel::PortalSector
+      {
+        .wall_id   = prev_point.wall_index,
+        .sector_id = prev_point.prev_sector,
+      });
+    }
+
+    points.push_back(prev_point.point);
+    transforms.push_back(transform);
+
+    if (cur_id == start_id)
+    {
+      break;
+    }
+    else
+    {
+      cur_id = prev_point.prev_sector;
+    }
+  }
+
+  // Make this a first transform (will get reversed later) as the first point
+  // does not have a transform.
+  if (found_path)
+  {
+    transforms.push_back(identity<mat4>());
+  }
+
+  // Reverse the path
+  std::reverse(points.begin(), points.end());
+  std::reverse(transforms.begin(), transforms.end());
+  std::reverse(nc_portals.begin(), nc_portals.end());
+
+  // Last point and no transform
+  if (found_path)
+  {
+    points.push_back(end_pos);
+  }
+
+  return found_path;
+}
+
+//==============================================================================
+// Same as the enemies use
+constexpr f32 BENCHMARK_PATH_RADIUS    = 0.25f;
+constexpr f32 BENCHMARK_PATH_HEIGHT    = 2.0f;
+constexpr f32 BENCHMARK_PATH_STEP_UP   = 1.0f;
+constexpr f32 BENCHMARK_PATH_STEP_DOWN = 1.0f;
+
+//==============================================================================
+// One frame of a whole horde of enemies searching for a path to the player.
+// The enemies are spread over the level and the player stands in a random
+// sector. The search gets the level, the start and the target.
+template<typename F>
+static void run_path_horde_benchmark(benchmark::State& state, F&& search)
+{
+  const BenchmarkLevel* level = get_benchmark_level(Levels::LEVEL_1);
+  if (!level)
+  {
+    state.SkipWithError("Failed to load the level");
+    return;
+  }
+
+  const PhysLevel phys = level->get_phys_level();
+  const auto&     rays = get_benchmark_rays(*level);
+
+  constexpr u64 HORDE_SIZE = 32;
+
+  u64 idx = 0;
+  for (auto _ : state)
+  {
+    // The player is the target of the first ray, the enemies start at the
+    // starting points of the next ones
+    const vec3 target = rays[idx % rays.size()].second;
+    for (u64 i = 0; i < HORDE_SIZE; ++i)
+    {
+      search(phys, rays[(idx + i) % rays.size()].first, target);
+    }
+
+    idx += HORDE_SIZE;
+  }
+
+  state.SetItemsProcessed(state.iterations() * HORDE_SIZE);
+}
+
+//==============================================================================
+static void benchmark_calc_path_horde(benchmark::State& state)
+{
+  run_path_horde_benchmark(state, [](const PhysLevel& phys, vec3 from, vec3 target)
+  {
+    bool found = false;
+    auto path  = phys.calc_path_relative
+    (
+      from,
+      target,
+      BENCHMARK_PATH_RADIUS,
+      BENCHMARK_PATH_HEIGHT,
+      BENCHMARK_PATH_STEP_UP,
+      BENCHMARK_PATH_STEP_DOWN,
+      true,
+      nullptr,
+      &found
+    );
+
+    benchmark::DoNotOptimize(path);
+  });
+}
+BENCHMARK(benchmark_calc_path_horde);
+
+//==============================================================================
+// Only the sector search of "benchmark_calc_path_horde", without smoothing
+template<bool DIJKSTRA>
+static void benchmark_calc_path_search_horde(benchmark::State& state)
+{
+  run_path_horde_benchmark(state, [](const PhysLevel& phys, vec3 from, vec3 target)
+  {
+    StackVector<vec3, 20>                    points;
+    StackVector<mat4, 20>                    transforms;
+    StackVector<PhysLevel::PortalSector, 20> portals;
+
+    bool found = false;
+    if constexpr (DIJKSTRA)
+    {
+      found = calc_path_raw_dijkstra
+      (
+        phys,
+        from,
+        target,
+        BENCHMARK_PATH_RADIUS,
+        BENCHMARK_PATH_HEIGHT,
+        BENCHMARK_PATH_STEP_UP,
+        BENCHMARK_PATH_STEP_DOWN,
+        points,
+        transforms,
+        portals
+      );
+    }
+    else
+    {
+      found = phys_helpers::calc_path_raw
+      (
+        phys,
+        from,
+        target,
+        BENCHMARK_PATH_RADIUS,
+        BENCHMARK_PATH_HEIGHT,
+        BENCHMARK_PATH_STEP_UP,
+        BENCHMARK_PATH_STEP_DOWN,
+        points,
+        transforms,
+        portals
+      );
+    }
+
+    benchmark::DoNotOptimize(found);
+    benchmark::DoNotOptimize(points.data());
+  });
+}
+BENCHMARK_TEMPLATE(benchmark_calc_path_search_horde, false)->Name("benchmark_calc_path_search_horde");
+BENCHMARK_TEMPLATE(benchmark_calc_path_search_horde, true)->Name("benchmark_calc_path_search_horde_dijkstra");
+
+}
+#endif
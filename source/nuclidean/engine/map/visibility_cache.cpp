@@ -0,0 +1,319 @@
+// Project Nuclidean Source File
+#include <engine/map/visibility_cache.h>
+
+#include <common.h>
+#include <profiling.h>
+
+#include <math/lingebra.h>
+
+#include <intersect.h>
+
+#include <cmath> // std::atan2, std::acos, std::asin
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+// Distance from the point to the nearest portal wall of the sector
+static f32 calc_portal_distance(const MapSectors& map, SectorID sector_id, vec2 pos)
+{
+  if (sector_id == INVALID_SECTOR_ID)
+  {
+    return 0.0f;
+  }
+
+  const SectorData& sector   = map.sectors[sector_id];
+  f32               distance = FLT_MAX;
+
+  for (WallID wall_id = sector.first_wall; wall_id < sector.last_wall; ++wall_id)
+  {
+    const WallData& wall = map.walls[wall_id];
+    if (!wall.is_portal())
+    {
+      continue;
+    }
+
+    const WallID next_id = map_helpers::next_wall(map, sector_id, wall_id);
+    distance = min(distance, dist::point_line_2d(pos, wall.pos, map.walls[next_id].pos));
+  }
+
+  return distance;
+}
+
+//==============================================================================
+const VisibilityTree& VisibilityCache::query
+(
+  const MapSectors& map,
+  vec3              position,
+  vec3              view_dir,
+  f32               hor_fov_rad,
+  f32               ver_fov_rad,
+  u8                recursion_depth
+)
+{
+  nc_assert(is_normal(view_dir));
+
+  const f32  angle_ver = std::atan2(std::abs(view_dir.y), length(view_dir.xz()));
+  const vec2 dir_2d    = normalize(view_dir.xz());
+  const vec2 pos_2d    = position.xz();
+
+  const bool same_query = m_valid
+    && hor_fov_rad     == m_hor_fov
+    && ver_fov_rad     == m_ver_fov
+    && recursion_depth == m_recursion_depth;
+
+  // Only look up the sector if the camera moved, but not too far
+  const f32  moved      = length(pos_2d - m_position);
+  const bool same_place = same_query
+    && (moved == 0.0f || (moved <= POSITION_EPSILON
+                          && map.get_sector_from_point(pos_2d) == m_sector));
+
+  // How much the move turned the directions to what we see through the portals
+  const f32 parallax = moved == 0.0f
+    ? 0.0f
+    : std::asin(min(moved / m_portal_distance, 1.0f));
+
+  // Whether the view is within the given angle from the cached one, counting
+  // in the parallax. The direction does not matter if we see all around us.
+  auto is_view_within = [&](f32 max_angle)
+  {
+    return same_place
+      && std::abs(angle_ver - m_angle_ver) <= max_angle
+      && (m_query_fov >= PI || std::acos(clamp(dot(dir_2d, m_dir_2d), -1.0f, 1.0f)) + parallax <= max_angle);
+  };
+
+  if (is_view_within(m_reuse_angle) || (same_place && moved == 0.0f && dir_2d == m_dir_2d && angle_ver == m_angle_ver))
+  {
+    NC_SCOPE_COUNTER(visibility_cache_hit)
+    m_stats.hits += 1;
+    m_misses_in_row = 0;
+    return m_tree;
+  }
+
+  NC_SCOPE_COUNTER(visibility_cache_miss)
+  m_stats.misses += 1;
+
+  // A narrow tree that would have been reused with the widening means that the
+  // view settled, so widen again
+  if (m_reuse_angle == 0.0f && is_view_within(REUSE_ANGLE))
+  {
+    m_misses_in_row = 0;
+  }
+  else
+  {
+    m_misses_in_row += 1;
+  }
+
+  const bool widen = m_misses_in_row < MAX_WIDENED_MISSES;
+
+  f32 query_fov = 0.0f;
+  if (widen)
+  {
+    // The FOV only grows when looking further up/down, so the widest one within
+    // the reuse angle is the one pitched the most
+    const f32 max_angle_ver = min(angle_ver + REUSE_ANGLE, HALF_PI);
+    const f32 widest_fov    = MapSectors::calc_query_hor_fov(max_angle_ver, hor_fov_rad, ver_fov_rad);
+    query_fov = min(widest_fov + 2.0f * REUSE_ANGLE, PI);
+  }
+  else
+  {
+    query_fov = MapSectors::calc_query_hor_fov(angle_ver, hor_fov_rad, ver_fov_rad);
+    m_stats.narrow_queries += 1;
+  }
+
+  map.query_visible_with_hor_fov(pos_2d, dir_2d, query_fov, m_tree, recursion_depth);
+
+  m_valid           = true;
+  m_position        = pos_2d;
+  m_dir_2d          = dir_2d;
+  m_sector          = map.get_sector_from_point(pos_2d);
+  m_angle_ver       = angle_ver;
+  m_hor_fov         = hor_fov_rad;
+  m_ver_fov         = ver_fov_rad;
+  m_query_fov       = query_fov;
+  m_reuse_angle     = widen ? REUSE_ANGLE : 0.0f;
+  m_portal_distance = calc_portal_distance(map, m_sector, pos_2d);
+  m_recursion_depth = recursion_depth;
+
+  return m_tree;
+}
+
+//==============================================================================
+void VisibilityCache::invalidate()
+{
+  m_valid = false;
+}
+
+//==============================================================================
+void VisibilityCache::clear()
+{
+  m_valid = false;
+  m_tree.clear();
+}
+
+//==============================================================================
+const VisibilityTree& VisibilityCache::get_tree() const
+{
+  return m_tree;
+}
+
+//==============================================================================
+const VisibilityCache::Stats& VisibilityCache::get_stats() const
+{
+  return m_stats;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool visibility_cache_test_reuse(unit_test::TestCtx& /*ctx*/)
+{
+  using namespace map_building;
+
+  // Three squares in a row with portals between them
+  const std::vector<vec2> points
+  {
+    vec2{0.0f, 0.0f}, vec2{1.0f, 0.0f}, vec2{1.0f, 1.0f}, vec2{0.0f, 1.0f},
+    vec2{2.0f, 0.0f}, vec2{2.0f, 1.0f}, vec2{3.0f, 0.0f}, vec2{3.0f, 1.0f},
+  };
+
+  auto make_sector = [&](std::initializer_list<WallID> indices)
+  {
+    SectorBuildData sector
+    {
+      .floor_y = {0.0f, 0.0f},
+      .ceil_y  = {2.0f, 2.0f},
+    };
+
+    for (WallID idx : indices)
+    {
+      sector.points.push_back(WallBuildData
+      {
+        .point_index            = idx,
+        .nc_portal_point_index  = INVALID_WALL_REL_ID,
+        .nc_portal_sector_index = INVALID_SECTOR_ID,
+        .surface                = {WallSegmentData{}},
+      });
+    }
+
+    return sector;
+  };
+
+  const std::vector<SectorBuildData> sectors
+  {
+    make_sector({0, 1, 2, 3}),
+    make_sector({1, 4, 5, 2}),
+    make_sector({4, 6, 7, 5}),
+  };
+
+  MapSectors map;
+  if (!build_map(points, sectors, map))
+  {
+    nc_warn("Visibility cache test failed. The test map did not build.");
+    NC_TEST_FAIL;
+  }
+
+  constexpr f32 HOR_FOV = HALF_PI;
+  constexpr f32 VER_FOV = QUARTER_PI;
+  constexpr u8  DEPTH   = 4;
+
+  const vec3 position = vec3{0.5f, 1.0f, 0.5f};
+  const vec3 forward  = vec3{1.0f, 0.0f, 0.0f};
+  auto turned = [&](f32 degrees)
+  {
+    const f32 rad = deg2rad(degrees);
+    return vec3{std::cos(rad), 0.0f, std::sin(rad)};
+  };
+
+  VisibilityCache cache;
+  cache.query(map, position, forward, HOR_FOV, VER_FOV, DEPTH);
+  cache.query(map, position, turned(1.0f), HOR_FOV, VER_FOV, DEPTH);
+
+  if (cache.get_stats().hits != 1 || cache.get_stats().misses != 1)
+  {
+    nc_warn("A slightly turned camera should reuse the cached visibility.");
+    NC_TEST_FAIL;
+  }
+
+  // The reused tree has to see everything the exact query does
+  VisibilityTree exact;
+  map.query_visible(position, turned(1.0f), HOR_FOV, VER_FOV, exact, DEPTH);
+  for (const auto& frustum : exact.get_sectors())
+  {
+    if (!cache.get_tree().is_visible(frustum.sector))
+    {
+      nc_warn("Cached visibility misses sector {}.", frustum.sector);
+      NC_TEST_FAIL;
+    }
+  }
+
+  // Turning more, moving or a change of the map needs a new query
+  cache.query(map, position, turned(10.0f), HOR_FOV, VER_FOV, DEPTH);
+  cache.query(map, position + vec3{0.1f, 0.0f, 0.0f}, turned(10.0f), HOR_FOV, VER_FOV, DEPTH);
+  cache.invalidate();
+  cache.query(map, position + vec3{0.1f, 0.0f, 0.0f}, turned(10.0f), HOR_FOV, VER_FOV, DEPTH);
+
+  if (cache.get_stats().hits != 1 || cache.get_stats().misses != 4)
+  {
+    nc_warn("The visibility cache reused a tree it should not have.");
+    NC_TEST_FAIL;
+  }
+
+  // The height does not matter and a tiny step within the sector is fine
+  const vec3 moved = position + vec3{0.1f, 0.5f, 0.005f};
+  cache.query(map, moved, turned(10.0f), HOR_FOV, VER_FOV, DEPTH);
+
+  if (cache.get_stats().hits != 2)
+  {
+    nc_warn("A camera that moved only by the epsilon should reuse the cached visibility.");
+    NC_TEST_FAIL;
+  }
+
+  // Right next to a portal the same step turns the view through it too much
+  VisibilityCache near_portal;
+  const vec3 at_portal = vec3{0.99f, 1.0f, 0.5f};
+  near_portal.query(map, at_portal, forward, HOR_FOV, VER_FOV, DEPTH);
+  near_portal.query(map, at_portal + vec3{0.0f, 0.0f, 0.005f}, forward, HOR_FOV, VER_FOV, DEPTH);
+
+  if (near_portal.get_stats().hits != 0)
+  {
+    nc_warn("A camera next to a portal should not reuse the visibility after moving.");
+    NC_TEST_FAIL;
+  }
+
+  // A camera that keeps turning fast stops paying for the wider query, but
+  // gets it back once the view settles
+  for (u32 i = 0; i < 2 * VisibilityCache::MAX_WIDENED_MISSES; ++i)
+  {
+    cache.query(map, moved, turned(20.0f + 10.0f * i), HOR_FOV, VER_FOV, DEPTH);
+  }
+
+  if (cache.get_stats().narrow_queries == 0)
+  {
+    nc_warn("The visibility cache did not stop widening the query.");
+    NC_TEST_FAIL;
+  }
+
+  const f32 settled = 20.0f + 20.0f * VisibilityCache::MAX_WIDENED_MISSES;
+  cache.query(map, moved, turned(settled), HOR_FOV, VER_FOV, DEPTH);
+  cache.query(map, moved, turned(settled + 1.0f), HOR_FOV, VER_FOV, DEPTH);
+
+  const u64 hits = cache.get_stats().hits;
+  cache.query(map, moved, turned(settled + 0.5f), HOR_FOV, VER_FOV, DEPTH);
+
+  if (cache.get_stats().hits != hits + 1)
+  {
+    nc_warn("The visibility cache did not widen the query again after the view settled.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(visibility_cache_test_reuse)->name("Visibility Cache Reuse");
+#endif
+
+}
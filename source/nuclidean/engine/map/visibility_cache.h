@@ -0,0 +1,85 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+#include <math/vector.h>
+#include <math/utils.h>
+
+#include <engine/map/map_system.h>
+
+namespace nc
+{
+
+// Keeps the visibility tree of the previous frame and reuses it as long as the
+// camera stays in the same sector, moves at most "POSITION_EPSILON" on the
+// ground plane and turns only a little. The height of the camera does not
+// matter, the query is 2D.
+// The cached tree is queried with a horizontal FOV wider by "REUSE_ANGLE" on
+// both sides (and for a view pitched further by "REUSE_ANGLE"). Both turning
+// and moving use up that widening. Everything we see through a portal is at
+// least as far as the nearest portal of the camera's sector, so moving by "d"
+// turns the direction to it by at most asin(d / portal_distance). The tree is
+// reused only if the turn plus this parallax fits within the widening, a
+// camera right next to a portal has to stand still.
+// Rendering a few extra sectors at the edges is much cheaper than re-running
+// the portal traversal every frame. If the camera keeps moving or turning
+// faster than that, the wider query never pays off, so after
+// "MAX_WIDENED_MISSES" misses in a row the cache queries the exact FOV until
+// the view settles again.
+class VisibilityCache
+{
+public:
+  static constexpr f32 REUSE_ANGLE        = 2.0f * (PI / 180.0f); // 2 degrees
+  static constexpr f32 POSITION_EPSILON   = 0.01f;
+  static constexpr u32 MAX_WIDENED_MISSES = 4;
+
+  struct Stats
+  {
+    u64 hits           = 0;
+    u64 misses         = 0;
+    u64 narrow_queries = 0; // misses queried without the widening
+  };
+
+  // Same arguments as "MapSectors::query_visible". Returns the cached tree if
+  // it is still valid for this view, otherwise re-runs the query.
+  const VisibilityTree& query
+  (
+    const MapSectors& map,
+    vec3              position,
+    vec3              view_dir,
+    f32               hor_fov_rad,
+    f32               ver_fov_rad,
+    u8                recursion_depth
+  );
+
+  // The next query will run from scratch. Has to be called when the map
+  // changes (e.g. sector heights).
+  void invalidate();
+
+  // Invalidates and empties the cached tree
+  void clear();
+
+  const VisibilityTree& get_tree()  const;
+  const Stats&          get_stats() const;
+
+private:
+  VisibilityTree m_tree;
+  Stats          m_stats;
+  bool           m_valid = false;
+
+  // Parameters of the cached query
+  vec2     m_position        = VEC2_ZERO;
+  vec2     m_dir_2d          = VEC2_ZERO;
+  SectorID m_sector          = INVALID_SECTOR_ID;
+  f32      m_angle_ver       = 0.0f;
+  f32      m_hor_fov         = 0.0f;
+  f32      m_ver_fov         = 0.0f;
+  f32      m_query_fov       = 0.0f; // the one the tree was queried with
+  f32      m_reuse_angle     = 0.0f; // zero if queried without the widening
+  f32      m_portal_distance = 0.0f; // to the nearest portal of "m_sector"
+  u8       m_recursion_depth = 0;
+
+  u32      m_misses_in_row   = 0;    // misses the widening did not prevent
+};
+
+}
@@ -30,6 +30,12 @@ inline std::string get_full_level_path(const LevelName& level_name)
   return std::format("{0}\\{1}.json", LEVELS_DIRECTORY_PATH, level_name.to_cstring().data());
 }
 
+// Binary form of the level JSON, see "engine/map/cooked_level.h"
+inline std::string get_cooked_level_path(const LevelName& level_name)
+{
+  return std::format("{0}\\{1}.ncl", LEVELS_DIRECTORY_PATH, level_name.to_cstring().data());
+}
+
 namespace Levels
 {
 inline constexpr LevelName EMPTY_LEVEL("empty_level");
@@ -128,6 +128,18 @@ static f32 get_weapon_fire_t(const WeaponAnims& anims)
   return trigger_t;
 }
 
+//==============================================================================
+// Returns null if there is no UI, e.g. when running headless
+static UiScreenEffect* get_screen_effect()
+{
+  if (get_engine().is_headless())
+  {
+    return nullptr;
+  }
+
+  return UserInterfaceSystem::get().get_ui_screen_effect();
+}
+
 //==============================================================================
 void Player::init(vec3 position, vec3 in_forward)
 {
@@ -173,7 +185,11 @@ void Player::init(vec3 position, vec3 in_forward)
 //==============================================================================
 void Player::post_init()
 {
-  get_engine().get_module<UserInterfaceSystem>().get_ui_screen_effect()->clear_effect();
+  if (UiScreenEffect* effect = get_screen_effect())
+  {
+    effect->clear_effect();
+  }
+
   rng.seed(cast<u8>(this->get_id().idx));
 }
 
@@ -791,14 +807,16 @@ void Player::handle_pickup(Pickup& pickup)
 {
   if (pickup.pick_up(*this))
   {
-    EntityRegistry&      ecs = GameSystem::get().get_entities();
-    UserInterfaceSystem& ui  = get_engine().get_module<UserInterfaceSystem>();
+    EntityRegistry& ecs = GameSystem::get().get_entities();
 
     // Destroy if picked up sucessfully.
     ecs.destroy_entity(pickup.get_id());
 
     // Notify UI to show a overlay effect
-    ui.get_ui_screen_effect()->did_pickup();
+    if (UiScreenEffect* effect = get_screen_effect())
+    {
+      effect->did_pickup();
+    }
   }
 }
 
@@ -904,12 +922,19 @@ void Player::damage(int damage)
   }
 
   this->current_health -= damage;
-  get_engine().get_module<UserInterfaceSystem>().get_ui_screen_effect()->did_damage(damage);
+  UiScreenEffect* effect = get_screen_effect();
+  if (effect)
+  {
+    effect->did_damage(damage);
+  }
 
   if (this->current_health <= 0)
   {
     this->die();
-    get_engine().get_module<UserInterfaceSystem>().get_ui_screen_effect()->did_damage(200);
+    if (effect)
+    {
+      effect->did_damage(200);
+    }
   }
   else
   {
@@ -9,6 +9,11 @@
 #include <filesystem>
 #include <fstream>
 
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
 namespace nc
 {
 
@@ -22,37 +27,163 @@ struct SaveGameStructure
 };
 
 //==============================================================================
-u64 calc_size_for_demo_to_bytes(const DemoDataHeader& header)
+static u64 calc_size_for_checkpoints(const DemoCheckpoints& checkpoints)
 {
-  return sizeof(DemoDataHeader) + header.num_frames * sizeof(DemoDataFrame);
+  if (checkpoints.empty())
+  {
+    // No section at all, same as the older demos
+    return 0;
+  }
+
+  u64 size = sizeof(DemoCheckpointsHeader);
+  for (const DemoCheckpoint& checkpoint : checkpoints)
+  {
+    size += sizeof(DemoCheckpointEntry) + checkpoint.snapshot.size();
+  }
+
+  return size;
+}
+
+//==============================================================================
+static bool load_checkpoints_from_bytes
+(
+  DemoCheckpoints& checkpoints_out,
+  const byte*      bytes_start,
+  u64              bytes_cnt
+)
+{
+  checkpoints_out.clear();
+
+  if (bytes_cnt == 0)
+  {
+    // Recorded without the checkpoints
+    return true;
+  }
+
+  if (bytes_cnt < sizeof(DemoCheckpointsHeader))
+  {
+    return false;
+  }
+
+  DemoCheckpointsHeader header;
+  std::memcpy(&header, bytes_start, sizeof(DemoCheckpointsHeader));
+
+  bool header_mismatch = std::memcmp
+  (
+    header.signature,
+    DemoCheckpointsHeader::SIGNATURE,
+    DemoCheckpointsHeader::SIGNATURE_SIZE
+  );
+
+  if (header_mismatch)
+  {
+    return false;
+  }
+
+  const byte* it  = bytes_start + sizeof(DemoCheckpointsHeader);
+  const byte* end = bytes_start + bytes_cnt;
+
+  checkpoints_out.resize(header.num_checkpoints);
+  for (DemoCheckpoint& checkpoint : checkpoints_out)
+  {
+    DemoCheckpointEntry entry;
+    if (cast<u64>(end - it) < sizeof(DemoCheckpointEntry))
+    {
+      return false;
+    }
+
+    std::memcpy(&entry, it, sizeof(DemoCheckpointEntry));
+    it += sizeof(DemoCheckpointEntry);
+
+    if (cast<u64>(end - it) < entry.snapshot_size)
+    {
+      return false;
+    }
+
+    checkpoint.frame      = entry.frame;
+    checkpoint.state_hash = entry.state_hash;
+    checkpoint.snapshot.assign(it, it + entry.snapshot_size);
+    it += entry.snapshot_size;
+  }
+
+  return it == end;
+}
+
+//==============================================================================
+u64 calc_size_for_demo_to_bytes
+(
+  const DemoDataHeader&  header,
+  const DemoCheckpoints& checkpoints
+)
+{
+  return sizeof(DemoDataHeader)
+    + header.num_frames * sizeof(DemoDataFrame)
+    + calc_size_for_checkpoints(checkpoints);
 }
 
 //==============================================================================
 void save_demo_to_bytes
 (
-  const DemoDataHeader& header,
-  const DemoDataFrame*  frames,
-  byte*                 bytes_out
+  const DemoDataHeader&  header,
+  const DemoDataFrame*   frames,
+  byte*                  bytes_out,
+  const DemoCheckpoints& checkpoints
 )
 {
   // Copy header
   std::memcpy(bytes_out, &header, sizeof(DemoDataHeader));
+  bytes_out += sizeof(DemoDataHeader);
 
   // Copy frames
+  std::memcpy(bytes_out, frames, header.num_frames * sizeof(DemoDataFrame));
+  bytes_out += header.num_frames * sizeof(DemoDataFrame);
+
+  if (checkpoints.empty())
+  {
+    return;
+  }
+
+  // And the checkpoints after them
+  DemoCheckpointsHeader checkpoints_header;
   std::memcpy
   (
-    bytes_out + sizeof(DemoDataHeader), frames,
-    header.num_frames * sizeof(DemoDataFrame)
+    checkpoints_header.signature,
+    DemoCheckpointsHeader::SIGNATURE,
+    DemoCheckpointsHeader::SIGNATURE_SIZE
   );
+  checkpoints_header.num_checkpoints = checkpoints.size();
+
+  std::memcpy(bytes_out, &checkpoints_header, sizeof(DemoCheckpointsHeader));
+  bytes_out += sizeof(DemoCheckpointsHeader);
+
+  for (const DemoCheckpoint& checkpoint : checkpoints)
+  {
+    DemoCheckpointEntry entry
+    {
+      .frame         = checkpoint.frame,
+      .state_hash    = checkpoint.state_hash,
+      .snapshot_size = checkpoint.snapshot.size(),
+    };
+
+    std::memcpy(bytes_out, &entry, sizeof(DemoCheckpointEntry));
+    bytes_out += sizeof(DemoCheckpointEntry);
+
+    if (entry.snapshot_size)
+    {
+      std::memcpy(bytes_out, checkpoint.snapshot.data(), entry.snapshot_size);
+      bytes_out += entry.snapshot_size;
+    }
+  }
 }
 
 //==============================================================================
 bool load_demo_from_bytes
 (
-  DemoDataHeader& header_out,
-  DemoDataFrames& frames_out,
-  const byte*     bytes_start,
-  u64             bytes_cnt
+  DemoDataHeader&  header_out,
+  DemoDataFrames&  frames_out,
+  const byte*      bytes_start,
+  u64              bytes_cnt,
+  DemoCheckpoints* checkpoints_out
 )
 {
   if (bytes_cnt < sizeof(DemoDataHeader))
@@ -75,21 +206,41 @@ bool load_demo_from_bytes
     return false;
   }
 
-  if (header_out.version != CURRENT_GAME_VERSION)
+  if (header_out.version < OLDEST_PLAYABLE_DEMO_VERSION || header_out.version > CURRENT_GAME_VERSION)
   {
-    // Versions do not match
+    // The inputs are not compatible
     return false;
   }
 
   u64 required_size
     = header_out.num_frames * sizeof(DemoDataFrame) + sizeof(DemoDataHeader);
 
-  if (required_size != bytes_cnt)
+  if (required_size > bytes_cnt)
   {
     // What?
     return false;
   }
 
+  // Anything after the frames are the checkpoints
+  if (checkpoints_out)
+  {
+    bool checkpoints_ok = load_checkpoints_from_bytes
+    (
+      *checkpoints_out, bytes_start + required_size, bytes_cnt - required_size
+    );
+
+    if (!checkpoints_ok)
+    {
+      return false;
+    }
+
+    if (header_out.version != CURRENT_GAME_VERSION)
+    {
+      // Recorded by an older version, the states would never match
+      checkpoints_out->clear();
+    }
+  }
+
   // Memcpy it
   frames_out.resize(header_out.num_frames);
   std::memcpy
@@ -195,7 +346,8 @@ bool load_demo_from_file
   const std::string&   file,
   LevelName&           level_name_out,
   LevelTransitionData& transition_out,
-  DemoDataFrames&      frames_out
+  DemoDataFrames&      frames_out,
+  DemoCheckpoints*     checkpoints_out
 )
 {
   std::vector<u8> bytes;
@@ -205,7 +357,7 @@ bool load_demo_from_file
   }
 
   DemoDataHeader header;
-  if (!load_demo_from_bytes(header, frames_out, bytes.data(), bytes.size()))
+  if (!load_demo_from_bytes(header, frames_out, bytes.data(), bytes.size(), checkpoints_out))
   {
     return false;
   }
@@ -275,10 +427,12 @@ std::vector<std::string> list_available_demo_files()
 //==============================================================================
 void save_demo_to_file
 (
-  const std::string&   name,
-  LevelName            lvl_name,
-  const DemoDataFrame* frames,
-  u64                  frames_cnt
+  const std::string&         name,
+  LevelName                  lvl_name,
+  const LevelTransitionData& transition,
+  const DemoDataFrame*       frames,
+  u64                        frames_cnt,
+  const DemoCheckpoints&     checkpoints
 )
 {
   namespace fs = std::filesystem;
@@ -292,14 +446,15 @@ void save_demo_to_file
   );
 
   // Set the level name
-  header.level_name = lvl_name;
-  header.version    = CURRENT_GAME_VERSION;
-  header.num_frames = frames_cnt;
+  header.level_name      = lvl_name;
+  header.version         = CURRENT_GAME_VERSION;
+  header.num_frames      = frames_cnt;
+  header.transition_data = transition;
 
-  std::vector<byte> bytes(calc_size_for_demo_to_bytes(header));
+  std::vector<byte> bytes(calc_size_for_demo_to_bytes(header, checkpoints));
 
   // Demo to bytes
-  save_demo_to_bytes(header, frames, bytes.data());
+  save_demo_to_bytes(header, frames, bytes.data(), checkpoints);
 
   // Create the directory for demos if it does not exist
   if (!fs::exists(DEMO_DIR_RELATIVE))
@@ -317,4 +472,101 @@ void save_demo_to_file
   save_bytes_to_file(final_path, bytes.data(), bytes.size());
 }
 
+//==============================================================================
+#if NC_TESTS
+static bool demo_test_checkpoints_round_trip(unit_test::TestCtx& /*ctx*/)
+{
+  DemoDataHeader header;
+  std::memcpy
+  (
+    header.signature, DemoDataHeader::SIGNATURE, DemoDataHeader::SIGNATURE_SIZE
+  );
+  header.level_name = Levels::TEST_LEVEL;
+  header.version    = CURRENT_GAME_VERSION;
+  header.num_frames = 3;
+
+  const DemoDataFrame frames[3] = {{.delta = 0.1f}, {.delta = 0.2f}, {.delta = 0.3f}};
+
+  const DemoCheckpoints checkpoints =
+  {
+    {.frame = 1, .state_hash = 0xDEAD, .snapshot = {}},
+    {.frame = 2, .state_hash = 0xBEEF, .snapshot = {1, 2, 3, 4, 5}},
+  };
+
+  // Without and with the checkpoints, the former is how the older demos look
+  for (bool with_checkpoints : {false, true})
+  {
+    const DemoCheckpoints& saved = with_checkpoints ? checkpoints : DemoCheckpoints{};
+
+    std::vector<byte> bytes(calc_size_for_demo_to_bytes(header, saved));
+    save_demo_to_bytes(header, frames, bytes.data(), saved);
+
+    DemoDataHeader  loaded_header;
+    DemoDataFrames  loaded_frames;
+    DemoCheckpoints loaded_checkpoints;
+
+    bool ok = load_demo_from_bytes
+    (
+      loaded_header, loaded_frames, bytes.data(), bytes.size(), &loaded_checkpoints
+    );
+
+    if (!ok || loaded_frames.size() != 3 || loaded_frames[2].delta != 0.3f)
+    {
+      nc_warn("Demo test failed. Could not load the frames back.");
+      NC_TEST_FAIL;
+    }
+
+    if (loaded_checkpoints.size() != saved.size())
+    {
+      nc_warn("Demo test failed. Expected {} checkpoints, got {}.", saved.size(), loaded_checkpoints.size());
+      NC_TEST_FAIL;
+    }
+
+    for (u64 i = 0; i < saved.size(); ++i)
+    {
+      const DemoCheckpoint& a = saved[i];
+      const DemoCheckpoint& b = loaded_checkpoints[i];
+      if (a.frame != b.frame || a.state_hash != b.state_hash || a.snapshot != b.snapshot)
+      {
+        nc_warn("Demo test failed. Checkpoint {} does not match.", i);
+        NC_TEST_FAIL;
+      }
+    }
+
+    // A truncated checkpoint section must be rejected
+    if (with_checkpoints && load_demo_from_bytes(loaded_header, loaded_frames, bytes.data(), bytes.size() - 1, &loaded_checkpoints))
+    {
+      nc_warn("Demo test failed. Truncated checkpoints were accepted.");
+      NC_TEST_FAIL;
+    }
+  }
+
+  // A demo of an older version still plays, but without its checkpoints
+  header.version = OLDEST_PLAYABLE_DEMO_VERSION;
+  if (header.version != CURRENT_GAME_VERSION)
+  {
+    std::vector<byte> bytes(calc_size_for_demo_to_bytes(header, checkpoints));
+    save_demo_to_bytes(header, frames, bytes.data(), checkpoints);
+
+    DemoDataHeader  loaded_header;
+    DemoDataFrames  loaded_frames;
+    DemoCheckpoints loaded_checkpoints;
+
+    bool ok = load_demo_from_bytes
+    (
+      loaded_header, loaded_frames, bytes.data(), bytes.size(), &loaded_checkpoints
+    );
+
+    if (!ok || loaded_frames.size() != 3 || !loaded_checkpoints.empty())
+    {
+      nc_warn("Demo test failed. An older demo was not loaded without its checkpoints.");
+      NC_TEST_FAIL;
+    }
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(demo_test_checkpoints_round_trip)->name("Demo Checkpoints Round Trip");
+#endif
+
 }
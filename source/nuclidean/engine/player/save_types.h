@@ -26,14 +26,20 @@ namespace GameVersions
 enum evalue : GameVersion
 {
   demo_001 = 0, // The initial demo release for software project
+  demo_002 = 1, // Entity IDs carry a generation, pools store their slots
 };
 }
 
 // ===========================================================================//
 // ! Change this when the version of the game changes !                       //
-constexpr GameVersion CURRENT_GAME_VERSION = GameVersions::demo_001;          //
+constexpr GameVersion CURRENT_GAME_VERSION = GameVersions::demo_002;          //
 // ===========================================================================//
 
+// Demos store only the inputs, which did not change since this version, so the
+// older demos still play. Their checkpoints are dropped though, the hashes and
+// snapshots describe the game state of the version they were recorded in.
+constexpr GameVersion OLDEST_PLAYABLE_DEMO_VERSION = GameVersions::demo_001;
+
 constexpr cstr SAVE_DIR_RELATIVE = "save";
 constexpr cstr DEMO_DIR_RELATIVE = "demo";
 constexpr cstr SAVE_FILE_SUFFIX  = ".ncs";
@@ -113,13 +119,50 @@ NC_POP_PACKED
 
 using DemoDataFrames = std::vector<DemoDataFrame>;
 
+// A periodic check of the game state recorded together with the demo. The hash
+// is taken after simulating "frame" frames, so the playback can find out where
+// it stopped following the recording. Some of the checkpoints also store the
+// whole game state so the playback can jump to them.
+struct DemoCheckpoint
+{
+  u64               frame      = 0;
+  u64               state_hash = 0; // see "Game::calc_state_hash"
+  std::vector<byte> snapshot;       // "Game::serialize" data, mostly empty
+};
+
+using DemoCheckpoints = std::vector<DemoCheckpoint>;
+
+// The checkpoints are stored in an optional section after the frames, so the
+// demos recorded without them still load.
+NC_PUSH_PACKED
+struct DemoCheckpointsHeader
+{
+  static constexpr u64  SIGNATURE_SIZE = 6;
+  static constexpr cstr SIGNATURE      = "ncchck";
+
+  char signature[SIGNATURE_SIZE];
+  u64  num_checkpoints = 0;
+};
+NC_POP_PACKED
+
+// One checkpoint in the file, followed by "snapshot_size" bytes of the snapshot
+NC_PUSH_PACKED
+struct DemoCheckpointEntry
+{
+  u64 frame         = 0;
+  u64 state_hash    = 0;
+  u64 snapshot_size = 0;
+};
+NC_POP_PACKED
+
 // Loads a given demo from a file
 bool load_demo_from_file
 (
   const std::string&   file,
   LevelName&           level_name_out,
   LevelTransitionData& transition_out,
-  DemoDataFrames&      frames_out
+  DemoDataFrames&      frames_out,
+  DemoCheckpoints*     checkpoints_out = nullptr
 );
 
 // Returns a list of available demos
@@ -130,7 +173,8 @@ std::vector<std::string> list_available_save_files();
 
 u64 calc_size_for_demo_to_bytes
 (
-  const DemoDataHeader& header
+  const DemoDataHeader&  header,
+  const DemoCheckpoints& checkpoints = {}
 );
 
 void save_bytes_to_file
@@ -148,25 +192,30 @@ void* load_bytes_from_file
 
 void save_demo_to_bytes
 (
-  const DemoDataHeader& header,
-  const DemoDataFrame*  frames,
-  byte*                 bytes_out // Preallocate this yourself
+  const DemoDataHeader&  header,
+  const DemoDataFrame*   frames,
+  byte*                  bytes_out, // Preallocate this yourself
+  const DemoCheckpoints& checkpoints = {}
 );
 
+// The checkpoints are loaded only if "checkpoints_out" is not null
 bool load_demo_from_bytes
 (
-  DemoDataHeader& header_out,
-  DemoDataFrames& frames_out,
-  const byte*     bytes_start,
-  u64             bytes_cnt
+  DemoDataHeader&  header_out,
+  DemoDataFrames&  frames_out,
+  const byte*      bytes_start,
+  u64              bytes_cnt,
+  DemoCheckpoints* checkpoints_out = nullptr
 );
 
 void save_demo_to_file
 (
-  const std::string&   filename, // No path or extension, only filename
-  LevelName            level_name, // Name of the level
-  const DemoDataFrame* frames,
-  u64                  frames_cnt
+  const std::string&         filename, // No path or extension, only filename
+  LevelName                  level_name, // Name of the level
+  const LevelTransitionData& transition,
+  const DemoDataFrame*       frames,
+  u64                        frames_cnt,
+  const DemoCheckpoints&     checkpoints = {}
 );
 
 }
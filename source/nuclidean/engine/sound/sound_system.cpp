@@ -83,6 +83,12 @@ static void SDLCALL on_channel_finished(int channel)
 //==============================================================================
 bool SoundSystem::init()
 {
+  if (get_engine().is_headless())
+  {
+    // Stay terminated, all the calls are ignored then
+    return true;
+  }
+
   if (!try_init())
   {
     nc_warn("Failed to initialize sound during startup.");
@@ -0,0 +1,187 @@
+// Project Nuclidean Source File
+#include <frame_arena.h>
+
+#include <common.h>
+#include <cvars.h>
+
+#include <algorithm> // std::max
+
+#if NC_TESTS
+#include <unit_test.h>  // NC_UNIT_TEST
+#include <logging.h>    // nc_warn in tests
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+/*static*/ FrameArena& FrameArena::get()
+{
+  static FrameArena arena;
+  return arena;
+}
+
+//==============================================================================
+/*static*/ std::pmr::memory_resource* FrameArena::get_resource()
+{
+  if (!CVars::frame_arena)
+  {
+    return std::pmr::new_delete_resource();
+  }
+
+  return &FrameArena::get();
+}
+
+//==============================================================================
+FrameArena::FrameArena(u64 block_size)
+: m_owner_thread(std::this_thread::get_id())
+{
+  this->add_block(block_size);
+  m_stats.capacity = block_size;
+}
+
+//==============================================================================
+FrameArena::~FrameArena()
+{
+  for (Block& block : m_blocks)
+  {
+    delete[] block.data;
+  }
+}
+
+//==============================================================================
+void FrameArena::reset()
+{
+  m_stats.last_frame_bytes = m_frame_bytes;
+  m_stats.peak_frame_bytes = std::max(m_stats.peak_frame_bytes, m_frame_bytes);
+
+  if (m_blocks.size() > 1)
+  {
+    // The frame did not fit, merge the blocks into one
+    u64 total_size = 0;
+    for (Block& block : m_blocks)
+    {
+      total_size += block.size;
+      delete[] block.data;
+    }
+
+    m_blocks.clear();
+    this->add_block(total_size);
+    m_stats.capacity = total_size;
+  }
+
+  m_offset      = 0;
+  m_frame_bytes = 0;
+}
+
+//==============================================================================
+u64 FrameArena::get_frame_bytes() const
+{
+  return m_frame_bytes;
+}
+
+//==============================================================================
+const FrameArena::Stats& FrameArena::get_stats() const
+{
+  return m_stats;
+}
+
+//==============================================================================
+void* FrameArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+  nc_assert(std::this_thread::get_id() == m_owner_thread, "The frame arena is not thread safe");
+
+  void* ptr = this->allocate_from_last_block(bytes, alignment);
+  if (!ptr)
+  {
+    const u64 last_size = m_blocks.back().size;
+    this->add_block(std::max<u64>(last_size * 2, bytes + alignment));
+
+    ptr = this->allocate_from_last_block(bytes, alignment);
+    nc_assert(ptr);
+  }
+
+  m_frame_bytes += bytes;
+  return ptr;
+}
+
+//==============================================================================
+void FrameArena::do_deallocate(void* /*ptr*/, std::size_t /*bytes*/, std::size_t /*alignment*/)
+{
+  // Released all at once in "reset"
+}
+
+//==============================================================================
+bool FrameArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+  return this == &other;
+}
+
+//==============================================================================
+void* FrameArena::allocate_from_last_block(u64 bytes, u64 alignment)
+{
+  nc_assert(!m_blocks.empty());
+  nc_assert((alignment & (alignment - 1)) == 0, "Alignment has to be a power of two");
+
+  const Block& block = m_blocks.back();
+
+  const u64 base  = recast<u64>(block.data);
+  const u64 start = (base + m_offset + alignment - 1) & ~(alignment - 1);
+  if (start + bytes > base + block.size)
+  {
+    return nullptr;
+  }
+
+  m_offset = start + bytes - base;
+  return recast<void*>(start);
+}
+
+//==============================================================================
+void FrameArena::add_block(u64 size)
+{
+  m_blocks.push_back(Block
+  {
+    .data = new byte[size],
+    .size = size,
+  });
+
+  m_offset = 0;
+}
+
+//==============================================================================
+#if NC_TESTS
+static bool frame_arena_test_reset(unit_test::TestCtx& /*ctx*/)
+{
+  FrameArena arena(64);
+
+  // Does not fit into the first block, has to take another one
+  std::pmr::vector<u64> values(&arena);
+  for (u64 i = 0; i < 100; ++i)
+  {
+    values.push_back(i);
+  }
+
+  if (values[99] != 99 || recast<u64>(values.data()) % alignof(u64) != 0)
+  {
+    nc_warn("The frame arena returned wrong memory.");
+    NC_TEST_FAIL;
+  }
+
+  const u64 frame_bytes = arena.get_frame_bytes();
+  values = std::pmr::vector<u64>(&arena);
+  arena.reset();
+
+  // The next frame fits into a single merged block
+  const FrameArena::Stats& stats = arena.get_stats();
+  if (stats.last_frame_bytes != frame_bytes || stats.capacity < frame_bytes || arena.get_frame_bytes() != 0)
+  {
+    nc_warn("The frame arena stats are wrong after reset.");
+    NC_TEST_FAIL;
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(frame_arena_test_reset)->name("Frame Arena Reset");
+#endif
+
+}
@@ -0,0 +1,80 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <memory_resource> // std::pmr::memory_resource
+#include <thread>          // std::thread::id
+#include <vector>
+
+namespace nc
+{
+
+// Linear allocator for the scratch memory that lives at most until the end of
+// the frame. Allocation only bumps an offset, deallocation does nothing and
+// everything is released at once by "reset" on "ModuleEventType::cleanup".
+// Use it through the std::pmr containers or pass it to a "StackVector".
+//
+// If a frame needs more than the current block, another block is taken from
+// the heap. On reset the blocks are merged into one large enough for the whole
+// frame, so after a few frames the arena does not touch the heap at all.
+//
+// Not thread safe, only the main thread is allowed to allocate from it.
+class FrameArena : public std::pmr::memory_resource
+{
+public:
+  static constexpr u64 DEFAULT_BLOCK_SIZE = 256 * 1024; // 256kB
+
+  struct Stats
+  {
+    u64 last_frame_bytes = 0; // allocated during the previous frame
+    u64 peak_frame_bytes = 0; // the most allocated during a single frame
+    u64 capacity         = 0; // size of the block after the last reset
+  };
+
+  // Returns the arena of the main thread
+  static FrameArena& get();
+
+  // Where the per-frame scratch memory should come from. The arena of the
+  // main thread, or the heap if the "frame_arena" cvar is off, so the
+  // allocation counters can be compared with and without the arena.
+  static std::pmr::memory_resource* get_resource();
+
+  FrameArena(u64 block_size = DEFAULT_BLOCK_SIZE);
+  ~FrameArena();
+
+  FrameArena(const FrameArena&)            = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  // Releases everything allocated since the last reset, none of it can be
+  // used anymore
+  void reset();
+
+  // Bytes allocated since the last reset
+  u64          get_frame_bytes() const;
+  const Stats& get_stats()       const;
+
+protected:
+  virtual void* do_allocate(std::size_t bytes, std::size_t alignment)               override;
+  virtual void  do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override;
+  virtual bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept  override;
+
+private:
+  struct Block
+  {
+    byte* data = nullptr;
+    u64   size = 0;
+  };
+
+  // Returns nullptr if the allocation does not fit into the last block
+  void* allocate_from_last_block(u64 bytes, u64 alignment);
+  void  add_block(u64 size);
+
+  std::vector<Block> m_blocks;          // allocating from the last one
+  u64                m_offset      = 0; // into the last block
+  u64                m_frame_bytes = 0;
+  Stats              m_stats;
+  std::thread::id    m_owner_thread;
+};
+
+}
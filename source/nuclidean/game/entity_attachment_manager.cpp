@@ -22,17 +22,25 @@ EntityAttachment::EntityAttachment(EntityRegistry& reg)
 }
 
 //==============================================================================
-void EntityAttachment::on_entity_move(EntityID id, vec3 p, f32, f32)
+void EntityAttachment::on_entities_moved(std::span<const EntityMove> moves)
 {
-  // Move all children
-  for (const Attachment& attach : m_attachments)
+  if (m_attachments.empty())
   {
-    if (attach.parent == id && (attach.type & EntityAttachmentFlags::copy_position))
+    return;
+  }
+
+  for (const EntityMove& move : moves)
+  {
+    // Move all children, they get reported in the next batch
+    for (const Attachment& attach : m_attachments)
     {
-      Entity* entity = m_registry.get_entity(attach.child);
-      nc_assert(entity);
+      if (attach.parent == move.id && (attach.type & EntityAttachmentFlags::copy_position))
+      {
+        Entity* entity = m_registry.get_entity(attach.child);
+        nc_assert(entity);
 
-      entity->set_position(p + UP_DIR * attach.offset);
+        entity->set_position(move.position + UP_DIR * attach.offset);
+      }
     }
   }
 }
@@ -32,7 +32,7 @@ public:
   EntityAttachment(EntityRegistry& registry);
 
   // IEntityListener
-  virtual void on_entity_move(EntityID id, vec3 pos, f32 r, f32 h)   override;
+  virtual void on_entities_moved(std::span<const EntityMove> moves)  override;
   virtual void on_entity_garbaged(EntityID id)                       override;
   virtual void on_entity_destroy(EntityID id)                        override;
   virtual void on_entity_create(EntityID id, vec3 pos, f32 r, f32 h) override;
@@ -19,324 +19,6 @@
 namespace nc::grid_helper
 {
 
-//==============================================================================
-static auto remap_point_to_indices
-(
-  vec2 point,
-  vec2 min,
-  vec2 max,
-  u64  width,
-  u64  height
-)
-{
-  nc_assert(min.x < max.x && min.y < max.y);
-
-  // The following code is ok, but results in a non-inlining call. Too bad
-  // f32 mxx = std::nextafter(max.x, -INFINITY);
-  // f32 mxy = std::nextafter(max.y, -INFINITY);
-
-  // Instead, lets use this variation and let's hope it does not fail
-  f32 mxx = max.x - 0.001f;
-  f32 mxy = max.y - 0.001f;
-  // This might fire if the world size is too big
-  nc_assert(mxx != max.x && mxy != max.y); 
-
-  point = clamp(point, min, vec2{mxx, mxy});
-
-  // Remap to interval [0, 1]
-  vec2 map_size = max-min;
-  vec2 remapped = (point-min) / map_size;
-  
-  vec2 grid = vec2{cast<f32>(width), cast<f32>(height)};
-  vec2 remapped_to_grid = remapped * grid;
-
-  struct Output
-  {
-    u64 xindex;
-    u64 yindex;
-  };
-
-  return Output
-  {
-    .xindex = cast<u64>(remapped_to_grid.x),
-    .yindex = cast<u64>(remapped_to_grid.y),
-  };
-}
-
-//==============================================================================
-static auto remap_point_to_indices_unclamped
-(
-  vec2 point,
-  vec2 min,
-  vec2 max,
-  u64  width,
-  u64  height
-)
-{
-  nc_assert(min.x < max.x && min.y < max.y);
-
-  // Remap to interval [0, 1]
-  vec2 map_size = max-min;
-  vec2 remapped = (point-min) / map_size;
-  
-  vec2  grid = vec2{cast<f32>(width), cast<f32>(height)};
-  ivec2 remapped_to_grid = remapped * grid;
-
-  nc_assert(remapped_to_grid.x >= 0);
-  nc_assert(remapped_to_grid.y >= 0);
-  nc_assert(cast<u64>(remapped_to_grid.x) < width);
-  nc_assert(cast<u64>(remapped_to_grid.y) < height);
-
-  struct Output
-  {
-    u64 xindex;
-    u64 yindex;
-  };
-
-  return Output
-  {
-    .xindex = cast<u64>(remapped_to_grid.x),
-    .yindex = cast<u64>(remapped_to_grid.y),
-  };
-}
-
-//==============================================================================
-// Returns false if the line is outside the bbox. Clips it otherwise and returns
-// true.
-// After this no point on the line lies outside the bbox.
-static bool check_line_in_bbox_and_clip_it(vec2& from, vec2& to, aabb2 bbox)
-{
-  nc_assert(bbox.is_valid());
-
-  vec2 mn = bbox.min;
-  vec2 mx = bbox.max;
-
-  // Going up/down
-  if (from.x == to.x)
-  {
-    if (to.x != clamp(to.x, mn.x, mx.x))
-    {
-      return false;
-    }
-
-    if (max(from.y, to.y) < mn.y || min(from.y, to.y) > mx.y)
-    {
-      return false;
-    }
-
-    from.y = clamp(from.y, mn.y, mx.y);
-    to.y   = clamp(to.y,   mn.y, mx.y);
-    return true;
-  }
-
-  // Going left/right
-  if (from.y == to.y)
-  {
-    if (to.y != clamp(to.y, mn.y, mx.y))
-    {
-      return false;
-    }
-
-    if (max(from.x, to.x) < mn.x || min(from.x, to.x) > mx.x)
-    {
-      return false;
-    }
-
-    from.x = clamp(from.x, mn.x, mx.x);
-    to.x   = clamp(to.x,   mn.x, mx.x);
-    return true;
-  }
-
-  // Now find 2 intersections
-  vec2 dir = to - from;
-
-  f32 cx1 = (mn.x - from.x) / dir.x;
-  f32 cx2 = (mx.x - from.x) / dir.x;
-  f32 cy1 = (mn.y - from.y) / dir.y;
-  f32 cy2 = (mx.y - from.y) / dir.y;
-
-  vec2 px1 = from + dir * cx1;
-  vec2 px2 = from + dir * cx2;
-  vec2 py1 = from + dir * cy1;
-  vec2 py2 = from + dir * cy2;
-
-  u8  cnt = 0;
-  f32 cfs[4]{0, 0, 0, 0};
-
-  if (px1.y >= mn.y && px1.y <= mx.y)
-  {
-    cfs[cnt++] = cx1;
-  }
-
-  if (px2.y >= mn.y && px2.y <= mx.y)
-  {
-    cfs[cnt++] = cx2;
-  }
-
-  if (py1.x >= mn.x && py1.x <= mx.x)
-  {
-    cfs[cnt++] = cy1;
-  }
-
-  if (py2.x >= mn.x && py2.x <= mx.x)
-  {
-    cfs[cnt++] = cy2;
-  }
-
-  // Happens if no intersection is valid
-  if (cnt < 2)
-  {
-    return false;
-  }
-
-  f32 mni = max(min(cfs[0], cfs[1]), 0.0f);
-  f32 mxi = min(max(cfs[0], cfs[1]), 1.0f);
-
-  to   = from + dir * mxi;
-  from = from + dir * mni;
-  if (mni <= mxi)
-  {
-    // nc_assert(to == clamp(to, mn, mx) && from == clamp(from, mn, mx));
-    // The following params trigger the assert :(
-    // From:  {1.10000610   1.60455322 }
-    // To:    {-533.628052 -523.461121 }
-    // BBMin: {-67.4000015 -20.3999996 }
-    // BBMax: {1052.59985   891.799866 }
-    //
-    // This seems to be just a float inaccuracy.
-    // Solving this by clamping the output, however, that might cause other
-    // problems.
-    to   = clamp(to,   mn, mx);
-    from = clamp(from, mn, mx);
-    return true;
-  }
-
-  return false;
-}
-
-//==============================================================================
-template<typename T, typename F>
-static void query_ray_helper(const StatGridAABB2<T>& self, vec2 from, vec2 to, F func)
-{
-  // First, clip the line into the BBOX so we do not run outside
-  aabb2 grid_bbox = aabb2{self.m_min, self.m_max - vec2{0.001f}};
-  nc_assert(grid_bbox.max != self.m_max);
-
-  bool inside_grid = check_line_in_bbox_and_clip_it(from, to, grid_bbox);
-  if (!inside_grid)
-  {
-    // The line is outside the grid! Exit
-    return;
-  }
-
-  vec2 abs_dir   = abs(to - from);
-  bool swap_axes = abs_dir.x < abs_dir.y;
-
-  ivec2 grid_cnt   = ivec2{self.m_cells.size(), self.m_cells[0].size()};
-  vec2  grid_min   = self.m_min;
-  vec2  grid_max   = self.m_max;
-  vec2  grid_cnt_f = grid_cnt;
-  vec2  grid_size  = grid_max - grid_min;
-
-  // Swap axes so that x-change is always greater than y-change
-  if (swap_axes)
-  {
-    std::swap(from.x,       from.y);
-    std::swap(to.x,         to.y);
-    std::swap(grid_min.x,   grid_min.y);
-    std::swap(grid_max.x,   grid_max.y);
-    std::swap(grid_cnt_f.x, grid_cnt_f.y);
-    std::swap(grid_cnt.x,   grid_cnt.y);
-    std::swap(grid_size.x,  grid_size.y);
-  }
-
-  // Start cell
-  auto[xfrom, yfrom] = grid_helper::remap_point_to_indices_unclamped
-  (
-    from, grid_min, grid_max, grid_cnt.x, grid_cnt.y
-  );
-
-  // End cell
-  auto[xto, yto] = grid_helper::remap_point_to_indices_unclamped
-  (
-    to, grid_min, grid_max, grid_cnt.x, grid_cnt.y
-  );
-
-  vec2 direction = to - from;
-
-  if (from.x > to.x)
-  {
-    // Make sure that from is on the left (TODO: Is this necessary?)
-    std::swap(from,  to);
-    std::swap(xfrom, xto);
-    std::swap(yfrom, yto);
-    direction = -direction;
-  }
-
-  // Direction has to be checked for scale, it might be 0
-  f32 rate       = direction.x ? direction.y / direction.x : 0.0f;
-  f32 right_x    = mix(grid_min.x, grid_max.x, (xfrom + 1) / grid_cnt_f.x);
-  f32 missing_x  = right_x - from.x;
-  f32 missing_y  = missing_x * rate;
-
-  f32 yp = from.y + missing_y;
-
-  // Precalculate here, as we are gonna use it multiple times in a loop
-  f32 one_over_gs_y = 1.0f / grid_size.y;
-  f32 cell_width    = (grid_size.x / grid_cnt.x);
-
-  for (u64 ix = xfrom, iy = yfrom; ix <= xto; ++ix)
-  {
-    // Set the correct y for the last iteration. Note that the first iteration
-    // can also be the last one.
-    if (ix == xto)
-    {
-      yp = to.y;
-    }
-
-    func(swap_axes ? ivec2{iy, ix} : ivec2{ix, iy});
-
-    i64 iy_signed = cast<i64>((yp - grid_min.y) * one_over_gs_y * grid_cnt.y);
-    nc_assert(iy_signed >= 0);
-
-    if (u64 new_iy = cast<u64>(iy_signed); new_iy != iy)
-    {
-      // This happens if the y-coord changes from the previous cell
-      func(swap_axes ? ivec2{new_iy, ix} : ivec2{ix, new_iy});
-      iy = new_iy;
-    }
-
-    // This will be overwritten at the start of the last iteration
-    yp += rate * cell_width;
-  }
-}
-
-//==============================================================================
-template<typename T, typename F>
-static void query_aabb_helper(const StatGridAABB2<T>& self, aabb2 bbox, F func)
-{
-  auto[xfrom, yfrom] = grid_helper::remap_point_to_indices
-  (
-    bbox.min, self.m_min, self.m_max, self.m_cells.size(), self.m_cells[0].size()
-  );
-
-  auto[xto, yto] = grid_helper::remap_point_to_indices
-  (
-    bbox.max, self.m_min, self.m_max, self.m_cells.size(), self.m_cells[0].size()
-  );
-
-  for (auto x = xfrom; x <= xto; ++x)
-  {
-    for (auto y = yfrom; y <= yto; ++y)
-    {
-      nc_assert(x < self.m_cells.size());
-      nc_assert(y < self.m_cells[x].size());
-
-      func(ivec2{x, y});
-    }
-  }
-}
-
 //==============================================================================
 u64 ray_count_cells(const StatGridAABB2<u64>& grid, vec2 from, vec2 to)
 {
@@ -361,148 +43,104 @@ void StatGridAABB2<T>::initialize(u64 width, u64 height, vec2 min, vec2 max)
   nc_assert(width > 0 && height > 0);
   nc_assert(min.x < max.x && min.y < max.y);
 
-  m_min = min;
-  m_max = max;
-
-  m_cells.resize(width);
-
-  for (auto& cell : m_cells)
-  {
-    cell.resize(height);
-  }
+  m_min    = min;
+  m_max    = max;
+  m_width  = width;
+  m_height = height;
 
   m_initialized = true;
 }
 
 //==============================================================================
 template<typename T>
-void StatGridAABB2<T>::query_point(vec2 point, Visitor func) const
+void StatGridAABB2<T>::insert(aabb2 new_bbox, const T& data)
 {
-  this->query_aabb(aabb2{point}, func);
+  nc_assert(m_initialized);
+  nc_assert(!m_built, "The grid is static, can not insert after build.");
+  nc_assert(new_bbox.is_valid());
+
+  m_bboxes.min_x.push_back(new_bbox.min.x);
+  m_bboxes.min_y.push_back(new_bbox.min.y);
+  m_bboxes.max_x.push_back(new_bbox.max.x);
+  m_bboxes.max_y.push_back(new_bbox.max.y);
+  m_data.push_back(data);
 }
 
 //==============================================================================
 template<typename T>
-void StatGridAABB2<T>::query_aabb(aabb2 bbox, Visitor func) const
+void StatGridAABB2<T>::build()
 {
-  NC_SCOPE_PROFILER(QueryAABB)
   nc_assert(m_initialized);
+  nc_assert(!m_built);
 
-  grid_helper::query_aabb_helper(*this, bbox, [&](ivec2 coord)
-  {
-    nc_assert(coord.x < cast<int>(m_cells.size()));
-    nc_assert(coord.y < cast<int>(m_cells[coord.x].size()));
+  const u64 cell_cnt   = m_width * m_height;
+  const u32 object_cnt = cast<u32>(m_data.size());
 
-    for (auto&[other_bbox, val] : m_cells[coord.x][coord.y])
+  // Calls the lambda for each cell the object overlaps
+  auto for_each_cell_of_object = [&](u32 obj, auto&& lambda)
+  {
+    grid_helper::query_aabb_helper(*this, this->get_object_bbox(obj), [&](ivec2 coord)
     {
-      if (intersect::aabb_aabb_2d(bbox, other_bbox))
-      {
-        func(bbox, val);
-      }
-    }
-  });
-}
-
-//==============================================================================
-template<typename T>
-void StatGridAABB2<T>::query_ray
-(
-  vec3 from, vec3 to, f32 expand, Visitor func
-)
-const
-{
-  NC_SCOPE_PROFILER(QueryRay)
-  return this->query_ray(from.xz(), to.xz(), expand, func);
-}
-
-//==============================================================================
-template<typename T>
-void StatGridAABB2<T>::query_ray
-(
-  vec2 from, vec2 to, f32 expand, Visitor func
-)
-const
-{
-  nc_assert(m_initialized);
-  nc_assert(expand >= 0.0f);
-  nc_assert(func);
+      lambda(coord.x * m_height + coord.y);
+    });
+  };
 
-  // TODO:
-  // [ ] handle expanded case
+  // First count the objects in each cell, stored shifted by one so the
+  // prefix sum turns it directly into offsets
+  m_cell_offsets.assign(cell_cnt + 1, 0);
+  for (u32 obj = 0; obj < object_cnt; ++obj)
+  {
+    for_each_cell_of_object(obj, [&](u64 cell)
+    {
+      m_cell_offsets[cell + 1] += 1;
+    });
+  }
 
-  if (expand > 0.0f)
+  for (u64 cell = 0; cell < cell_cnt; ++cell)
   {
-    // Fallback to stupid implementation for expanded queries.
-    vec2 mn = min(from, to);
-    vec2 mx = max(from, to);
-    vec2 ex = vec2{expand};
-    this->query_aabb(aabb2{mn - ex, mx + ex}, func);
+    m_cell_offsets[cell + 1] += m_cell_offsets[cell];
   }
-  else
+
+  // And now scatter the objects into their cells
+  std::vector<u32> cursors(m_cell_offsets.begin(), m_cell_offsets.end() - 1);
+  m_cell_objects.resize(m_cell_offsets.back());
+
+  for (u32 obj = 0; obj < object_cnt; ++obj)
   {
-    // Faster implementation for raycasts (expansion size == 0.0f)
-    grid_helper::query_ray_helper(*this, from, to, [&](ivec2 coord)
+    for_each_cell_of_object(obj, [&](u64 cell)
     {
-      if (coord.x >= this->m_cells.size() || coord.y >= this->m_cells[0].size())
-      {
-        nc_warn(
-          "Out of bounds grid indexing! Grid size: [{}, {}], idx: [{}, {}]",
-          this->m_cells.size(), this->m_cells[0].size(), coord.x, coord.y);
-        return;
-      }
-
-      for (const Unit& unit : this->m_cells[coord.x][coord.y])
-      {
-        if (intersect::ray_aabb2(from, to, unit.bbox))
-        {
-          func(unit.bbox, unit.data);
-        }
-      }
+      m_cell_objects[cursors[cell]++] = obj;
     });
   }
+
+  m_built = true;
 }
 
 //==============================================================================
 template<typename T>
-void StatGridAABB2<T>::insert(aabb2 new_bbox, const T& data)
+u64 StatGridAABB2<T>::get_cell_object_count(u64 x, u64 y) const
 {
-  nc_assert(m_initialized);
-  nc_assert(new_bbox.is_valid());
-
-  auto[xfrom, yfrom] = grid_helper::remap_point_to_indices(
-    new_bbox.min, m_min, m_max, m_cells.size(), m_cells[0].size());
-
-  auto[xto, yto] = grid_helper::remap_point_to_indices(
-    new_bbox.max, m_min, m_max, m_cells.size(), m_cells[0].size());
-
-  nc_assert(xfrom <= xto && yfrom <= yto);
+  nc_assert(m_built);
+  nc_assert(x < m_width && y < m_height);
 
-  for (u64 xi = xfrom; xi <= xto; ++xi)
-  {
-    nc_assert(xi < m_cells.size());
-    Coll& col = m_cells[xi];
-
-    for (u64 yi = yfrom; yi <= yto; ++yi)
-    {
-      nc_assert(yi < col.size());
-      Cell& cell = col[yi];
-      cell.push_back(Unit
-      {
-        .bbox = new_bbox,
-        .data = data,
-      });
-    }
-  }
+  const u64 cell = x * m_height + y;
+  return m_cell_offsets[cell + 1] - m_cell_offsets[cell];
 }
 
 //==============================================================================
 template<typename T>
 void StatGridAABB2<T>::reset()
 {
-  m_cells.clear();
-  m_min = vec2{FLT_MAX};
-  m_max = vec2{-FLT_MAX};
+  m_bboxes = BBoxes{};
+  m_data.clear();
+  m_cell_offsets.clear();
+  m_cell_objects.clear();
+  m_min    = vec2{FLT_MAX};
+  m_max    = vec2{-FLT_MAX};
+  m_width  = 0;
+  m_height = 0;
   m_initialized = false;
+  m_built       = false;
 }
 
 //==============================================================================
@@ -660,7 +298,7 @@ bool grid_test_compare(unit_test::TestCtx& /*ctx*/)
     // Query the aabb
     grid_helper::query_aabb_helper(grid, aabb2{c.from, c.to}, [&](ivec2 coord)
     {
-      vec2  grid_cnt  = vec2{grid.m_cells.size(), grid.m_cells[0].size()};
+      vec2  grid_cnt  = vec2{grid.m_width, grid.m_height};
       vec2  grid_size = grid.m_max - grid.m_min;
       vec2  mn_pt = grid.m_min + grid_size * vec2{coord}            / grid_cnt;
       vec2  mx_pt = grid.m_min + grid_size * vec2{coord + ivec2{1}} / grid_cnt;
@@ -789,5 +427,86 @@ bool clip_bbox_test(unit_test::TestCtx& /*ctx*/)
 }
 NC_UNIT_TEST(clip_bbox_test)->name("Clip Line In BBOX");
 
+//==============================================================================
+// -unit_test -test_filter=Grid.*
+bool grid_test_queries(unit_test::TestCtx& /*ctx*/)
+{
+  const aabb2 OBJECTS[]
+  {
+    aabb2{vec2{ 0.5f,  0.5f}, vec2{ 1.5f,  1.5f}},
+    aabb2{vec2{ 2.0f,  2.0f}, vec2{12.0f,  3.0f}},
+    aabb2{vec2{-4.0f, -4.0f}, vec2{ 0.2f, 40.0f}}, // partially outside
+    aabb2{vec2{10.1f, 10.1f}, vec2{10.2f, 10.2f}},
+    aabb2{vec2{ 0.0f,  0.0f}, vec2{32.0f, 32.0f}}, // covers everything
+  };
+
+  StatGridAABB2<u64> grid;
+  grid.initialize(16, 16, vec2{0, 0}, vec2{32, 32});
+  for (u64 i = 0; i < std::size(OBJECTS); ++i)
+  {
+    grid.insert(OBJECTS[i], i);
+  }
+  grid.build();
+
+  NC_TEST_ASSERT(grid.get_cell_object_count(0,  0)  == 3);
+  NC_TEST_ASSERT(grid.get_cell_object_count(15, 15) == 1);
+
+  const vec2 POINTS[]
+  {
+    vec2{1.0f, 1.0f}, vec2{10.15f, 10.15f}, vec2{0.1f, 20.0f}, vec2{31.0f, 1.0f},
+  };
+
+  for (vec2 pt : POINTS)
+  {
+    std::set<u64> expected, got;
+    for (u64 i = 0; i < std::size(OBJECTS); ++i)
+    {
+      if (intersect::aabb_aabb_2d(OBJECTS[i], aabb2{pt, pt}))
+      {
+        expected.insert(i);
+      }
+    }
+
+    grid.query_point(pt, [&](aabb2, u64 i)
+    {
+      got.insert(i);
+      return false;
+    });
+
+    NC_TEST_ASSERT(expected == got);
+  }
+
+  const std::pair<vec2, vec2> RAYS[]
+  {
+    {vec2{ 1.0f,  0.1f}, vec2{ 1.0f, 20.0f}},
+    {vec2{-5.0f,  2.5f}, vec2{40.0f,  2.5f}},
+    {vec2{ 9.0f, 12.0f}, vec2{12.0f,  9.0f}},
+    {vec2{ 0.1f,  0.1f}, vec2{31.9f, 31.8f}},
+  };
+
+  for (auto[from, to] : RAYS)
+  {
+    std::set<u64> expected, got;
+    for (u64 i = 0; i < std::size(OBJECTS); ++i)
+    {
+      if (intersect::ray_aabb2(from, to, OBJECTS[i]))
+      {
+        expected.insert(i);
+      }
+    }
+
+    grid.query_ray(from, to, 0.0f, [&](aabb2, u64 i)
+    {
+      got.insert(i);
+      return false;
+    });
+
+    NC_TEST_ASSERT(expected == got);
+  }
+
+  NC_TEST_SUCCESS;
+}
+NC_UNIT_TEST(grid_test_queries)->name("Grid Test Queries");
+
 }
 #endif
@@ -3,8 +3,12 @@
 
 #include <types.h>
 #include <aabb.h>
+#include <common.h>
+#include <intersect.h>
+#include <profiling.h>
+#include <math/lingebra.h>
 
-#include <functional>
+#include <vector>
 #include <utility>
 #include <float.h>
 
@@ -12,7 +16,10 @@ namespace nc
 {
 
 // Static 2D grid storing bounding boxes.
-// TODO: not very efficient, should use better data structure
+// The objects are first inserted and then packed into a flat, compressed-row
+// layout by calling "build". Every cell is a range in one packed array of
+// object indices and the bounding boxes are stored as SoA, so a query touches
+// only a few contiguous arrays instead of chasing pointers.
 template<typename T>
 class StatGridAABB2
 {
@@ -20,34 +27,67 @@ public:
   // Maybe RAII instead of this?
   void initialize(u64 width, u64 height, vec2 min, vec2 max);
 
-  // Inserts a new AABB with some data into the grid.
+  // Inserts a new AABB with some data into the grid. The object is not
+  // queryable until "build" is called.
   void insert(aabb2 bbox, const T& data);
 
-  // Visitor returns true it it does not require more iterations
-  using Visitor = std::function<bool(aabb2, const T&)>;
-  void query_point(vec2 point, Visitor func) const;
-  void query_aabb(aabb2 bbox,  Visitor func) const;
+  // Packs all inserted objects into the cells. Has to be called once after all
+  // insertions and before the first query.
+  void build();
 
-  void query_ray(vec2 from, vec2 to, f32 expand, Visitor func) const;
-  void query_ray(vec3 from, vec3 to, f32 expand, Visitor func) const;
+  // Visitor has a signature of "bool(aabb2, const T&)". The return value is
+  // ignored for now and all candidates are visited. It is a template parameter
+  // instead of a std::function so that the hot queries can get inlined.
+  // An object overlapping multiple cells can be reported multiple times by
+  // aabb and ray queries.
+  template<typename F>
+  void query_point(vec2 point, F&& func) const;
+
+  template<typename F>
+  void query_aabb(aabb2 bbox,  F&& func) const;
+
+  template<typename F>
+  void query_ray(vec2 from, vec2 to, f32 expand, F&& func) const;
+
+  template<typename F>
+  void query_ray(vec3 from, vec3 to, f32 expand, F&& func) const;
+
+  // Calls "bool(aabb2, const T&)" for each object in the given cell
+  template<typename F>
+  void for_each_in_cell(u64 x, u64 y, F&& func) const;
+
+  u64 get_cell_object_count(u64 x, u64 y) const;
 
   // Resets the grid into non initialized state and frees all resources
   void reset();
 
-  struct Unit
+  u64  get_width()  const;
+  u64  get_height() const;
+  bool is_built()   const;
+
+  // Returns the bbox of the object with the given index
+  aabb2 get_object_bbox(u32 object_idx) const;
+
+  // Bounding boxes of objects in SoA layout, indexed by the object index
+  struct BBoxes
   {
-    aabb2 bbox; // bbox of the object
-    T     data; // this will be some pointer, index or something else..
+    std::vector<f32> min_x;
+    std::vector<f32> min_y;
+    std::vector<f32> max_x;
+    std::vector<f32> max_y;
   };
-  using Cell  = std::vector<Unit>;
-  using Coll  = std::vector<Cell>;
-  using Cells = std::vector<Coll>;
 
   // MR says: I am just not a fan of std::numeric_limits<blah blah>...
-  vec2  m_min = vec2{ FLT_MAX};
-  vec2  m_max = vec2{-FLT_MAX};
-  Cells m_cells;
-  bool  m_initialized = false;
+  vec2             m_min = vec2{ FLT_MAX};
+  vec2             m_max = vec2{-FLT_MAX};
+  u64              m_width  = 0;
+  u64              m_height = 0;
+  BBoxes           m_bboxes;       // bboxes of all inserted objects
+  std::vector<T>   m_data;         // user data of all inserted objects
+  std::vector<u32> m_cell_offsets; // cell "x * height + y" owns [offsets[i], offsets[i + 1])
+  std::vector<u32> m_cell_objects; // packed object indices of all cells
+  bool             m_initialized = false;
+  bool             m_built       = false;
 };
 
 // TODO:  hash grid
@@ -55,3 +95,5 @@ public:
   
 }
 
+#include <grid.inl>
+
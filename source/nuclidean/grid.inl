@@ -0,0 +1,450 @@
+// Project Nuclidean Source File
+#pragma once
+
+namespace nc::grid_helper
+{
+
+//==============================================================================
+inline auto remap_point_to_indices
+(
+  vec2 point,
+  vec2 min,
+  vec2 max,
+  u64  width,
+  u64  height
+)
+{
+  nc_assert(min.x < max.x && min.y < max.y);
+
+  // The following code is ok, but results in a non-inlining call. Too bad
+  // f32 mxx = std::nextafter(max.x, -INFINITY);
+  // f32 mxy = std::nextafter(max.y, -INFINITY);
+
+  // Instead, lets use this variation and let's hope it does not fail
+  f32 mxx = max.x - 0.001f;
+  f32 mxy = max.y - 0.001f;
+  // This might fire if the world size is too big
+  nc_assert(mxx != max.x && mxy != max.y); 
+
+  point = clamp(point, min, vec2{mxx, mxy});
+
+  // Remap to interval [0, 1]
+  vec2 map_size = max-min;
+  vec2 remapped = (point-min) / map_size;
+  
+  vec2 grid = vec2{cast<f32>(width), cast<f32>(height)};
+  vec2 remapped_to_grid = remapped * grid;
+
+  struct Output
+  {
+    u64 xindex;
+    u64 yindex;
+  };
+
+  return Output
+  {
+    .xindex = cast<u64>(remapped_to_grid.x),
+    .yindex = cast<u64>(remapped_to_grid.y),
+  };
+}
+
+//==============================================================================
+// Returns false if the line is outside the bbox. Clips it otherwise and returns
+// true.
+// After this no point on the line lies outside the bbox.
+inline bool check_line_in_bbox_and_clip_it(vec2& from, vec2& to, aabb2 bbox)
+{
+  nc_assert(bbox.is_valid());
+
+  vec2 mn = bbox.min;
+  vec2 mx = bbox.max;
+
+  // Going up/down
+  if (from.x == to.x)
+  {
+    if (to.x != clamp(to.x, mn.x, mx.x))
+    {
+      return false;
+    }
+
+    if (max(from.y, to.y) < mn.y || min(from.y, to.y) > mx.y)
+    {
+      return false;
+    }
+
+    from.y = clamp(from.y, mn.y, mx.y);
+    to.y   = clamp(to.y,   mn.y, mx.y);
+    return true;
+  }
+
+  // Going left/right
+  if (from.y == to.y)
+  {
+    if (to.y != clamp(to.y, mn.y, mx.y))
+    {
+      return false;
+    }
+
+    if (max(from.x, to.x) < mn.x || min(from.x, to.x) > mx.x)
+    {
+      return false;
+    }
+
+    from.x = clamp(from.x, mn.x, mx.x);
+    to.x   = clamp(to.x,   mn.x, mx.x);
+    return true;
+  }
+
+  // Now find 2 intersections
+  vec2 dir = to - from;
+
+  f32 cx1 = (mn.x - from.x) / dir.x;
+  f32 cx2 = (mx.x - from.x) / dir.x;
+  f32 cy1 = (mn.y - from.y) / dir.y;
+  f32 cy2 = (mx.y - from.y) / dir.y;
+
+  vec2 px1 = from + dir * cx1;
+  vec2 px2 = from + dir * cx2;
+  vec2 py1 = from + dir * cy1;
+  vec2 py2 = from + dir * cy2;
+
+  u8  cnt = 0;
+  f32 cfs[4]{0, 0, 0, 0};
+
+  if (px1.y >= mn.y && px1.y <= mx.y)
+  {
+    cfs[cnt++] = cx1;
+  }
+
+  if (px2.y >= mn.y && px2.y <= mx.y)
+  {
+    cfs[cnt++] = cx2;
+  }
+
+  if (py1.x >= mn.x && py1.x <= mx.x)
+  {
+    cfs[cnt++] = cy1;
+  }
+
+  if (py2.x >= mn.x && py2.x <= mx.x)
+  {
+    cfs[cnt++] = cy2;
+  }
+
+  // Happens if no intersection is valid
+  if (cnt < 2)
+  {
+    return false;
+  }
+
+  // A line going through a corner of the bbox produces more than 2 valid
+  // intersections, some of them duplicate. Take the outermost ones.
+  f32 mni = cfs[0];
+  f32 mxi = cfs[0];
+  for (u8 i = 1; i < cnt; ++i)
+  {
+    mni = min(mni, cfs[i]);
+    mxi = max(mxi, cfs[i]);
+  }
+
+  mni = max(mni, 0.0f);
+  mxi = min(mxi, 1.0f);
+
+  to   = from + dir * mxi;
+  from = from + dir * mni;
+  if (mni <= mxi)
+  {
+    // nc_assert(to == clamp(to, mn, mx) && from == clamp(from, mn, mx));
+    // The following params trigger the assert :(
+    // From:  {1.10000610   1.60455322 }
+    // To:    {-533.628052 -523.461121 }
+    // BBMin: {-67.4000015 -20.3999996 }
+    // BBMax: {1052.59985   891.799866 }
+    //
+    // This seems to be just a float inaccuracy.
+    // Solving this by clamping the output, however, that might cause other
+    // problems.
+    to   = clamp(to,   mn, mx);
+    from = clamp(from, mn, mx);
+    return true;
+  }
+
+  return false;
+}
+
+//==============================================================================
+// Walks all the cells the line goes through (DDA). Expects the line to be
+// already clipped by the grid bbox.
+template<typename F>
+void walk_cells_dda
+(
+  vec2 from,
+  vec2 to,
+  vec2 grid_min,
+  vec2 grid_max,
+  u64  width,
+  u64  height,
+  F&&  func
+)
+{
+  vec2 cell_size = (grid_max - grid_min) / vec2{cast<f32>(width), cast<f32>(height)};
+
+  auto[x,    y   ] = remap_point_to_indices(from, grid_min, grid_max, width, height);
+  auto[xend, yend] = remap_point_to_indices(to,   grid_min, grid_max, width, height);
+
+  vec2 direction = to - from;
+
+  // Parametric distance (in units of "direction") to the next vertical and
+  // horizontal cell boundary and how much it grows with each step
+  f32 t_max_x   = FLT_MAX;
+  f32 t_max_y   = FLT_MAX;
+  f32 t_delta_x = FLT_MAX;
+  f32 t_delta_y = FLT_MAX;
+
+  if (direction.x != 0.0f)
+  {
+    f32 boundary = grid_min.x + cell_size.x * (x + (direction.x > 0.0f ? 1 : 0));
+    t_max_x   = (boundary - from.x) / direction.x;
+    t_delta_x = cell_size.x / abs(direction.x);
+  }
+
+  if (direction.y != 0.0f)
+  {
+    f32 boundary = grid_min.y + cell_size.y * (y + (direction.y > 0.0f ? 1 : 0));
+    t_max_y   = (boundary - from.y) / direction.y;
+    t_delta_y = cell_size.y / abs(direction.y);
+  }
+
+  // Each step moves exactly one cell closer to the end cell, therefore the
+  // number of steps is known beforehand. This way the float inaccuracies can
+  // never make us walk out of the grid.
+  const u64 steps_x = x > xend ? x - xend : xend - x;
+  const u64 steps_y = y > yend ? y - yend : yend - y;
+
+  func(ivec2{x, y});
+
+  for (u64 i = 0; i < steps_x + steps_y; ++i)
+  {
+    bool step_x = y == yend || (x != xend && t_max_x < t_max_y);
+
+    if (step_x)
+    {
+      x = direction.x > 0.0f ? x + 1 : x - 1;
+      t_max_x += t_delta_x;
+    }
+    else
+    {
+      y = direction.y > 0.0f ? y + 1 : y - 1;
+      t_max_y += t_delta_y;
+    }
+
+    nc_assert(x < width && y < height);
+    func(ivec2{x, y});
+  }
+}
+
+//==============================================================================
+template<typename T, typename F>
+void query_ray_helper(const StatGridAABB2<T>& self, vec2 from, vec2 to, F func)
+{
+  // First, clip the line into the BBOX so we do not run outside
+  aabb2 grid_bbox = aabb2{self.m_min, self.m_max - vec2{0.001f}};
+  nc_assert(grid_bbox.max != self.m_max);
+
+  bool inside_grid = check_line_in_bbox_and_clip_it(from, to, grid_bbox);
+  if (!inside_grid)
+  {
+    // The line is outside the grid! Exit
+    return;
+  }
+
+  walk_cells_dda
+  (
+    from, to, self.m_min, self.m_max, self.m_width, self.m_height, func
+  );
+}
+
+//==============================================================================
+template<typename T, typename F>
+void query_aabb_helper(const StatGridAABB2<T>& self, aabb2 bbox, F func)
+{
+  auto[xfrom, yfrom] = grid_helper::remap_point_to_indices
+  (
+    bbox.min, self.m_min, self.m_max, self.m_width, self.m_height
+  );
+
+  auto[xto, yto] = grid_helper::remap_point_to_indices
+  (
+    bbox.max, self.m_min, self.m_max, self.m_width, self.m_height
+  );
+
+  for (auto x = xfrom; x <= xto; ++x)
+  {
+    for (auto y = yfrom; y <= yto; ++y)
+    {
+      nc_assert(x < self.m_width);
+      nc_assert(y < self.m_height);
+
+      func(ivec2{x, y});
+    }
+  }
+}
+
+}
+
+namespace nc
+{
+
+//==============================================================================
+template<typename T>
+template<typename F>
+void StatGridAABB2<T>::for_each_in_cell(u64 x, u64 y, F&& func) const
+{
+  nc_assert(m_built);
+  nc_assert(x < m_width && y < m_height);
+
+  const u64 cell = x * m_height + y;
+  for (u32 i = m_cell_offsets[cell]; i < m_cell_offsets[cell + 1]; ++i)
+  {
+    const u32 obj = m_cell_objects[i];
+    func(this->get_object_bbox(obj), m_data[obj]);
+  }
+}
+
+//==============================================================================
+template<typename T>
+template<typename F>
+void StatGridAABB2<T>::query_point(vec2 point, F&& func) const
+{
+  nc_assert(m_built);
+
+  // A point always falls into exactly one cell
+  auto[x, y] = grid_helper::remap_point_to_indices
+  (
+    point, m_min, m_max, m_width, m_height
+  );
+
+  const u64 cell = x * m_height + y;
+  for (u32 i = m_cell_offsets[cell]; i < m_cell_offsets[cell + 1]; ++i)
+  {
+    const u32 obj = m_cell_objects[i];
+
+    if (point.x >= m_bboxes.min_x[obj] && point.x <= m_bboxes.max_x[obj]
+     && point.y >= m_bboxes.min_y[obj] && point.y <= m_bboxes.max_y[obj])
+    {
+      func(this->get_object_bbox(obj), m_data[obj]);
+    }
+  }
+}
+
+//==============================================================================
+template<typename T>
+template<typename F>
+void StatGridAABB2<T>::query_aabb(aabb2 bbox, F&& func) const
+{
+  NC_SCOPE_PROFILER(QueryAABB)
+  nc_assert(m_built);
+
+  grid_helper::query_aabb_helper(*this, bbox, [&](ivec2 coord)
+  {
+    const u64 cell = coord.x * m_height + coord.y;
+    for (u32 i = m_cell_offsets[cell]; i < m_cell_offsets[cell + 1]; ++i)
+    {
+      const u32 obj = m_cell_objects[i];
+
+      if (max(bbox.min.x, m_bboxes.min_x[obj]) <= min(bbox.max.x, m_bboxes.max_x[obj])
+       && max(bbox.min.y, m_bboxes.min_y[obj]) <= min(bbox.max.y, m_bboxes.max_y[obj]))
+      {
+        func(this->get_object_bbox(obj), m_data[obj]);
+      }
+    }
+  });
+}
+
+//==============================================================================
+template<typename T>
+template<typename F>
+void StatGridAABB2<T>::query_ray
+(
+  vec3 from, vec3 to, f32 expand, F&& func
+)
+const
+{
+  NC_SCOPE_PROFILER(QueryRay)
+  return this->query_ray(from.xz(), to.xz(), expand, func);
+}
+
+//==============================================================================
+template<typename T>
+template<typename F>
+void StatGridAABB2<T>::query_ray
+(
+  vec2 from, vec2 to, f32 expand, F&& func
+)
+const
+{
+  nc_assert(m_built);
+  nc_assert(expand >= 0.0f);
+
+  // TODO:
+  // [ ] handle expanded case
+
+  if (expand > 0.0f)
+  {
+    // Fallback to stupid implementation for expanded queries.
+    vec2 mn = min(from, to);
+    vec2 mx = max(from, to);
+    vec2 ex = vec2{expand};
+    this->query_aabb(aabb2{mn - ex, mx + ex}, func);
+  }
+  else
+  {
+    // Faster implementation for raycasts (expansion size == 0.0f)
+    grid_helper::query_ray_helper(*this, from, to, [&](ivec2 coord)
+    {
+      const u64 cell = coord.x * m_height + coord.y;
+      for (u32 i = m_cell_offsets[cell]; i < m_cell_offsets[cell + 1]; ++i)
+      {
+        const aabb2 obj_bbox = this->get_object_bbox(m_cell_objects[i]);
+
+        if (intersect::ray_aabb2(from, to, obj_bbox))
+        {
+          func(obj_bbox, m_data[m_cell_objects[i]]);
+        }
+      }
+    });
+  }
+}
+
+//==============================================================================
+template<typename T>
+aabb2 StatGridAABB2<T>::get_object_bbox(u32 obj) const
+{
+  aabb2 bbox;
+  bbox.min = vec2{m_bboxes.min_x[obj], m_bboxes.min_y[obj]};
+  bbox.max = vec2{m_bboxes.max_x[obj], m_bboxes.max_y[obj]};
+  return bbox;
+}
+
+//==============================================================================
+template<typename T>
+u64 StatGridAABB2<T>::get_width() const
+{
+  return m_width;
+}
+
+//==============================================================================
+template<typename T>
+u64 StatGridAABB2<T>::get_height() const
+{
+  return m_height;
+}
+
+//==============================================================================
+template<typename T>
+bool StatGridAABB2<T>::is_built() const
+{
+  return m_built;
+}
+
+}
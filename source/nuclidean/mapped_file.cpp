@@ -0,0 +1,139 @@
+// Project Nuclidean Source File
+#include <common.h>
+#include <mapped_file.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>   // CreateFileMappingA, MapViewOfFile
+#else
+#include <fcntl.h>     // ::open
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // ::close
+#endif
+
+namespace nc
+{
+
+//==============================================================================
+MappedFile::~MappedFile()
+{
+  this->close();
+}
+
+//==============================================================================
+bool MappedFile::open(const std::string& path)
+{
+  this->close();
+
+#if defined(_WIN32)
+  HANDLE file = CreateFileA
+  (
+    path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+  );
+
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  m_file    = file;
+  m_mapping = mapping;
+  m_data    = static_cast<const byte*>(view);
+  m_size    = cast<u64>(file_size.QuadPart);
+#else
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* view = mmap(nullptr, cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping keeps the file alive on its own
+  ::close(fd);
+
+  if (view == MAP_FAILED)
+  {
+    return false;
+  }
+
+  m_data = static_cast<const byte*>(view);
+  m_size = cast<u64>(file_stat.st_size);
+#endif
+
+  return true;
+}
+
+//==============================================================================
+void MappedFile::close()
+{
+  if (!m_data)
+  {
+    return;
+  }
+
+#if defined(_WIN32)
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mapping);
+  CloseHandle(m_file);
+#else
+  munmap(const_cast<byte*>(m_data), m_size);
+#endif
+
+  m_data    = nullptr;
+  m_size    = 0;
+  m_file    = nullptr;
+  m_mapping = nullptr;
+}
+
+//==============================================================================
+bool MappedFile::is_open() const
+{
+  return m_data != nullptr;
+}
+
+//==============================================================================
+const byte* MappedFile::data() const
+{
+  return m_data;
+}
+
+//==============================================================================
+u64 MappedFile::size() const
+{
+  return m_size;
+}
+
+}
@@ -0,0 +1,40 @@
+// Project Nuclidean Source File
+#pragma once
+
+#include <types.h>
+
+#include <string> // std::string
+
+namespace nc
+{
+
+// Read-only view of a whole file mapped into memory. The pages are loaded
+// lazily by the OS on first touch, so opening even a large file is cheap.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Maps the file, closes the previous one if any. Returns false if the file
+  // does not exist, is empty or the mapping fails.
+  bool open(const std::string& path);
+  void close();
+
+  bool        is_open() const;
+  const byte* data()    const;
+  u64         size()    const;
+
+private:
+  const byte* m_data = nullptr;
+  u64         m_size = 0;
+
+  // Native handles of the file and its mapping
+  void*       m_file    = nullptr;
+  void*       m_mapping = nullptr;
+};
+
+}
@@ -11,10 +11,58 @@
 #include <fstream>
 #include <iterator>
 #include <numeric>
+#include <mutex>       // std::mutex
+#include <thread>      // std::this_thread
+#include <new>         // std::bad_alloc
+#include <cstdlib>     // std::malloc, std::free
 
 namespace nc
 {
 
+//==============================================================================
+// The counters and the profiler keep a single stack of the active scopes, so
+// they can measure only one thread. Written once before the workers start, so
+// they do not need to synchronize with it.
+static std::thread::id g_profiled_thread_id;
+
+//==============================================================================
+void set_profiled_thread()
+{
+  g_profiled_thread_id = std::this_thread::get_id();
+}
+
+//==============================================================================
+static bool is_profiled_thread()
+{
+  return std::this_thread::get_id() == g_profiled_thread_id;
+}
+
+//==============================================================================
+// Only the scopes on the profiled thread ever set this, the other threads keep
+// allocating into nowhere. Constant initialized, so it is safe to touch from
+// operator new even before the statics of this file are constructed.
+static thread_local AllocationStats* t_allocation_scope = nullptr;
+
+//==============================================================================
+AllocationStats* track_allocations_in(AllocationStats* scope)
+{
+  AllocationStats* previous = t_allocation_scope;
+  t_allocation_scope = scope;
+  return previous;
+}
+
+//==============================================================================
+#if NC_ALLOC_TRACKING
+static void count_allocation(u64 bytes)
+{
+  if (AllocationStats* scope = t_allocation_scope)
+  {
+    scope->count += 1;
+    scope->bytes += bytes;
+  }
+}
+#endif
+
 //==============================================================================
 std::vector<ProfilingCounter*>& get_all_profiling_counters()
 {
@@ -32,6 +80,10 @@ ProfilingCounter::ProfilingCounter(cstr label)
     parent[i]     = nullptr;
   }
 
+  // Function-local counters can be constructed on any thread the first time
+  // their scope runs
+  static std::mutex mutex;
+  std::lock_guard lock(mutex);
   get_all_profiling_counters().push_back(this);
 }
 
@@ -44,6 +96,12 @@ ScopeProfilingCounter::ScopeProfilingCounter(ProfilingCounter& ref)
 : counter(&ref)
 , start(ClockType::now())
 {
+  if (!is_profiled_thread())
+  {
+    counter = nullptr;
+    return;
+  }
+
   // The enclosing scope is the parent; the outermost scope is its own parent.
   ProfilingCounter* the_parent = counter_stack_it ? counter_stack[counter_stack_it - 1] : &ref;
 
@@ -62,14 +120,25 @@ ScopeProfilingCounter::ScopeProfilingCounter(ProfilingCounter& ref)
 
   counter_stack[counter_stack_it] = &ref;
   counter_stack_it += 1;
+
+  parent_allocs = track_allocations_in(&allocs);
 }
 
 //==============================================================================
 ScopeProfilingCounter::~ScopeProfilingCounter()
 {
+  if (!counter)
+  {
+    return;
+  }
+
+  track_allocations_in(parent_allocs);
+
   auto   now     = std::chrono::high_resolution_clock::now();
   double seconds = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() / 1'000'000.0;
-  counter->total_time[used_idx] += seconds;
+  counter->total_time[used_idx]  += seconds;
+  counter->alloc_count[used_idx] += allocs.count;
+  counter->alloc_bytes[used_idx] += allocs.bytes;
   counter_stack_it -= 1;
 }
 
@@ -109,10 +178,23 @@ void Profiler::new_frame(u64 idx, f32 /*dt*/)
       (
         it->second.num_calls.begin(), it->second.num_calls.end(), 0_u32
       );
+
+      // And the allocations
+      std::fill
+      (
+        it->second.num_allocs.begin(), it->second.num_allocs.end(), 0_u32
+      );
+
+      std::fill
+      (
+        it->second.alloc_bytes.begin(), it->second.alloc_bytes.end(), 0_u32
+      );
     }
 
-    it->second.delta_time[idx_in_ring] = data.accumulated_time;
-    it->second.num_calls[idx_in_ring]  = data.num_calls;
+    it->second.delta_time[idx_in_ring]  = data.accumulated_time;
+    it->second.num_calls[idx_in_ring]   = data.num_calls;
+    it->second.num_allocs[idx_in_ring]  = data.num_allocs;
+    it->second.alloc_bytes[idx_in_ring] = data.alloc_bytes;
   }
 
   m_scope_map_this_frame.clear();
@@ -125,7 +207,7 @@ void Profiler::push_scope(cstr name)
 }
 
 //==============================================================================
-void Profiler::pop_scope()
+void Profiler::pop_scope(const AllocationStats& allocs)
 {
   namespace sch = std::chrono;
 
@@ -141,6 +223,8 @@ void Profiler::pop_scope()
   AccumulatedScopeData& data = m_scope_map_this_frame[recast<u64>(top.name)];
   data.num_calls        += 1;
   data.accumulated_time += time;
+  data.num_allocs       += cast<u32>(allocs.count);
+  data.alloc_bytes      += cast<u32>(allocs.bytes);
   data.name              = top.name;
 
   m_scope_stack.pop_back();
@@ -161,14 +245,27 @@ const Profiler::ProfilingData& Profiler::get_profiling_data_for_all_scopes() con
 
 //==============================================================================
 ScopeProfiler::ScopeProfiler(cstr name)
+: m_active(is_profiled_thread())
 {
-  Profiler::get().push_scope(name);
+  if (m_active)
+  {
+    // The bookkeeping of the profiler allocates as well, but that is not
+    // something the profiled code should be blamed for
+    m_parent_allocs = track_allocations_in(nullptr);
+    Profiler::get().push_scope(name);
+    track_allocations_in(&m_allocs);
+  }
 }
 
 //==============================================================================
 ScopeProfiler::~ScopeProfiler()
 {
-  Profiler::get().pop_scope();
+  if (m_active)
+  {
+    track_allocations_in(nullptr);
+    Profiler::get().pop_scope(m_allocs);
+    track_allocations_in(m_parent_allocs);
+  }
 }
 
 //==============================================================================
@@ -178,24 +275,21 @@ static f64 counter_total_time(ProfilingCounter* counter)
 }
 
 //==============================================================================
-// Prints an aligned table of all runtime counters laid out as a tree following
-// their parent links. Because a counter can run under several parents and keeps
-// a separate timing for each, it is printed once under every parent it ran in,
-// showing the time spent there and that time's share of the parent's total.
-// Child rows are indented one level to the right and siblings are sorted
-// against each other within their layer.
-void print_runtime_counters(cstr output_path)
+// Groups the counters following their parent links. Because a counter can run
+// under several parents and keeps a separate timing for each, it is placed once
+// under every parent it ran in, with the time spent there and that time's share
+// of the parent's total. Siblings are sorted against each other within their
+// layer.
+std::vector<RuntimeCounterNode> collect_runtime_counters()
 {
-  constexpr u64 INDENT        = 2; // spaces of indentation per tree level
-  constexpr s32 TIME_WIDTH    = 12; // width of the "Time (s)" column
-  constexpr s32 PERCENT_WIDTH = 11; // width of the "% of parent" column
-
   // An edge of the call tree: a child counter and the time it spent under the
   // parent it hangs from.
   struct Edge
   {
-    ProfilingCounter* counter = nullptr;
-    f64               time    = 0.0;
+    ProfilingCounter* counter     = nullptr;
+    f64               time        = 0.0;
+    u64               alloc_count = 0;
+    u64               alloc_bytes = 0;
   };
 
   // Group every counter under each of its parents. A slot whose parent is the
@@ -211,13 +305,22 @@ void print_runtime_counters(cstr output_path)
       {
         continue;
       }
-      else if (parent == counter)
+
+      const Edge edge
+      {
+        .counter     = counter,
+        .time        = counter->total_time[i],
+        .alloc_count = counter->alloc_count[i],
+        .alloc_bytes = counter->alloc_bytes[i],
+      };
+
+      if (parent == counter)
       {
-        roots.push_back({counter, counter->total_time[i]});
+        roots.push_back(edge);
       }
       else
       {
-        children[parent].push_back({counter, counter->total_time[i]});
+        children[parent].push_back(edge);
       }
     }
   }
@@ -230,33 +333,25 @@ void print_runtime_counters(cstr output_path)
     std::sort(entry.second.begin(), entry.second.end(), by_time);
   }
 
-  // A single printed line of the table.
-  struct Row
-  {
-    std::string label;      // name, already indented for its depth
-    f64         time;       // seconds spent under the parent
-    f64         percentage; // share of the parent's total time
-  };
-
-  std::vector<Row> rows;
-  u64 name_width = std::string_view{"Counter"}.size();
   std::vector<ProfilingCounter*> path; // counters currently being expanded, to break cycles
 
-  // Emit the row for one counter, then recurse into its (already sorted)
+  // Build the node for one counter, then recurse into its (already sorted)
   // children. The denominator for a child's percentage is the parent's total
   // time across all of its own parents.
-  auto build = [&](auto&& self, const Edge& edge, f64 parent_total, u64 depth) -> void
+  auto build = [&](auto&& self, const Edge& edge, f64 parent_total) -> RuntimeCounterNode
   {
-    const f64 percentage = parent_total > 0.0 ? 100.0 * edge.time / parent_total : 0.0;
-    std::string label = std::string(depth * INDENT, ' ') + edge.counter->name;
-    name_width = std::max(name_width, label.size());
-    rows.push_back({std::move(label), edge.time, percentage});
+    RuntimeCounterNode node;
+    node.name        = edge.counter->name;
+    node.time        = edge.time;
+    node.percentage  = parent_total > 0.0 ? 100.0 * edge.time / parent_total : 0.0;
+    node.alloc_count = edge.alloc_count;
+    node.alloc_bytes = edge.alloc_bytes;
 
     // Stop if this counter is already an ancestor on the current path so that
     // recursive or mutually-recursive counters cannot loop forever.
     if (std::find(path.begin(), path.end(), edge.counter) != path.end())
     {
-      return;
+      return node;
     }
 
     if (auto it = children.find(edge.counter); it != children.end())
@@ -265,16 +360,67 @@ void print_runtime_counters(cstr output_path)
       path.push_back(edge.counter);
       for (const Edge& child : it->second)
       {
-        self(self, child, total, depth + 1);
+        node.children.push_back(self(self, child, total));
       }
 
       path.pop_back();
     }
+
+    return node;
   };
 
+  std::vector<RuntimeCounterNode> output;
   for (const Edge& root : roots)
   {
-    build(build, root, root.time, 0);
+    output.push_back(build(build, root, root.time));
+  }
+
+  return output;
+}
+
+//==============================================================================
+// Prints an aligned table of all runtime counters laid out as a tree, see
+// "collect_runtime_counters". Child rows are indented one level to the right.
+void print_runtime_counters(cstr output_path)
+{
+  constexpr u64 INDENT        = 2; // spaces of indentation per tree level
+  constexpr s32 TIME_WIDTH    = 12; // width of the "Time (s)" column
+  constexpr s32 PERCENT_WIDTH = 11; // width of the "% of parent" column
+  constexpr s32 ALLOCS_WIDTH  = 10; // width of the "Allocs" column
+  constexpr s32 BYTES_WIDTH   = 14; // width of the "Bytes" column
+
+  // Without the tracking there are no allocations to print
+  constexpr bool PRINT_ALLOCS = NC_ALLOC_TRACKING;
+
+  // A single printed line of the table.
+  struct Row
+  {
+    std::string label;      // name, already indented for its depth
+    f64         time;       // seconds spent under the parent
+    f64         percentage; // share of the parent's total time
+    u64         alloc_count;
+    u64         alloc_bytes;
+  };
+
+  std::vector<Row> rows;
+  u64 name_width = std::string_view{"Counter"}.size();
+
+  // Flatten the tree into rows in depth-first order.
+  auto flatten = [&](auto&& self, const RuntimeCounterNode& node, u64 depth) -> void
+  {
+    std::string label = std::string(depth * INDENT, ' ') + node.name;
+    name_width = std::max(name_width, label.size());
+    rows.push_back({std::move(label), node.time, node.percentage, node.alloc_count, node.alloc_bytes});
+
+    for (const RuntimeCounterNode& child : node.children)
+    {
+      self(self, child, depth + 1);
+    }
+  };
+
+  for (const RuntimeCounterNode& root : collect_runtime_counters())
+  {
+    flatten(flatten, root, 0);
   }
 
   // Determine where do we want to output the stuff.
@@ -287,6 +433,10 @@ void print_runtime_counters(cstr output_path)
   std::ostream& output = (output_path && file_output.is_open()) ? file_output : std::cout;
 
   u64 table_width = name_width + TIME_WIDTH + PERCENT_WIDTH + 4;
+  if constexpr (PRINT_ALLOCS)
+  {
+    table_width += ALLOCS_WIDTH + BYTES_WIDTH + 4;
+  }
 
   output << std::string(table_width, '=') << std::endl;
   output << "Total runtime counters" << std::endl;
@@ -295,7 +445,16 @@ void print_runtime_counters(cstr output_path)
   output << std::format("{:<{}}  {:>{}}  {:>{}}",
                            "Counter",     name_width,
                            "Time (s)",    TIME_WIDTH,
-                           "% of parent", PERCENT_WIDTH) << std::endl;
+                           "% of parent", PERCENT_WIDTH);
+
+  if constexpr (PRINT_ALLOCS)
+  {
+    output << std::format("  {:>{}}  {:>{}}",
+                             "Allocs", ALLOCS_WIDTH,
+                             "Bytes",  BYTES_WIDTH);
+  }
+
+  output << std::endl;
 
   output << std::string(table_width, '-') << std::endl;
 
@@ -305,7 +464,16 @@ void print_runtime_counters(cstr output_path)
     output << std::format("{:<{}}  {:>{}.3f}  {:>{}.3f}%",
                              row.label,      name_width,
                              row.time,       TIME_WIDTH,
-                             row.percentage, PERCENT_WIDTH - 1) << std::endl;
+                             row.percentage, PERCENT_WIDTH - 1);
+
+    if constexpr (PRINT_ALLOCS)
+    {
+      output << std::format("  {:>{}}  {:>{}}",
+                               row.alloc_count, ALLOCS_WIDTH,
+                               row.alloc_bytes, BYTES_WIDTH);
+    }
+
+    output << std::endl;
   }
 
   output << std::string(table_width, '=') << std::endl;
@@ -313,4 +481,52 @@ void print_runtime_counters(cstr output_path)
 
 }
 
+//==============================================================================
+// Replacements of the global allocation functions, they have to live outside
+// of any namespace. The array and nothrow versions end up here as well. The
+// over-aligned ones are not replaced and stay untracked.
+#if NC_ALLOC_TRACKING
+void* operator new(std::size_t size)
+{
+  nc::count_allocation(size);
+
+  if (void* ptr = std::malloc(size ? size : 1))
+  {
+    return ptr;
+  }
+
+  throw std::bad_alloc{};
+}
+
+//==============================================================================
+void* operator new[](std::size_t size)
+{
+  return ::operator new(size);
+}
+
+//==============================================================================
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+//==============================================================================
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+//==============================================================================
+void operator delete(void* ptr, std::size_t /*size*/) noexcept
+{
+  std::free(ptr);
+}
+
+//==============================================================================
+void operator delete[](void* ptr, std::size_t /*size*/) noexcept
+{
+  std::free(ptr);
+}
+#endif
+
 #endif
@@ -19,6 +19,38 @@ namespace nc
 // Prints the counter data into the specified file. If null then prints to standart output.
 void print_runtime_counters(cstr output_path);
 
+// Only the scopes running on the calling thread are measured from now on. The
+// engine calls this from the main thread before it starts any workers, the
+// scopes that run before that are ignored.
+void set_profiled_thread();
+
+// Heap allocations made while a profiled scope was the innermost one. Filled in
+// only with "NC_ALLOC_TRACKING", which replaces the global operator new/delete.
+struct AllocationStats
+{
+  u64 count = 0;
+  u64 bytes = 0;
+};
+
+// Makes the allocations of the current thread count into "scope" (or nowhere
+// if null) and returns the previous one so it can be restored later.
+AllocationStats* track_allocations_in(AllocationStats* scope);
+
+// One node of the runtime counter tree. A counter that ran under several
+// parents appears once under each of them with the time spent there.
+struct RuntimeCounterNode
+{
+  cstr                            name        = nullptr;
+  f64                             time        = 0.0; // seconds spent under the parent
+  f64                             percentage  = 0.0; // share of the parent's total time
+  u64                             alloc_count = 0;   // allocations directly in the counter's scope
+  u64                             alloc_bytes = 0;
+  std::vector<RuntimeCounterNode> children;          // sorted by time, descending
+};
+
+// Builds the tree of all runtime counters following their parent links.
+std::vector<RuntimeCounterNode> collect_runtime_counters();
+
 // A hierarchical counter that accumulates time spent in a section of a code. Is supposed to work as
 // a static variable somewhere in the code or potentially a global one.
 struct ProfilingCounter
@@ -36,9 +68,12 @@ struct ProfilingCounter
   // Each slot tracks the time spent under one distinct parent: parent[i] is the
   // enclosing counter and total_time[i] is the seconds accumulated under it.
   // A slot whose parent is null is unused; a slot whose parent is the counter
-  // itself marks a root.
-  f64               total_time[MAX_PARENT_COUNTERS]{};
-  ProfilingCounter* parent[MAX_PARENT_COUNTERS]    {}; // Set by the scope counter
+  // itself marks a root. The allocations are not inclusive, the ones made in
+  // a nested counter belong to that counter.
+  f64               total_time[MAX_PARENT_COUNTERS] {};
+  u64               alloc_count[MAX_PARENT_COUNTERS]{};
+  u64               alloc_bytes[MAX_PARENT_COUNTERS]{};
+  ProfilingCounter* parent[MAX_PARENT_COUNTERS]     {}; // Set by the scope counter
   cstr              name;
 
 	// Inserts the name of the counter
@@ -47,6 +82,7 @@ struct ProfilingCounter
 
 // Captures the counter at the start of the scope, then measures how much time was spent in the
 // scope when it ends and then writes this information into the counter.
+// Only the main thread is measured, scopes running on the job system workers are ignored.
 struct ScopeProfilingCounter
 {
   ScopeProfilingCounter(ProfilingCounter& counter);
@@ -55,8 +91,10 @@ struct ScopeProfilingCounter
   using ClockType = std::chrono::high_resolution_clock;
   using TimePoint = ClockType::time_point;
   TimePoint         start;
-  ProfilingCounter* counter  = nullptr;
-  u64               used_idx = 0;
+  ProfilingCounter* counter       = nullptr;
+  u64               used_idx      = 0;
+  AllocationStats   allocs;
+  AllocationStats*  parent_allocs = nullptr;
 };
 
 // =================================================================================================
@@ -79,6 +117,8 @@ public:
   {
     RingBuffer<f32> delta_time;
     RingBuffer<u32> num_calls;
+    RingBuffer<u32> num_allocs;  // made directly in the scope, not in nested ones
+    RingBuffer<u32> alloc_bytes;
   };
   using ProfilingData = std::map<std::string, DataPerScope, std::less<void>>;
 
@@ -91,13 +131,15 @@ public:
 protected: friend class ScopeProfiler;
   // These two to be called only by the scope profiler
   void push_scope(cstr name);
-  void pop_scope();
+  void pop_scope(const AllocationStats& allocs);
 
 private:
   struct AccumulatedScopeData
   {
     u32  num_calls        = 0;
     f32  accumulated_time = 0.0f; // in ms
+    u32  num_allocs       = 0;
+    u32  alloc_bytes      = 0;
     cstr name             = nullptr;
   };
   using ScopeMap = std::map<u64, AccumulatedScopeData>;
@@ -117,11 +159,17 @@ private:
   ScopeMap                m_scope_map_this_frame;
 };
 
+// Same as with the counters, only scopes on the main thread are recorded.
 class ScopeProfiler
 {
 public:
   ScopeProfiler(cstr name);
   ~ScopeProfiler();
+
+private:
+  bool             m_active        = false;
+  AllocationStats  m_allocs;
+  AllocationStats* m_parent_allocs = nullptr;
 };
 
 }
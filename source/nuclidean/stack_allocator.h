@@ -1,7 +1,8 @@
 // Project Nuclidean Source File
 #pragma once
 
-#include <memory> // std::allocator
+#include <memory>          // std::allocator
+#include <memory_resource> // std::pmr::memory_resource
 
 namespace nc
 {
@@ -13,9 +14,14 @@ struct StackData
   bool m_used = false;
 };
 
+// Hands out the stack data for the first allocation that fits. Everything
+// else goes to the upstream resource if there is one, or to the heap.
 template<typename T, u64 Cnt>
 class StackAllocator : public std::allocator<T>
 {
+  template<typename U, u64 OtherCnt>
+  friend class StackAllocator;
+
 public:
   using pointer   = T*;
   using size_type = std::size_t;
@@ -27,10 +33,13 @@ public:
   };
 
   template<typename U, u64 OtherCnt>
-  StackAllocator(const StackAllocator<U, OtherCnt>&)  noexcept;
+  StackAllocator(const StackAllocator<U, OtherCnt>& other) noexcept;
 
   StackAllocator(StackData<T, Cnt>* d)                noexcept;
 
+  // Allocations that do not fit the stack go to the "upstream" resource
+  StackAllocator(StackData<T, Cnt>* d, std::pmr::memory_resource* upstream) noexcept;
+
   StackAllocator(const StackAllocator<T, Cnt>& other) noexcept;
 
   StackAllocator(StackAllocator<T, Cnt>&& other)      noexcept;
@@ -40,7 +49,8 @@ public:
   void deallocate(T* ptr, u64 n);
 
 private:
-  StackData<T, Cnt>* m_data = nullptr;
+  StackData<T, Cnt>*         m_data     = nullptr;
+  std::pmr::memory_resource* m_upstream = nullptr;
 };
 
 }
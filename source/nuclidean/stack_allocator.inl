@@ -10,6 +10,11 @@ T* StackAllocator<T, Cnt>::allocate(u64 n)
 {
   if (!m_data || m_data->m_used || n > Cnt)
   {
+    if (m_upstream)
+    {
+      return static_cast<T*>(m_upstream->allocate(n * sizeof(T), alignof(T)));
+    }
+
     return std::allocator<T>::allocate(n);
   }
   else
@@ -25,6 +30,12 @@ void StackAllocator<T, Cnt>::deallocate(T* ptr, u64 n)
 {
   if (!m_data || ptr != m_data->m_data)
   {
+    if (m_upstream)
+    {
+      m_upstream->deallocate(ptr, n * sizeof(T), alignof(T));
+      return;
+    }
+
     std::allocator<T>::deallocate(ptr, n);
   }
   else
@@ -41,11 +52,24 @@ StackAllocator<T, Cnt>::StackAllocator(StackData<T, Cnt>* d) noexcept
 
 }
 
+//==============================================================================
+template<typename T, u64 Cnt>
+StackAllocator<T, Cnt>::StackAllocator
+(
+  StackData<T, Cnt>* d, std::pmr::memory_resource* upstream
+) noexcept
+: m_data(d)
+, m_upstream(upstream)
+{
+
+}
+
 //==============================================================================
 template<typename T, u64 Cnt>
 template<typename U, u64 OtherCnt>
-StackAllocator<T, Cnt>::StackAllocator(const StackAllocator<U, OtherCnt>&) noexcept
+StackAllocator<T, Cnt>::StackAllocator(const StackAllocator<U, OtherCnt>& other) noexcept
 : m_data(nullptr)
+, m_upstream(other.m_upstream)
 {
 
 }
@@ -54,6 +78,7 @@ StackAllocator<T, Cnt>::StackAllocator(const StackAllocator<U, OtherCnt>&) noexc
 template<typename T, u64 Cnt>
 StackAllocator<T, Cnt>::StackAllocator(const StackAllocator<T, Cnt>& other) noexcept
 : m_data(other.m_data)
+, m_upstream(other.m_upstream)
 {
 
 }
@@ -62,6 +87,7 @@ StackAllocator<T, Cnt>::StackAllocator(const StackAllocator<T, Cnt>& other) noex
 template<typename T, u64 Cnt>
 StackAllocator<T, Cnt>::StackAllocator(StackAllocator<T, Cnt>&& other) noexcept
 : m_data(other.m_data)
+, m_upstream(other.m_upstream)
 {
   other.m_data = nullptr;
 }
@@ -12,7 +12,8 @@ namespace nc
 
 // Same as std::vector, but first "Cnt" elements are on the stack together with
 // the container. If the size exceeds the "Cnt" then the remaining elements are
-// then allocated on the heap as with a normal std::vector.
+// then allocated on the heap as with a normal std::vector, or in the given
+// memory resource (e.g. "FrameArena") if there is one.
 template<typename T, u64 Cnt>
 class StackVector
 : public StackData<T, Cnt>        // The ordering of bases is important as they
@@ -35,6 +36,13 @@ public:
   {
     this->reserve(Cnt);
   }
+
+  explicit StackVector(std::pmr::memory_resource* upstream)
+  : Allocator(static_cast<Data*>(this), upstream)
+  , Vector(*static_cast<Allocator*>(this))
+  {
+    this->reserve(Cnt);
+  }
 };
 
 }